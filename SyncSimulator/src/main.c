@@ -0,0 +1,163 @@
+#include <zephyr.h>
+#include <math.h>
+#include "ClockModel.h"
+#include "SyncStatistics.h"
+
+/*
+ * The benchmark of the chat application without hardware: a master and a
+ * few nodes with modelled crystals, the nodes tracking the master through
+ * noisy, lossy beacons with the ClockModel of the real nodes. Every pulse
+ * the error between the network time a node would fire at and the master's
+ * is recorded, per minute and per beacon interval of the sweep.
+ */
+
+#define DEVICE_TIME_PER_SECOND 63897600000.0
+#define DEVICE_TIME_WRAP (1LL << 40)
+#define PICOSECONDS_PER_DEVICE_TIME (1e12 / DEVICE_TIME_PER_SECOND)
+
+#define NODES 8
+#define SIMULATION_STEP 10             /* ms */
+#define SIMULATION_TIME 600000         /* ms per interval */
+#define SETTLE_TIME 30000              /* ms before the first pulse */
+#define PULSE_PERIOD 100               /* ms */
+#define REPORT_PERIOD 60000            /* ms */
+
+/* Crystals within +-20 ppm, wandering by a random walk of 0.01 ppm per sqrt(s). */
+#define CRYSTAL_TOLERANCE 20.0
+#define CRYSTAL_WANDER 0.01
+
+/* Timestamp noise of one beacon (~250 ps) and the share of beacons lost. */
+#define TIMESTAMP_NOISE 16.0
+#define BEACON_LOSS 0.05
+
+/* Error the adaptive interval keeps the prediction below, device time units (~1 ns). */
+#define ADAPTIVE_MAX_ERROR 64
+
+/* Beacon intervals in ms, 0 lets every node resync as resyncInterval() asks. */
+static const uint32_t intervals[] = { 250, 1000, 4000, 16000, 0 };
+
+struct crystal {
+	double time;                   /* device time units, unwrapped */
+	double rate;                   /* ppm */
+	double wander;                 /* ppm */
+};
+
+struct node {
+	struct crystal crystal;
+	struct ClockModel model;
+	int64_t nextBeacon;            /* ms */
+	uint32_t beacons;
+};
+
+static uint64_t randomState = 0x9E3779B97F4A7C15ULL;
+
+/* xorshift64*, the same sequence every run. */
+static double uniform() {
+	randomState ^= randomState >> 12;
+	randomState ^= randomState << 25;
+	randomState ^= randomState >> 27;
+	return ((randomState * 0x2545F4914F6CDD1DULL) >> 11) * (1.0 / (1ULL << 53));
+}
+
+static double gaussian() {
+	return sqrt(-2.0 * log(1.0 - uniform())) * cos(2.0 * M_PI * uniform());
+}
+
+static void resetCrystal(struct crystal *crystal) {
+	crystal->time = uniform() * DEVICE_TIME_WRAP;
+	crystal->rate = (2.0 * uniform() - 1.0) * CRYSTAL_TOLERANCE;
+	crystal->wander = 0;
+}
+
+static void advanceCrystal(struct crystal *crystal, uint32_t step) {
+	crystal->wander += gaussian() * CRYSTAL_WANDER * sqrt(step / 1000.0);
+	crystal->time += step / 1000.0 * DEVICE_TIME_PER_SECOND * (1.0 + (crystal->rate + crystal->wander) * 1e-6);
+}
+
+static DeviceTime wrap(double time) {
+	return (DeviceTime)llround(fmod(time, DEVICE_TIME_WRAP));
+}
+
+/* Difference of two 40-bit times, sign extended. */
+static int64_t signedDifference(DeviceTime a, DeviceTime b) {
+	return ((int64_t)((a - b) << 24)) >> 24;
+}
+
+static void simulateInterval(uint32_t interval) {
+	struct crystal master;
+	struct node nodes[NODES];
+	struct SyncStatistics total;
+	struct SyncStatistics minute;
+	uint64_t beacons = 0;
+	char label[48];
+
+	resetCrystal(&master);
+	for (uint8_t i = 0; i < NODES; i++) {
+		resetCrystal(&nodes[i].crystal);
+		resetClockModel(&nodes[i].model);
+		nodes[i].nextBeacon = 0;
+		nodes[i].beacons = 0;
+	}
+
+	resetSyncStatistics(&total);
+	resetSyncStatistics(&minute);
+
+	for (int64_t now = 0; now < SIMULATION_TIME; now += SIMULATION_STEP) {
+		advanceCrystal(&master, SIMULATION_STEP);
+
+		for (uint8_t i = 0; i < NODES; i++) {
+			struct node *node = &nodes[i];
+			DeviceTime local;
+			double offset;
+
+			advanceCrystal(&node->crystal, SIMULATION_STEP);
+			local = wrap(node->crystal.time);
+			offset = node->crystal.time - master.time;
+
+			if (now >= node->nextBeacon) {
+				node->beacons++;
+				if (uniform() >= BEACON_LOSS) {
+					updateClockModel(&node->model, local, now, wrap(offset + gaussian() * TIMESTAMP_NOISE + DEVICE_TIME_WRAP));
+				}
+
+				node->nextBeacon = now + (interval != 0 ? interval : resyncInterval(&node->model, ADAPTIVE_MAX_ERROR));
+			}
+
+			/* The node fires when its estimate of network time reaches the pulse, off by the offset it mispredicts. */
+			if (now >= SETTLE_TIME && now % PULSE_PERIOD == 0 && node->model.updates >= 2) {
+				int64_t error = signedDifference(wrap(offset + DEVICE_TIME_WRAP), predictOffset(&node->model, local, now));
+
+				addSyncError(&total, llround(error * PICOSECONDS_PER_DEVICE_TIME));
+				addSyncError(&minute, llround(error * PICOSECONDS_PER_DEVICE_TIME));
+			}
+		}
+
+		if (now >= SETTLE_TIME && (now + SIMULATION_STEP) % REPORT_PERIOD == 0) {
+			snprintk(label, sizeof(label), "  minute %lld", (now + SIMULATION_STEP) / REPORT_PERIOD);
+			printSyncStatistics(label, &minute);
+			resetSyncStatistics(&minute);
+		}
+	}
+
+	for (uint8_t i = 0; i < NODES; i++) {
+		beacons += nodes[i].beacons;
+	}
+
+	snprintk(label, sizeof(label), "  total");
+	printSyncStatistics(label, &total);
+	printk("  %llu beacons per node per minute\n", beacons * REPORT_PERIOD / SIMULATION_TIME / NODES);
+}
+
+void main(void) {
+	for (uint8_t i = 0; i < ARRAY_SIZE(intervals); i++) {
+		if (intervals[i] != 0) {
+			printk("Beacon interval %u ms:\n", intervals[i]);
+		} else {
+			printk("Adaptive beacon interval, %u device time units:\n", ADAPTIVE_MAX_ERROR);
+		}
+
+		simulateInterval(intervals[i]);
+	}
+
+	printk("Simulation done\n");
+}
@@ -0,0 +1,236 @@
+#include <zephyr.h>
+#include <shell/shell.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "AngleOfArrival.h"
+
+/* pi and 2 pi in the Q11 radians of the PDOA register. */
+#define PI_Q11 6434
+#define TWO_PI_Q11 12868
+
+#define ONE_Q15 32768
+
+/* Carrier wavelengths in um, 6489.6 and 7987.2 MHz. */
+#define WAVELENGTH_CHANNEL_5 46196
+#define WAVELENGTH_CHANNEL_9 37534
+
+/* Half a channel 5 wavelength, the spacing of the common PDOA modules and free of ambiguity there. */
+#define DEFAULT_ANTENNA_SPACING 23098
+
+#define CORDIC_ITERATIONS 16
+
+/* atan(2^-i) in 0.01 degree, Q8. */
+static const int32_t cordicAngles[CORDIC_ITERATIONS] = {
+	1152000, 680065, 359328, 182400, 91554, 45822, 22916, 11459,
+	5730, 2865, 1432, 716, 358, 179, 90, 45
+};
+
+static dwt_pdoa_mode_e requestedMode = DWT_PDOA_M0;
+static int16_t pdoaOffset;
+static bool offsetApplied;
+
+/* Offset the chip subtracted from the PDOA just read, a new one only applies from the next frame. */
+static int16_t chipOffset;
+static uint32_t antennaSpacing = DEFAULT_ANTENNA_SPACING;
+
+/* Last PDOA before the offset, for calibration at boresight. */
+static int16_t lastRawPdoa;
+
+void setPdoaMode(dwt_pdoa_mode_e mode) {
+	requestedMode = mode;
+}
+
+dwt_pdoa_mode_e pdoaModeFor(const dwt_config_t *config) {
+	if ((config->stsMode & DWT_STS_CONFIG_MASK_NO_SDC) == DWT_STS_MODE_OFF) {
+		return DWT_PDOA_M0;
+	}
+
+	/* Mode 3 splits the STS in two halves, which needs at least 128 symbols. */
+	if (requestedMode == DWT_PDOA_M3 && config->stsLength < DWT_STS_LEN_128) {
+		return DWT_PDOA_M1;
+	}
+
+	return requestedMode;
+}
+
+void setPdoaOffset(int16_t offset) {
+	pdoaOffset = offset;
+	offsetApplied = false;
+}
+
+int16_t getPdoaOffset() {
+	return pdoaOffset;
+}
+
+void setAntennaSpacing(uint32_t spacing) {
+	antennaSpacing = spacing;
+}
+
+int16_t getLastRawPdoa() {
+	return lastRawPdoa;
+}
+
+void pdoaConfigured() {
+	chipOffset = 0;
+	offsetApplied = false;
+}
+
+static int32_t wrapPhase(int32_t phase) {
+	while (phase >= PI_Q11) {
+		phase -= TWO_PI_Q11;
+	}
+	while (phase < -PI_Q11) {
+		phase += TWO_PI_Q11;
+	}
+
+	return phase;
+}
+
+static uint32_t squareRoot(uint32_t value) {
+	uint32_t result = 0;
+	uint32_t bit = 1U << 30;
+
+	while (bit > value) {
+		bit >>= 2;
+	}
+
+	while (bit != 0) {
+		if (value >= result + bit) {
+			value -= result + bit;
+			result = (result >> 1) + bit;
+		} else {
+			result >>= 1;
+		}
+		bit >>= 2;
+	}
+
+	return result;
+}
+
+/* atan(y / x) for x >= 0 in 0.01 degree, CORDIC in vectoring mode. */
+static int16_t arcTangent(int32_t y, int32_t x) {
+	int32_t angle = 0;
+
+	x *= 256;
+	y *= 256;
+
+	for (int i = 0; i < CORDIC_ITERATIONS; i++) {
+		int32_t nextX;
+
+		if (y > 0) {
+			nextX = x + (y >> i);
+			y -= x >> i;
+			angle += cordicAngles[i];
+		} else {
+			nextX = x - (y >> i);
+			y += x >> i;
+			angle -= cordicAngles[i];
+		}
+		x = nextX;
+	}
+
+	return (int16_t)((angle + 128) >> 8);
+}
+
+void bearingFromPdoa(int16_t pdoa, uint32_t wavelength, uint32_t spacing, int16_t previousAzimuth, struct Bearing *bearing) {
+	int32_t phase = wrapPhase(pdoa);
+	int32_t branches = (int32_t)((spacing + wavelength - 1) / wavelength);
+	int32_t bestDistance = INT32_MAX;
+	int32_t bestSine = 0;
+
+	/* sin(azimuth) = phase * wavelength / (2 pi * spacing), every 2 pi added to the phase that stays in [-1, 1] is a candidate. */
+	for (int32_t branch = -branches; branch <= branches; branch++) {
+		int64_t candidatePhase = phase + branch * TWO_PI_Q11;
+		int64_t sine = candidatePhase * wavelength * ONE_Q15 / ((int64_t)TWO_PI_Q11 * spacing);
+		int32_t distance;
+
+		/* Noise can push the direct branch past endfire, it is kept as endfire. */
+		if (branch == 0) {
+			sine = CLAMP(sine, -ONE_Q15, ONE_Q15);
+		} else if (sine > ONE_Q15 || sine < -ONE_Q15) {
+			continue;
+		}
+
+		/* Without history the smallest phase correction wins, with history the closest direction. */
+		if (previousAzimuth == AZIMUTH_INVALID) {
+			distance = abs((int32_t)(candidatePhase - phase));
+		} else {
+			distance = abs(arcTangent((int32_t)sine, (int32_t)squareRoot(ONE_Q15 * ONE_Q15 - (uint32_t)(sine * sine))) - previousAzimuth);
+		}
+
+		if (distance < bestDistance) {
+			bestDistance = distance;
+			bestSine = (int32_t)sine;
+		}
+	}
+
+	bearing->pdoa = (int16_t)phase;
+	bearing->sine = (int16_t)CLAMP(bestSine, -ONE_Q15 + 1, ONE_Q15 - 1);
+	bearing->cosine = (int16_t)MIN(squareRoot((uint32_t)(ONE_Q15 * ONE_Q15 - bestSine * bestSine)), ONE_Q15 - 1);
+	bearing->azimuth = arcTangent(bestSine, bearing->cosine);
+}
+
+void captureBearing(struct Bearing *bearing, dwt_pdoa_mode_e mode, uint8_t channel) {
+	int16_t pdoa;
+
+	if (mode == DWT_PDOA_M0) {
+		bearing->azimuth = AZIMUTH_INVALID;
+		return;
+	}
+
+	/* The frame was measured with the offset then in the chip, which need not be the current one yet. */
+	lastRawPdoa = (int16_t)wrapPhase(dwt_readpdoa() + chipOffset);
+	pdoa = (int16_t)wrapPhase(lastRawPdoa - pdoaOffset);
+
+	/* The offset register is written between frames, the chip applies it from the next one. */
+	if (!offsetApplied) {
+		dwt_setpdoaoffset((uint16_t)pdoaOffset);
+		chipOffset = pdoaOffset;
+		offsetApplied = true;
+	}
+
+	bearingFromPdoa(pdoa, channel == 9 ? WAVELENGTH_CHANNEL_9 : WAVELENGTH_CHANNEL_5, antennaSpacing, bearing->azimuth, bearing);
+}
+
+static int cmd_mode(const struct shell *shell, size_t argc, char *argv[]) {
+	if (strcmp(argv[1], "off") == 0) {
+		setPdoaMode(DWT_PDOA_M0);
+	} else if (strcmp(argv[1], "m1") == 0) {
+		setPdoaMode(DWT_PDOA_M1);
+	} else if (strcmp(argv[1], "m3") == 0) {
+		setPdoaMode(DWT_PDOA_M3);
+	} else {
+		shell_error(shell, "Unknown mode %s", argv[1]);
+		return -EINVAL;
+	}
+
+	return 0;
+}
+
+static int cmd_offset(const struct shell *shell, size_t argc, char *argv[]) {
+	setPdoaOffset(strtol(argv[1], NULL, 0));
+	return 0;
+}
+
+static int cmd_calibrate(const struct shell *shell, size_t argc, char *argv[]) {
+	setPdoaOffset(getLastRawPdoa());
+	shell_print(shell, "PDOA offset %d (Q11 rad)", lastRawPdoa);
+	return 0;
+}
+
+static int cmd_spacing(const struct shell *shell, size_t argc, char *argv[]) {
+	setAntennaSpacing(strtoul(argv[1], NULL, 0));
+	return 0;
+}
+
+SHELL_STATIC_SUBCMD_SET_CREATE(
+	pdoa_cmds,
+	SHELL_CMD_ARG(mode, NULL, "PDOA mode off|m1|m3, needs a PDOA module and an STS profile", cmd_mode, 2, 0),
+	SHELL_CMD_ARG(offset, NULL, "Set the PDOA offset <Q11 rad>", cmd_offset, 2, 0),
+	SHELL_CMD_ARG(calibrate, NULL, "Take the last PDOA as offset, with the peer at boresight", cmd_calibrate, 1, 0),
+	SHELL_CMD_ARG(spacing, NULL, "Set the antenna spacing <um>", cmd_spacing, 2, 0),
+	SHELL_SUBCMD_SET_END
+);
+
+SHELL_CMD_REGISTER(pdoa, &pdoa_cmds, "Angle of arrival", NULL);
@@ -0,0 +1,52 @@
+#ifndef MJ_ANGLE_OF_ARRIVAL
+#define MJ_ANGLE_OF_ARRIVAL
+
+#include <stdint.h>
+#include <deca_device_api.h>
+
+#define AZIMUTH_INVALID INT16_MIN
+
+/*
+ * Direction of the last final frame on an anchor with a dual antenna (PDOA)
+ * module. The azimuth is measured from the antenna boresight, positive
+ * towards the antenna that receives first, and sine and cosine place the
+ * peer in the anchor's frame together with the range.
+ */
+struct Bearing {
+	int16_t pdoa;                  /* radians in Q11 after the offset, wrapped to [-pi, pi) */
+	int16_t azimuth;               /* 0.01 degree, AZIMUTH_INVALID without PDOA */
+	int16_t sine;                  /* Q15 */
+	int16_t cosine;                /* Q15 */
+};
+
+/* M1 compares the Ipatov and STS phases, M3 the two STS halves. Both need an STS profile. */
+void setPdoaMode(dwt_pdoa_mode_e mode);
+
+/* PDOA mode a configuration is sent to the chip with, M0 for profiles without STS. */
+dwt_pdoa_mode_e pdoaModeFor(const dwt_config_t *config);
+
+/* Subtracted by the chip from every PDOA, radians in Q11. */
+void setPdoaOffset(int16_t offset);
+int16_t getPdoaOffset();
+
+/* PDOA of the last frame before any offset, the offset to calibrate with at boresight. */
+int16_t getLastRawPdoa();
+
+/* Distance between the antenna phase centres in um. */
+void setAntennaSpacing(uint32_t spacing);
+
+/* Call after every dwt_configure, it resets the chip's PDOA offset. */
+void pdoaConfigured();
+
+/*
+ * Reads the PDOA of the last received frame in the radio context, mode is the
+ * one the chip is configured with. With
+ * antennas more than half a wavelength apart the phase is ambiguous, the
+ * branch closest to the previous azimuth in bearing is taken.
+ */
+void captureBearing(struct Bearing *bearing, dwt_pdoa_mode_e mode, uint8_t channel);
+
+/* Integer kernel behind captureBearing, exposed for the host and benchmarks. */
+void bearingFromPdoa(int16_t pdoa, uint32_t wavelength, uint32_t spacing, int16_t previousAzimuth, struct Bearing *bearing);
+
+#endif
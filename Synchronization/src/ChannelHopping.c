@@ -0,0 +1,100 @@
+#include <zephyr.h>
+
+#include "ChannelHopping.h"
+
+#define FIRST_HOP_CODE 9
+#define CODES_PER_CHANNEL 4
+
+/* A hop is judged after this many attempts, and blacklisted above the failure rate in percent. */
+#define HOP_MINIMUM_ATTEMPTS 16
+#define HOP_BLACKLIST_RATE 50
+
+/* ms until a blacklisted hop is tried again, interference moves. */
+#define HOP_BLACKLIST_TIME 60000
+
+void setHopping(struct HopState *state, uint32_t seed, uint32_t dwell) {
+	*state = (struct HopState){ .seed = seed, .dwell = dwell, .current = HOP_HOME };
+}
+
+static uint32_t mix(uint32_t value) {
+	value ^= value >> 16;
+	value *= 0x7FEB352DU;
+	value ^= value >> 15;
+	value *= 0x846CA68BU;
+	value ^= value >> 16;
+	return value;
+}
+
+uint8_t hopFor(const struct HopState *state, uint8_t sequenceNumber) {
+	uint8_t exchange = sequenceNumber >> 1;
+	uint8_t allowed = ~state->blacklist;
+	uint32_t choice;
+
+	if (state->seed == 0 || exchange % HOP_RENDEZVOUS == 0 || allowed == 0) {
+		return HOP_HOME;
+	}
+
+	choice = mix(state->seed ^ exchange) % __builtin_popcount(allowed);
+
+	for (uint8_t hop = 0; hop < HOP_COUNT; hop++) {
+		if ((allowed & BIT(hop)) && choice-- == 0) {
+			return hop;
+		}
+	}
+
+	return HOP_HOME;
+}
+
+uint8_t hopChannel(uint8_t hop, uint8_t homeChannel) {
+	if (hop == HOP_HOME) {
+		return homeChannel;
+	}
+
+	return hop < CODES_PER_CHANNEL ? 5 : 9;
+}
+
+uint8_t hopCode(uint8_t hop, uint8_t homeCode) {
+	if (hop == HOP_HOME) {
+		return homeCode;
+	}
+
+	return FIRST_HOP_CODE + hop % CODES_PER_CHANNEL;
+}
+
+void recordHopResult(struct HopState *state, bool success) {
+	uint8_t hop = state->current;
+	uint32_t now = k_uptime_get_32();
+
+	for (uint8_t i = 0; i < HOP_COUNT; i++) {
+		if ((state->pendingBlacklist & BIT(i)) && now - state->blacklistedAt[i] > HOP_BLACKLIST_TIME) {
+			state->pendingBlacklist &= ~BIT(i);
+		}
+	}
+
+	if (state->seed == 0 || hop == HOP_HOME) {
+		return;
+	}
+
+	state->attempts[hop]++;
+	if (!success) {
+		state->failures[hop]++;
+	}
+
+	if (state->attempts[hop] < HOP_MINIMUM_ATTEMPTS) {
+		return;
+	}
+
+	/* Never blacklist the last usable hop, the home hop alone would carry everything. */
+	if (state->failures[hop] * 100 > state->attempts[hop] * HOP_BLACKLIST_RATE && (uint8_t)~(state->pendingBlacklist | BIT(hop)) != 0) {
+		state->pendingBlacklist |= BIT(hop);
+		state->blacklistedAt[hop] = now;
+	}
+
+	state->attempts[hop] = 0;
+	state->failures[hop] = 0;
+}
+
+uint8_t commitBlacklist(struct HopState *state) {
+	state->blacklist = state->pendingBlacklist;
+	return state->blacklist;
+}
@@ -0,0 +1,47 @@
+#ifndef MJ_CHANNEL_HOPPING
+#define MJ_CHANNEL_HOPPING
+
+#include <stdbool.h>
+#include <stdint.h>
+
+/*
+ * Hops are the 64 MHz PRF codes 9 to 12 on channel 5 (hops 0 to 3) and on
+ * channel 9 (hops 4 to 7), so a blacklist fits one byte. HOP_HOME keeps the
+ * channel and code of the session's PHY profile.
+ */
+#define HOP_COUNT 8
+#define HOP_HOME 0xFF
+
+/* Every HOP_RENDEZVOUS-th exchange is on the home hop, where a peer that lost track picks the schedule up again. */
+#define HOP_RENDEZVOUS 8
+
+struct HopState {
+	uint32_t seed;                 /* shared by both peers, 0 disables hopping */
+	uint32_t dwell;                /* ms a responder waits on the next hop before it returns home */
+	uint8_t current;               /* hop of the exchange in flight */
+	uint8_t blacklist;             /* in use, sent to the responder with every final */
+	uint8_t pendingBlacklist;      /* initiator only, takes effect with the next final */
+	uint16_t attempts[HOP_COUNT];
+	uint16_t failures[HOP_COUNT];
+	uint32_t blacklistedAt[HOP_COUNT];
+};
+
+void setHopping(struct HopState *state, uint32_t seed, uint32_t dwell);
+
+/*
+ * Deterministic hop of the exchange started by the poll with sequenceNumber.
+ * Both peers derive the same hop from the seed, the sequence number and the
+ * blacklist of the last final frame.
+ */
+uint8_t hopFor(const struct HopState *state, uint8_t sequenceNumber);
+
+uint8_t hopChannel(uint8_t hop, uint8_t homeChannel);
+uint8_t hopCode(uint8_t hop, uint8_t homeCode);
+
+/* Initiator side failure statistics, hops failing too often are blacklisted for a while. */
+void recordHopResult(struct HopState *state, bool success);
+
+/* Blacklist to send with the final frame, it is the one both peers use from the next exchange on. */
+uint8_t commitBlacklist(struct HopState *state);
+
+#endif
@@ -0,0 +1,206 @@
+#include <zephyr.h>
+#include <deca_device_api.h>
+#include <shell/shell.h>
+#include <stdlib.h>
+
+#include "CirCapture.h"
+#include "DSTWR.h"
+#include "Telemetry.h"
+
+#define CIR_THREAD_STACK_SIZE 1024
+#define CIR_THREAD_PRIORITY K_LOWEST_APPLICATION_THREAD_PRIO
+
+/* dwt_readaccdata returns one dummy byte before the samples. */
+#define ACC_DUMMY_LENGTH 1
+
+enum CirState { CirIdle, CirReading, CirStreaming };
+
+struct Capture {
+	uint16_t number;
+	uint16_t peerAddress;
+	uint8_t sequenceNumber;
+	uint16_t firstPathIndex;
+	uint16_t firstTap;
+	uint16_t totalTaps;
+	uint16_t readTaps;
+	uint32_t startCycles;
+};
+
+static void readChunk(struct k_work *work);
+
+K_WORK_DEFINE(readWork, readChunk);
+K_SEM_DEFINE(streamSemaphore, 0, 1);
+
+static bool captureEnabled;
+static uint16_t windowBefore = 16;
+static uint16_t windowLength = 64;
+static uint16_t chunkTaps = 16;
+
+static volatile enum CirState state = CirIdle;
+static struct Capture capture;
+static uint8_t samples[CIR_MAX_WINDOW * TELEMETRY_CIR_SAMPLE_LENGTH];
+static uint8_t readBuffer[ACC_DUMMY_LENGTH + TELEMETRY_CIR_CHUNK_TAPS * TELEMETRY_CIR_SAMPLE_LENGTH];
+
+static uint32_t enabledSince;
+static uint32_t captures;
+static uint32_t skipped;
+static uint64_t readCycles;
+
+void setCirCapture(bool enabled) {
+	captureEnabled = enabled;
+	enabledSince = k_uptime_get_32();
+	captures = 0;
+	skipped = 0;
+	readCycles = 0;
+}
+
+void setCirWindow(uint16_t before, uint16_t length) {
+	windowBefore = before;
+	windowLength = CLAMP(length, 1, CIR_MAX_WINDOW);
+}
+
+void setCirChunk(uint16_t taps) {
+	chunkTaps = CLAMP(taps, 1, TELEMETRY_CIR_CHUNK_TAPS);
+}
+
+void getCirStatistics(struct CirStatistics *statistics) {
+	uint32_t elapsed = k_uptime_get_32() - enabledSince;
+
+	statistics->captures = captures;
+	statistics->skipped = skipped;
+	statistics->capturesPerSecond = elapsed == 0 ? 0 : (uint32_t)((uint64_t)captures * 100000 / elapsed);
+	statistics->readMicroseconds = captures == 0 ? 0 : k_cyc_to_us_floor32((uint32_t)(readCycles / captures));
+}
+
+bool startCirCapture(uint16_t peerAddress, uint8_t sequenceNumber) {
+	dwt_nlos_ipdiag_t indices;
+	uint16_t firstPathTap;
+
+	if (!captureEnabled) {
+		return false;
+	}
+
+	if (state != CirIdle) {
+		skipped++;
+		return false;
+	}
+
+	dwt_nlos_ipdiag(&indices);
+	firstPathTap = MIN(indices.index_fp_u32 / 64, CIR_LENGTH - 1);
+
+	capture.number++;
+	capture.peerAddress = peerAddress;
+	capture.sequenceNumber = sequenceNumber;
+	capture.firstPathIndex = indices.index_fp_u32;
+	capture.firstTap = firstPathTap > windowBefore ? firstPathTap - windowBefore : 0;
+	capture.totalTaps = MIN(windowLength, CIR_LENGTH - capture.firstTap);
+	capture.readTaps = 0;
+	capture.startCycles = k_cycle_get_32();
+
+	state = CirReading;
+	holdReceiver();
+	k_work_submit(&readWork);
+
+	return true;
+}
+
+/* One SPI transfer per work item, radio callbacks and session work queued meanwhile run in between. */
+static void readChunk(struct k_work *work) {
+	uint16_t taps = MIN(chunkTaps, capture.totalTaps - capture.readTaps);
+	uint16_t length = taps * TELEMETRY_CIR_SAMPLE_LENGTH;
+
+	dwt_readaccdata(readBuffer, ACC_DUMMY_LENGTH + length, capture.firstTap + capture.readTaps);
+	memcpy(&samples[capture.readTaps * TELEMETRY_CIR_SAMPLE_LENGTH], &readBuffer[ACC_DUMMY_LENGTH], length);
+
+	capture.readTaps += taps;
+
+	if (capture.readTaps < capture.totalTaps) {
+		k_work_submit(&readWork);
+		return;
+	}
+
+	readCycles += k_cycle_get_32() - capture.startCycles;
+
+	resumeReceiver();
+
+	state = CirStreaming;
+	k_sem_give(&streamSemaphore);
+}
+
+static void streamCapture() {
+	struct TelemetryCirRecord record = {
+		.type = TELEMETRY_RECORD_CIR,
+		.captureNumber = capture.number,
+		.peerAddress = capture.peerAddress,
+		.sequenceNumber = capture.sequenceNumber,
+		.firstPathIndex = capture.firstPathIndex,
+		.firstTap = capture.firstTap,
+		.totalTaps = capture.totalTaps
+	};
+
+	for (uint16_t offset = 0; offset < capture.totalTaps; offset += TELEMETRY_CIR_CHUNK_TAPS) {
+		record.chunkOffset = offset;
+		record.taps = MIN(TELEMETRY_CIR_CHUNK_TAPS, capture.totalTaps - offset);
+
+		memcpy(record.samples, &samples[offset * TELEMETRY_CIR_SAMPLE_LENGTH], record.taps * TELEMETRY_CIR_SAMPLE_LENGTH);
+
+		sendCirChunk(&record);
+	}
+}
+
+static void cirThread(void *p1, void *p2, void *p3) {
+	while (true) {
+		k_sem_take(&streamSemaphore, K_FOREVER);
+
+		streamCapture();
+
+		captures++;
+		state = CirIdle;
+	}
+}
+
+K_THREAD_DEFINE(cirThreadId, CIR_THREAD_STACK_SIZE, cirThread, NULL, NULL, NULL, CIR_THREAD_PRIORITY, 0, 0);
+
+static int cmd_on(const struct shell *shell, size_t argc, char *argv[]) {
+	setCirCapture(true);
+	return 0;
+}
+
+static int cmd_off(const struct shell *shell, size_t argc, char *argv[]) {
+	setCirCapture(false);
+	return 0;
+}
+
+static int cmd_window(const struct shell *shell, size_t argc, char *argv[]) {
+	setCirWindow(strtol(argv[1], NULL, 0), strtol(argv[2], NULL, 0));
+	return 0;
+}
+
+static int cmd_chunk(const struct shell *shell, size_t argc, char *argv[]) {
+	setCirChunk(strtol(argv[1], NULL, 0));
+	return 0;
+}
+
+static int cmd_stats(const struct shell *shell, size_t argc, char *argv[]) {
+	struct CirStatistics statistics;
+
+	getCirStatistics(&statistics);
+
+	shell_print(shell, "Captures: %u skipped: %u", statistics.captures, statistics.skipped);
+	shell_print(shell, "Rate: %u.%02u captures/s", statistics.capturesPerSecond / 100, statistics.capturesPerSecond % 100);
+	shell_print(shell, "Receiver held: %u us per capture", statistics.readMicroseconds);
+
+	return 0;
+}
+
+SHELL_STATIC_SUBCMD_SET_CREATE(
+	cir_cmds,
+	SHELL_CMD_ARG(on, NULL, "Capture the CIR of every exchange", cmd_on, 1, 0),
+	SHELL_CMD_ARG(off, NULL, "Stop capturing", cmd_off, 1, 0),
+	SHELL_CMD_ARG(window, NULL, "Capture <before> taps before the first path, <length> in total", cmd_window, 3, 0),
+	SHELL_CMD_ARG(chunk, NULL, "Read <taps> samples per SPI transfer", cmd_chunk, 2, 0),
+	SHELL_CMD_ARG(stats, NULL, "Print capture statistics", cmd_stats, 1, 0),
+	SHELL_SUBCMD_SET_END
+);
+
+SHELL_CMD_REGISTER(cir, &cir_cmds, "Channel impulse response capture", NULL);
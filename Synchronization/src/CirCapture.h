@@ -0,0 +1,32 @@
+#ifndef MJ_CIR_CAPTURE
+#define MJ_CIR_CAPTURE
+
+#include <stdbool.h>
+#include <stdint.h>
+
+/* Ipatov accumulator samples at the 64 MHz PRF, one per ~1 ns. */
+#define CIR_LENGTH 1016
+#define CIR_MAX_WINDOW 256
+
+struct CirStatistics {
+	uint32_t captures;             /* streamed completely */
+	uint32_t skipped;              /* exchanges that found the previous capture still busy */
+	uint32_t capturesPerSecond;    /* since capturing was enabled, in 0.01 */
+	uint32_t readMicroseconds;     /* average time the receiver was held per capture */
+};
+
+/*
+ * Site survey mode: after each ranging exchange a window of the accumulator
+ * around the first path is read in chunks, one work item per chunk, while
+ * the receiver is held off. The samples are then streamed through the binary
+ * telemetry by a low priority thread, the receiver is already back on.
+ */
+void setCirCapture(bool enabled);
+void setCirWindow(uint16_t before, uint16_t length);
+void setCirChunk(uint16_t taps);
+void getCirStatistics(struct CirStatistics *statistics);
+
+/* Called from the radio callback right after a frame was received, returns true when a capture started. */
+bool startCirCapture(uint16_t peerAddress, uint8_t sequenceNumber);
+
+#endif
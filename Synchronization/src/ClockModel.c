@@ -0,0 +1,181 @@
+#include <math.h>
+
+#include "ClockModel.h"
+
+#define DEVICE_TIME_PER_SECOND 63897600000.0
+#define DEVICE_TIME_PER_MILLISECOND 63897600LL
+#define DEVICE_TIME_WRAP (1LL << 40)
+
+/* Timestamp noise of one offset measurement, device time units (~250 ps). */
+#define MEASUREMENT_NOISE 16.0
+
+/* Skew uncertainty before the second measurement, crystals are within +-20 ppm. */
+#define SKEW_PRIOR (20e-6 * DEVICE_TIME_PER_SECOND)
+
+/*
+ * Process noise: white phase noise in units^2 per s and the random walk of
+ * the skew in (units/s)^2 per s, 0.1 ppb per square root second.
+ */
+#define OFFSET_NOISE 1.0
+#define SKEW_WANDER (0.1e-9 * DEVICE_TIME_PER_SECOND * 0.1e-9 * DEVICE_TIME_PER_SECOND)
+
+/* Outliers are rejected beyond this many sigma, a run of them means the model is wrong and restarts it. */
+#define REJECTION_SIGMA 5.0
+#define MAX_CONSECUTIVE_REJECTIONS 3
+
+#define RESYNC_MINIMUM 100
+#define RESYNC_MAXIMUM 600000
+
+/* Offset difference in -2^39 to 2^39. */
+static int64_t signedDifference(uint64_t later, uint64_t earlier) {
+	int64_t difference = (later - earlier) & DEVICE_TIME_MASK;
+
+	return difference >= DEVICE_TIME_WRAP / 2 ? difference - DEVICE_TIME_WRAP : difference;
+}
+
+/* The unwrapped time nearest to where uptime says the clock should be. */
+static int64_t unwrap(const struct ClockModel *model, DeviceTime time, int64_t uptime) {
+	int64_t expected = model->baseTime + (uptime - model->baseUptime) * DEVICE_TIME_PER_MILLISECOND;
+
+	return expected + signedDifference(time, expected);
+}
+
+void resetClockModel(struct ClockModel *model) {
+	*model = (struct ClockModel){ 0 };
+}
+
+static double measurementNoise(const struct ClockModel *model) {
+	return model->measurementNoise > 0 ? model->measurementNoise : MEASUREMENT_NOISE;
+}
+
+/* Covariance of the prediction dt s after the last update. */
+static void predictCovariance(const struct ClockModel *model, double dt, double covariance[2][2]) {
+	const double (*p)[2] = model->covariance;
+
+	covariance[0][0] = p[0][0] + 2 * dt * p[0][1] + dt * dt * p[1][1] + OFFSET_NOISE * dt + SKEW_WANDER * dt * dt * dt / 3;
+	covariance[0][1] = p[0][1] + dt * p[1][1] + SKEW_WANDER * dt * dt / 2;
+	covariance[1][0] = covariance[0][1];
+	covariance[1][1] = p[1][1] + SKEW_WANDER * dt;
+}
+
+bool updateClockModel(struct ClockModel *model, DeviceTime time, int64_t uptime, DeviceTime offset) {
+	double covariance[2][2];
+	int64_t now;
+	double dt;
+	double innovation;
+	double variance;
+	double noise = measurementNoise(model);
+
+	if (!model->initialized) {
+		*model = (struct ClockModel){
+			.initialized = true,
+			.updates = 1,
+			.rejected = model->rejected,
+			.measurementNoise = model->measurementNoise,
+			.baseTime = time,
+			.baseUptime = uptime,
+			.baseOffset = offset,
+			.covariance = { { noise * noise, 0 }, { 0, SKEW_PRIOR * SKEW_PRIOR } }
+		};
+		return true;
+	}
+
+	now = unwrap(model, time, uptime);
+	dt = (now - model->baseTime) / DEVICE_TIME_PER_SECOND;
+
+	predictCovariance(model, dt, covariance);
+
+	/* The predicted offset is baseOffset + offset + skew * dt, the measurement is compared modulo 2^40. */
+	innovation = signedDifference(offset, model->baseOffset) - (model->offset + model->skew * dt);
+	variance = covariance[0][0] + noise * noise;
+
+	if (model->updates >= 2 && innovation * innovation > REJECTION_SIGMA * REJECTION_SIGMA * variance) {
+		model->rejected++;
+
+		if (++model->consecutiveRejections >= MAX_CONSECUTIVE_REJECTIONS) {
+			model->initialized = false;
+			updateClockModel(model, time, uptime, offset);
+		}
+
+		return false;
+	}
+
+	double gainOffset = covariance[0][0] / variance;
+	double gainSkew = covariance[0][1] / variance;
+
+	model->offset += model->skew * dt + gainOffset * innovation;
+	model->skew += gainSkew * innovation;
+
+	model->covariance[0][0] = (1 - gainOffset) * covariance[0][0];
+	model->covariance[0][1] = (1 - gainOffset) * covariance[0][1];
+	model->covariance[1][0] = model->covariance[0][1];
+	model->covariance[1][1] = covariance[1][1] - gainSkew * covariance[0][1];
+
+	/* Move the integer part into the base, so the state stays small and exact in a double. */
+	model->baseTime = now;
+	model->baseUptime = uptime;
+	model->baseOffset += (int64_t)floor(model->offset);
+	model->offset -= floor(model->offset);
+
+	model->updates++;
+	model->consecutiveRejections = 0;
+
+	return true;
+}
+
+DeviceTime predictOffset(const struct ClockModel *model, DeviceTime time, int64_t uptime) {
+	double dt = (unwrap(model, time, uptime) - model->baseTime) / DEVICE_TIME_PER_SECOND;
+
+	return (model->baseOffset + (int64_t)llround(model->offset + model->skew * dt)) & DEVICE_TIME_MASK;
+}
+
+int32_t getModelSkew(const struct ClockModel *model) {
+	return (int32_t)lround(model->skew * 1e9 / DEVICE_TIME_PER_SECOND);
+}
+
+uint32_t predictedError(const struct ClockModel *model, int64_t uptime) {
+	double covariance[2][2];
+
+	if (!model->initialized) {
+		return UINT32_MAX;
+	}
+
+	predictCovariance(model, (uptime - model->baseUptime) / 1000.0, covariance);
+
+	return covariance[0][0] >= (double)UINT32_MAX * UINT32_MAX ? UINT32_MAX : (uint32_t)sqrt(covariance[0][0]);
+}
+
+uint32_t resyncInterval(const struct ClockModel *model, uint32_t maxError) {
+	double limit = (double)maxError * maxError;
+	double covariance[2][2];
+	uint32_t low = RESYNC_MINIMUM;
+	uint32_t high = RESYNC_MAXIMUM;
+
+	if (!model->initialized) {
+		return RESYNC_MINIMUM;
+	}
+
+	predictCovariance(model, high / 1000.0, covariance);
+	if (covariance[0][0] <= limit) {
+		return RESYNC_MAXIMUM;
+	}
+
+	predictCovariance(model, low / 1000.0, covariance);
+	if (covariance[0][0] >= limit) {
+		return RESYNC_MINIMUM;
+	}
+
+	/* The variance grows monotonically with the time since the update. */
+	while (high - low > RESYNC_MINIMUM / 10) {
+		uint32_t middle = low + (high - low) / 2;
+
+		predictCovariance(model, middle / 1000.0, covariance);
+		if (covariance[0][0] < limit) {
+			low = middle;
+		} else {
+			high = middle;
+		}
+	}
+
+	return low;
+}
@@ -0,0 +1,54 @@
+#ifndef MJ_CLOCK_MODEL
+#define MJ_CLOCK_MODEL
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "DeviceTime.h"
+
+/*
+ * Offset and skew of a peer clock tracked by a two-state Kalman filter over
+ * successive offset measurements, so the offset can be predicted between
+ * them. Offsets are local minus peer device time (modulo 2^40) at a local
+ * device time. The 40-bit times are unwrapped with the uptime the
+ * measurement was taken at, which only has to be right within a few s.
+ *
+ * The filter runs in double, once per synchronization, never per frame.
+ */
+struct ClockModel {
+	bool initialized;
+	uint32_t updates;
+	uint32_t rejected;             /* measurements further than 5 sigma from the prediction */
+	uint8_t consecutiveRejections;
+	double measurementNoise;       /* device time units, 0 for the UWB timestamp noise */
+	int64_t baseTime;              /* local device time of the last update, unwrapped */
+	int64_t baseUptime;            /* ms */
+	int64_t baseOffset;            /* device time units, the state holds the part below one unit */
+	double offset;                 /* device time units */
+	double skew;                   /* device time units per second */
+	double covariance[2][2];
+};
+
+/* Resets to the UWB timestamp noise, set measurementNoise afterwards for coarser measurements. */
+void resetClockModel(struct ClockModel *model);
+
+/* Adds the offset measured at local device time time, taken at uptime ms. Returns false for a rejected outlier. */
+bool updateClockModel(struct ClockModel *model, DeviceTime time, int64_t uptime, DeviceTime offset);
+
+/* Offset predicted for local device time time, which happened at about uptime ms. */
+DeviceTime predictOffset(const struct ClockModel *model, DeviceTime time, int64_t uptime);
+
+/* Local clock rate minus the peer's, parts per billion, the rate the offset grows at: positive when the local clock runs fast. */
+int32_t getModelSkew(const struct ClockModel *model);
+
+/* Standard deviation of the predicted offset at uptime ms, in device time units. */
+uint32_t predictedError(const struct ClockModel *model, int64_t uptime);
+
+/*
+ * ms after the last update until the predicted error reaches maxError
+ * device time units, clamped to the resync limits. Stable crystals get long
+ * intervals, a model with few updates or a wandering skew short ones.
+ */
+uint32_t resyncInterval(const struct ClockModel *model, uint32_t maxError);
+
+#endif
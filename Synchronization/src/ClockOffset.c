@@ -0,0 +1,25 @@
+#include "ClockOffset.h"
+#include "TimeOfFlight.h"
+
+void computeClockOffset(const struct DSTWRResult *result, struct ClockOffset *clockOffset) {
+	uint64_t initiatorSpan = deviceTimeDiff(result->tx3, result->tx1);
+	uint64_t responderSpan = deviceTimeDiff(result->rx3, result->rx1);
+
+	clockOffset->timeOfFlight = dsTwrTimeOfFlight(
+		deviceTimeDiff(result->rx2, result->tx1),
+		deviceTimeDiff(result->tx2, result->rx1),
+		deviceTimeDiff(result->rx3, result->tx2),
+		deviceTimeDiff(result->tx3, result->rx2)
+	);
+
+	/* The final left the initiator at tx3 and arrived one time of flight later, at rx3 on the responder clock. */
+	clockOffset->time = result->rx3;
+	clockOffset->offset = deviceTimeDiff(result->rx3, deviceTimeAdd(result->tx3, clockOffset->timeOfFlight));
+
+	/*
+	 * Poll and final travel the same path, so both clocks measure the same
+	 * interval between them. The spans are a few ms, the difference of a few
+	 * thousand units times 10^9 stays far inside int64_t.
+	 */
+	clockOffset->skew = initiatorSpan == 0 ? 0 : (int32_t)(((int64_t)responderSpan - (int64_t)initiatorSpan) * 1000000000 / (int64_t)initiatorSpan);
+}
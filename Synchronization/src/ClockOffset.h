@@ -0,0 +1,22 @@
+#ifndef MJ_CLOCK_OFFSET
+#define MJ_CLOCK_OFFSET
+
+#include <stdint.h>
+
+#include "DSTWR.h"
+
+/*
+ * Relation of the responder clock to the initiator clock measured by one
+ * DS-TWR exchange. At the moment the responder received the final frame its
+ * device time was the initiator's plus offset, modulo 2^40.
+ */
+struct ClockOffset {
+	DeviceTime time;               /* responder device time the offset holds at, the final's RX */
+	DeviceTime offset;
+	int32_t timeOfFlight;          /* device time units */
+	int32_t skew;                  /* responder clock rate relative to the initiator's, parts per billion */
+};
+
+void computeClockOffset(const struct DSTWRResult *result, struct ClockOffset *clockOffset);
+
+#endif
@@ -2,66 +2,310 @@
 #include <dw3000_spi.h>
 #include <deca_probe_interface.h>
 #include <logging/log.h>
+#include <shell/shell.h>
+#include <stdlib.h>
+#include <string.h>
 
 #include "UWBFrame.h"
+#include "DeviceTime.h"
 #include "DSTWR.h"
-
-#define INITIATOR_ADDRESS 0x4556
-#define RESPONDER_ADDRESS 0x4157
+#include "CirCapture.h"
 
 #define DUMMY_ANTENNA_DELAY 16385
 
-#define UUS_TO_DWT_TIME 63898
-
-#define RX_DELAY 700
-#define TX_DELAY 3400
 #define RX_TIME_OUT 0
 #define PREAMBLE_TIME_OUT 65000
 
 LOG_MODULE_REGISTER(DSTWR);
 
-static dwt_config_t config = {
-	5,                /* Channel number. */
-	DWT_PLEN_128,     /* Preamble length. Used in TX only. */
-	DWT_PAC8,         /* Preamble acquisition chunk size. Used in RX only. */
-	9,                /* TX preamble code. Used in TX only. */
-	9,                /* RX preamble code. Used in RX only. */
-	1,                /* 0 to use standard 8 symbol SFD, 1 to use non-standard 8 symbol, 2 for non-standard 16 symbol SFD and 3 for 4z 8 symbol SDF type */
-	DWT_BR_6M8,       /* Data rate. */
-	DWT_PHRMODE_STD,  /* PHY header mode. */
-	DWT_PHRRATE_STD,  /* PHY header rate. */
-	(129 + 8 - 8),    /* SFD timeout (preamble length + 1 + SFD length - PAC size). Used in RX only. */
-	DWT_STS_MODE_OFF, /* STS disabled */
-	DWT_STS_LEN_64,   /* STS length see allowed values in Enum dwt_sts_lengths_e */
-	DWT_PDOA_M0       /* PDOA mode off */
-};
-
 static dwt_txconfig_t txconfig_options = {
 	0x34,
 	0xfdfdfdfd,
 	0x0
 };
 
-void (*initiatorDone)();
-void setInitiatorDone(void (*function)()) {
-	initiatorDone = function;
-}
+static dwt_txconfig_t txconfigChannel9 = {
+	0x34,
+	0xfefefefe,
+	0x0
+};
+
+#define FRAME_CONTROL 0x8841
+#define PAN_ID 0xDECA
+
+#define FUNCTION_POLL 0x21
+#define FUNCTION_RESPONSE 0x10
+#define FUNCTION_FINAL 0x23
+#define ACTIVITY_CONTINUE 0x02
+
+#define RADIO_BUSY_RETRY 2
+
+/* us from reading the system time to the beacon's TX, enough to write the frame over SPI. */
+#define BEACON_TX_DELAY 800
+
+/* us before its start time a scheduled exchange arms the radio, the chip waits out the rest. */
+#define SCHEDULE_LEAD 2000
 
-void (*resultProcessor)(struct DSTWRResult);
-void setResultProcessor(void (*function)(struct DSTWRResult)) {
-	resultProcessor = function;
+/*
+ * Every session keeps its frames in its own slot of the chip's TX buffer, the
+ * poll or response at the start and the final frame behind it. The templates
+ * are written by the first start of the session and again only after the
+ * local address changes, exchanges only patch the sequence number and
+ * timestamps. The frames do not depend on the profile.
+ */
+#define TEMPLATE_SLOT_SIZE 48
+#define FINAL_TEMPLATE_OFFSET 16
+#define BLINK_TEMPLATE_OFFSET (DSTWR_MAX_SESSIONS * TEMPLATE_SLOT_SIZE)
+#define TX_BUFFER_SIZE 1024
+
+#define SEQUENCE_NUMBER_OFFSET offsetof(struct UWBFrame, sequenceNumber)
+#define TIME_STAMPS_OFFSET offsetof(struct UWBDelayDataFrame, tx1TimeStamp)
+
+BUILD_ASSERT(sizeof(struct UWBResponseFrame) <= FINAL_TEMPLATE_OFFSET, "Response template overlaps the final template");
+BUILD_ASSERT(FINAL_TEMPLATE_OFFSET + sizeof(struct UWBDelayDataFrame) <= TEMPLATE_SLOT_SIZE, "Final template does not fit the slot");
+BUILD_ASSERT(BLINK_TEMPLATE_OFFSET + DSTWR_MAX_FRAME_LENGTH <= TX_BUFFER_SIZE, "Templates do not fit the TX buffer");
+BUILD_ASSERT(sizeof(struct UWBBeaconFrame) <= DSTWR_MAX_FRAME_LENGTH, "Beacon does not fit the blink slot");
+
+static uint16_t localAddress = 0x4556;
+
+static struct DSTWRSession sessions[DSTWR_MAX_SESSIONS];
+
+/* Session whose exchange currently occupies the radio, NULL when the radio is free. */
+static struct DSTWRSession *radioOwner;
+
+/* Set while someone reads the accumulator, the receiver stays off between exchanges. */
+static bool receiverHeld;
+
+/* Blink reception and the own blink in flight, it occupies the radio like an exchange. */
+static DSTWRBlinkHandler blinkHandler;
+static bool blinkInFlight;
+static uint8_t blinkSequenceNumber;
+
+/* Sync beacon reception, and the own beacon or scheduled frame in flight, which share the blink slot. */
+static DSTWRBeaconHandler beaconHandler;
+static bool frameInFlight;
+
+/* Scheduled responder whose receive window is armed, it holds the radio until a poll or the window's end. */
+static struct DSTWRSession *rxWindow;
+
+static bool isRadioFree() {
+	return radioOwner == NULL && !receiverHeld && !blinkInFlight && !frameInFlight && rxWindow == NULL;
 }
 
-uint8_t sequenceNumber;
+#define POLL_LENGTH (sizeof(struct UWBFrame) + FCS_LEN)
+#define RESPONSE_LENGTH (sizeof(struct UWBResponseFrame) + FCS_LEN)
+#define FINAL_LENGTH (sizeof(struct UWBDelayDataFrame) + FCS_LEN)
 
-struct UWBFrame firstTxFrame = {
-	.frameControl = 0x8841,
-	.panId = 0xDECA,
-	.destinationAddress = RESPONDER_ADDRESS,
-	.sourceAddress = INITIATOR_ADDRESS,
-	.functionCode = 0x21
+struct PhyTiming {
+	uint32_t responseDelay;        /* us from the poll RX to the response TX timestamp */
+	uint32_t finalDelay;           /* us from the response RX to the final TX timestamp */
+	uint32_t rxAfterTx;            /* UWB us, for dwt_setrxaftertxdelay */
+	uint32_t exchangeDuration;     /* us from the start of the poll to the processed final */
 };
 
+/* Profile and hop the responders listen with, the hop follows the last served session. */
+static const struct PhyProfile *listenProfile;
+static uint8_t listenHop = HOP_HOME;
+
+/* What is currently configured on the chip. */
+static const struct PhyProfile *chipProfile;
+static uint8_t chipChannel;
+static uint8_t chipCode;
+static uint8_t chipStsMode;
+static dwt_pdoa_mode_e chipPdoaMode;
+
+/* Timing of the chip's profile, and of exchanges that send every frame with data (SP3 profiles out of sync). */
+static struct PhyTiming timing;
+static struct PhyTiming dataTiming;
+
+/* Responder session whose next poll comes as an SP3 frame with a known IV. */
+static struct DSTWRSession *stsListener;
+
+/* Cost of reconfigurations, full profile changes and channel or code hops. */
+static uint32_t profileChanges;
+static uint64_t profileCycles;
+static uint32_t hopChanges;
+static uint64_t hopCycles;
+
+/* Software time of the delayed replies, from the end of the received frame to dwt_starttx, see PHY_REPLY_PROCESSING_TIME. */
+static uint32_t replies;
+static uint32_t lateReplies;
+static uint32_t worstReplyProcessing;
+
+static void profileWork(struct k_work *work);
+
+K_WORK_DEFINE(profileChange, profileWork);
+
+/* Last frame length and buffer offset given to dwt_writetxfctrl. */
+static uint16_t txFrameLength;
+static uint16_t txFrameOffset;
+
+union UWBRxBuffer {
+	struct UWBBlinkFrame blink;
+	struct UWBBeaconFrame beacon;
+	struct UWBFrame frame;
+	struct UWBResponseFrame response;
+	struct UWBDelayDataFrame delayData;
+};
+
+static void dispatchTX(const dwt_cb_data_t *cb_data);
+static void dispatchRX(const dwt_cb_data_t *cb_data);
+static void dispatchRXFault(const dwt_cb_data_t *cb_data);
+static void sessionWork(struct k_work *work);
+
+/* The next start of every session rewrites its frames. */
+static void invalidateTemplates() {
+	for (int i = 0; i < DSTWR_MAX_SESSIONS; i++) {
+		sessions[i].templatesWritten = false;
+	}
+}
+
+void setLocalAddress(uint16_t address) {
+	if (address != localAddress) {
+		localAddress = address;
+		invalidateTemplates();
+	}
+}
+
+uint16_t getLocalAddress() {
+	return localAddress;
+}
+
+static bool isSecure(const struct PhyProfile *profile) {
+	return profile != NULL && (profile->config.stsMode & DWT_STS_CONFIG_MASK_NO_SDC) != DWT_STS_MODE_OFF;
+}
+
+static bool isNoData(uint8_t stsMode) {
+	return (stsMode & DWT_STS_CONFIG_MASK_NO_SDC) == DWT_STS_MODE_ND;
+}
+
+/*
+ * The final always carries data. Poll and response use the profile as it is,
+ * or with data as well when withData is set. The preamble does not change
+ * with the STS mode, so one configuration serves both sides of a reply.
+ */
+static void computeTiming(const struct PhyProfile *profile, bool withData, struct PhyTiming *result) {
+	dwt_config_t config = profile->config;
+	dwt_config_t dataConfig = profile->config;
+	struct Airtime poll;
+	struct Airtime final;
+
+	dataConfig.stsMode = dataStsMode(profile->config.stsMode);
+	if (withData) {
+		config = dataConfig;
+	}
+
+	frameAirtime(&config, POLL_LENGTH, &poll);
+	frameAirtime(&dataConfig, FINAL_LENGTH, &final);
+
+	result->responseDelay = minimumReplyDelay(&config, POLL_LENGTH, RESPONSE_LENGTH);
+	result->finalDelay = minimumReplyDelay(&config, RESPONSE_LENGTH, FINAL_LENGTH);
+
+	/* One receiver delay serves both sides, the initiator after the poll and the responder after the response. */
+	result->rxAfterTx = MIN(
+		rxAfterTxDelay(&config, POLL_LENGTH, result->responseDelay, RESPONSE_LENGTH),
+		rxAfterTxDelay(&config, RESPONSE_LENGTH, result->finalDelay, FINAL_LENGTH)
+	);
+
+	result->exchangeDuration = (poll.preamble + final.afterMarker) / 1000 + result->responseDelay + result->finalDelay + PHY_REPLY_PROCESSING_TIME;
+}
+
+/*
+ * Reconfigures the chip only when something differs. The driver has no
+ * channel or code setter, so every change goes through dwt_configure (PLL
+ * lock and PGF calibration), but a hop skips what only depends on the
+ * profile (timing, receiver delay) or on the channel (TX power).
+ */
+static bool applyConfiguration(const struct PhyProfile *profile, uint8_t hop) {
+	dwt_config_t config = profile->config;
+	bool profileChanged = profile != chipProfile;
+	uint32_t start;
+
+	config.chan = hopChannel(hop, profile->config.chan);
+	config.txCode = hopCode(hop, profile->config.txCode);
+	config.rxCode = config.txCode;
+	config.pdoaMode = pdoaModeFor(&config);
+
+	if (!profileChanged && config.chan == chipChannel && config.txCode == chipCode && config.pdoaMode == chipPdoaMode) {
+		return true;
+	}
+
+	start = k_cycle_get_32();
+
+	if (dwt_configure(&config) != DWT_SUCCESS) {
+		LOG_ERR("Configuration of %s profile on channel %u code %u failed", profile->name, config.chan, config.txCode);
+		chipProfile = NULL;
+		return false;
+	}
+
+	chipStsMode = config.stsMode;
+	chipPdoaMode = config.pdoaMode;
+	pdoaConfigured();
+
+	if (config.chan != chipChannel) {
+		dwt_configuretxrf(config.chan == 9 ? &txconfigChannel9 : &txconfig_options);
+	}
+
+	if (profileChanged) {
+		computeTiming(profile, false, &timing);
+		computeTiming(profile, true, &dataTiming);
+		dwt_setrxaftertxdelay(MIN(timing.rxAfterTx, dataTiming.rxAfterTx));
+	}
+
+	chipProfile = profile;
+	chipChannel = config.chan;
+	chipCode = config.txCode;
+
+	if (profileChanged) {
+		profileCycles += k_cycle_get_32() - start;
+		profileChanges++;
+	} else {
+		hopCycles += k_cycle_get_32() - start;
+		hopChanges++;
+	}
+
+	return true;
+}
+
+static const struct PhyProfile *sessionProfile(const struct DSTWRSession *session) {
+	return session->profile != NULL ? session->profile : listenProfile;
+}
+
+/* Switches the STS mode between frames, much cheaper than dwt_configure. */
+static void setStsMode(uint8_t stsMode) {
+	if (stsMode != chipStsMode) {
+		dwt_configurestsmode(stsMode);
+		chipStsMode = stsMode;
+	}
+}
+
+/* Timing of the exchange in flight, it depends on whether poll and response are SP3 frames. */
+static const struct PhyTiming *exchangeTiming() {
+	return isNoData(chipStsMode) ? &timing : &dataTiming;
+}
+
+/* Responders listen for SP3 polls of the synchronized session, otherwise for frames with data. */
+static void applyListenSts() {
+	if (!isSecure(listenProfile)) {
+		return;
+	}
+
+	if (stsListener != NULL && stsListener->running) {
+		setStsMode(listenProfile->config.stsMode);
+		loadStsIv(&stsListener->sts, stsListener->peerAddress, localAddress);
+	} else {
+		setStsMode(dataStsMode(listenProfile->config.stsMode));
+	}
+}
+
+static void desynchronizeResponder(struct DSTWRSession *session) {
+	session->sts.synchronized = false;
+
+	if (stsListener == session) {
+		stsListener = NULL;
+	}
+}
+
 bool initializeUWB() {
 	if (dw3000_hw_init() != 0) {
 		LOG_ERR("Initialization of UWB chip HW failed");
@@ -85,13 +329,15 @@ bool initializeUWB() {
 		return false;
 	}
 
-	if (dwt_configure(&config) != DWT_SUCCESS) {
-		LOG_ERR("Configuration failed");
+	/* The reset cleared the TX buffer. */
+	invalidateTemplates();
+
+	listenProfile = getPhyProfile(PhyStandard);
+
+	if (!applyConfiguration(listenProfile, listenHop)) {
 		return false;
 	}
 
-	dwt_configuretxrf(&txconfig_options);
-
 	if (dw3000_hw_init_interrupt() != 0) {
 		LOG_ERR("Interrupt initialization failed");
 		return false;
@@ -102,205 +348,1082 @@ bool initializeUWB() {
 	dwt_setrxantennadelay(DUMMY_ANTENNA_DELAY);
 	dwt_settxantennadelay(DUMMY_ANTENNA_DELAY);
 
-	dwt_setrxaftertxdelay(RX_DELAY);
 	dwt_setrxtimeout(RX_TIME_OUT);
 	dwt_setpreambledetecttimeout(PREAMBLE_TIME_OUT);
 
+	dwt_setcallbacks(dispatchTX, dispatchRX, dispatchRXFault, dispatchRXFault, NULL, NULL, NULL);
+
+	dwt_writesysstatuslo(DWT_INT_RXFCG_BIT_MASK | DWT_INT_TXFRS_BIT_MASK);
+	dwt_setinterrupt(DWT_INT_RXFCG_BIT_MASK | DWT_INT_RXFR_BIT_MASK | DWT_INT_TXFRS_BIT_MASK | SYS_STATUS_ALL_RX_TO | SYS_STATUS_ALL_RX_ERR, 0, DWT_ENABLE_INT_ONLY);
+
 	return true;
 }
 
-void initiator();
+/* Outside the turnaround, after dwt_starttx, now is the system time read just before it. */
+static void recordReplyProcessing(DeviceTime rxTimeStamp, DeviceTime now, uint16_t rxLength) {
+	dwt_config_t config = chipProfile->config;
+	struct Airtime rx;
+	uint32_t elapsed = deviceTimeToMicroseconds(deviceTimeDiff(now, rxTimeStamp));
+
+	config.stsMode = chipStsMode;
+	frameAirtime(&config, rxLength, &rx);
+
+	replies++;
+	worstReplyProcessing = MAX(worstReplyProcessing, elapsed > rx.afterMarker / 1000 ? elapsed - rx.afterMarker / 1000 : 0);
+}
+
+static void selectTxFrame(uint16_t length, uint16_t offset) {
+	if (length != txFrameLength || offset != txFrameOffset) {
+		txFrameLength = length;
+		txFrameOffset = offset;
+		dwt_writetxfctrl(length + FCS_LEN, offset, 1);
+	}
+}
+
+static void writeTemplates(struct DSTWRSession *session) {
+	struct UWBFrame header = {
+		.frameControl = FRAME_CONTROL,
+		.panId = PAN_ID,
+		.destinationAddress = session->peerAddress,
+		.sourceAddress = localAddress
+	};
+
+	if (session->templatesWritten) {
+		return;
+	}
+
+	session->templatesWritten = true;
+
+	if (session->role == DSTWRInitiator) {
+		struct UWBDelayDataFrame finalFrame = { .baseFrame = header };
+		finalFrame.baseFrame.functionCode = FUNCTION_FINAL;
+
+		header.functionCode = FUNCTION_POLL;
+
+		dwt_writetxdata(sizeof(header), (uint8_t *)&header, session->templateOffset);
+		dwt_writetxdata(sizeof(finalFrame), (uint8_t *)&finalFrame, session->templateOffset + FINAL_TEMPLATE_OFFSET);
+	} else {
+		struct UWBResponseFrame responseFrame = { .baseFrame = header, .activityCode = ACTIVITY_CONTINUE };
+		responseFrame.baseFrame.functionCode = FUNCTION_RESPONSE;
+
+		dwt_writetxdata(sizeof(responseFrame), (uint8_t *)&responseFrame, session->templateOffset);
+	}
+}
+
+static bool hasListener() {
+	if (blinkHandler != NULL || beaconHandler != NULL) {
+		return true;
+	}
+
+	/* Scheduled responders wait for their window with the receiver off. */
+	for (int i = 0; i < DSTWR_MAX_SESSIONS; i++) {
+		if (sessions[i].used && sessions[i].running && sessions[i].role == DSTWRResponder && !sessions[i].scheduled) {
+			return true;
+		}
+	}
+
+	return false;
+}
+
+static void closeRxWindow() {
+	if (rxWindow != NULL) {
+		rxWindow = NULL;
+		dwt_setrxtimeout(RX_TIME_OUT);
+	}
+}
+
+/* Frees the radio and puts it back to listening when some responder waits for polls or blinks are received. */
+static void releaseRadio() {
+	radioOwner = NULL;
+	closeRxWindow();
+
+	if (!receiverHeld && hasListener()) {
+		applyConfiguration(listenProfile, listenHop);
+		applyListenSts();
+		dwt_rxenable(DWT_START_RX_IMMEDIATE);
+	}
+}
 
-void initiatorTX(const dwt_cb_data_t *cb_data) {
-	if (initiatorDone != NULL) {
-		initiatorDone();
+void holdReceiver() {
+	receiverHeld = true;
+}
+
+void resumeReceiver() {
+	receiverHeld = false;
+
+	if (radioOwner == NULL && !blinkInFlight && !frameInFlight && rxWindow == NULL) {
+		releaseRadio();
 	}
 }
 
-void initiatorRX(const dwt_cb_data_t *cb_data) {
-	uint64_t tx1TimeStamp;
-	uint64_t rxTimeStamp;
-	uint64_t tx2TimeStamp;
+static void finishInitiator(struct DSTWRSession *session, bool completed) {
+	session->state = DSTWRIdle;
+
+	if (completed && session->initiatorDone != NULL) {
+		session->initiatorDone(session);
+	}
+
+	if (!session->running) {
+		return;
+	}
 
-	struct UWBDelayDataFrame secondTxFrame = { .baseFrame = firstTxFrame };
-	secondTxFrame.baseFrame.functionCode = 0x23;
+	if (!completed) {
+		k_work_reschedule(&session->work, K_NO_WAIT);
+	} else if (session->interval != 0) {
+		k_work_reschedule(&session->work, K_MSEC(session->interval));
+	} else {
+		session->running = false;
+	}
+}
+
+/* Forgets the exchange in flight without touching the radio. */
+static void dropExchange() {
+	struct DSTWRSession *session = radioOwner;
+
+	radioOwner = NULL;
+
+	if (session == NULL) {
+		return;
+	}
 
-	struct UWBResponseFrame rxFrame;
+	if (session->role == DSTWRInitiator) {
+		/* The peer may have seen the poll, the next attempt moves on to the next hop like after a success. */
+		if (session->state == DSTWRWaitResponse) {
+			session->sequenceNumber += 2;
+		}
 
-	uint32_t tx2Time;
+		session->sts.synchronized = false;
+		recordHopResult(&session->hop, false);
+		finishInitiator(session, false);
+	} else {
+		desynchronizeResponder(session);
+		session->state = DSTWRIdle;
+	}
+}
 
-	if (dwt_getframelength() >= sizeof(rxFrame)) {
-		dwt_readrxdata(&rxFrame, sizeof(rxFrame), 0);
+/* Drops the exchange in flight, e.g. after an RX error, and frees the radio. */
+static void abortExchange() {
+	dropExchange();
+	releaseRadio();
+}
 
+static struct DSTWRSession *findResponder(uint16_t peerAddress) {
+	for (int i = 0; i < DSTWR_MAX_SESSIONS; i++) {
 		if (
-			rxFrame.baseFrame.frameControl == 0x8841 &&
-			rxFrame.baseFrame.panId == 0xDECA &&
-			rxFrame.baseFrame.destinationAddress == INITIATOR_ADDRESS &&
-			rxFrame.baseFrame.sourceAddress == RESPONDER_ADDRESS &&
-			rxFrame.baseFrame.functionCode == 0x10 &&
-			rxFrame.activityCode == 0x02
+			sessions[i].used &&
+			sessions[i].running &&
+			sessions[i].role == DSTWRResponder &&
+			sessions[i].peerAddress == peerAddress
 		) {
-			tx1TimeStamp = 0;
-			tx1TimeStamp |= dwt_readtxtimestamphi32();
-			tx1TimeStamp <<= 8;
-			tx1TimeStamp |= dwt_readtxtimestamplo32();
+			return &sessions[i];
+		}
+	}
+
+	return NULL;
+}
+
+static bool isFrameFor(const struct UWBFrame *frame, uint16_t sourceAddress, uint8_t functionCode) {
+	return
+		frame->frameControl == FRAME_CONTROL &&
+		frame->panId == PAN_ID &&
+		frame->destinationAddress == localAddress &&
+		frame->sourceAddress == sourceAddress &&
+		frame->functionCode == functionCode;
+}
+
+/* SP3 frames only while the responder knows the IV, otherwise the exchange resynchronizes with data frames. */
+static void prepareInitiatorSts(struct DSTWRSession *session, const struct PhyProfile *profile) {
+	if (!isSecure(profile)) {
+		return;
+	}
+
+	session->sts.validated = isStsSynchronized(&session->sts);
+	session->sts.exchanges++;
+
+	setStsMode(session->sts.validated ? profile->config.stsMode : dataStsMode(profile->config.stsMode));
+	loadStsIv(&session->sts, localAddress, session->peerAddress);
+
+	/* An IV is never used twice, a failed exchange moves on as well. */
+	session->sts.exchange++;
+}
+
+/* mode is DWT_START_TX_IMMEDIATE, or DWT_START_TX_DELAYED with the start time already set. */
+static void initiatorPoll(struct DSTWRSession *session, uint8_t mode) {
+	uint8_t sequenceNumber = session->sequenceNumber;
+	uint8_t finalSequenceNumber = session->sequenceNumber + 1;
+
+	radioOwner = session;
+	session->state = DSTWRWaitResponse;
+
+	/* The final frame's sequence number is known now, patch it outside the turnaround. */
+	dwt_writetxdata(sizeof(sequenceNumber), &sequenceNumber, session->templateOffset + SEQUENCE_NUMBER_OFFSET);
+	dwt_writetxdata(sizeof(finalSequenceNumber), &finalSequenceNumber, session->templateOffset + FINAL_TEMPLATE_OFFSET + SEQUENCE_NUMBER_OFFSET);
+	selectTxFrame(sizeof(struct UWBFrame), session->templateOffset);
+
+	if (dwt_starttx(mode | DWT_RESPONSE_EXPECTED) == DWT_ERROR) {
+		abortExchange();
+	}
+}
+
+static void initiatorResponse(struct DSTWRSession *session, const struct UWBResponseFrame *rxFrame) {
+	uint8_t patch[3 * DEVICE_TIME_LENGTH + 1 + sizeof(uint32_t)];
+	DeviceTime tx2TimeStamp;
+	DeviceTime now;
+
+	if (isSecure(chipProfile) && session->sts.validated && !isStsGood()) {
+		session->sts.failures++;
+		abortExchange();
+		return;
+	}
+
+	/* Both chip timestamps are already little endian 40-bit values, read them straight into the patch. */
+	dwt_readtxtimestamp(&patch[0]);
+	dwt_readrxtimestamp(&patch[DEVICE_TIME_LENGTH]);
+	session->firstTxTimeStamp = deviceTimeFromBytes(&patch[0]);
 
-			rxTimeStamp = 0;
-			rxTimeStamp |= dwt_readrxtimestamphi32();
-			rxTimeStamp <<= 8;
-			rxTimeStamp |= dwt_readrxtimestamplo32();
+	dwt_setdelayedtrxtime(delayedTxTime(deviceTimeFromBytes(&patch[DEVICE_TIME_LENGTH]), exchangeTiming()->finalDelay, DUMMY_ANTENNA_DELAY, &tx2TimeStamp));
 
-			tx2Time = (rxTimeStamp + (TX_DELAY * UUS_TO_DWT_TIME)) >> 8;
+	deviceTimeToBytes(tx2TimeStamp, &patch[2 * DEVICE_TIME_LENGTH]);
+	patch[3 * DEVICE_TIME_LENGTH] = commitBlacklist(&session->hop);
+	memcpy(&patch[3 * DEVICE_TIME_LENGTH + 1], &session->sts.exchange, sizeof(uint32_t));
 
-			dwt_setdelayedtrxtime(tx2Time);
+	/* The final carries data, after an SP3 response it goes out as SP1. */
+	setStsMode(dataStsMode(chipStsMode));
 
-			tx2TimeStamp = (((uint64_t)(tx2Time & 0xFFFFFFFEUL)) << 8) + DUMMY_ANTENNA_DELAY;
+	session->sequenceNumber += 2;
+	session->state = DSTWRSendFinal;
 
-			secondTxFrame.tx1TimeStamp = (uint32_t)tx1TimeStamp;
-			secondTxFrame.rxTimeStamp = (uint32_t)rxTimeStamp;
-			secondTxFrame.tx2TimeStamp = (uint32_t)tx2TimeStamp;
+	dwt_writetxdata(sizeof(patch), patch, session->templateOffset + FINAL_TEMPLATE_OFFSET + TIME_STAMPS_OFFSET);
+	selectTxFrame(sizeof(struct UWBDelayDataFrame), session->templateOffset + FINAL_TEMPLATE_OFFSET);
 
-			secondTxFrame.baseFrame.sequenceNumber = sequenceNumber++;
+	now = (DeviceTime)dwt_readsystimestamphi32() << 8;
 
-			dwt_writetxdata(sizeof(secondTxFrame), &secondTxFrame, 0);
-			dwt_writetxfctrl(sizeof(secondTxFrame) + FCS_LEN, 0, 1);
+	if (dwt_starttx(DWT_START_TX_DELAYED) != DWT_SUCCESS) {
+		lateReplies++;
+		abortExchange();
+		return;
+	}
+
+	recordReplyProcessing(deviceTimeFromBytes(&patch[DEVICE_TIME_LENGTH]), now, RESPONSE_LENGTH);
+}
+
+/* ms until a responder returns to the home hop and gives up its STS synchronization, UINT32_MAX for never. */
+static uint32_t responderDwell(const struct DSTWRSession *session) {
+	uint32_t dwell = stsListener == session ? session->sts.dwell : UINT32_MAX;
+
+	if (session->hop.seed != 0) {
+		dwell = MIN(dwell, session->hop.dwell);
+	}
+
+	return dwell;
+}
+
+static void responderPoll(struct DSTWRSession *session, uint8_t sequenceNumber) {
+	uint32_t dwell = responderDwell(session);
+	bool noData = isNoData(chipStsMode);
+	DeviceTime now;
+
+	/* The receive timeout of a window would cut the wait for the final short, a poll heard early needs no window. */
+	closeRxWindow();
+	if (session->scheduled) {
+		session->scheduled = false;
+		k_work_cancel_delayable(&session->work);
+	}
+
+	session->firstRxTimeStamp = readRxTimeStamp();
+
+	/* Only a poll of the synchronized session is validated, anything else resynchronizes. */
+	if (isSecure(chipProfile)) {
+		session->sts.exchanges++;
+		session->sts.validated = stsListener == session && isStsGood();
 
-			dwt_setinterrupt(DWT_INT_TXFRS_BIT_MASK, 0, DWT_ENABLE_INT_ONLY);
+		if (stsListener == session && !session->sts.validated) {
+			session->sts.failures++;
 
-			if (dwt_starttx(DWT_START_TX_DELAYED) == DWT_SUCCESS) {
+			/* An SP3 frame with a bad STS is not a poll at all. */
+			if (noData) {
+				desynchronizeResponder(session);
+				releaseRadio();
 				return;
 			}
 		}
 	}
 
-	initiator();
-}
+	/* Return to the home hop unless the final arrives and names the next one. */
+	if (dwell != UINT32_MAX) {
+		k_work_reschedule(&session->work, K_MSEC(dwell));
+	}
+
+	dwt_setdelayedtrxtime(delayedTxTime(session->firstRxTimeStamp, exchangeTiming()->responseDelay, DUMMY_ANTENNA_DELAY, NULL));
+
+	/* The response echoes the poll's sequence number, the rest of the template is already on the chip. */
+	dwt_writetxdata(sizeof(sequenceNumber), &sequenceNumber, session->templateOffset + SEQUENCE_NUMBER_OFFSET);
+	selectTxFrame(sizeof(struct UWBResponseFrame), session->templateOffset);
 
-void initiatorRXFault(const dwt_cb_data_t *cb_data) {
-	initiator();
+	radioOwner = session;
+	session->sequenceNumber = sequenceNumber + 1;
+	session->state = DSTWRWaitFinal;
+
+	now = (DeviceTime)dwt_readsystimestamphi32() << 8;
+
+	/* After an SP3 response the receiver is enabled by dispatchTX, the final needs SP1. */
+	if (dwt_starttx(noData ? DWT_START_TX_DELAYED : DWT_START_TX_DELAYED | DWT_RESPONSE_EXPECTED) == DWT_ERROR) {
+		lateReplies++;
+		abortExchange();
+		return;
+	}
+
+	recordReplyProcessing(session->firstRxTimeStamp, now, POLL_LENGTH);
 }
 
-void initiatorStart() {
-	dwt_setcallbacks(initiatorTX, initiatorRX, initiatorRXFault, initiatorRXFault, NULL, NULL, NULL);
-	
-	dwt_writesysstatuslo(DWT_INT_RXFCG_BIT_MASK | DWT_INT_TXFRS_BIT_MASK);
+static void responderFinal(struct DSTWRSession *session, const struct UWBDelayDataFrame *rxFrame) {
+	struct DSTWRResult result = {
+		.tx1 = deviceTimeFromBytes(rxFrame->tx1TimeStamp),
+		.rx1 = session->firstRxTimeStamp,
+		.tx2 = readTxTimeStamp(),
+		.rx2 = deviceTimeFromBytes(rxFrame->rxTimeStamp),
+		.tx3 = deviceTimeFromBytes(rxFrame->tx2TimeStamp),
+		.rx3 = readRxTimeStamp()
+	};
+	bool secure = isSecure(chipProfile);
+	uint32_t dwell;
+
+	session->state = DSTWRIdle;
+
+	if (secure) {
+		recordStsCost(&session->sts, stsListener != session, deviceTimeDiff(result.rx3, result.rx1));
 
-	initiator();
+		if (stsListener != session) {
+			session->sts.resyncs++;
+		} else if (session->sts.validated && !isStsGood()) {
+			session->sts.failures++;
+			session->sts.validated = false;
+		}
+
+		/* The final names the IV of the next exchange, the responder is synchronized with it for the dwell. */
+		session->sts.exchange = rxFrame->stsExchange;
+		session->sts.synchronized = true;
+		stsListener = session;
+	}
+
+	captureLinkQuality(&session->quality);
+	captureBearing(&session->bearing, chipPdoaMode, chipChannel);
+	startCirCapture(session->peerAddress, session->sequenceNumber);
+
+	/* The final's sequence number is one above the poll, the next poll comes two above. */
+	session->hop.blacklist = rxFrame->hopBlacklist;
+	listenHop = hopFor(&session->hop, session->sequenceNumber + 1);
+
+	dwell = responderDwell(session);
+	if (dwell != UINT32_MAX) {
+		k_work_reschedule(&session->work, K_MSEC(dwell));
+	}
+
+	/* Listen again before handing out the result, the processor may take its time. */
+	releaseRadio();
+
+	/* Without a validated STS the timestamps are not trustworthy, a secure session only hands out validated results. */
+	if (session->resultProcessor != NULL && (!secure || session->sts.validated)) {
+		session->resultProcessor(session, result);
+	}
 }
 
-void initiator() {
-	dwt_setinterrupt(DWT_INT_RXFCG_BIT_MASK | SYS_STATUS_ALL_RX_TO | SYS_STATUS_ALL_RX_ERR, 0, DWT_ENABLE_INT_ONLY);
+static void dispatchTX(const dwt_cb_data_t *cb_data) {
+	struct DSTWRSession *session = radioOwner;
+
+	if (blinkInFlight) {
+		blinkInFlight = false;
+
+		if (blinkHandler != NULL) {
+			blinkHandler(localAddress, blinkSequenceNumber, readTxTimeStamp());
+		}
+
+		releaseRadio();
+		return;
+	}
+
+	if (frameInFlight) {
+		frameInFlight = false;
+		releaseRadio();
+		return;
+	}
 
-	do {
-		firstTxFrame.sequenceNumber = sequenceNumber++;
+	/* Only the final frame of an initiator ends an exchange, the other transmissions expect a response. */
+	if (session != NULL && session->state == DSTWRSendFinal) {
+		if (isSecure(chipProfile)) {
+			recordStsCost(&session->sts, !session->sts.validated, deviceTimeDiff(readTxTimeStamp(), session->firstTxTimeStamp));
+
+			if (!session->sts.validated) {
+				session->sts.resyncs++;
+			}
+		}
 
-		dwt_writetxdata(sizeof(firstTxFrame), &firstTxFrame, 0);
-		dwt_writetxfctrl(sizeof(firstTxFrame) + FCS_LEN, 0, 1);
-	} while(dwt_starttx(DWT_START_TX_IMMEDIATE | DWT_RESPONSE_EXPECTED) == DWT_ERROR);
+		session->sts.synchronized = true;
+		session->sts.lastExchange = k_uptime_get_32();
+
+		recordHopResult(&session->hop, true);
+		releaseRadio();
+		finishInitiator(session, true);
+	} else if (session != NULL && session->state == DSTWRWaitFinal && isNoData(chipStsMode)) {
+		setStsMode(dataStsMode(chipStsMode));
+		dwt_rxenable(DWT_START_RX_IMMEDIATE);
+	}
 }
 
-void responderRX(const dwt_cb_data_t *cb_data);
-void responderRXFault(const dwt_cb_data_t *cb_data);
+/*
+ * SP3 frames carry nothing to route by, they belong to whoever waits for
+ * one: an initiator for its response or the synchronized responder.
+ */
+static void dispatchNoData() {
+	struct DSTWRSession *session = radioOwner;
+
+	if (session != NULL && session->state == DSTWRWaitResponse && isNoData(chipStsMode)) {
+		initiatorResponse(session, NULL);
+		return;
+	}
+
+	if (session != NULL) {
+		dropExchange();
+	} else if (stsListener != NULL && stsListener->running && isNoData(chipStsMode)) {
+		responderPoll(stsListener, stsListener->sequenceNumber + 1);
+		return;
+	}
 
-void responder() {
-	dwt_setcallbacks(NULL, responderRX, responderRXFault, responderRXFault, NULL, NULL, NULL);
-	dwt_rxenable(DWT_START_RX_IMMEDIATE);
+	releaseRadio();
 }
 
-uint64_t firstRxTimeStamp;
+static void dispatchRX(const dwt_cb_data_t *cb_data) {
+	union UWBRxBuffer rxBuffer;
+	struct DSTWRSession *session = radioOwner;
+	uint16_t length = MIN(cb_data->datalength, sizeof(rxBuffer));
 
-void responderSecondRX(const dwt_cb_data_t *cb_data) {
-	struct UWBDelayDataFrame secondRxFrame;
-	uint64_t txTimeStamp;
-	uint64_t secondRxTimeStamp;
+	if (cb_data->rx_flags & DWT_CB_DATA_RX_FLAG_ND) {
+		dispatchNoData();
+		return;
+	}
+
+	if (length < sizeof(rxBuffer.blink)) {
+		abortExchange();
+		return;
+	}
+
+	dwt_readrxdata((uint8_t *)&rxBuffer, length, 0);
+
+	/* Blinks and beacons are timestamped whatever the radio waited for, a tag does not retry. */
+	if (rxBuffer.blink.frameControl == BLINK_FRAME_CONTROL) {
+		DeviceTime rxTimeStamp = readRxTimeStamp();
+
+		if (session != NULL) {
+			dropExchange();
+		}
+
+		if (length >= sizeof(rxBuffer.beacon) + FCS_LEN) {
+			if (beaconHandler != NULL) {
+				beaconHandler(
+					rxBuffer.blink.tagAddress,
+					rxBuffer.blink.sequenceNumber,
+					deviceTimeFromBytes(rxBuffer.beacon.txTimeStamp),
+					rxTimeStamp
+				);
+			}
+		} else if (blinkHandler != NULL) {
+			blinkHandler(rxBuffer.blink.tagAddress, rxBuffer.blink.sequenceNumber, rxTimeStamp);
+		}
+
+		releaseRadio();
+		return;
+	}
+
+	if (length < sizeof(rxBuffer.frame)) {
+		abortExchange();
+		return;
+	}
 
-	sequenceNumber++;
+	if (session != NULL) {
+		if (
+			session->state == DSTWRWaitResponse &&
+			length >= sizeof(rxBuffer.response) &&
+			isFrameFor(&rxBuffer.frame, session->peerAddress, FUNCTION_RESPONSE) &&
+			rxBuffer.frame.sequenceNumber == session->sequenceNumber &&
+			rxBuffer.response.activityCode == ACTIVITY_CONTINUE
+		) {
+			initiatorResponse(session, &rxBuffer.response);
+			return;
+		}
 
-	if (dwt_getframelength() >= sizeof(secondRxFrame)) {
-		dwt_readrxdata(&secondRxFrame, sizeof(secondRxFrame), 0);
 		if (
-			secondRxFrame.baseFrame.frameControl == 0x8841 &&
-			secondRxFrame.baseFrame.panId == 0xDECA &&
-			secondRxFrame.baseFrame.destinationAddress == RESPONDER_ADDRESS &&
-			secondRxFrame.baseFrame.sourceAddress == INITIATOR_ADDRESS &&
-			secondRxFrame.baseFrame.functionCode == 0x23
+			session->state == DSTWRWaitFinal &&
+			length >= sizeof(rxBuffer.delayData) &&
+			isFrameFor(&rxBuffer.frame, session->peerAddress, FUNCTION_FINAL) &&
+			rxBuffer.frame.sequenceNumber == session->sequenceNumber
 		) {
-			txTimeStamp = 0;
-			txTimeStamp |= dwt_readtxtimestamphi32();
-			txTimeStamp <<= 8;
-			txTimeStamp |= dwt_readtxtimestamplo32();
-
-			secondRxTimeStamp = 0;
-			secondRxTimeStamp |= dwt_readrxtimestamphi32();
-			secondRxTimeStamp <<= 8;
-			secondRxTimeStamp |= dwt_readrxtimestamplo32();
-
-			if (resultProcessor != NULL) {
-				resultProcessor((struct DSTWRResult){secondRxFrame.tx1TimeStamp, firstRxTimeStamp, txTimeStamp, secondRxFrame.rxTimeStamp, secondRxFrame.tx2TimeStamp, secondRxTimeStamp});
-			}
+			responderFinal(session, &rxBuffer.delayData);
+			return;
+		}
+
+		dropExchange();
+	}
 
+	/* The radio is free, a poll from any peer with a listening session starts a new exchange. */
+	if (rxBuffer.frame.functionCode == FUNCTION_POLL) {
+		session = findResponder(rxBuffer.frame.sourceAddress);
+
+		if (session != NULL && isFrameFor(&rxBuffer.frame, session->peerAddress, FUNCTION_POLL)) {
+			responderPoll(session, rxBuffer.frame.sequenceNumber);
 			return;
 		}
 	}
 
-	responder();
+	releaseRadio();
+}
+
+static void dispatchRXFault(const dwt_cb_data_t *cb_data) {
+	abortExchange();
+}
+
+/*
+ * Arms the radio for a scheduled exchange, the initiator's poll as delayed
+ * TX, the responder's receiver from shortly before the poll's preamble for
+ * the window. A busy radio or a start time already passed falls back to
+ * the unscheduled exchange, the initiator polls right away and the
+ * responder listens.
+ */
+static void armScheduled(struct DSTWRSession *session) {
+	const struct PhyProfile *profile = sessionProfile(session);
+	struct Airtime poll;
+	uint32_t lead;
+
+	session->scheduled = false;
+
+	if (!isRadioFree()) {
+		LOG_WRN("Radio busy at the scheduled exchange with 0x%04X", session->peerAddress);
+
+		if (session->role == DSTWRInitiator) {
+			k_work_reschedule(&session->work, K_NO_WAIT);
+		}
+		return;
+	}
+
+	dwt_forcetrxoff();
+
+	if (session->role == DSTWRInitiator) {
+		session->hop.current = hopFor(&session->hop, session->sequenceNumber);
+		applyConfiguration(profile, session->hop.current);
+		prepareInitiatorSts(session, profile);
+
+		/* The chip adds the antenna delay, the poll's timestamp is the start time. */
+		dwt_setdelayedtrxtime((uint32_t)(deviceTimeAdd(session->startTime, -DUMMY_ANTENNA_DELAY) >> 8));
+		initiatorPoll(session, DWT_START_TX_DELAYED);
+		return;
+	}
+
+	applyConfiguration(profile, HOP_HOME);
+	setStsMode(dataStsMode(profile->config.stsMode));
+	frameAirtime(&profile->config, POLL_LENGTH, &poll);
+
+	/* Window and timeout are centred on the poll, the timeout in units of 512 / 499.2 us. */
+	lead = (poll.preamble + 999) / 1000 + PHY_RX_ENABLE_GUARD + session->window / 2;
+	dwt_setdelayedtrxtime((uint32_t)(deviceTimeAdd(session->startTime, -microsecondsToDeviceTime(lead)) >> 8));
+	dwt_setrxtimeout((lead + (poll.afterMarker + 999) / 1000 + session->window / 2) * 975 / 1000 + 1);
+
+	rxWindow = session;
+	if (dwt_rxenable(DWT_START_RX_DELAYED) != DWT_SUCCESS) {
+		LOG_WRN("Window for 0x%04X missed", session->peerAddress);
+		releaseRadio();
+	}
+}
+
+static void sessionWork(struct k_work *work) {
+	struct DSTWRSession *session = CONTAINER_OF(k_work_delayable_from_work(work), struct DSTWRSession, work);
+
+	if (!session->running) {
+		return;
+	}
+
+	if (session->scheduled) {
+		armScheduled(session);
+		return;
+	}
+
+	/* A responder's work is the dwell timeout of its hop. */
+	if (session->role == DSTWRResponder) {
+		listenHop = HOP_HOME;
+		desynchronizeResponder(session);
+
+		if (isRadioFree()) {
+			dwt_forcetrxoff();
+			releaseRadio();
+		}
+
+		return;
+	}
+
+	/* Single radio: wait until the exchange in flight or a receiver hold finishes. */
+	if (!isRadioFree()) {
+		k_work_reschedule(&session->work, K_MSEC(RADIO_BUSY_RETRY));
+		return;
+	}
+
+	/* The receiver may be listening for polls, it has to be off for the poll and a reconfiguration. */
+	dwt_forcetrxoff();
+	session->hop.current = hopFor(&session->hop, session->sequenceNumber);
+	applyConfiguration(sessionProfile(session), session->hop.current);
+	prepareInitiatorSts(session, sessionProfile(session));
+
+	initiatorPoll(session, DWT_START_TX_IMMEDIATE);
+}
+
+struct DSTWRSession *createSession(uint16_t peerAddress, enum DSTWRRole role, uint32_t interval, DSTWRResultProcessor resultProcessor) {
+	for (int i = 0; i < DSTWR_MAX_SESSIONS; i++) {
+		if (!sessions[i].used) {
+			sessions[i] = (struct DSTWRSession){
+				.used = true,
+				.role = role,
+				.peerAddress = peerAddress,
+				.interval = interval,
+				.resultProcessor = resultProcessor,
+				.templateOffset = i * TEMPLATE_SLOT_SIZE
+			};
+
+			k_work_init_delayable(&sessions[i].work, sessionWork);
+			setHopping(&sessions[i].hop, 0, 0);
+			setStsState(&sessions[i].sts, STS_DEFAULT_DWELL);
+			sessions[i].bearing.azimuth = AZIMUTH_INVALID;
+
+			return &sessions[i];
+		}
+	}
+
+	LOG_ERR("No free ranging session");
+	return NULL;
+}
+
+void destroySession(struct DSTWRSession *session) {
+	stopSession(session);
+	session->used = false;
+}
+
+void setInitiatorDone(struct DSTWRSession *session, DSTWRInitiatorDone function) {
+	session->initiatorDone = function;
+}
+
+bool startSession(struct DSTWRSession *session) {
+	if (session == NULL || !session->used) {
+		return false;
+	}
+
+	session->running = true;
+	session->state = DSTWRIdle;
+
+	writeTemplates(session);
+
+	if (session->role == DSTWRInitiator) {
+		k_work_reschedule(&session->work, K_NO_WAIT);
+	} else if (isRadioFree()) {
+		dwt_forcetrxoff();
+		dwt_rxenable(DWT_START_RX_IMMEDIATE);
+	}
+
+	return true;
+}
+
+bool startSessionAt(struct DSTWRSession *session, DeviceTime startTime, uint32_t window) {
+	uint64_t ahead = deviceTimeDiff(startTime, (DeviceTime)dwt_readsystimestamphi32() << 8);
+	uint64_t aheadUs = deviceTimeToMicroseconds(ahead);
+
+	if (session == NULL || !session->used || ahead > DEVICE_TIME_MASK / 2 || aheadUs < SCHEDULE_LEAD) {
+		return false;
+	}
+
+	session->running = true;
+	session->scheduled = true;
+	session->state = DSTWRIdle;
+	session->startTime = startTime;
+	session->window = window;
+
+	writeTemplates(session);
+
+	k_work_reschedule(&session->work, K_USEC(aheadUs - SCHEDULE_LEAD));
+
+	return true;
 }
 
-void responderRX(const dwt_cb_data_t *cb_data) {
-	struct UWBFrame firstRxFrame;
-	uint64_t txTime;
+void stopSession(struct DSTWRSession *session) {
+	session->running = false;
+	session->scheduled = false;
+	k_work_cancel_delayable(&session->work);
+	desynchronizeResponder(session);
+
+	if (radioOwner == session) {
+		dwt_forcetrxoff();
+		abortExchange();
+	} else if (rxWindow == session) {
+		dwt_forcetrxoff();
+		releaseRadio();
+	} else if (radioOwner == NULL && !hasListener()) {
+		dwt_forcetrxoff();
+	}
+
+	session->state = DSTWRIdle;
+}
+
+void setSessionProfile(struct DSTWRSession *session, const struct PhyProfile *profile) {
+	session->profile = profile;
+}
+
+void setSessionHopping(struct DSTWRSession *session, uint32_t seed, uint32_t dwell) {
+	setHopping(&session->hop, seed, dwell);
+}
+
+void setBlinkHandler(DSTWRBlinkHandler handler) {
+	blinkHandler = handler;
+
+	if (handler != NULL && isRadioFree()) {
+		dwt_forcetrxoff();
+		releaseRadio();
+	}
+}
 
-	struct UWBResponseFrame txFrame = {
-		.baseFrame = {
-			.frameControl = 0x8841,
-			.panId = 0xDECA,
-			.destinationAddress = INITIATOR_ADDRESS,
-			.sourceAddress = RESPONDER_ADDRESS,
-			.functionCode = 0x10
-		},
-		.activityCode = 0x02
+bool sendBlink(uint8_t sequenceNumber) {
+	struct UWBBlinkFrame blink = {
+		.frameControl = BLINK_FRAME_CONTROL,
+		.sequenceNumber = sequenceNumber,
+		.tagAddress = localAddress
 	};
 
-	if (dwt_getframelength() >= sizeof(firstRxFrame)) {
-		dwt_readrxdata(&firstRxFrame, sizeof(firstRxFrame), 0);
-		if (
-			firstRxFrame.frameControl == 0x8841 &&
-			firstRxFrame.panId == 0xDECA &&
-			firstRxFrame.destinationAddress == RESPONDER_ADDRESS &&
-			firstRxFrame.sourceAddress == INITIATOR_ADDRESS &&
-			firstRxFrame.functionCode == 0x21
-		) {
-			firstRxTimeStamp = 0;
-			firstRxTimeStamp |= dwt_readrxtimestamphi32();
-			firstRxTimeStamp <<= 8;
-			firstRxTimeStamp |= dwt_readrxtimestamplo32();
+	if (!isRadioFree()) {
+		return false;
+	}
 
-			txTime = (firstRxTimeStamp + (TX_DELAY * UUS_TO_DWT_TIME)) >> 8;
+	/* Tags do not hop and carry data, so blinks use the home hop and data frames of the listening profile. */
+	dwt_forcetrxoff();
+	applyConfiguration(listenProfile, HOP_HOME);
+	setStsMode(dataStsMode(listenProfile->config.stsMode));
 
-			dwt_setdelayedtrxtime(txTime);
+	dwt_writetxdata(sizeof(blink), (uint8_t *)&blink, BLINK_TEMPLATE_OFFSET);
+	selectTxFrame(sizeof(blink), BLINK_TEMPLATE_OFFSET);
 
-			txFrame.baseFrame.sequenceNumber = sequenceNumber;
+	if (dwt_starttx(DWT_START_TX_IMMEDIATE) != DWT_SUCCESS) {
+		releaseRadio();
+		return false;
+	}
+
+	blinkSequenceNumber = sequenceNumber;
+	blinkInFlight = true;
 
-			dwt_writetxdata(sizeof(txFrame), &txFrame, 0);
-			dwt_writetxfctrl(sizeof(txFrame) + FCS_LEN, 0, 1);
+	return true;
+}
 
-			dwt_setcallbacks(NULL, responderSecondRX, responderRXFault, responderRXFault, NULL, NULL, NULL);
+void setBeaconHandler(DSTWRBeaconHandler handler) {
+	beaconHandler = handler;
 
-			if (dwt_starttx(DWT_START_TX_DELAYED | DWT_RESPONSE_EXPECTED) != DWT_ERROR) {
-				return;
-			}
+	if (handler != NULL && isRadioFree()) {
+		dwt_forcetrxoff();
+		releaseRadio();
+	}
+}
+
+bool sendBeacon(uint8_t sequenceNumber) {
+	struct UWBBeaconFrame beacon = {
+		.blink = {
+			.frameControl = BLINK_FRAME_CONTROL,
+			.sequenceNumber = sequenceNumber,
+			.tagAddress = localAddress
 		}
+	};
+	DeviceTime txTimeStamp;
+
+	if (!isRadioFree()) {
+		return false;
 	}
 
-	responder();
+	dwt_forcetrxoff();
+	applyConfiguration(listenProfile, HOP_HOME);
+	setStsMode(dataStsMode(listenProfile->config.stsMode));
+
+	/* The TX time is fixed in advance, so the beacon can carry its own timestamp. */
+	dwt_setdelayedtrxtime(delayedTxTime((DeviceTime)dwt_readsystimestamphi32() << 8, BEACON_TX_DELAY, DUMMY_ANTENNA_DELAY, &txTimeStamp));
+	deviceTimeToBytes(txTimeStamp, beacon.txTimeStamp);
+
+	dwt_writetxdata(sizeof(beacon), (uint8_t *)&beacon, BLINK_TEMPLATE_OFFSET);
+	selectTxFrame(sizeof(beacon), BLINK_TEMPLATE_OFFSET);
+
+	if (dwt_starttx(DWT_START_TX_DELAYED) != DWT_SUCCESS) {
+		releaseRadio();
+		return false;
+	}
+
+	frameInFlight = true;
+
+	return true;
 }
 
-void responderRXFault(const dwt_cb_data_t *cb_data) {
-	responder();
+bool sendFrameAt(const uint8_t *frame, uint16_t length, DeviceTime txTime) {
+	if (length > DSTWR_MAX_FRAME_LENGTH || !isRadioFree()) {
+		return false;
+	}
+
+	dwt_forcetrxoff();
+	applyConfiguration(listenProfile, HOP_HOME);
+	setStsMode(dataStsMode(listenProfile->config.stsMode));
+
+	/* The chip adds the antenna delay to the programmed time, the timestamp is what the caller asked for. */
+	dwt_setdelayedtrxtime((uint32_t)(deviceTimeAdd(txTime, -DUMMY_ANTENNA_DELAY) >> 8));
+
+	dwt_writetxdata(length, (uint8_t *)frame, BLINK_TEMPLATE_OFFSET);
+	selectTxFrame(length, BLINK_TEMPLATE_OFFSET);
+
+	if (dwt_starttx(DWT_START_TX_DELAYED) != DWT_SUCCESS) {
+		releaseRadio();
+		return false;
+	}
+
+	frameInFlight = true;
+
+	return true;
 }
 
-void responderStart() {
-	dwt_writesysstatuslo(DWT_INT_RXFCG_BIT_MASK | DWT_INT_TXFRS_BIT_MASK);
-	dwt_setinterrupt(DWT_INT_RXFCG_BIT_MASK | SYS_STATUS_ALL_RX_TO | SYS_STATUS_ALL_RX_ERR, 0, DWT_ENABLE_INT_ONLY);
-	responder();
-}
\ No newline at end of file
+void setSessionStsDwell(struct DSTWRSession *session, uint32_t dwell) {
+	session->sts.dwell = dwell;
+}
+
+void setPhyProfile(const struct PhyProfile *profile) {
+	listenProfile = profile;
+	k_work_submit(&profileChange);
+}
+
+const struct PhyProfile *getListenProfile() {
+	return listenProfile;
+}
+
+uint32_t getExchangeDuration(const struct DSTWRSession *session) {
+	struct PhyTiming sessionTiming;
+
+	computeTiming(sessionProfile(session), false, &sessionTiming);
+
+	return sessionTiming.exchangeDuration;
+}
+
+/* Runs on the system workqueue like the radio callbacks, an exchange in flight switches when it releases the radio. */
+static void profileWork(struct k_work *work) {
+	if (isRadioFree()) {
+		dwt_forcetrxoff();
+		releaseRadio();
+	}
+}
+
+static int cmd_list(const struct shell *shell, size_t argc, char *argv[]) {
+	for (int i = 0; i < PHY_PROFILE_COUNT; i++) {
+		const struct PhyProfile *profile = getPhyProfile(i);
+
+		shell_print(shell, "%c %s", profile == listenProfile ? '*' : ' ', profile->name);
+	}
+
+	return 0;
+}
+
+static int cmd_set(const struct shell *shell, size_t argc, char *argv[]) {
+	const struct PhyProfile *profile = findPhyProfile(argv[1]);
+
+	if (profile == NULL) {
+		shell_error(shell, "Unknown profile %s", argv[1]);
+		return -EINVAL;
+	}
+
+	setPhyProfile(profile);
+
+	return 0;
+}
+
+static int cmd_airtime(const struct shell *shell, size_t argc, char *argv[]) {
+	for (int i = 0; i < PHY_PROFILE_COUNT; i++) {
+		const struct PhyProfile *profile = getPhyProfile(i);
+		dwt_config_t dataConfig = profile->config;
+		struct PhyTiming profileTiming;
+		struct PhyTiming profileDataTiming;
+		struct Airtime poll;
+		struct Airtime response;
+		struct Airtime final;
+
+		dataConfig.stsMode = dataStsMode(profile->config.stsMode);
+
+		frameAirtime(&profile->config, POLL_LENGTH, &poll);
+		frameAirtime(&profile->config, RESPONSE_LENGTH, &response);
+		frameAirtime(&dataConfig, FINAL_LENGTH, &final);
+		computeTiming(profile, false, &profileTiming);
+		computeTiming(profile, true, &profileDataTiming);
+
+		shell_print(shell, "%s: poll %u ns, response %u ns, final %u ns", profile->name, poll.total, response.total, final.total);
+		shell_print(
+			shell, "  reply delays %u/%u us, receiver after TX %u uus, exchange %u us",
+			profileTiming.responseDelay, profileTiming.finalDelay, profileTiming.rxAfterTx, profileTiming.exchangeDuration
+		);
+
+		if (isNoData(profile->config.stsMode)) {
+			shell_print(shell, "  resynchronizing exchange with data frames %u us", profileDataTiming.exchangeDuration);
+		}
+	}
+
+	return 0;
+}
+
+static int cmd_processing(const struct shell *shell, size_t argc, char *argv[]) {
+	shell_print(
+		shell, "%u replies, %u too late, worst processing %u us of %u us allowed",
+		replies, lateReplies, worstReplyProcessing, PHY_REPLY_PROCESSING_TIME
+	);
+
+	return 0;
+}
+
+SHELL_STATIC_SUBCMD_SET_CREATE(
+	phy_cmds,
+	SHELL_CMD_ARG(list, NULL, "List the PHY profiles, * marks the active one", cmd_list, 1, 0),
+	SHELL_CMD_ARG(set, NULL, "Switch to profile <name>", cmd_set, 2, 0),
+	SHELL_CMD_ARG(airtime, NULL, "Print frame durations and reply delays of all profiles", cmd_airtime, 1, 0),
+	SHELL_CMD_ARG(processing, NULL, "Print the worst software time of a delayed reply", cmd_processing, 1, 0),
+	SHELL_SUBCMD_SET_END
+);
+
+SHELL_CMD_REGISTER(phy, &phy_cmds, "Radio configuration profiles", NULL);
+
+static struct DSTWRSession *findSession(uint16_t peerAddress) {
+	for (int i = 0; i < DSTWR_MAX_SESSIONS; i++) {
+		if (sessions[i].used && sessions[i].peerAddress == peerAddress) {
+			return &sessions[i];
+		}
+	}
+
+	return NULL;
+}
+
+static int cmd_hop_set(const struct shell *shell, size_t argc, char *argv[]) {
+	struct DSTWRSession *session = findSession(strtol(argv[1], NULL, 0));
+
+	if (session == NULL) {
+		shell_error(shell, "No session with %s", argv[1]);
+		return -EINVAL;
+	}
+
+	setSessionHopping(session, strtoul(argv[2], NULL, 0), strtoul(argv[3], NULL, 0));
+
+	return 0;
+}
+
+static int cmd_hop_stats(const struct shell *shell, size_t argc, char *argv[]) {
+	for (int i = 0; i < DSTWR_MAX_SESSIONS; i++) {
+		const struct HopState *hop = &sessions[i].hop;
+
+		if (!sessions[i].used) {
+			continue;
+		}
+
+		shell_print(
+			shell, "0x%04x: seed 0x%08x, dwell %u ms, blacklist 0x%02x, pending 0x%02x",
+			sessions[i].peerAddress, hop->seed, hop->dwell, hop->blacklist, hop->pendingBlacklist
+		);
+
+		for (uint8_t j = 0; j < HOP_COUNT; j++) {
+			shell_print(
+				shell, "  hop %u (channel %u code %u): %u of %u failed", j,
+				hopChannel(j, 0), hopCode(j, 0), hop->failures[j], hop->attempts[j]
+			);
+		}
+	}
+
+	return 0;
+}
+
+static int cmd_hop_cost(const struct shell *shell, size_t argc, char *argv[]) {
+	shell_print(
+		shell, "Profile changes: %u, %u us average", profileChanges,
+		profileChanges == 0 ? 0 : k_cyc_to_us_floor32((uint32_t)(profileCycles / profileChanges))
+	);
+	shell_print(
+		shell, "Channel and code hops: %u, %u us average", hopChanges,
+		hopChanges == 0 ? 0 : k_cyc_to_us_floor32((uint32_t)(hopCycles / hopChanges))
+	);
+
+	return 0;
+}
+
+SHELL_STATIC_SUBCMD_SET_CREATE(
+	hop_cmds,
+	SHELL_CMD_ARG(set, NULL, "Hop with peer <address> using <seed> (0 disables) and <dwell ms>", cmd_hop_set, 4, 0),
+	SHELL_CMD_ARG(stats, NULL, "Print the per hop failure counts and blacklists", cmd_hop_stats, 1, 0),
+	SHELL_CMD_ARG(cost, NULL, "Print the time spent reconfiguring the radio", cmd_hop_cost, 1, 0),
+	SHELL_SUBCMD_SET_END
+);
+
+SHELL_CMD_REGISTER(hop, &hop_cmds, "Channel and preamble code hopping", NULL);
+
+static int cmd_sts_key(const struct shell *shell, size_t argc, char *argv[]) {
+	dwt_sts_cp_key_t key = {
+		strtoul(argv[1], NULL, 16),
+		strtoul(argv[2], NULL, 16),
+		strtoul(argv[3], NULL, 16),
+		strtoul(argv[4], NULL, 16)
+	};
+
+	setStsKey(&key);
+
+	return 0;
+}
+
+static int cmd_sts_dwell(const struct shell *shell, size_t argc, char *argv[]) {
+	struct DSTWRSession *session = findSession(strtol(argv[1], NULL, 0));
+
+	if (session == NULL) {
+		shell_error(shell, "No session with %s", argv[1]);
+		return -EINVAL;
+	}
+
+	setSessionStsDwell(session, strtoul(argv[2], NULL, 0));
+
+	return 0;
+}
+
+static void printStsCost(const struct shell *shell, const char *kind, const struct StsCost *cost) {
+	if (cost->exchanges == 0) {
+		shell_print(shell, "  %s: none", kind);
+		return;
+	}
+
+	shell_print(
+		shell, "  %s: %u exchanges, mean %u us, worst %u us",
+		kind, cost->exchanges,
+		(uint32_t)deviceTimeToMicroseconds(cost->total / cost->exchanges),
+		(uint32_t)deviceTimeToMicroseconds(cost->worst)
+	);
+}
+
+static int cmd_sts_stats(const struct shell *shell, size_t argc, char *argv[]) {
+	for (int i = 0; i < DSTWR_MAX_SESSIONS; i++) {
+		const struct StsState *sts = &sessions[i].sts;
+
+		if (!sessions[i].used) {
+			continue;
+		}
+
+		shell_print(
+			shell, "0x%04x: %s, modelled exchange %u us, %u exchanges, %u STS failures (%u%%), %u resyncs",
+			sessions[i].peerAddress, sts->synchronized ? "synchronized" : "not synchronized",
+			getExchangeDuration(&sessions[i]), sts->exchanges, sts->failures,
+			sts->exchanges == 0 ? 0 : sts->failures * 100 / sts->exchanges, sts->resyncs
+		);
+		printStsCost(shell, "SP3", &sts->sp3Cost);
+		printStsCost(shell, "resync", &sts->resyncCost);
+	}
+
+	return 0;
+}
+
+SHELL_STATIC_SUBCMD_SET_CREATE(
+	sts_cmds,
+	SHELL_CMD_ARG(key, NULL, "Set the STS key, four 32-bit hex words", cmd_sts_key, 5, 0),
+	SHELL_CMD_ARG(dwell, NULL, "Keep the IV of peer <address> known for <ms> after an exchange", cmd_sts_dwell, 3, 0),
+	SHELL_CMD_ARG(stats, NULL, "Print measured exchange durations and STS failure rates", cmd_sts_stats, 1, 0),
+	SHELL_SUBCMD_SET_END
+);
+
+SHELL_CMD_REGISTER(sts, &sts_cmds, "STS secured ranging", NULL);
@@ -4,22 +4,153 @@
 #include <stdio.h>
 #include <zephyr.h>
 
+#include "DeviceTime.h"
+#include "LinkQuality.h"
+#include "PhyProfile.h"
+#include "ChannelHopping.h"
+#include "SecureRanging.h"
+#include "AngleOfArrival.h"
+
 #define SPEED_OF_LIGHT 299702547
 
+#define DSTWR_MAX_SESSIONS 8
+
+/* Longest frame sendFrameAt takes, without the FCS. */
+#define DSTWR_MAX_FRAME_LENGTH 125
+
+/* 40-bit device times, tx1, rx2 and tx3 on the initiator clock, the rest on the responder clock. */
 struct DSTWRResult {
-	uint64_t tx1;
-	uint64_t rx1;
-	uint64_t tx2;
-	uint64_t rx2;
-	uint64_t tx3;
-	uint64_t rx3;
+	DeviceTime tx1;
+	DeviceTime rx1;
+	DeviceTime tx2;
+	DeviceTime rx2;
+	DeviceTime tx3;
+	DeviceTime rx3;
 } __attribute__((packed));
 
+enum DSTWRRole { DSTWRInitiator, DSTWRResponder };
+
+enum DSTWRState { DSTWRIdle, DSTWRWaitResponse, DSTWRWaitFinal, DSTWRSendFinal };
+
+struct DSTWRSession;
+
+typedef void (*DSTWRResultProcessor)(struct DSTWRSession *session, struct DSTWRResult result);
+typedef void (*DSTWRInitiatorDone)(struct DSTWRSession *session);
+typedef void (*DSTWRBlinkHandler)(uint16_t tagAddress, uint8_t sequenceNumber, DeviceTime timeStamp);
+typedef void (*DSTWRBeaconHandler)(uint16_t sourceAddress, uint8_t sequenceNumber, DeviceTime txTimeStamp, DeviceTime rxTimeStamp);
+
+/*
+ * All protocol state of one ranging relationship. Sessions live in a static
+ * pool, the driver callbacks are routed to them by peer address and sequence
+ * number, so an anchor can serve many tags without resetting state.
+ */
+struct DSTWRSession {
+	bool used;
+	bool running;
+	enum DSTWRRole role;
+	enum DSTWRState state;
+	uint16_t peerAddress;
+	uint32_t interval;             /* ms between exchanges of an initiator, 0 for a single exchange */
+	uint8_t sequenceNumber;
+	DeviceTime firstRxTimeStamp;
+	DeviceTime firstTxTimeStamp;   /* of the poll, initiator side */
+	struct LinkQuality quality;    /* of the last final frame received as responder */
+	struct Bearing bearing;        /* of the last final frame received as responder */
+	const struct PhyProfile *profile; /* initiators and scheduled responders, NULL uses the listening profile */
+	struct HopState hop;
+	struct StsState sts;           /* used with profiles that send an STS */
+	uint16_t templateOffset;       /* slot of the session's frames in the chip's TX buffer */
+	bool templatesWritten;         /* the slot holds this session's frames with the current local address */
+	bool scheduled;                /* waits for startTime, see startSessionAt */
+	DeviceTime startTime;
+	uint32_t window;               /* us */
+	DSTWRResultProcessor resultProcessor;
+	DSTWRInitiatorDone initiatorDone;
+	struct k_work_delayable work;
+	void *userData;
+};
+
 bool initializeUWB();
-void responderStart();
-void responder();
-void initiatorStart();
-void setResultProcessor(void (*function)(struct DSTWRResult));
-void setInitiatorDone(void (*function)());
+void setLocalAddress(uint16_t address);
+uint16_t getLocalAddress();
+
+struct DSTWRSession *createSession(uint16_t peerAddress, enum DSTWRRole role, uint32_t interval, DSTWRResultProcessor resultProcessor);
+void destroySession(struct DSTWRSession *session);
+void setInitiatorDone(struct DSTWRSession *session, DSTWRInitiatorDone function);
+bool startSession(struct DSTWRSession *session);
+void stopSession(struct DSTWRSession *session);
+
+/*
+ * Starts the first exchange at local device time startTime, the poll's TX
+ * timestamp. The initiator sends it as a delayed TX, the responder keeps its
+ * receiver off until then and listens for window us around it. Without the
+ * poll, both go on unscheduled. From the system workqueue, startTime has to
+ * be 2 ms to 8 s in the future.
+ */
+bool startSessionAt(struct DSTWRSession *session, DeviceTime startTime, uint32_t window);
+
+/*
+ * Responders listen with one profile, setPhyProfile switches it as soon as
+ * the radio is free. An initiator session may use its own profile, the chip
+ * is reconfigured before its poll and back when responders listen again.
+ */
+void setPhyProfile(const struct PhyProfile *profile);
+const struct PhyProfile *getListenProfile();
+void setSessionProfile(struct DSTWRSession *session, const struct PhyProfile *profile);
+
+/*
+ * Hops channel and preamble code per exchange with a schedule derived from
+ * seed, both peers must use the same seed. After an exchange the responder
+ * listens on the next hop for dwell ms, then returns to the home hop.
+ */
+void setSessionHopping(struct DSTWRSession *session, uint32_t seed, uint32_t dwell);
+
+/*
+ * With an SP3 profile, poll and response are SP3 frames while the STS IV is
+ * known, which it stays for dwell ms after an exchange on both peers. The
+ * dwell has to be longer than the ranging period.
+ */
+void setSessionStsDwell(struct DSTWRSession *session, uint32_t dwell);
+
+/* Radio time of one exchange of the session in us, follows from its profile. */
+uint32_t getExchangeDuration(const struct DSTWRSession *session);
+
+/*
+ * Hands the RX timestamp of every tag blink to handler, the receiver stays
+ * on whenever the radio is free. The handler runs in the radio context.
+ */
+void setBlinkHandler(DSTWRBlinkHandler handler);
+
+/*
+ * Sends a blink from the local address when the radio is free, the blink
+ * handler then gets its TX timestamp with the local address as the tag.
+ * Must be called from the system workqueue.
+ */
+bool sendBlink(uint8_t sequenceNumber);
+
+/*
+ * Sync beacons are blinks that carry their own TX timestamp, the handler gets
+ * it with the local RX timestamp. Like blinks they are received whenever the
+ * radio is free, the handler runs in the radio context.
+ */
+void setBeaconHandler(DSTWRBeaconHandler handler);
+
+/* Sends a sync beacon from the local address when the radio is free, from the system workqueue. */
+bool sendBeacon(uint8_t sequenceNumber);
+
+/*
+ * Sends frame with its TX timestamp at txTime when the radio is free, from
+ * the system workqueue. The chip ignores the lowest 9 bits of the time and
+ * fails late starts, txTime has to be some 100 us to 8 s in the future.
+ */
+bool sendFrameAt(const uint8_t *frame, uint16_t length, DeviceTime txTime);
+
+/*
+ * Keeps the receiver off between exchanges, so the chip's accumulator and
+ * diagnostic registers survive until they are read. Initiators wait as if
+ * the radio was busy. Both must be called from the system workqueue.
+ */
+void holdReceiver();
+void resumeReceiver();
 
-#endif
\ No newline at end of file
+#endif
@@ -0,0 +1,77 @@
+#include <deca_device_api.h>
+
+#include "DeviceTime.h"
+
+DeviceTime deviceTimeFromBytes(const uint8_t *bytes) {
+	DeviceTime time = 0;
+
+	for (int i = DEVICE_TIME_LENGTH - 1; i >= 0; i--) {
+		time = (time << 8) | bytes[i];
+	}
+
+	return time;
+}
+
+void deviceTimeToBytes(DeviceTime time, uint8_t *bytes) {
+	for (int i = 0; i < DEVICE_TIME_LENGTH; i++) {
+		bytes[i] = (uint8_t)time;
+		time >>= 8;
+	}
+}
+
+DeviceTime readRxTimeStamp() {
+	uint8_t timeStamp[DEVICE_TIME_LENGTH];
+
+	dwt_readrxtimestamp(timeStamp);
+
+	return deviceTimeFromBytes(timeStamp);
+}
+
+DeviceTime readTxTimeStamp() {
+	uint8_t timeStamp[DEVICE_TIME_LENGTH];
+
+	dwt_readtxtimestamp(timeStamp);
+
+	return deviceTimeFromBytes(timeStamp);
+}
+
+uint64_t deviceTimeDiff(DeviceTime later, DeviceTime earlier) {
+	return (later - earlier) & DEVICE_TIME_MASK;
+}
+
+DeviceTime deviceTimeAdd(DeviceTime time, uint64_t duration) {
+	return (time + duration) & DEVICE_TIME_MASK;
+}
+
+int64_t deviceTimeSignedDiff(DeviceTime a, DeviceTime b) {
+	uint64_t difference = (a - b) & DEVICE_TIME_MASK;
+
+	return difference >= (1ULL << 39) ? (int64_t)difference - (1LL << 40) : (int64_t)difference;
+}
+
+bool deviceTimeBefore(DeviceTime a, DeviceTime b) {
+	return deviceTimeSignedDiff(a, b) < 0;
+}
+
+/* 1e12 / 63897600000 ps per unit is exactly 78125 / 4992, a 40-bit duration times 78125 stays below 2^57. */
+uint64_t deviceTimeToPicoseconds(uint64_t duration) {
+	return duration * 78125 / 4992;
+}
+
+uint64_t deviceTimeToMicroseconds(uint64_t duration) {
+	return duration * DEVICE_TIME_PER_US_DENOMINATOR / DEVICE_TIME_PER_US_NUMERATOR;
+}
+
+uint64_t microsecondsToDeviceTime(uint64_t microseconds) {
+	return microseconds * DEVICE_TIME_PER_US_NUMERATOR / DEVICE_TIME_PER_US_DENOMINATOR;
+}
+
+uint32_t delayedTxTime(DeviceTime reference, uint32_t delay, uint16_t antennaDelay, DeviceTime *txTimeStamp) {
+	uint32_t txTime = (uint32_t)(deviceTimeAdd(reference, microsecondsToDeviceTime(delay)) >> 8);
+
+	if (txTimeStamp != NULL) {
+		*txTimeStamp = deviceTimeAdd(((DeviceTime)(txTime & 0xFFFFFFFEUL)) << 8, antennaDelay);
+	}
+
+	return txTime;
+}
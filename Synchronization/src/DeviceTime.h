@@ -0,0 +1,50 @@
+#ifndef MJ_DEVICE_TIME
+#define MJ_DEVICE_TIME
+
+#include <stdbool.h>
+#include <stdint.h>
+
+/*
+ * DW3000 device time: a 40-bit counter in units of 1 / (128 * 499.2 MHz),
+ * wrapping every ~17.2 s. Values are kept in the low 40 bits of a uint64_t
+ * and all arithmetic is modulo 2^40, so exchanges across the wrap stay valid.
+ */
+typedef uint64_t DeviceTime;
+
+#define DEVICE_TIME_LENGTH 5
+#define DEVICE_TIME_MASK 0xFFFFFFFFFFULL
+
+/* Device time units per microsecond (63897.6) as a fraction. */
+#define DEVICE_TIME_PER_US_NUMERATOR 319488
+#define DEVICE_TIME_PER_US_DENOMINATOR 5
+
+/* Both timestamps are fetched with one 5-byte SPI read. */
+DeviceTime readRxTimeStamp();
+DeviceTime readTxTimeStamp();
+
+DeviceTime deviceTimeFromBytes(const uint8_t *bytes);
+void deviceTimeToBytes(DeviceTime time, uint8_t *bytes);
+
+/* Duration from earlier to later, correct as long as it is shorter than the 17.2 s wrap. */
+uint64_t deviceTimeDiff(DeviceTime later, DeviceTime earlier);
+DeviceTime deviceTimeAdd(DeviceTime time, uint64_t duration);
+
+/*
+ * a - b in [-2^39, 2^39), for times less than half the wrap (8.6 s) apart.
+ * Exactly half the wrap apart is ambiguous, each then reads as before the other.
+ */
+int64_t deviceTimeSignedDiff(DeviceTime a, DeviceTime b);
+bool deviceTimeBefore(DeviceTime a, DeviceTime b);
+
+uint64_t deviceTimeToPicoseconds(uint64_t duration);
+uint64_t deviceTimeToMicroseconds(uint64_t duration);
+uint64_t microsecondsToDeviceTime(uint64_t microseconds);
+
+/*
+ * Value for dwt_setdelayedtrxtime() that starts a transmission delay us after
+ * reference. The chip ignores the lowest 9 bits of the start time, so the
+ * actual transmit timestamp is returned through txTimeStamp when not NULL.
+ */
+uint32_t delayedTxTime(DeviceTime reference, uint32_t delay, uint16_t antennaDelay, DeviceTime *txTimeStamp);
+
+#endif
@@ -0,0 +1,206 @@
+#include <zephyr.h>
+#include <deca_device_api.h>
+#include <shell/shell.h>
+#include <stdlib.h>
+
+#include "LinkQuality.h"
+
+/* Receiver constant A of the power formulas for the 64 MHz PRF, 121.7 dB. */
+#define PRF64_CONSTANT 12170
+
+/* Each step of the DGC decision D is 6 dB of gain. */
+#define DGC_STEP 600
+
+/* First path to RX level difference (0.01 dB) below which the link is line of sight, above the upper one NLOS. */
+#define LOS_POWER_DIFFERENCE 600
+#define NLOS_POWER_DIFFERENCE 1000
+
+/* Peak path to first path distance in 1/64 taps, 3.3 and 6.6 taps. */
+#define LOS_PATH_GAP 211
+#define NLOS_PATH_GAP 422
+
+/* 1000 * log10(2), turns a Q16 log2 into 0.01 dB of 10 * log10. */
+#define CENTIBELS_PER_OCTAVE 30103
+
+static enum DiagnosticsTier requestedTier = DiagnosticsNone;
+static enum DiagnosticsTier configuredTier = DiagnosticsNone;
+static bool configured;
+
+static uint8_t confidenceThreshold = 100;
+
+static uint32_t captureCount[DiagnosticsFull + 1];
+static uint64_t captureCycles[DiagnosticsFull + 1];
+
+void setDiagnosticsTier(enum DiagnosticsTier tier) {
+	requestedTier = tier;
+}
+
+enum DiagnosticsTier getDiagnosticsTier() {
+	return requestedTier;
+}
+
+void setConfidenceThreshold(uint8_t nlosProbability) {
+	confidenceThreshold = nlosProbability;
+}
+
+bool isConfident(const struct LinkQuality *quality) {
+	return quality->tier == DiagnosticsNone || quality->nlosProbability <= confidenceThreshold;
+}
+
+/* log2(value) in Q16, value > 0, by normalising and repeated squaring of the mantissa. */
+static int32_t log2Q16(uint64_t value) {
+	int32_t integer = 63 - __builtin_clzll(value);
+	uint64_t mantissa = integer >= 31 ? value >> (integer - 31) : value << (31 - integer);
+	int32_t result = integer << 16;
+
+	for (int bit = 15; bit >= 0; bit--) {
+		mantissa = (mantissa * mantissa) >> 31;
+
+		if (mantissa >= (2ULL << 31)) {
+			mantissa >>= 1;
+			result |= 1 << bit;
+		}
+	}
+
+	return result;
+}
+
+/* 10 * log10(value) in 0.01 dB. */
+static int32_t centibels(uint64_t value) {
+	if (value == 0) {
+		return INT16_MIN;
+	}
+
+	return (int32_t)((int64_t)log2Q16(value) * CENTIBELS_PER_OCTAVE / (100 << 16));
+}
+
+/* 0 % at or below low, 100 % at or above high, linear in between. */
+static uint8_t probability(int32_t value, int32_t low, int32_t high) {
+	return (uint8_t)(CLAMP(value - low, 0, high - low) * 100 / (high - low));
+}
+
+/*
+ * Qorvo APS006 part 3:
+ * first path power = 10 * log10((F1^2 + F2^2 + F3^2) / N^2) + 6 * D - A
+ * RX level = 10 * log10(C * 2^21 / N^2) + 6 * D - A
+ * The F registers carry two fractional bits.
+ */
+static void readPowers(struct LinkQuality *quality) {
+	dwt_nlos_alldiag_t diagnostics = { .diag_type = IPATOV };
+	uint64_t f1;
+	uint64_t f2;
+	uint64_t f3;
+	int32_t accumulation;
+	int32_t gain;
+
+	dwt_nlos_alldiag(&diagnostics);
+
+	if (diagnostics.accumCount == 0) {
+		return;
+	}
+
+	f1 = diagnostics.F1 / 4;
+	f2 = diagnostics.F2 / 4;
+	f3 = diagnostics.F3 / 4;
+
+	accumulation = 2 * centibels(diagnostics.accumCount);
+	gain = DGC_STEP * diagnostics.D - PRF64_CONSTANT;
+
+	quality->firstPathPower = CLAMP(centibels(f1 * f1 + f2 * f2 + f3 * f3) - accumulation + gain, INT16_MIN, INT16_MAX);
+	quality->rxLevel = CLAMP(centibels((uint64_t)diagnostics.cir_power << 21) - accumulation + gain, INT16_MIN, INT16_MAX);
+	quality->nlosProbability = probability(quality->rxLevel - quality->firstPathPower, LOS_POWER_DIFFERENCE, NLOS_POWER_DIFFERENCE);
+}
+
+/* A strongest path well behind the first one points to a blocked direct path, even when the power test is unsure. */
+static void readPathIndices(struct LinkQuality *quality) {
+	dwt_nlos_ipdiag_t indices;
+	dwt_rxdiag_t diagnostics;
+
+	dwt_nlos_ipdiag(&indices);
+	dwt_readdiagnostics(&diagnostics);
+
+	quality->firstPathIndex = diagnostics.ipatovFpIndex;
+	quality->nlosProbability = (quality->nlosProbability + probability(
+		(int32_t)(indices.index_pp_u32 - indices.index_fp_u32), LOS_PATH_GAP, NLOS_PATH_GAP
+	)) / 2;
+}
+
+void captureLinkQuality(struct LinkQuality *quality) {
+	enum DiagnosticsTier tier = requestedTier;
+	uint32_t start;
+
+	*quality = (struct LinkQuality){ .tier = DiagnosticsNone };
+
+	/* The logging mode applies from the next frame on, this one is read as configured before. */
+	if (!configured || tier != configuredTier) {
+		dwt_configciadiag(tier == DiagnosticsNone ? DW_CIA_DIAG_LOG_OFF : DW_CIA_DIAG_LOG_ALL);
+		configuredTier = tier;
+		configured = true;
+		return;
+	}
+
+	if (tier == DiagnosticsNone) {
+		return;
+	}
+
+	start = k_cycle_get_32();
+
+	quality->tier = tier;
+	readPowers(quality);
+
+	if (tier == DiagnosticsFull) {
+		readPathIndices(quality);
+	}
+
+	captureCycles[tier] += k_cycle_get_32() - start;
+	captureCount[tier]++;
+}
+
+void getDiagnosticsCost(enum DiagnosticsTier tier, struct DiagnosticsCost *cost) {
+	cost->captures = captureCount[tier];
+	cost->cycles = captureCount[tier] == 0 ? 0 : (uint32_t)(captureCycles[tier] / captureCount[tier]);
+}
+
+static int cmd_none(const struct shell *shell, size_t argc, char *argv[]) {
+	setDiagnosticsTier(DiagnosticsNone);
+	return 0;
+}
+
+static int cmd_light(const struct shell *shell, size_t argc, char *argv[]) {
+	setDiagnosticsTier(DiagnosticsLight);
+	return 0;
+}
+
+static int cmd_full(const struct shell *shell, size_t argc, char *argv[]) {
+	setDiagnosticsTier(DiagnosticsFull);
+	return 0;
+}
+
+static int cmd_threshold(const struct shell *shell, size_t argc, char *argv[]) {
+	setConfidenceThreshold(strtol(argv[1], NULL, 0));
+	return 0;
+}
+
+static int cmd_cost(const struct shell *shell, size_t argc, char *argv[]) {
+	static const char *const names[] = { "none", "light", "full" };
+	struct DiagnosticsCost cost;
+
+	for (int tier = DiagnosticsLight; tier <= DiagnosticsFull; tier++) {
+		getDiagnosticsCost(tier, &cost);
+		shell_print(shell, "%s: %u captures, %u cycles (%u us) each", names[tier], cost.captures, cost.cycles, k_cyc_to_us_floor32(cost.cycles));
+	}
+
+	return 0;
+}
+
+SHELL_STATIC_SUBCMD_SET_CREATE(
+	diagnostics_cmds,
+	SHELL_CMD_ARG(none, NULL, "Do not read receive diagnostics", cmd_none, 1, 0),
+	SHELL_CMD_ARG(light, NULL, "Read first path power and RX level", cmd_light, 1, 0),
+	SHELL_CMD_ARG(full, NULL, "Also read path indices and all diagnostic registers", cmd_full, 1, 0),
+	SHELL_CMD_ARG(threshold, NULL, "Drop results above <percent> NLOS probability", cmd_threshold, 2, 0),
+	SHELL_CMD_ARG(cost, NULL, "Print the measured cost of each tier", cmd_cost, 1, 0),
+	SHELL_SUBCMD_SET_END
+);
+
+SHELL_CMD_REGISTER(diagnostics, &diagnostics_cmds, "Link quality diagnostics", NULL);
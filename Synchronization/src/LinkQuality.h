@@ -0,0 +1,43 @@
+#ifndef MJ_LINK_QUALITY
+#define MJ_LINK_QUALITY
+
+#include <stdbool.h>
+#include <stdint.h>
+
+/*
+ * How much of the chip's receive diagnostics is read after each exchange.
+ * Light reads the Ipatov first path and CIR power registers, full adds the
+ * first/peak path indices and the complete dwt_rxdiag_t record.
+ */
+enum DiagnosticsTier { DiagnosticsNone, DiagnosticsLight, DiagnosticsFull };
+
+struct LinkQuality {
+	enum DiagnosticsTier tier;     /* tier the values were captured with, DiagnosticsNone leaves the rest zero */
+	int16_t firstPathPower;        /* 0.01 dBm */
+	int16_t rxLevel;               /* 0.01 dBm */
+	uint8_t nlosProbability;       /* percent */
+	uint16_t firstPathIndex;       /* CIR tap in 1/64, full tier only */
+};
+
+struct DiagnosticsCost {
+	uint32_t captures;
+	uint32_t cycles;               /* average per capture */
+};
+
+void setDiagnosticsTier(enum DiagnosticsTier tier);
+enum DiagnosticsTier getDiagnosticsTier();
+
+/* Results with a higher NLOS probability are low confidence, 100 keeps everything. */
+void setConfidenceThreshold(uint8_t nlosProbability);
+bool isConfident(const struct LinkQuality *quality);
+
+/*
+ * Reads the diagnostics of the last received frame. Must run in the radio
+ * callback context before the receiver is enabled again, the registers are
+ * overwritten by the next frame.
+ */
+void captureLinkQuality(struct LinkQuality *quality);
+
+void getDiagnosticsCost(enum DiagnosticsTier tier, struct DiagnosticsCost *cost);
+
+#endif
@@ -0,0 +1,133 @@
+#include <string.h>
+
+#include "PhyProfile.h"
+
+/* Everything is counted in chips of 1 / 499.2 MHz, one chip is exactly 128 device time units. */
+#define CHIPS_PER_PRF16_PREAMBLE_SYMBOL 496
+#define CHIPS_PER_PRF64_PREAMBLE_SYMBOL 508
+#define CHIPS_PER_850K_SYMBOL 512
+#define CHIPS_PER_6M8_SYMBOL 64
+#define CHIPS_PER_STS_SYMBOL 512
+
+/* 19 PHR bits and the 2 tail bits of the convolutional code. */
+#define PHR_SYMBOLS 21
+
+/* Reed-Solomon adds 48 parity bits to every block of up to 330 data bits. */
+#define RS_BLOCK_BITS 330
+#define RS_PARITY_BITS 48
+
+/* Preamble codes above 8 use the 64 MHz PRF. */
+#define LAST_PRF16_CODE 8
+
+static const struct PhyProfile profiles[PHY_PROFILE_COUNT] = {
+	[PhyFast] = { "fast", {
+		5, DWT_PLEN_64, DWT_PAC8, 9, 9, DWT_SFD_IEEE_4Z, DWT_BR_6M8, DWT_PHRMODE_STD, DWT_PHRRATE_DTA,
+		(65 + 8 - 8), DWT_STS_MODE_OFF, DWT_STS_LEN_64, DWT_PDOA_M0
+	} },
+	[PhyStandard] = { "standard", {
+		5, DWT_PLEN_128, DWT_PAC8, 9, 9, DWT_SFD_DW_8, DWT_BR_6M8, DWT_PHRMODE_STD, DWT_PHRRATE_STD,
+		(129 + 8 - 8), DWT_STS_MODE_OFF, DWT_STS_LEN_64, DWT_PDOA_M0
+	} },
+	[PhyRobust] = { "robust", {
+		5, DWT_PLEN_1024, DWT_PAC32, 9, 9, DWT_SFD_DW_16, DWT_BR_850K, DWT_PHRMODE_STD, DWT_PHRRATE_STD,
+		(1025 + 16 - 32), DWT_STS_MODE_OFF, DWT_STS_LEN_64, DWT_PDOA_M0
+	} },
+	[PhySecure] = { "secure", {
+		5, DWT_PLEN_64, DWT_PAC8, 9, 9, DWT_SFD_IEEE_4Z, DWT_BR_6M8, DWT_PHRMODE_STD, DWT_PHRRATE_STD,
+		(65 + 8 - 8), DWT_STS_MODE_1, DWT_STS_LEN_64, DWT_PDOA_M0
+	} },
+	[PhySecureNoData] = { "sp3", {
+		5, DWT_PLEN_64, DWT_PAC8, 9, 9, DWT_SFD_IEEE_4Z, DWT_BR_6M8, DWT_PHRMODE_STD, DWT_PHRRATE_STD,
+		(65 + 8 - 8), DWT_STS_MODE_ND, DWT_STS_LEN_64, DWT_PDOA_M0
+	} }
+};
+
+const struct PhyProfile *getPhyProfile(enum PhyProfileId id) {
+	return id < PHY_PROFILE_COUNT ? &profiles[id] : NULL;
+}
+
+const struct PhyProfile *findPhyProfile(const char *name) {
+	for (int i = 0; i < PHY_PROFILE_COUNT; i++) {
+		if (strcmp(profiles[i].name, name) == 0) {
+			return &profiles[i];
+		}
+	}
+
+	return NULL;
+}
+
+uint8_t dataStsMode(uint8_t stsMode) {
+	if ((stsMode & DWT_STS_CONFIG_MASK_NO_SDC) != DWT_STS_MODE_ND) {
+		return stsMode;
+	}
+
+	return (stsMode & ~DWT_STS_CONFIG_MASK_NO_SDC) | DWT_STS_MODE_1;
+}
+
+static uint32_t preambleSymbols(dwt_tx_plen_e length) {
+	switch (length) {
+	case DWT_PLEN_32: return 32;
+	case DWT_PLEN_64: return 64;
+	case DWT_PLEN_72: return 72;
+	case DWT_PLEN_128: return 128;
+	case DWT_PLEN_256: return 256;
+	case DWT_PLEN_512: return 512;
+	case DWT_PLEN_1024: return 1024;
+	case DWT_PLEN_1536: return 1536;
+	case DWT_PLEN_2048: return 2048;
+	default: return 4096;
+	}
+}
+
+static uint32_t chipsToNanoseconds(uint64_t chips) {
+	return (uint32_t)((chips * 10000 + 4991) / 4992);
+}
+
+void frameAirtime(const dwt_config_t *config, uint16_t length, struct Airtime *airtime) {
+	uint32_t preambleSymbol = config->txCode > LAST_PRF16_CODE ? CHIPS_PER_PRF64_PREAMBLE_SYMBOL : CHIPS_PER_PRF16_PREAMBLE_SYMBOL;
+	uint32_t dataSymbol = config->dataRate == DWT_BR_850K ? CHIPS_PER_850K_SYMBOL : CHIPS_PER_6M8_SYMBOL;
+	uint32_t phrSymbol = config->phrRate == DWT_PHRRATE_DTA ? dataSymbol : CHIPS_PER_850K_SYMBOL;
+	uint32_t sfdSymbols = config->sfdType == DWT_SFD_DW_16 ? DWT_SFD_LEN16 : DWT_SFD_LEN8;
+	uint32_t bits = length * 8;
+	uint32_t stsMode = config->stsMode & DWT_STS_MODE_ND;
+	uint64_t sts = stsMode == DWT_STS_MODE_OFF ? 0 : (uint64_t)(32 << config->stsLength) * CHIPS_PER_STS_SYMBOL;
+	uint64_t phr = (uint64_t)PHR_SYMBOLS * phrSymbol;
+	uint64_t payload = (uint64_t)(bits + RS_PARITY_BITS * ((bits + RS_BLOCK_BITS - 1) / RS_BLOCK_BITS)) * dataSymbol;
+
+	/* SP3 frames carry no PHR and no payload. */
+	if (stsMode == DWT_STS_MODE_ND || config->dataRate == DWT_BR_NODATA) {
+		phr = 0;
+		payload = 0;
+	}
+
+	airtime->preamble = chipsToNanoseconds((uint64_t)(preambleSymbols(config->txPreambLength) + sfdSymbols) * preambleSymbol);
+	airtime->sts = chipsToNanoseconds(sts);
+	airtime->phr = chipsToNanoseconds(phr);
+	airtime->payload = chipsToNanoseconds(payload);
+	airtime->afterMarker = chipsToNanoseconds(sts + phr + payload);
+	airtime->total = airtime->preamble + airtime->afterMarker;
+}
+
+uint32_t minimumReplyDelay(const dwt_config_t *config, uint16_t rxLength, uint16_t txLength) {
+	struct Airtime rx;
+	struct Airtime tx;
+
+	frameAirtime(config, rxLength, &rx);
+	frameAirtime(config, txLength, &tx);
+
+	return (rx.afterMarker + tx.preamble + 999) / 1000 + PHY_REPLY_PROCESSING_TIME;
+}
+
+uint32_t rxAfterTxDelay(const dwt_config_t *config, uint16_t txLength, uint32_t replyDelay, uint16_t rxLength) {
+	struct Airtime rx;
+	struct Airtime tx;
+	uint32_t busy;
+
+	frameAirtime(config, txLength, &tx);
+	frameAirtime(config, rxLength, &rx);
+
+	busy = (tx.afterMarker + rx.preamble + 999) / 1000 + PHY_RX_ENABLE_GUARD;
+
+	/* 1 UWB microsecond is 512 / 499.2 us, so us * 39 / 40. */
+	return replyDelay > busy ? (replyDelay - busy) * 39 / 40 : 0;
+}
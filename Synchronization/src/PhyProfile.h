@@ -0,0 +1,73 @@
+#ifndef MJ_PHY_PROFILE
+#define MJ_PHY_PROFILE
+
+#include <stdint.h>
+#include <deca_device_api.h>
+
+/*
+ * Named radio configurations. Reply delays and receiver timing are derived
+ * from the configuration by the airtime calculator, nothing is tuned per
+ * profile by hand.
+ */
+enum PhyProfileId {
+	PhyFast,                       /* short range, 64 symbol preamble, PHR at 6.8 Mbps */
+	PhyStandard,                   /* the original configuration, 128 symbols at 6.8 Mbps */
+	PhyRobust,                     /* long range, 1024 symbols at 850 kbps */
+	PhySecure,                     /* STS after the SFD for secure timestamps */
+	PhySecureNoData,               /* SP3, poll and response are only preamble and STS, the final is SP1 */
+	PHY_PROFILE_COUNT
+};
+
+struct PhyProfile {
+	const char *name;
+	dwt_config_t config;
+};
+
+/*
+ * Software time of a reply, from the end of the received frame to
+ * dwt_starttx. An estimate, not a measurement: the 3400 us reply delay that
+ * was tuned by hand on the nRF52833 for the standard profile, less that
+ * profile's airtime, so its margin is whatever the tuning left. 'phy
+ * processing' prints the worst time seen and the replies that came too
+ * late. Set it to the worst time plus a margin of at least 25 % before
+ * shortening it.
+ */
+#define PHY_REPLY_PROCESSING_TIME 3200
+
+/* Time the receiver is enabled before the expected preamble, covers the RX start up and clock tolerance. */
+#define PHY_RX_ENABLE_GUARD 50
+
+/* Durations in ns, split at the RMARKER, the point the chip timestamps. */
+struct Airtime {
+	uint32_t preamble;             /* preamble and SFD, everything before the RMARKER */
+	uint32_t sts;
+	uint32_t phr;
+	uint32_t payload;
+	uint32_t afterMarker;          /* STS, PHR and payload */
+	uint32_t total;
+};
+
+const struct PhyProfile *getPhyProfile(enum PhyProfileId id);
+const struct PhyProfile *findPhyProfile(const char *name);
+
+/* STS mode of frames that carry data, SP3 profiles send them as SP1. */
+uint8_t dataStsMode(uint8_t stsMode);
+
+/* Airtime of a frame of length bytes including the FCS. */
+void frameAirtime(const dwt_config_t *config, uint16_t length, struct Airtime *airtime);
+
+/*
+ * Shortest delay in us from the RX timestamp of a frame of rxLength bytes to
+ * the TX timestamp of a reply of txLength bytes: the rest of the received
+ * frame, the processing time and the preamble of the reply.
+ */
+uint32_t minimumReplyDelay(const dwt_config_t *config, uint16_t rxLength, uint16_t txLength);
+
+/*
+ * Value for dwt_setrxaftertxdelay() (UWB microseconds of 512 / 499.2 us)
+ * after sending txLength bytes to a peer that replies with rxLength bytes
+ * replyDelay us after the RX timestamp of our frame.
+ */
+uint32_t rxAfterTxDelay(const dwt_config_t *config, uint16_t txLength, uint32_t replyDelay, uint16_t rxLength);
+
+#endif
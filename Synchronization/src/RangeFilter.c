@@ -0,0 +1,195 @@
+#include <zephyr.h>
+#include <shell/shell.h>
+#include <stdlib.h>
+
+#include "RangeFilter.h"
+
+/*
+ * The Kalman state is kept in Q8 fixed point, the covariance in whole units,
+ * the position gain in Q16 and the velocity gain in Q24, which the velocity
+ * variance is updated with as the small difference of two large terms.
+ */
+#define FRACTION_BITS 8
+#define ONE (1LL << FRACTION_BITS)
+#define GAIN_BITS 16
+#define VELOCITY_GAIN_BITS 24
+
+/* Measurement noise (mm^2) and acceleration noise (mm^2/s^4) of a walking or driving peer. */
+#define MEASUREMENT_VARIANCE (50LL * 50LL)
+#define ACCELERATION_VARIANCE (2000LL * 2000LL)
+
+/* Innovations are clamped to 1 km, far beyond anything the median lets through. */
+#define INNOVATION_LIMIT ((1LL << 20) * ONE)
+
+/* Gaps longer than this (ms) restart the peer's filter instead of predicting across them. */
+#define RESET_GAP 5000
+
+/*
+ * Velocity variance cap, (100 m/s)^2. With it and dt <= RESET_GAP the
+ * covariance stays below 2.6e11 mm^2, 5e10 mm^2/s and 1e10 mm^2/s^2, and
+ * the velocity gain below 1000 / s (p01^2 <= p00 * p11). The largest
+ * products are then the velocity gain in Q24 times a clamped innovation,
+ * 4.5e18, and p01 in Q24, 8.4e17, below 2^63 = 9.2e18. p01 times the
+ * velocity gain is at most p11 in Q24.
+ */
+#define VELOCITY_VARIANCE_LIMIT 10000000000LL
+
+struct PeerFilter {
+	bool used;
+	uint16_t peerAddress;
+	uint32_t lastTime;
+	uint32_t samples;
+	uint8_t medianCount;
+	uint8_t medianIndex;
+	int32_t window[RANGE_FILTER_MEDIAN_WINDOW];
+	int64_t position;              /* mm, Q8 */
+	int64_t velocity;              /* mm/s, Q8 */
+	int64_t p00;                   /* mm^2 */
+	int64_t p01;                   /* mm^2/s */
+	int64_t p11;                   /* mm^2/s^2 */
+};
+
+static struct PeerFilter filters[RANGE_FILTER_MAX_PEERS];
+static uint16_t filterDecimation = 1;
+
+void setFilterDecimation(uint16_t decimation) {
+	filterDecimation = decimation == 0 ? 1 : decimation;
+}
+
+void resetRangeFilters() {
+	memset(filters, 0, sizeof(filters));
+}
+
+/* Finds the peer's filter, taking over the least recently updated one when the table is full. */
+static struct PeerFilter *findFilter(uint16_t peerAddress, uint32_t time) {
+	struct PeerFilter *oldest = &filters[0];
+
+	for (int i = 0; i < RANGE_FILTER_MAX_PEERS; i++) {
+		if (filters[i].used && filters[i].peerAddress == peerAddress) {
+			return &filters[i];
+		}
+	}
+
+	for (int i = 0; i < RANGE_FILTER_MAX_PEERS; i++) {
+		if (!filters[i].used) {
+			oldest = &filters[i];
+			break;
+		}
+
+		if ((int32_t)(filters[i].lastTime - oldest->lastTime) < 0) {
+			oldest = &filters[i];
+		}
+	}
+
+	*oldest = (struct PeerFilter){ .used = true, .peerAddress = peerAddress, .lastTime = time };
+
+	return oldest;
+}
+
+static int32_t median(struct PeerFilter *filter, int32_t distance) {
+	int32_t sorted[RANGE_FILTER_MEDIAN_WINDOW];
+
+	filter->window[filter->medianIndex] = distance;
+	filter->medianIndex = (filter->medianIndex + 1) % RANGE_FILTER_MEDIAN_WINDOW;
+	if (filter->medianCount < RANGE_FILTER_MEDIAN_WINDOW) {
+		filter->medianCount++;
+	}
+
+	for (int i = 0; i < filter->medianCount; i++) {
+		int j = i;
+
+		for (; j > 0 && sorted[j - 1] > filter->window[i]; j--) {
+			sorted[j] = sorted[j - 1];
+		}
+		sorted[j] = filter->window[i];
+	}
+
+	return sorted[filter->medianCount / 2];
+}
+
+static void initializeKalman(struct PeerFilter *filter, int32_t distance) {
+	filter->position = (int64_t)distance * ONE;
+	filter->velocity = 0;
+	filter->p00 = MEASUREMENT_VARIANCE;
+	filter->p01 = 0;
+	filter->p11 = 1000LL * 1000LL;
+}
+
+/* Constant velocity prediction over dt ms with white acceleration noise, dt is capped at RESET_GAP for the bounds above. */
+static void predict(struct PeerFilter *filter, int64_t dt) {
+	int64_t noise;
+
+	dt = MIN(dt, RESET_GAP);
+
+	/* Q = noise * [dt^4 / 4, dt^3 / 2; dt^3 / 2, dt^2] with dt in s, noise * dt^2 in mm^2 / 1000 first. */
+	noise = ACCELERATION_VARIANCE * dt * dt / 1000;
+
+	filter->position += filter->velocity * dt / 1000;
+
+	filter->p00 += 2 * filter->p01 * dt / 1000 + filter->p11 * dt * dt / 1000000 + noise * dt / 1000 * dt / 4000000;
+	filter->p01 += filter->p11 * dt / 1000 + noise * dt / 2000000;
+	filter->p11 = MIN(filter->p11 + noise / 1000, VELOCITY_VARIANCE_LIMIT);
+}
+
+static void update(struct PeerFilter *filter, int32_t distance) {
+	int64_t innovation = CLAMP((int64_t)distance * ONE - filter->position, -INNOVATION_LIMIT, INNOVATION_LIMIT);
+	int64_t variance = filter->p00 + MEASUREMENT_VARIANCE;
+	int64_t positionGain = (filter->p00 << GAIN_BITS) / variance;
+	int64_t velocityGain = (filter->p01 << VELOCITY_GAIN_BITS) / variance;
+
+	filter->position += positionGain * innovation >> GAIN_BITS;
+	filter->velocity += velocityGain * innovation >> VELOCITY_GAIN_BITS;
+
+	filter->p11 = MAX(filter->p11 - (filter->p01 * velocityGain >> VELOCITY_GAIN_BITS), 0);
+	filter->p00 = filter->p00 * MEASUREMENT_VARIANCE / variance;
+	filter->p01 = filter->p01 * MEASUREMENT_VARIANCE / variance;
+}
+
+bool filterRange(uint16_t peerAddress, int32_t distance, uint32_t time, struct FilteredRange *output) {
+	struct PeerFilter *filter = findFilter(peerAddress, time);
+	uint32_t dt = time - filter->lastTime;
+	int32_t measurement;
+
+	if (filter->samples == 0 || dt > RESET_GAP) {
+		filter->medianCount = 0;
+		filter->medianIndex = 0;
+		measurement = median(filter, distance);
+		initializeKalman(filter, measurement);
+	} else {
+		measurement = median(filter, distance);
+		predict(filter, dt);
+		update(filter, measurement);
+	}
+
+	filter->lastTime = time;
+	filter->samples++;
+
+	if (filter->samples % filterDecimation != 0) {
+		return false;
+	}
+
+	output->distance = (int32_t)(filter->position / ONE);
+	output->velocity = (int32_t)(filter->velocity / ONE);
+	output->samples = filterDecimation;
+
+	return true;
+}
+
+static int cmd_decimation(const struct shell *shell, size_t argc, char *argv[]) {
+	setFilterDecimation(strtol(argv[1], NULL, 0));
+	return 0;
+}
+
+static int cmd_reset(const struct shell *shell, size_t argc, char *argv[]) {
+	resetRangeFilters();
+	return 0;
+}
+
+SHELL_STATIC_SUBCMD_SET_CREATE(
+	filter_cmds,
+	SHELL_CMD_ARG(decimation, NULL, "Output one filtered value per <n> raw ranges", cmd_decimation, 2, 0),
+	SHELL_CMD_ARG(reset, NULL, "Forget the state of all peers", cmd_reset, 1, 0),
+	SHELL_SUBCMD_SET_END
+);
+
+SHELL_CMD_REGISTER(filter, &filter_cmds, "Range filter commands", NULL);
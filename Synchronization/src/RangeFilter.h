@@ -0,0 +1,27 @@
+#ifndef MJ_RANGE_FILTER
+#define MJ_RANGE_FILTER
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#define RANGE_FILTER_MAX_PEERS 8
+#define RANGE_FILTER_MEDIAN_WINDOW 5
+
+struct FilteredRange {
+	int32_t distance;              /* mm */
+	int32_t velocity;              /* mm/s */
+	uint32_t samples;              /* raw samples folded into this output */
+};
+
+/*
+ * Per-peer filter stage between the ranging engine and the output: a sliding
+ * median rejects outliers, a fixed point constant velocity Kalman filter
+ * smooths the result. Returns true when a filtered value is due, i.e. on
+ * every decimation-th raw sample of that peer.
+ */
+bool filterRange(uint16_t peerAddress, int32_t distance, uint32_t time, struct FilteredRange *output);
+
+void setFilterDecimation(uint16_t decimation);
+void resetRangeFilters();
+
+#endif
@@ -0,0 +1,82 @@
+#include <logging/log.h>
+#include <shell/shell.h>
+
+#include "ResultPipeline.h"
+
+#define RESULT_THREAD_STACK_SIZE 2048
+#define RESULT_THREAD_PRIORITY K_LOWEST_APPLICATION_THREAD_PRIO
+
+LOG_MODULE_REGISTER(ResultPipeline);
+
+K_MSGQ_DEFINE(resultQueue, sizeof(struct RangingRecord), RESULT_QUEUE_LENGTH, 4);
+
+static RangingRecordConsumer recordConsumer;
+
+static uint32_t posted;
+static uint32_t processed;
+static uint32_t dropped;
+static uint32_t maxDepth;
+
+void setRecordConsumer(RangingRecordConsumer consumer) {
+	recordConsumer = consumer;
+}
+
+void postResult(struct DSTWRSession *session, struct DSTWRResult result) {
+	struct RangingRecord record = {
+		.peerAddress = session->peerAddress,
+		.sequenceNumber = session->sequenceNumber,
+		.result = result,
+		.quality = session->quality,
+		.bearing = session->bearing
+	};
+	uint32_t depth;
+
+	if (k_msgq_put(&resultQueue, &record, K_NO_WAIT) != 0) {
+		dropped++;
+		return;
+	}
+
+	posted++;
+
+	depth = k_msgq_num_used_get(&resultQueue);
+	if (depth > maxDepth) {
+		maxDepth = depth;
+	}
+}
+
+void getPipelineStatistics(struct PipelineStatistics *statistics) {
+	statistics->posted = posted;
+	statistics->processed = processed;
+	statistics->dropped = dropped;
+	statistics->depth = k_msgq_num_used_get(&resultQueue);
+	statistics->maxDepth = maxDepth;
+}
+
+static void resultThread(void *p1, void *p2, void *p3) {
+	struct RangingRecord record;
+
+	while (true) {
+		k_msgq_get(&resultQueue, &record, K_FOREVER);
+
+		if (recordConsumer != NULL) {
+			recordConsumer(&record);
+		}
+
+		processed++;
+	}
+}
+
+K_THREAD_DEFINE(resultThreadId, RESULT_THREAD_STACK_SIZE, resultThread, NULL, NULL, NULL, RESULT_THREAD_PRIORITY, 0, 0);
+
+static int cmd_pipeline(const struct shell *shell, size_t argc, char *argv[]) {
+	struct PipelineStatistics statistics;
+
+	getPipelineStatistics(&statistics);
+
+	shell_print(shell, "Queue depth: %u/%u (max %u)", statistics.depth, RESULT_QUEUE_LENGTH, statistics.maxDepth);
+	shell_print(shell, "Posted: %u processed: %u dropped: %u", statistics.posted, statistics.processed, statistics.dropped);
+
+	return 0;
+}
+
+SHELL_CMD_ARG_REGISTER(pipeline, NULL, "Print result pipeline statistics", cmd_pipeline, 1, 0);
@@ -0,0 +1,35 @@
+#ifndef MJ_RESULT_PIPELINE
+#define MJ_RESULT_PIPELINE
+
+#include "DSTWR.h"
+
+#define RESULT_QUEUE_LENGTH 16
+
+struct RangingRecord {
+	uint16_t peerAddress;
+	uint8_t sequenceNumber;
+	struct DSTWRResult result;
+	struct LinkQuality quality;
+	struct Bearing bearing;
+};
+
+typedef void (*RangingRecordConsumer)(const struct RangingRecord *record);
+
+struct PipelineStatistics {
+	uint32_t posted;
+	uint32_t processed;
+	uint32_t dropped;
+	uint32_t depth;
+	uint32_t maxDepth;
+};
+
+/*
+ * Moves ranging results out of the radio callback context. postResult only
+ * copies the result into a message queue, a low priority thread hands it to
+ * the consumer, so the radio is listening again before any math or output.
+ */
+void setRecordConsumer(RangingRecordConsumer consumer);
+void postResult(struct DSTWRSession *session, struct DSTWRResult result);
+void getPipelineStatistics(struct PipelineStatistics *statistics);
+
+#endif
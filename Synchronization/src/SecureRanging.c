@@ -0,0 +1,55 @@
+#include <zephyr.h>
+
+#include "SecureRanging.h"
+
+/* The initiator gives up its synchronization a bit before the responder, so both agree at the dwell boundary. */
+#define STS_DWELL_MARGIN 5
+
+/* Reset value of the chip's key, used until setStsKey. */
+static dwt_sts_cp_key_t stsKey = { 0xC9A375FA, 0x8DF43A20, 0xB5E5A4ED, 0x0738123B };
+static bool keyChanged = true;
+
+void setStsState(struct StsState *state, uint32_t dwell) {
+	*state = (struct StsState){ .dwell = dwell };
+}
+
+void recordStsCost(struct StsState *state, bool resync, uint64_t duration) {
+	struct StsCost *cost = resync ? &state->resyncCost : &state->sp3Cost;
+
+	cost->exchanges++;
+	cost->total += duration;
+	cost->worst = MAX(cost->worst, duration);
+}
+
+bool isStsSynchronized(const struct StsState *state) {
+	return state->synchronized && k_uptime_get_32() - state->lastExchange + STS_DWELL_MARGIN < state->dwell;
+}
+
+void setStsKey(const dwt_sts_cp_key_t *key) {
+	stsKey = *key;
+	keyChanged = true;
+}
+
+void loadStsIv(const struct StsState *state, uint16_t initiatorAddress, uint16_t responderAddress) {
+	dwt_sts_cp_iv_t iv = {
+		.iv0 = 0,
+		.iv1 = state->exchange,
+		.iv2 = (uint32_t)initiatorAddress << 16 | responderAddress,
+		.iv3 = 0
+	};
+
+	if (keyChanged) {
+		dwt_configurestskey(&stsKey);
+		keyChanged = false;
+	}
+
+	dwt_configurestsiv(&iv);
+	dwt_configurestsloadiv();
+}
+
+bool isStsGood() {
+	int16_t quality;
+	uint16_t status;
+
+	return dwt_readstsquality(&quality) >= 0 && dwt_readstsstatus(&status, 0) >= 0;
+}
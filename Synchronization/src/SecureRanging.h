@@ -0,0 +1,60 @@
+#ifndef MJ_SECURE_RANGING
+#define MJ_SECURE_RANGING
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <deca_device_api.h>
+
+#include "DeviceTime.h"
+
+/*
+ * Measured length of completed exchanges, from the poll to the final in
+ * device time: TX to TX on the initiator, RX to RX on the responder.
+ */
+struct StsCost {
+	uint32_t exchanges;
+	uint64_t total;
+	uint64_t worst;
+};
+
+/*
+ * STS state of one session. The 128-bit IV is the peer addresses and an
+ * exchange number that never repeats, its low word is the counter the chip
+ * increments by itself from frame to frame within the exchange. The final
+ * frame carries the next exchange number, a responder that missed it is out
+ * of sync and the next exchange sends data frames again (a resync) to
+ * establish a new one.
+ */
+struct StsState {
+	uint32_t dwell;                /* ms both peers stay synchronized after an exchange, longer than the ranging period */
+	uint32_t exchange;             /* exchange number of the IV of the next (initiator) or current (responder) exchange */
+	uint32_t lastExchange;         /* uptime in ms of the last completed exchange */
+	bool synchronized;
+	bool validated;                /* every STS of the exchange in flight passed so far */
+	uint32_t exchanges;
+	uint32_t failures;             /* STS received with bad quality or status */
+	uint32_t resyncs;              /* exchanges without a known IV, they give no result */
+	struct StsCost sp3Cost;        /* exchanges with a known IV, SP3 poll and response */
+	struct StsCost resyncCost;     /* resyncs, every frame with data */
+};
+
+#define STS_DEFAULT_DWELL 1000
+
+void setStsState(struct StsState *state, uint32_t dwell);
+
+/* Initiator side, the responder gives up its synchronization after dwell ms. */
+bool isStsSynchronized(const struct StsState *state);
+
+/* Key shared by all peers, applied with the next IV. */
+void setStsKey(const dwt_sts_cp_key_t *key);
+
+/* Loads the IV of the current exchange, radio context only. */
+void loadStsIv(const struct StsState *state, uint16_t initiatorAddress, uint16_t responderAddress);
+
+/* Adds one completed exchange of duration device time units to the cost of its kind. */
+void recordStsCost(struct StsState *state, bool resync, uint64_t duration);
+
+/* Quality and status of the STS of the last received frame. */
+bool isStsGood();
+
+#endif
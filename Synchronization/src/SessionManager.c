@@ -0,0 +1,282 @@
+#include <logging/log.h>
+#include <shell/shell.h>
+#include <stdlib.h>
+
+#include "SessionManager.h"
+
+/* An exchange that has not finished after this many ms is given up. */
+#define EXCHANGE_TIME_OUT 20
+
+LOG_MODULE_REGISTER(SessionManager);
+
+static struct ManagedPeer peers[MANAGER_MAX_PEERS];
+
+static struct ManagedPeer *activePeer;
+static bool managerRunning;
+
+static void schedule(struct k_work *work);
+static void exchangeTimeOut(struct k_work *work);
+
+static K_WORK_DELAYABLE_DEFINE(scheduleWork, schedule);
+static K_WORK_DELAYABLE_DEFINE(timeOutWork, exchangeTimeOut);
+
+/* Exchanges last a few ms, they are timed on the cycle counter rather than the 1 ms uptime. */
+static uint32_t exchangeStart;
+static uint64_t busyCycles;
+static int64_t statisticsStart;
+
+static uint32_t effectivePeriod(const struct ManagedPeer *peer) {
+	return peer->period * peer->degradation;
+}
+
+uint32_t plannedUtilisation() {
+	uint64_t airtime = 0;
+
+	/* us of airtime per s summed over the peers, so short shares are not truncated away one by one. */
+	for (int i = 0; i < MANAGER_MAX_PEERS; i++) {
+		if (peers[i].used) {
+			airtime += (uint64_t)getExchangeDuration(peers[i].session) * 1000 / effectivePeriod(&peers[i]);
+		}
+	}
+
+	return (uint32_t)(airtime / 1000);
+}
+
+/* Stretches the periods of the least important peers until the plan fits the radio. */
+static void rebalance() {
+	struct ManagedPeer *victim;
+
+	for (int i = 0; i < MANAGER_MAX_PEERS; i++) {
+		peers[i].degradation = 1;
+	}
+
+	while (plannedUtilisation() > MANAGER_UTILISATION_LIMIT) {
+		victim = NULL;
+
+		for (int i = 0; i < MANAGER_MAX_PEERS; i++) {
+			if (!peers[i].used || peers[i].degradation >= MANAGER_MAX_DEGRADATION) {
+				continue;
+			}
+
+			if (
+				victim == NULL ||
+				peers[i].priority < victim->priority ||
+				(peers[i].priority == victim->priority && effectivePeriod(&peers[i]) < effectivePeriod(victim))
+			) {
+				victim = &peers[i];
+			}
+		}
+
+		if (victim == NULL) {
+			LOG_WRN("Ranging plan overloaded: %u permille", plannedUtilisation());
+			return;
+		}
+
+		victim->degradation *= 2;
+		LOG_INF("Degrading peer 0x%04X to %u ms", victim->address, effectivePeriod(victim));
+	}
+}
+
+static void endExchange() {
+	busyCycles += k_cycle_get_32() - exchangeStart;
+	activePeer = NULL;
+	k_work_cancel_delayable(&timeOutWork);
+	k_work_reschedule(&scheduleWork, K_NO_WAIT);
+}
+
+static void exchangeDone(struct DSTWRSession *session) {
+	struct ManagedPeer *peer = session->userData;
+
+	if (peer != activePeer) {
+		return;
+	}
+
+	peer->completed++;
+	peer->release += effectivePeriod(peer);
+	peer->deadline = peer->release + effectivePeriod(peer);
+
+	endExchange();
+}
+
+static void exchangeTimeOut(struct k_work *work) {
+	if (activePeer == NULL) {
+		return;
+	}
+
+	stopSession(activePeer->session);
+	activePeer->failed++;
+
+	endExchange();
+}
+
+static void schedule(struct k_work *work) {
+	struct ManagedPeer *next = NULL;
+	int64_t now = k_uptime_get();
+	int64_t wakeUp = INT64_MAX;
+
+	if (!managerRunning || activePeer != NULL) {
+		return;
+	}
+
+	for (int i = 0; i < MANAGER_MAX_PEERS; i++) {
+		struct ManagedPeer *peer = &peers[i];
+
+		if (!peer->used) {
+			continue;
+		}
+
+		/* Jobs not served within their period are counted and skipped. */
+		while (peer->deadline <= now) {
+			peer->missed++;
+			peer->release = peer->deadline;
+			peer->deadline += effectivePeriod(peer);
+		}
+
+		if (peer->release > now) {
+			wakeUp = MIN(wakeUp, peer->release);
+			continue;
+		}
+
+		if (
+			next == NULL ||
+			peer->deadline < next->deadline ||
+			(peer->deadline == next->deadline && peer->priority > next->priority)
+		) {
+			next = peer;
+		}
+	}
+
+	if (next == NULL) {
+		if (wakeUp != INT64_MAX) {
+			k_work_reschedule(&scheduleWork, K_MSEC(wakeUp - now));
+		}
+		return;
+	}
+
+	activePeer = next;
+	exchangeStart = k_cycle_get_32();
+	k_work_reschedule(&timeOutWork, K_MSEC(EXCHANGE_TIME_OUT));
+
+	if (!startSession(next->session)) {
+		exchangeTimeOut(NULL);
+	}
+}
+
+struct ManagedPeer *addManagedPeer(uint16_t address, uint32_t period, uint8_t priority) {
+	if (period == 0) {
+		return NULL;
+	}
+
+	for (int i = 0; i < MANAGER_MAX_PEERS; i++) {
+		if (!peers[i].used) {
+			struct DSTWRSession *session = createSession(address, DSTWRInitiator, 0, NULL);
+
+			if (session == NULL) {
+				return NULL;
+			}
+
+			peers[i] = (struct ManagedPeer){
+				.used = true,
+				.address = address,
+				.priority = priority,
+				.period = period,
+				.degradation = 1,
+				.release = k_uptime_get(),
+				.session = session
+			};
+
+			session->userData = &peers[i];
+			setInitiatorDone(session, exchangeDone);
+
+			rebalance();
+
+			peers[i].deadline = peers[i].release + effectivePeriod(&peers[i]);
+
+			k_work_reschedule(&scheduleWork, K_NO_WAIT);
+
+			return &peers[i];
+		}
+	}
+
+	LOG_ERR("No free managed peer");
+	return NULL;
+}
+
+void removeManagedPeer(struct ManagedPeer *peer) {
+	if (peer == activePeer) {
+		exchangeTimeOut(NULL);
+	}
+
+	destroySession(peer->session);
+	peer->used = false;
+
+	rebalance();
+}
+
+void startManager() {
+	managerRunning = true;
+	statisticsStart = k_uptime_get();
+	busyCycles = 0;
+
+	k_work_reschedule(&scheduleWork, K_NO_WAIT);
+}
+
+void stopManager() {
+	managerRunning = false;
+	k_work_cancel_delayable(&scheduleWork);
+
+	if (activePeer != NULL) {
+		stopSession(activePeer->session);
+		activePeer = NULL;
+		k_work_cancel_delayable(&timeOutWork);
+	}
+}
+
+static int cmd_stats(const struct shell *shell, size_t argc, char *argv[]) {
+	int64_t elapsed = k_uptime_get() - statisticsStart;
+
+	shell_print(shell, "peer    prio period(ms) done failed missed");
+
+	for (int i = 0; i < MANAGER_MAX_PEERS; i++) {
+		if (peers[i].used) {
+			shell_print(shell, "0x%04X %4u %10u %4u %6u %6u", peers[i].address, peers[i].priority, effectivePeriod(&peers[i]), peers[i].completed, peers[i].failed, peers[i].missed);
+		}
+	}
+
+	shell_print(shell, "Planned utilisation: %u permille", plannedUtilisation());
+	shell_print(shell, "Measured utilisation: %u permille", elapsed > 0 ? (uint32_t)(k_cyc_to_us_floor64(busyCycles) / elapsed) : 0);
+
+	return 0;
+}
+
+static int cmd_reset(const struct shell *shell, size_t argc, char *argv[]) {
+	for (int i = 0; i < MANAGER_MAX_PEERS; i++) {
+		peers[i].completed = 0;
+		peers[i].failed = 0;
+		peers[i].missed = 0;
+	}
+
+	statisticsStart = k_uptime_get();
+	busyCycles = 0;
+
+	return 0;
+}
+
+static int cmd_add(const struct shell *shell, size_t argc, char *argv[]) {
+	if (addManagedPeer(strtol(argv[1], NULL, 0), strtol(argv[2], NULL, 0), strtol(argv[3], NULL, 0)) == NULL) {
+		shell_error(shell, "No free peer slot");
+		return -ENOMEM;
+	}
+
+	return 0;
+}
+
+SHELL_STATIC_SUBCMD_SET_CREATE(
+	ranging_cmds,
+	SHELL_CMD_ARG(stats, NULL, "Print deadline and utilisation statistics", cmd_stats, 1, 0),
+	SHELL_CMD_ARG(reset, NULL, "Clear the statistics", cmd_reset, 1, 0),
+	SHELL_CMD_ARG(add, NULL, "Range with a peer <address> <period ms> <priority>", cmd_add, 4, 0),
+	SHELL_SUBCMD_SET_END
+);
+
+SHELL_CMD_REGISTER(ranging, &ranging_cmds, "Ranging session manager commands", NULL);
@@ -0,0 +1,41 @@
+#ifndef MJ_SESSION_MANAGER
+#define MJ_SESSION_MANAGER
+
+#include "DSTWR.h"
+
+#define MANAGER_MAX_PEERS DSTWR_MAX_SESSIONS
+
+/* Share of radio time the scheduler may plan, in per mille. */
+#define MANAGER_UTILISATION_LIMIT 900
+
+/* Highest power of two an overloaded peer's period may be stretched by. */
+#define MANAGER_MAX_DEGRADATION 16
+
+struct ManagedPeer {
+	bool used;
+	uint16_t address;
+	uint8_t priority;              /* higher is more important */
+	uint32_t period;               /* requested ms between exchanges */
+	uint32_t degradation;          /* period multiplier applied under overload */
+	int64_t release;
+	int64_t deadline;
+	uint32_t completed;
+	uint32_t failed;
+	uint32_t missed;
+	struct DSTWRSession *session;
+};
+
+/*
+ * Plans initiator exchanges of all managed peers with earliest-deadline-first
+ * on the single radio. Each peer is a periodic job whose deadline is the end
+ * of its (possibly degraded) period.
+ */
+struct ManagedPeer *addManagedPeer(uint16_t address, uint32_t period, uint8_t priority);
+void removeManagedPeer(struct ManagedPeer *peer);
+void startManager();
+void stopManager();
+
+/* Planned radio utilisation in per mille, after degradation. */
+uint32_t plannedUtilisation();
+
+#endif
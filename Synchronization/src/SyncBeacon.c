@@ -0,0 +1,169 @@
+#include <zephyr.h>
+#include <shell/shell.h>
+#include <stdlib.h>
+
+#include "DSTWR.h"
+#include "SyncBeacon.h"
+
+#define RADIO_BUSY_RETRY 2
+
+/* Without a beacon for this long a follower counts as unsynchronized. */
+#define SYNC_TIME_OUT 5000
+
+static void beaconWork(struct k_work *work);
+static void followWork(struct k_work *work);
+
+K_WORK_DELAYABLE_DEFINE(beaconTransmission, beaconWork);
+K_WORK_DEFINE(followChange, followWork);
+
+static uint32_t beaconInterval;
+static uint8_t beaconSequenceNumber;
+static uint32_t beaconsSent;
+
+static struct BeaconSync sync;
+static struct ClockModel masterClock;
+static int32_t propagation;
+static uint8_t lastSequenceNumber;
+static MasterClockHandler masterClockHandler;
+
+/* Requested by followSyncBeacons, applied on the system workqueue with the beacon handler. */
+static bool following;
+static uint16_t followedMaster;
+static int32_t followedPropagation;
+
+static void beaconWork(struct k_work *work) {
+	if (beaconInterval == 0) {
+		return;
+	}
+
+	if (!sendBeacon(beaconSequenceNumber)) {
+		k_work_schedule(&beaconTransmission, K_MSEC(RADIO_BUSY_RETRY));
+		return;
+	}
+
+	beaconSequenceNumber++;
+	beaconsSent++;
+	k_work_schedule(&beaconTransmission, K_MSEC(beaconInterval));
+}
+
+void startSyncBeacons(uint32_t interval) {
+	beaconInterval = interval;
+
+	if (interval == 0) {
+		k_work_cancel_delayable(&beaconTransmission);
+	} else {
+		k_work_schedule(&beaconTransmission, K_NO_WAIT);
+	}
+}
+
+static void beaconReceived(uint16_t sourceAddress, uint8_t sequenceNumber, DeviceTime txTimeStamp, DeviceTime rxTimeStamp) {
+	int64_t now = k_uptime_get();
+
+	if (sourceAddress != sync.master) {
+		return;
+	}
+
+	if (sync.received != 0) {
+		sync.missed += (uint8_t)(sequenceNumber - lastSequenceNumber - 1);
+	}
+
+	bool updated = updateClockModel(&masterClock, rxTimeStamp, now, deviceTimeDiff(rxTimeStamp, deviceTimeAdd(txTimeStamp, propagation)));
+
+	sync.offset = predictOffset(&masterClock, rxTimeStamp, now);
+	sync.skew = getModelSkew(&masterClock);
+	sync.lastRx = rxTimeStamp;
+	sync.lastUptime = (uint32_t)now;
+	sync.received++;
+	sync.synchronized = true;
+
+	lastSequenceNumber = sequenceNumber;
+
+	if (updated && masterClockHandler != NULL) {
+		masterClockHandler(&masterClock);
+	}
+}
+
+static void followWork(struct k_work *work) {
+	if (!following) {
+		setBeaconHandler(NULL);
+		sync.synchronized = false;
+		return;
+	}
+
+	sync = (struct BeaconSync){ .master = followedMaster };
+	propagation = followedPropagation;
+	resetClockModel(&masterClock);
+
+	setBeaconHandler(beaconReceived);
+}
+
+void followSyncBeacons(uint16_t master, int32_t timeOfFlight) {
+	followedMaster = master;
+	followedPropagation = timeOfFlight;
+	following = true;
+
+	k_work_submit(&followChange);
+}
+
+void stopFollowing() {
+	following = false;
+
+	k_work_submit(&followChange);
+}
+
+void getBeaconSync(struct BeaconSync *result) {
+	*result = sync;
+	result->error = predictedError(&masterClock, k_uptime_get());
+
+	if (result->synchronized && k_uptime_get_32() - result->lastUptime > SYNC_TIME_OUT) {
+		result->synchronized = false;
+	}
+}
+
+void setMasterClockHandler(MasterClockHandler handler) {
+	masterClockHandler = handler;
+}
+
+bool predictMasterOffset(DeviceTime time, DeviceTime *offset) {
+	if (!masterClock.initialized) {
+		return false;
+	}
+
+	*offset = predictOffset(&masterClock, time, k_uptime_get());
+	return true;
+}
+
+static int cmd_start(const struct shell *shell, size_t argc, char *argv[]) {
+	startSyncBeacons(strtoul(argv[1], NULL, 0));
+
+	return 0;
+}
+
+static int cmd_follow(const struct shell *shell, size_t argc, char *argv[]) {
+	followSyncBeacons(strtoul(argv[1], NULL, 0), argc > 2 ? strtol(argv[2], NULL, 0) : 0);
+
+	return 0;
+}
+
+static int cmd_status(const struct shell *shell, size_t argc, char *argv[]) {
+	struct BeaconSync status;
+
+	getBeaconSync(&status);
+
+	shell_print(shell, "Beacons sent: %u", beaconsSent);
+	shell_print(shell, "Master 0x%04X %s", status.master, status.synchronized ? "synchronized" : "not synchronized");
+	shell_print(shell, "Offset: %llu, skew %d ppb, predicted error %u", status.offset, status.skew, status.error);
+	shell_print(shell, "Received %u, missed %u", status.received, status.missed);
+
+	return 0;
+}
+
+SHELL_STATIC_SUBCMD_SET_CREATE(
+	beacon_cmds,
+	SHELL_CMD_ARG(start, NULL, "Send a sync beacon every <ms>, 0 stops", cmd_start, 2, 0),
+	SHELL_CMD_ARG(follow, NULL, "Synchronize to the beacons of <master> [time of flight]", cmd_follow, 2, 1),
+	SHELL_CMD_ARG(status, NULL, "Print the synchronization to the master", cmd_status, 1, 0),
+	SHELL_SUBCMD_SET_END
+);
+
+SHELL_CMD_REGISTER(beacon, &beacon_cmds, "Sync beacon commands", NULL);
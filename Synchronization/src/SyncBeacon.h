@@ -0,0 +1,49 @@
+#ifndef MJ_SYNC_BEACON
+#define MJ_SYNC_BEACON
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "ClockModel.h"
+#include "DeviceTime.h"
+
+/* Runs on the system workqueue after every beacon that updated the model of the master clock. */
+typedef void (*MasterClockHandler)(const struct ClockModel *model);
+
+/* What a follower knows about the master clock after the last beacon. */
+struct BeaconSync {
+	bool synchronized;
+	uint16_t master;
+	DeviceTime offset;             /* local minus master device time at the last beacon, modulo 2^40 */
+	int32_t skew;                  /* local clock rate relative to the master's, parts per billion */
+	uint32_t error;                /* predicted standard deviation of the offset now, device time units */
+	DeviceTime lastRx;             /* local device time of the last beacon */
+	uint32_t lastUptime;           /* ms of uptime at the last beacon */
+	uint32_t received;
+	uint32_t missed;
+};
+
+/*
+ * Master side: sends a sync beacon every interval ms, 0 stops. Every node
+ * in range synchronizes from the same transmission, so the cost does not
+ * grow with the number of nodes.
+ */
+void startSyncBeacons(uint32_t interval);
+
+/*
+ * Follower side: relates the local clock to the beacons of master. The
+ * beacons arrive timeOfFlight device time units after their TX timestamp,
+ * the master measures it once by DS-TWR and hands it out. Both may be
+ * called from any thread.
+ */
+void followSyncBeacons(uint16_t master, int32_t timeOfFlight);
+void stopFollowing();
+
+void getBeaconSync(struct BeaconSync *sync);
+
+void setMasterClockHandler(MasterClockHandler handler);
+
+/* Offset to the master predicted for local device time time, from the clock model of all beacons so far. */
+bool predictMasterOffset(DeviceTime time, DeviceTime *offset);
+
+#endif
@@ -0,0 +1,69 @@
+#include <zephyr.h>
+#include <math.h>
+
+#include "SyncStatistics.h"
+
+void resetSyncStatistics(struct SyncStatistics *statistics) {
+	*statistics = (struct SyncStatistics){ .minimum = INT64_MAX, .maximum = INT64_MIN };
+}
+
+void addSyncError(struct SyncStatistics *statistics, int64_t error) {
+	uint64_t magnitude = error < 0 ? -error : error;
+	uint8_t bucket = magnitude == 0 ? 0 : 64 - __builtin_clzll(magnitude);
+
+	statistics->count++;
+	statistics->minimum = MIN(statistics->minimum, error);
+	statistics->maximum = MAX(statistics->maximum, error);
+	statistics->sum += error;
+	statistics->sumSquares += (double)error * error;
+	statistics->histogram[MIN(bucket, SYNC_HISTOGRAM_BUCKETS - 1)]++;
+}
+
+int64_t syncErrorMean(const struct SyncStatistics *statistics) {
+	return statistics->count == 0 ? 0 : llround(statistics->sum / statistics->count);
+}
+
+int64_t syncErrorDeviation(const struct SyncStatistics *statistics) {
+	double mean;
+
+	if (statistics->count < 2) {
+		return 0;
+	}
+
+	mean = statistics->sum / statistics->count;
+	return llround(sqrt(fmax(statistics->sumSquares / statistics->count - mean * mean, 0)));
+}
+
+int64_t syncErrorPercentile(const struct SyncStatistics *statistics, uint8_t percent) {
+	uint64_t needed = ((uint64_t)statistics->count * percent + 99) / 100;
+	uint64_t seen = 0;
+
+	for (uint8_t bucket = 0; bucket < SYNC_HISTOGRAM_BUCKETS - 1; bucket++) {
+		seen += statistics->histogram[bucket];
+		if (seen >= needed) {
+			return 1LL << bucket;
+		}
+	}
+
+	return MAX(statistics->maximum, -statistics->minimum);
+}
+
+void printSyncStatistics(const char *label, const struct SyncStatistics *statistics) {
+	if (statistics->count == 0) {
+		printk("%s: no samples\n", label);
+		return;
+	}
+
+	printk(
+		"%s: %u samples, mean %lld ps, deviation %lld ps, min %lld ps, max %lld ps, p50 %lld ps, p95 %lld ps, p99 %lld ps\n",
+		label,
+		statistics->count,
+		syncErrorMean(statistics),
+		syncErrorDeviation(statistics),
+		statistics->minimum,
+		statistics->maximum,
+		syncErrorPercentile(statistics, 50),
+		syncErrorPercentile(statistics, 95),
+		syncErrorPercentile(statistics, 99)
+	);
+}
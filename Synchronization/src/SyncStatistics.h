@@ -0,0 +1,34 @@
+#ifndef MJ_SYNC_STATISTICS
+#define MJ_SYNC_STATISTICS
+
+#include <stdint.h>
+
+/* Buckets of the absolute error, bucket k holds errors below 2^k ps, the last one everything above. */
+#define SYNC_HISTOGRAM_BUCKETS 28
+
+/*
+ * Distribution of synchronization errors, signed, in picoseconds. Shared
+ * by the benchmark on the nodes and the simulator, so both report alike.
+ */
+struct SyncStatistics {
+	uint32_t count;
+	int64_t minimum;
+	int64_t maximum;
+	double sum;
+	double sumSquares;
+	uint32_t histogram[SYNC_HISTOGRAM_BUCKETS];
+};
+
+void resetSyncStatistics(struct SyncStatistics *statistics);
+void addSyncError(struct SyncStatistics *statistics, int64_t error);
+
+int64_t syncErrorMean(const struct SyncStatistics *statistics);
+int64_t syncErrorDeviation(const struct SyncStatistics *statistics);
+
+/* Bound below which percent of the absolute errors lie, to the power of two of the histogram. */
+int64_t syncErrorPercentile(const struct SyncStatistics *statistics, uint8_t percent);
+
+/* One line: count, mean, deviation, extremes and the 50th, 95th and 99th percentile. */
+void printSyncStatistics(const char *label, const struct SyncStatistics *statistics);
+
+#endif
@@ -0,0 +1,169 @@
+#include <zephyr.h>
+#include <dw3000_hw.h>
+#include <logging/log.h>
+#include <random/rand32.h>
+#include <shell/shell.h>
+#include <stdlib.h>
+
+#include "UWBFrame.h"
+#include "DSTWR.h"
+#include "Telemetry.h"
+#include "Tdoa.h"
+
+#define TDOA_THREAD_STACK_SIZE 1024
+#define TDOA_THREAD_PRIORITY K_LOWEST_APPLICATION_THREAD_PRIO
+
+/* Jitter of the tag interval in percent, blinks of two tags that collide once drift apart. */
+#define TAG_JITTER 10
+
+#define RADIO_BUSY_RETRY 2
+
+/* The chip reaches IDLE_RC within about 1 ms of the wakeup, it is polled for twice that. */
+#define WAKEUP_POLLS 200
+#define WAKEUP_POLL_US 10
+
+LOG_MODULE_REGISTER(Tdoa);
+
+K_MSGQ_DEFINE(blinkQueue, sizeof(struct TelemetryBlinkRecord), TDOA_QUEUE_LENGTH, 1);
+
+static void tagWork(struct k_work *work);
+static void referenceWork(struct k_work *work);
+
+K_WORK_DELAYABLE_DEFINE(tagBlink, tagWork);
+K_WORK_DELAYABLE_DEFINE(referenceBlink, referenceWork);
+
+static uint32_t tagInterval;
+static bool tagAsleep;
+static uint8_t tagSequenceNumber;
+
+static uint32_t referenceInterval;
+static uint8_t referenceSequenceNumber;
+
+static uint32_t blinksReceived;
+static uint32_t blinksDropped;
+
+static bool wakeUp() {
+	dw3000_hw_wakeup();
+
+	for (int i = 0; i < WAKEUP_POLLS; i++) {
+		if (dwt_checkidlerc()) {
+			return true;
+		}
+		k_busy_wait(WAKEUP_POLL_US);
+	}
+
+	return false;
+}
+
+static void tagWork(struct k_work *work) {
+	struct UWBBlinkFrame blink = {
+		.frameControl = BLINK_FRAME_CONTROL,
+		.sequenceNumber = tagSequenceNumber++,
+		.tagAddress = getLocalAddress()
+	};
+	uint32_t jitter = tagInterval * TAG_JITTER / 100;
+
+	/* The configuration survives the deep sleep in the AON memory, the TX buffer does not. */
+	if (tagAsleep && !wakeUp()) {
+		LOG_WRN("Chip did not wake up, blink %u skipped", blink.sequenceNumber);
+	} else {
+		if (tagAsleep) {
+			dwt_restoreconfig();
+		}
+
+		dwt_writetxdata(sizeof(blink), (uint8_t *)&blink, 0);
+		dwt_writetxfctrl(sizeof(blink) + FCS_LEN, 0, 0);
+		dwt_starttx(DWT_START_TX_IMMEDIATE);
+
+		/* The chip goes to deep sleep on its own as soon as the blink is out. */
+		tagAsleep = true;
+	}
+
+	k_work_schedule(&tagBlink, K_MSEC(tagInterval - jitter + (jitter == 0 ? 0 : sys_rand32_get() % (2 * jitter))));
+}
+
+void startTdoaTag(uint32_t interval) {
+	tagInterval = interval;
+
+	/* No events, the IRQ line has to stay low for the automatic sleep. */
+	dwt_setinterrupt(0, 0, DWT_ENABLE_INT_ONLY);
+
+	dwt_configuresleep(DWT_CONFIG, DWT_PRES_SLEEP | DWT_WAKE_WUP | DWT_WAKE_CSN | DWT_SLP_EN);
+	dwt_entersleepaftertx(1);
+
+	k_work_schedule(&tagBlink, K_NO_WAIT);
+}
+
+static void anchorBlink(uint16_t tagAddress, uint8_t sequenceNumber, DeviceTime timeStamp) {
+	struct TelemetryBlinkRecord record = {
+		.type = TELEMETRY_RECORD_BLINK,
+		.anchorAddress = getLocalAddress(),
+		.tagAddress = tagAddress,
+		.sequenceNumber = sequenceNumber
+	};
+
+	deviceTimeToBytes(timeStamp, record.timeStamp);
+
+	if (k_msgq_put(&blinkQueue, &record, K_NO_WAIT) != 0) {
+		blinksDropped++;
+		return;
+	}
+
+	blinksReceived++;
+}
+
+void startTdoaAnchor() {
+	setBlinkHandler(anchorBlink);
+}
+
+static void referenceWork(struct k_work *work) {
+	if (referenceInterval == 0) {
+		return;
+	}
+
+	if (!sendBlink(referenceSequenceNumber)) {
+		k_work_schedule(&referenceBlink, K_MSEC(RADIO_BUSY_RETRY));
+		return;
+	}
+
+	referenceSequenceNumber++;
+	k_work_schedule(&referenceBlink, K_MSEC(referenceInterval));
+}
+
+void setTdoaReference(uint32_t interval) {
+	referenceInterval = interval;
+
+	if (interval != 0) {
+		k_work_schedule(&referenceBlink, K_NO_WAIT);
+	}
+}
+
+static void tdoaThread(void *p1, void *p2, void *p3) {
+	struct TelemetryBlinkRecord record;
+
+	while (true) {
+		k_msgq_get(&blinkQueue, &record, K_FOREVER);
+		sendBlinkRecord(&record);
+	}
+}
+
+K_THREAD_DEFINE(tdoaThreadId, TDOA_THREAD_STACK_SIZE, tdoaThread, NULL, NULL, NULL, TDOA_THREAD_PRIORITY, 0, 0);
+
+static int cmd_reference(const struct shell *shell, size_t argc, char *argv[]) {
+	setTdoaReference(strtoul(argv[1], NULL, 0));
+	return 0;
+}
+
+static int cmd_stats(const struct shell *shell, size_t argc, char *argv[]) {
+	shell_print(shell, "Blinks forwarded: %u, dropped: %u, queued: %u", blinksReceived, blinksDropped, k_msgq_num_used_get(&blinkQueue));
+	return 0;
+}
+
+SHELL_STATIC_SUBCMD_SET_CREATE(
+	tdoa_cmds,
+	SHELL_CMD_ARG(reference, NULL, "Blink as the reference anchor every <ms>, 0 stops", cmd_reference, 2, 0),
+	SHELL_CMD_ARG(stats, NULL, "Print blink forwarding statistics", cmd_stats, 1, 0),
+	SHELL_SUBCMD_SET_END
+);
+
+SHELL_CMD_REGISTER(tdoa, &tdoa_cmds, "TDoA anchor commands", NULL);
@@ -0,0 +1,25 @@
+#ifndef MJ_TDOA
+#define MJ_TDOA
+
+#include <stdint.h>
+
+#define TDOA_QUEUE_LENGTH 32
+
+/*
+ * Tag side: sends a blink every interval ms (with a random jitter against
+ * repeated collisions) and lets the chip sleep right after it. The tag never
+ * receives, so it takes no part in any exchange.
+ */
+void startTdoaTag(uint32_t interval);
+
+/* Anchor side: timestamps every blink and forwards it as telemetry. */
+void startTdoaAnchor();
+
+/*
+ * A reference anchor blinks itself, every interval ms. The other anchors
+ * relate their clocks to its TX timestamps, the reference's position is
+ * known to the solver, interval 0 stops it.
+ */
+void setTdoaReference(uint32_t interval);
+
+#endif
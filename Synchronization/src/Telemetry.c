@@ -0,0 +1,249 @@
+#include <device.h>
+#include <drivers/uart.h>
+#include <shell/shell.h>
+#include <sys/crc.h>
+#include <stdlib.h>
+
+#if defined(CONFIG_USE_SEGGER_RTT)
+#include <SEGGER_RTT.h>
+#endif
+
+#include "Telemetry.h"
+
+/*
+ * Binary frames need a channel of their own, interleaved with shell output
+ * they are lost. RTT up channel 0 belongs to the console, binary telemetry
+ * gets channel 1. Without RTT it goes to the UART of the mj,telemetry-uart
+ * chosen node, and without one binary mode is refused.
+ */
+#define TELEMETRY_RTT_CHANNEL 1
+
+#if defined(CONFIG_USE_SEGGER_RTT) || DT_HAS_CHOSEN(mj_telemetry_uart)
+#define HAS_BINARY_OUTPUT 1
+#endif
+
+/* tools/TelemetryDecoder.cpp parses the record by these offsets. */
+BUILD_ASSERT(sizeof(struct TelemetryRangingRecord) == 49, "Telemetry record layout changed");
+
+BUILD_ASSERT(TELEMETRY_CIR_HEADER_LENGTH == 15, "CIR record layout changed");
+
+BUILD_ASSERT(sizeof(struct TelemetryBlinkRecord) == 11, "Blink record layout changed");
+
+BUILD_ASSERT(sizeof(struct TelemetryFilteredRecord) == 17, "Filtered record layout changed");
+
+#define FRAME_LENGTH (MAX(sizeof(struct TelemetryRangingRecord), sizeof(struct TelemetryCirRecord)) + sizeof(uint16_t))
+#define ENCODED_FRAME_LENGTH (FRAME_LENGTH + FRAME_LENGTH / 254 + 2)
+
+/* Arguments of "%s%d.%02u" for a value in hundredths, the sign is printed apart so -0.50 keeps it. */
+#define HUNDREDTHS(value) ((value) < 0 ? "-" : ""), abs(value) / 100, abs(value) % 100
+
+static enum TelemetryMode telemetryMode = TelemetryText;
+
+/* Ranging records, CIR chunks and blinks come from different threads. */
+K_MUTEX_DEFINE(outputLock);
+
+#if !defined(CONFIG_USE_SEGGER_RTT) && defined(HAS_BINARY_OUTPUT)
+static const struct device *uart = DEVICE_DT_GET(DT_CHOSEN(mj_telemetry_uart));
+#endif
+
+bool setTelemetryMode(enum TelemetryMode mode) {
+#if !defined(HAS_BINARY_OUTPUT)
+	if (mode == TelemetryBinary) {
+		return false;
+	}
+#elif !defined(CONFIG_USE_SEGGER_RTT)
+	if (mode == TelemetryBinary && !device_is_ready(uart)) {
+		return false;
+	}
+#endif
+
+	telemetryMode = mode;
+	return true;
+}
+
+enum TelemetryMode getTelemetryMode() {
+	return telemetryMode;
+}
+
+/* Consistent overhead byte stuffing, returns the encoded length including the terminating zero. */
+static size_t encodeCobs(const uint8_t *data, size_t length, uint8_t *output) {
+	size_t codeIndex = 0;
+	size_t outputIndex = 1;
+	uint8_t code = 1;
+
+	for (size_t i = 0; i < length; i++) {
+		if (data[i] == 0) {
+			output[codeIndex] = code;
+			codeIndex = outputIndex++;
+			code = 1;
+			continue;
+		}
+
+		output[outputIndex++] = data[i];
+
+		if (++code == 0xFF) {
+			output[codeIndex] = code;
+			codeIndex = outputIndex++;
+			code = 1;
+		}
+	}
+
+	output[codeIndex] = code;
+	output[outputIndex++] = 0;
+
+	return outputIndex;
+}
+
+static void writeOutput(const uint8_t *data, size_t length) {
+#if defined(CONFIG_USE_SEGGER_RTT)
+	SEGGER_RTT_Write(TELEMETRY_RTT_CHANNEL, data, length);
+#elif defined(HAS_BINARY_OUTPUT)
+	for (size_t i = 0; i < length; i++) {
+		uart_poll_out(uart, data[i]);
+	}
+#endif
+}
+
+/* Appends the CRC, COBS encodes and writes one frame. */
+static void sendFrame(const void *record, size_t length) {
+	static uint8_t frame[FRAME_LENGTH];
+	static uint8_t encoded[ENCODED_FRAME_LENGTH];
+	uint16_t crc = crc16_ccitt(0xFFFF, record, length);
+
+	k_mutex_lock(&outputLock, K_FOREVER);
+
+	memcpy(frame, record, length);
+	frame[length] = (uint8_t)crc;
+	frame[length + 1] = (uint8_t)(crc >> 8);
+
+	writeOutput(encoded, encodeCobs(frame, length + sizeof(crc), encoded));
+
+	k_mutex_unlock(&outputLock);
+}
+
+static void sendBinary(const struct RangingRecord *record, int32_t distance) {
+	struct TelemetryRangingRecord telemetry = {
+		.type = TELEMETRY_RECORD_RANGING,
+		.uptime = k_uptime_get_32(),
+		.peerAddress = record->peerAddress,
+		.sequenceNumber = record->sequenceNumber,
+		.distance = distance,
+		.firstPathPower = record->quality.firstPathPower,
+		.rxLevel = record->quality.rxLevel,
+		.nlosProbability = record->quality.nlosProbability,
+		.azimuth = record->bearing.azimuth
+	};
+	const DeviceTime timeStamps[6] = {
+		record->result.tx1, record->result.rx1, record->result.tx2,
+		record->result.rx2, record->result.tx3, record->result.rx3
+	};
+
+	for (int i = 0; i < 6; i++) {
+		deviceTimeToBytes(timeStamps[i], telemetry.timeStamps[i]);
+	}
+
+	sendFrame(&telemetry, sizeof(telemetry));
+}
+
+/* Position of the peer in the anchor's frame, x along the boresight. */
+static void printBearing(const struct RangingRecord *record, int32_t distance) {
+	const struct Bearing *bearing = &record->bearing;
+
+	printk(
+		"0x%04X Azimuth = %s%d.%02u deg X = %d mm Y = %d mm\n",
+		record->peerAddress, HUNDREDTHS(bearing->azimuth),
+		(int32_t)(((int64_t)distance * bearing->cosine) >> 15),
+		(int32_t)(((int64_t)distance * bearing->sine) >> 15)
+	);
+}
+
+void sendTelemetry(const struct RangingRecord *record, int32_t distance) {
+	if (telemetryMode == TelemetryBinary) {
+		sendBinary(record, distance);
+		return;
+	}
+
+	if (record->quality.tier == DiagnosticsNone) {
+		printk("0x%04X Distance = %d mm\n", record->peerAddress, distance);
+	} else {
+		printk(
+			"0x%04X Distance = %d mm FP = %s%d.%02u dBm RX = %s%d.%02u dBm NLOS = %u %%\n",
+			record->peerAddress, distance,
+			HUNDREDTHS(record->quality.firstPathPower),
+			HUNDREDTHS(record->quality.rxLevel),
+			record->quality.nlosProbability
+		);
+	}
+
+	if (record->bearing.azimuth != AZIMUTH_INVALID) {
+		printBearing(record, distance);
+	}
+}
+
+void sendFilteredRange(uint16_t peerAddress, const struct FilteredRange *range) {
+	struct TelemetryFilteredRecord telemetry = {
+		.type = TELEMETRY_RECORD_FILTERED,
+		.uptime = k_uptime_get_32(),
+		.peerAddress = peerAddress,
+		.distance = range->distance,
+		.velocity = range->velocity,
+		.samples = MIN(range->samples, UINT16_MAX)
+	};
+
+	if (telemetryMode == TelemetryBinary) {
+		sendFrame(&telemetry, sizeof(telemetry));
+	} else {
+		printk(
+			"0x%04X Distance = %d mm Velocity = %d mm/s Samples = %u\n",
+			peerAddress, range->distance, range->velocity, range->samples
+		);
+	}
+}
+
+void sendCirChunk(const struct TelemetryCirRecord *record) {
+	if (telemetryMode == TelemetryBinary) {
+		sendFrame(record, TELEMETRY_CIR_HEADER_LENGTH + record->taps * TELEMETRY_CIR_SAMPLE_LENGTH);
+	} else if (record->chunkOffset == 0) {
+		printk(
+			"0x%04X CIR %u: %u taps from %u, first path at %u.%02u\n",
+			record->peerAddress, record->captureNumber, record->totalTaps, record->firstTap,
+			record->firstPathIndex / 64, record->firstPathIndex % 64 * 100 / 64
+		);
+	}
+}
+
+void sendBlinkRecord(const struct TelemetryBlinkRecord *record) {
+	if (telemetryMode == TelemetryBinary) {
+		sendFrame(record, sizeof(*record));
+	} else {
+		DeviceTime timeStamp = deviceTimeFromBytes(record->timeStamp);
+
+		printk(
+			"0x%04X Blink 0x%04X %u at 0x%02X%08X\n",
+			record->anchorAddress, record->tagAddress, record->sequenceNumber, (uint32_t)(timeStamp >> 32), (uint32_t)timeStamp
+		);
+	}
+}
+
+static int cmd_text(const struct shell *shell, size_t argc, char *argv[]) {
+	setTelemetryMode(TelemetryText);
+	return 0;
+}
+
+static int cmd_binary(const struct shell *shell, size_t argc, char *argv[]) {
+	if (!setTelemetryMode(TelemetryBinary)) {
+		shell_error(shell, "No telemetry channel, enable RTT or choose mj,telemetry-uart apart from the console");
+		return -ENODEV;
+	}
+
+	return 0;
+}
+
+SHELL_STATIC_SUBCMD_SET_CREATE(
+	telemetry_cmds,
+	SHELL_CMD_ARG(text, NULL, "Print ranging results as text", cmd_text, 1, 0),
+	SHELL_CMD_ARG(binary, NULL, "Stream COBS framed binary records", cmd_binary, 1, 0),
+	SHELL_SUBCMD_SET_END
+);
+
+SHELL_CMD_REGISTER(telemetry, &telemetry_cmds, "Ranging telemetry output", NULL);
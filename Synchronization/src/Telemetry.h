@@ -0,0 +1,104 @@
+#ifndef MJ_TELEMETRY
+#define MJ_TELEMETRY
+
+#include <stdbool.h>
+#include <stddef.h>
+
+#include "RangeFilter.h"
+#include "ResultPipeline.h"
+
+#define TELEMETRY_RECORD_RANGING 0x01
+#define TELEMETRY_RECORD_CIR 0x02
+#define TELEMETRY_RECORD_BLINK 0x03
+#define TELEMETRY_RECORD_FILTERED 0x04
+
+#define TELEMETRY_CIR_SAMPLE_LENGTH 6
+#define TELEMETRY_CIR_CHUNK_TAPS 32
+
+enum TelemetryMode { TelemetryText, TelemetryBinary };
+
+/*
+ * Binary record of one exchange, little endian. On the wire it is followed by
+ * a CRC-16/CCITT (crc16_ccitt, seed 0xFFFF) over the record, the whole frame
+ * is COBS encoded and terminated by a zero byte. Quality fields are zero when
+ * no diagnostics were captured, the azimuth is INT16_MIN without PDOA.
+ */
+struct TelemetryRangingRecord {
+	uint8_t type;
+	uint32_t uptime;               /* ms */
+	uint16_t peerAddress;
+	uint8_t sequenceNumber;
+	uint8_t timeStamps[6][5];      /* tx1, rx1, tx2, rx2, tx3, rx3 as 40-bit device times */
+	int32_t distance;              /* mm */
+	int16_t firstPathPower;        /* 0.01 dBm */
+	int16_t rxLevel;               /* 0.01 dBm */
+	uint8_t nlosProbability;       /* percent */
+	int16_t azimuth;               /* 0.01 degree */
+} __attribute__((packed));
+
+/*
+ * Output of the range filter for one peer, sent every decimation-th raw
+ * sample instead of the ranging record of the exchange that happened to
+ * complete it. It carries no timestamps, the filtered values belong to no
+ * single exchange.
+ */
+struct TelemetryFilteredRecord {
+	uint8_t type;
+	uint32_t uptime;               /* ms */
+	uint16_t peerAddress;
+	int32_t distance;              /* mm */
+	int32_t velocity;              /* mm/s */
+	uint16_t samples;              /* raw samples folded in since the last output */
+} __attribute__((packed));
+
+/*
+ * Part of one accumulator capture, only the header and taps samples are sent.
+ * Samples are copied from the chip as they are: 18-bit signed real and
+ * imaginary parts in 3 bytes little endian each.
+ */
+struct TelemetryCirRecord {
+	uint8_t type;
+	uint16_t captureNumber;        /* shared by all chunks of a capture, wraps */
+	uint16_t peerAddress;
+	uint8_t sequenceNumber;
+	uint16_t firstPathIndex;       /* accumulator index in 1/64 */
+	uint16_t firstTap;             /* accumulator index of the first sample of the capture */
+	uint16_t totalTaps;            /* samples in the capture */
+	uint16_t chunkOffset;          /* samples of the capture before this chunk */
+	uint8_t taps;                  /* samples in this chunk */
+	uint8_t samples[TELEMETRY_CIR_CHUNK_TAPS][TELEMETRY_CIR_SAMPLE_LENGTH];
+} __attribute__((packed));
+
+#define TELEMETRY_CIR_HEADER_LENGTH offsetof(struct TelemetryCirRecord, samples)
+
+/*
+ * One TDoA blink seen by an anchor, in the anchor's device time. A reference
+ * anchor reports its own blinks with its address as the tag and the TX time.
+ */
+struct TelemetryBlinkRecord {
+	uint8_t type;
+	uint16_t anchorAddress;
+	uint16_t tagAddress;
+	uint8_t sequenceNumber;
+	uint8_t timeStamp[5];
+} __attribute__((packed));
+
+/*
+ * Binary frames go to RTT channel 1, or to the UART of the mj,telemetry-uart
+ * chosen node, never the console the shell shares. False for binary when
+ * neither exists.
+ */
+bool setTelemetryMode(enum TelemetryMode mode);
+enum TelemetryMode getTelemetryMode();
+
+/* Called from the result pipeline thread. */
+void sendTelemetry(const struct RangingRecord *record, int32_t distance);
+void sendFilteredRange(uint16_t peerAddress, const struct FilteredRange *range);
+
+/* Called from the CIR capture thread, frames of both are written whole. */
+void sendCirChunk(const struct TelemetryCirRecord *record);
+
+/* Called from the TDoA thread. */
+void sendBlinkRecord(const struct TelemetryBlinkRecord *record);
+
+#endif
@@ -0,0 +1,164 @@
+#include <stdbool.h>
+
+#include "TimeOfFlight.h"
+
+#define SHORT_DURATION_LIMIT (1ULL << 31)
+
+/* Largest time of flight in device time units that still scales to mm within int64_t. */
+#define TIME_OF_FLIGHT_LIMIT (1ULL << 34)
+
+struct UInt128 {
+	uint64_t high;
+	uint64_t low;
+};
+
+static struct UInt128 multiply(uint64_t a, uint64_t b) {
+	uint64_t aLow = (uint32_t)a;
+	uint64_t aHigh = a >> 32;
+	uint64_t bLow = (uint32_t)b;
+	uint64_t bHigh = b >> 32;
+
+	uint64_t lowLow = aLow * bLow;
+	uint64_t lowHigh = aLow * bHigh;
+	uint64_t highLow = aHigh * bLow;
+	uint64_t highHigh = aHigh * bHigh;
+
+	uint64_t middle = (lowLow >> 32) + (uint32_t)lowHigh + (uint32_t)highLow;
+
+	return (struct UInt128){
+		.high = highHigh + (lowHigh >> 32) + (highLow >> 32) + (middle >> 32),
+		.low = (middle << 32) | (uint32_t)lowLow
+	};
+}
+
+static bool isLess(struct UInt128 a, struct UInt128 b) {
+	return a.high < b.high || (a.high == b.high && a.low < b.low);
+}
+
+static struct UInt128 subtract(struct UInt128 a, struct UInt128 b) {
+	return (struct UInt128){
+		.high = a.high - b.high - (a.low < b.low),
+		.low = a.low - b.low
+	};
+}
+
+/* Restoring division, the caller guarantees dividend.high < divisor < 2^63. */
+static uint64_t divide(struct UInt128 dividend, uint64_t divisor, uint64_t *remainder) {
+	uint64_t quotient = 0;
+	uint64_t rest = dividend.high;
+
+	for (int bit = 63; bit >= 0; bit--) {
+		rest = (rest << 1) | ((dividend.low >> bit) & 1);
+
+		if (rest >= divisor) {
+			rest -= divisor;
+			quotient |= 1ULL << bit;
+		}
+	}
+
+	*remainder = rest;
+	return quotient;
+}
+
+static int32_t saturate(uint64_t magnitude, bool negative) {
+	if (magnitude > INT32_MAX) {
+		return negative ? INT32_MIN : INT32_MAX;
+	}
+
+	return negative ? -(int32_t)magnitude : (int32_t)magnitude;
+}
+
+/* (quotient + remainder / divisor) device time units in mm, rounded. */
+static int32_t toMillimetres(uint64_t quotient, uint64_t remainder, uint64_t divisor, bool negative) {
+	uint64_t fraction;
+
+	if (quotient >= TIME_OF_FLIGHT_LIMIT) {
+		return saturate(UINT64_MAX, negative);
+	}
+
+	/* Keep remainder * speed of light below 2^63, the dropped bits are far below 1 mm. */
+	while (divisor >= TIME_OF_FLIGHT_LIMIT) {
+		divisor >>= 1;
+		remainder >>= 1;
+	}
+
+	fraction = remainder * TOF_SPEED_OF_LIGHT / divisor;
+
+	return saturate((quotient * TOF_SPEED_OF_LIGHT + fraction + TOF_UNITS_PER_MILLISECOND / 2) / TOF_UNITS_PER_MILLISECOND, negative);
+}
+
+/* Returns the sum of the durations, the time of flight is (quotient + remainder / sum) device time units. */
+static uint64_t dsTwrQuotient(uint64_t firstLoop, uint64_t firstReply, uint64_t secondLoop, uint64_t secondReply, uint64_t *quotient, uint64_t *remainder, bool *negative) {
+	uint64_t sum = firstLoop + firstReply + secondLoop + secondReply;
+
+	if (sum == 0) {
+		*quotient = 0;
+		*remainder = 0;
+		*negative = false;
+		return 0;
+	}
+
+	if (
+		firstLoop < SHORT_DURATION_LIMIT &&
+		firstReply < SHORT_DURATION_LIMIT &&
+		secondLoop < SHORT_DURATION_LIMIT &&
+		secondReply < SHORT_DURATION_LIMIT
+	) {
+		int64_t numerator = (int64_t)(firstLoop * secondLoop) - (int64_t)(firstReply * secondReply);
+
+		*negative = numerator < 0;
+		if (*negative) {
+			numerator = -numerator;
+		}
+
+		*quotient = (uint64_t)numerator / sum;
+		*remainder = (uint64_t)numerator % sum;
+	} else {
+		struct UInt128 loops = multiply(firstLoop, secondLoop);
+		struct UInt128 replies = multiply(firstReply, secondReply);
+
+		*negative = isLess(loops, replies);
+
+		/* Products of 40-bit values are below 2^80, the sum is at least 2^31, so the quotient fits. */
+		*quotient = divide(*negative ? subtract(replies, loops) : subtract(loops, replies), sum, remainder);
+	}
+
+	return sum;
+}
+
+int32_t dsTwrDistance(uint64_t firstLoop, uint64_t firstReply, uint64_t secondLoop, uint64_t secondReply) {
+	uint64_t remainder;
+	uint64_t quotient;
+	bool negative;
+	uint64_t sum = dsTwrQuotient(firstLoop, firstReply, secondLoop, secondReply, &quotient, &remainder, &negative);
+
+	if (sum == 0) {
+		return 0;
+	}
+
+	return toMillimetres(quotient, remainder, sum, negative);
+}
+
+int32_t dsTwrTimeOfFlight(uint64_t firstLoop, uint64_t firstReply, uint64_t secondLoop, uint64_t secondReply) {
+	uint64_t remainder;
+	uint64_t quotient;
+	bool negative;
+	uint64_t sum = dsTwrQuotient(firstLoop, firstReply, secondLoop, secondReply, &quotient, &remainder, &negative);
+
+	if (sum == 0) {
+		return 0;
+	}
+
+	return saturate(remainder >= sum - remainder ? quotient + 1 : quotient, negative);
+}
+
+int32_t ssTwrDistance(uint64_t roundTrip, uint64_t reply, int16_t clockOffset) {
+	int64_t twiceTimeOfFlight = (int64_t)roundTrip - (int64_t)reply + (int64_t)reply * clockOffset / (1 << 26);
+	bool negative = twiceTimeOfFlight < 0;
+
+	if (negative) {
+		twiceTimeOfFlight = -twiceTimeOfFlight;
+	}
+
+	return toMillimetres((uint64_t)twiceTimeOfFlight / 2, (uint64_t)twiceTimeOfFlight % 2, 2, negative);
+}
@@ -0,0 +1,42 @@
+#ifndef MJ_TIME_OF_FLIGHT
+#define MJ_TIME_OF_FLIGHT
+
+#include <stdint.h>
+
+/*
+ * Integer time of flight calculators, so ranging does not depend on the FPU
+ * (the soft-float driver builds make the double path very slow).
+ *
+ * All durations are differences of 40-bit device timestamps in DW time units
+ * (1 / (128 * 499.2 MHz) ~ 15.65 ps). The results are distances in mm,
+ * rounded to nearest and saturated to the int32_t range.
+ */
+
+/* mm per device time unit is SPEED_OF_LIGHT * 1000 / TOF_UNITS_PER_SECOND. */
+#define TOF_SPEED_OF_LIGHT 299702547LL
+#define TOF_UNITS_PER_MILLISECOND 63897600LL
+
+/*
+ * Asymmetric double-sided TWR:
+ * (firstLoop * secondLoop - firstReply * secondReply) / (sum of all four).
+ *
+ * Durations below 2^31 units (33.6 ms, every sane reply delay) take a pure
+ * 64-bit path: each product is below 2^62, so the difference fits int64_t,
+ * and the sum is below 2^33. Longer durations up to the full 2^40 fall back
+ * to 128-bit products, which are exact for any 40-bit inputs.
+ */
+int32_t dsTwrDistance(uint64_t firstLoop, uint64_t firstReply, uint64_t secondLoop, uint64_t secondReply);
+
+/* The same time of flight in device time units, rounded to nearest. */
+int32_t dsTwrTimeOfFlight(uint64_t firstLoop, uint64_t firstReply, uint64_t secondLoop, uint64_t secondReply);
+
+/*
+ * Single-sided TWR: (roundTrip - reply * (1 - clockOffset / 2^26)) / 2, where
+ * clockOffset is the value of dwt_readclockoffset() on the initiator.
+ * reply * clockOffset stays below 2^40 * 2^15 = 2^55 and the corrected round
+ * trip must stay below 2^34 units (268 ms), which keeps the scaling to mm
+ * below 2^63.
+ */
+int32_t ssTwrDistance(uint64_t roundTrip, uint64_t reply, int16_t clockOffset);
+
+#endif
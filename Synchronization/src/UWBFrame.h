@@ -3,6 +3,22 @@
 
 #include <stdint.h>
 
+/* First byte of a blink, an IEEE 802.15.4 data frame starts with 0x41 instead. */
+#define BLINK_FRAME_CONTROL 0xC5
+
+/* TDoA tag blink, an IEEE 802.15.4 blink shortened to a 16-bit tag address. */
+struct UWBBlinkFrame {
+    uint8_t  frameControl;
+    uint8_t  sequenceNumber;
+    uint16_t tagAddress;
+} __attribute__((packed));
+
+/* Sync beacon, a blink that carries its TX timestamp on the sender's clock. */
+struct UWBBeaconFrame {
+    struct UWBBlinkFrame blink;
+    uint8_t              txTimeStamp[5];
+} __attribute__((packed));
+
 struct UWBFrame {
     uint16_t frameControl;
     uint8_t  sequenceNumber;
@@ -17,11 +33,19 @@ struct UWBResponseFrame {
     uint8_t         activityCode;
 } __attribute__((packed));
 
+/*
+ * Timestamps are full 40-bit device times, little endian as read from the chip.
+ * hopBlacklist is the channel hopping blacklist both peers use from the next
+ * exchange on, 0 without hopping. stsExchange is the exchange number of the
+ * next STS IV.
+ */
 struct UWBDelayDataFrame {
     struct UWBFrame baseFrame;
-    uint32_t        tx1TimeStamp;
-    uint32_t        rxTimeStamp;
-    uint32_t        tx2TimeStamp;
+    uint8_t         tx1TimeStamp[5];
+    uint8_t         rxTimeStamp[5];
+    uint8_t         tx2TimeStamp[5];
+    uint8_t         hopBlacklist;
+    uint32_t        stsExchange;
 } __attribute__((packed));
 
 #endif
\ No newline at end of file
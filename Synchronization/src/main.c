@@ -1,49 +1,139 @@
 #include <logging/log.h>
 #include <deca_probe_interface.h>
+#include <shell/shell.h>
 
 #include "DSTWR.h"
+#include "RangeFilter.h"
+#include "ResultPipeline.h"
+#include "Telemetry.h"
+#include "SessionManager.h"
+#include "Tdoa.h"
+#include "TimeOfFlight.h"
 
 LOG_MODULE_REGISTER(main);
 
+#define INITIATOR_ADDRESS 0x4556
+#define RESPONDER_ADDRESS 0x4157
+
 #define RANGING_INTERVAL 1000
+#define RANGING_PRIORITY 1
+
+#define TDOA_TAG_ADDRESS 0x5441
+#define BLINK_INTERVAL 100
 
 //#define INITIATOR
 
-void printResult(struct DSTWRResult result) {
-	double firstLoopDuration = (double)(result.rx2 - result.tx1);
-	double firstProcessingDuration = (double)(result.tx2 - result.rx1);
-	double secondLoopDuration = (double)(result.rx3 - result.tx2);
-	double secondProcessingDuration = (double)(result.tx3 - result.rx2);
+/* A TDoA tag only blinks, a TDoA anchor forwards blinks next to its responder session. */
+//#define TDOA_TAG
+//#define TDOA_ANCHOR
+
+#define BENCHMARK_RUNS 1000
+
+void printResult(const struct RangingRecord *record) {
+	int32_t distance = dsTwrDistance(
+		deviceTimeDiff(record->result.rx2, record->result.tx1),
+		deviceTimeDiff(record->result.tx2, record->result.rx1),
+		deviceTimeDiff(record->result.rx3, record->result.tx2),
+		deviceTimeDiff(record->result.tx3, record->result.rx2)
+	);
+	struct FilteredRange filtered;
 
-	double timeOfFlight = (firstLoopDuration * secondLoopDuration - firstProcessingDuration * secondProcessingDuration) /
-				(firstLoopDuration + secondLoopDuration + firstProcessingDuration + secondProcessingDuration) * DWT_TIME_UNITS;
+	if (!isConfident(&record->quality)) {
+		return;
+	}
 
-	double distance = timeOfFlight * SPEED_OF_LIGHT;
+	if (filterRange(record->peerAddress, distance, k_uptime_get_32(), &filtered)) {
+		sendFilteredRange(record->peerAddress, &filtered);
+	}
+}
 
-	printf("2Distance = %3.2f m\n", distance);
+static double doubleDistance(uint64_t firstLoop, uint64_t firstReply, uint64_t secondLoop, uint64_t secondReply) {
+	double timeOfFlight = ((double)firstLoop * (double)secondLoop - (double)firstReply * (double)secondReply) /
+				((double)firstLoop + (double)secondLoop + (double)firstReply + (double)secondReply) * DWT_TIME_UNITS;
 
-	responder();
+	return timeOfFlight * SPEED_OF_LIGHT * 1000;
 }
 
-void repeatRanging() {
-	k_msleep(RANGING_INTERVAL);
-	initiator();
+static uint32_t nextRandom(uint32_t *state) {
+	*state ^= *state << 13;
+	*state ^= *state >> 17;
+	*state ^= *state << 5;
+	return *state;
 }
 
+/* Compares the integer engine with the double formula it replaced, build with and without CONFIG_FPU for both ABIs. */
+static int cmd_benchmark(const struct shell *shell, size_t argc, char *argv[]) {
+	static uint64_t durations[BENCHMARK_RUNS][4];
+	static int32_t fixedResults[BENCHMARK_RUNS];
+	static double doubleResults[BENCHMARK_RUNS];
+	uint32_t state = 0x12345678;
+	uint32_t start;
+	uint32_t fixedCycles;
+	uint32_t doubleCycles;
+	double maxError = 0;
+
+	for (int i = 0; i < BENCHMARK_RUNS; i++) {
+		uint64_t timeOfFlight = nextRandom(&state) % 20000;
+		uint64_t firstReply = 100000 + nextRandom(&state) % (1 << 28);
+		uint64_t secondReply = 100000 + nextRandom(&state) % (1 << 28);
+
+		durations[i][0] = firstReply + 2 * timeOfFlight;
+		durations[i][1] = firstReply;
+		durations[i][2] = secondReply + 2 * timeOfFlight;
+		durations[i][3] = secondReply;
+	}
+
+	start = k_cycle_get_32();
+	for (int i = 0; i < BENCHMARK_RUNS; i++) {
+		fixedResults[i] = dsTwrDistance(durations[i][0], durations[i][1], durations[i][2], durations[i][3]);
+	}
+	fixedCycles = k_cycle_get_32() - start;
+
+	start = k_cycle_get_32();
+	for (int i = 0; i < BENCHMARK_RUNS; i++) {
+		doubleResults[i] = doubleDistance(durations[i][0], durations[i][1], durations[i][2], durations[i][3]);
+	}
+	doubleCycles = k_cycle_get_32() - start;
+
+	for (int i = 0; i < BENCHMARK_RUNS; i++) {
+		double error = fixedResults[i] - doubleResults[i];
+
+		if (error < 0) {
+			error = -error;
+		}
+		if (error > maxError) {
+			maxError = error;
+		}
+	}
+
+	shell_print(shell, "Fixed point: %u cycles per exchange", fixedCycles / BENCHMARK_RUNS);
+	shell_print(shell, "Double: %u cycles per exchange", doubleCycles / BENCHMARK_RUNS);
+	shell_print(shell, "Largest difference: %d um", (int)(maxError * 1000));
+
+	return 0;
+}
+
+SHELL_CMD_ARG_REGISTER(benchmark, NULL, "Benchmark the time of flight calculation", cmd_benchmark, 1, 0);
+
 void main(void) {
-#ifdef INITIATOR
-	setInitiatorDone(repeatRanging);
-#else
-	setResultProcessor(printResult);
-#endif
+	if (!initializeUWB()) {
+		LOG_ERR("Initialization failed");
+		return;
+	}
 
-	if (initializeUWB()) {
-#ifdef INITIATOR
-		initiatorStart();
+#if defined(TDOA_TAG)
+	setLocalAddress(TDOA_TAG_ADDRESS);
+	startTdoaTag(BLINK_INTERVAL);
+#elif defined(INITIATOR)
+	setLocalAddress(INITIATOR_ADDRESS);
+	addManagedPeer(RESPONDER_ADDRESS, RANGING_INTERVAL, RANGING_PRIORITY);
+	startManager();
 #else
-		responderStart();
+	setLocalAddress(RESPONDER_ADDRESS);
+	setRecordConsumer(printResult);
+	startSession(createSession(INITIATOR_ADDRESS, DSTWRResponder, 0, postResult));
+#ifdef TDOA_ANCHOR
+	startTdoaAnchor();
+#endif
 #endif
-	} else {
-		LOG_ERR("Initialization failed");
-	}
 }
@@ -0,0 +1,139 @@
+#include <math.h>
+#include <stdlib.h>
+#include <zephyr.h>
+
+#include "Test.h"
+#include "AngleOfArrival.h"
+
+#define PI_Q11 6434
+#define TWO_PI_Q11 12868
+
+/* Channel 5 wavelength and half of it, the default spacing, in um. */
+#define WAVELENGTH 46196
+#define SPACING 23098
+
+/* Azimuth error against asin in 0.01 degree, largest near endfire where the Q15 sine is coarsest. */
+#define AZIMUTH_BOUND 10
+
+/* The chip: a phase difference of the antennas, and the offset it subtracts, written between frames. */
+static int32_t antennaPhase;
+static int16_t chipOffset;
+static int offsetWrites;
+
+static int16_t wrap(int32_t phase) {
+	while (phase >= PI_Q11) {
+		phase -= TWO_PI_Q11;
+	}
+	while (phase < -PI_Q11) {
+		phase += TWO_PI_Q11;
+	}
+
+	return (int16_t)phase;
+}
+
+int16_t dwt_readpdoa(void) {
+	return wrap(antennaPhase - chipOffset);
+}
+
+void dwt_setpdoaoffset(uint16_t offset) {
+	chipOffset = (int16_t)offset;
+	offsetWrites++;
+}
+
+/* Calibrating at boresight takes effect on the very next frame, before and after the chip has the offset. */
+static void testCalibration() {
+	struct Bearing bearing = { .azimuth = AZIMUTH_INVALID };
+
+	antennaPhase = 1000;
+	pdoaConfigured();
+	setPdoaOffset(0);
+
+	captureBearing(&bearing, DWT_PDOA_M1, 5);
+	CHECK(bearing.pdoa == 1000, "uncalibrated pdoa %d", bearing.pdoa);
+	CHECK(getLastRawPdoa() == 1000, "uncalibrated raw pdoa %d", getLastRawPdoa());
+
+	setPdoaOffset(getLastRawPdoa());
+
+	/* The chip still subtracts the old offset from this frame. */
+	captureBearing(&bearing, DWT_PDOA_M1, 5);
+	CHECK(getLastRawPdoa() == 1000, "raw pdoa %d right after calibration", getLastRawPdoa());
+	CHECK(bearing.pdoa == 0, "pdoa %d right after calibration", bearing.pdoa);
+	CHECK(bearing.azimuth == 0, "azimuth %d right after calibration", bearing.azimuth);
+	CHECK(chipOffset == 1000, "offset %d not written", chipOffset);
+
+	captureBearing(&bearing, DWT_PDOA_M1, 5);
+	CHECK(getLastRawPdoa() == 1000, "raw pdoa %d with the offset in the chip", getLastRawPdoa());
+	CHECK(bearing.pdoa == 0, "pdoa %d with the offset in the chip", bearing.pdoa);
+
+	/* Calibrating again at boresight keeps the same offset. */
+	setPdoaOffset(getLastRawPdoa());
+	captureBearing(&bearing, DWT_PDOA_M1, 5);
+	CHECK(getPdoaOffset() == 1000, "recalibrated offset %d", getPdoaOffset());
+	CHECK(bearing.pdoa == 0, "pdoa %d after recalibration", bearing.pdoa);
+
+	/* dwt_configure clears the chip's offset, the next frame is measured without it. */
+	chipOffset = 0;
+	pdoaConfigured();
+	captureBearing(&bearing, DWT_PDOA_M1, 5);
+	CHECK(bearing.pdoa == 0, "pdoa %d after a reconfiguration", bearing.pdoa);
+	CHECK(chipOffset == 1000, "offset %d not rewritten after a reconfiguration", chipOffset);
+}
+
+/* Offsets that wrap the phase past pi, one frame before and one after the write. */
+static void testWrappedOffset() {
+	struct Bearing bearing = { .azimuth = AZIMUTH_INVALID };
+
+	for (int32_t offset = -PI_Q11; offset < PI_Q11; offset += 97) {
+		for (int32_t phase = -PI_Q11; phase < PI_Q11; phase += 89) {
+			int16_t expected = wrap(phase - offset);
+
+			antennaPhase = phase;
+			chipOffset = 0;
+			pdoaConfigured();
+			setPdoaOffset(offset);
+
+			captureBearing(&bearing, DWT_PDOA_M1, 5);
+			CHECK(bearing.pdoa == expected, "pdoa %d before the write, phase %d offset %d", bearing.pdoa, phase, offset);
+			CHECK(getLastRawPdoa() == wrap(phase), "raw pdoa %d before the write, phase %d", getLastRawPdoa(), phase);
+
+			captureBearing(&bearing, DWT_PDOA_M1, 5);
+			CHECK(bearing.pdoa == expected, "pdoa %d after the write, phase %d offset %d", bearing.pdoa, phase, offset);
+			CHECK(getLastRawPdoa() == wrap(phase), "raw pdoa %d after the write, phase %d", getLastRawPdoa(), phase);
+		}
+	}
+}
+
+/* At half a wavelength the azimuth is asin(phase / pi), without ambiguity. */
+static void testAzimuth() {
+	struct Bearing bearing;
+	int worst = 0;
+
+	for (int32_t phase = -PI_Q11; phase < PI_Q11; phase++) {
+		double sine = fmin(fmax(phase / (double)PI_Q11 * (WAVELENGTH / 2.0) / SPACING, -1.0), 1.0);
+		int expected = (int)lround(asin(sine) * 18000 / M_PI);
+
+		bearingFromPdoa(phase, WAVELENGTH, SPACING, AZIMUTH_INVALID, &bearing);
+		worst = MAX(worst, abs(bearing.azimuth - expected));
+	}
+
+	printf("azimuth: worst error %d.%02d degree\n", worst / 100, worst % 100);
+	CHECK(worst <= AZIMUTH_BOUND, "azimuth off by %d", worst);
+}
+
+static void testNoPdoa() {
+	struct Bearing bearing = { .azimuth = 0 };
+	int writes = offsetWrites;
+
+	captureBearing(&bearing, DWT_PDOA_M0, 5);
+	CHECK(bearing.azimuth == AZIMUTH_INVALID, "azimuth %d without PDOA", bearing.azimuth);
+	CHECK(offsetWrites == writes, "offset written without PDOA");
+}
+
+int main() {
+	testCalibration();
+	testWrappedOffset();
+	testAzimuth();
+	testNoPdoa();
+
+	return testFailures;
+}
@@ -0,0 +1,125 @@
+#include <string.h>
+
+#include <deca_device_api.h>
+
+#include "Test.h"
+#include "DeviceTime.h"
+
+#define WRAP (1ULL << 40)
+#define HALF (1ULL << 39)
+#define RANDOM_SAMPLES 1000000
+
+/* The chip as DeviceTime.c reads it, low byte first. */
+static uint8_t rxTimeStamp[DEVICE_TIME_LENGTH];
+
+void dwt_readrxtimestamp(uint8_t *timestamp) {
+	memcpy(timestamp, rxTimeStamp, DEVICE_TIME_LENGTH);
+}
+
+void dwt_readtxtimestamp(uint8_t *timestamp) {
+	memset(timestamp, 0, DEVICE_TIME_LENGTH);
+}
+
+/* Every pair of these exercises the wrap from both sides. */
+static const uint64_t boundaries[] = {
+	0, 1, 2, 0xFF, 0x100, HALF - 1, HALF, HALF + 1, WRAP - 2, WRAP - 1
+};
+
+static void testBoundaries() {
+	for (size_t i = 0; i < sizeof(boundaries) / sizeof(boundaries[0]); i++) {
+		for (size_t j = 0; j < sizeof(boundaries) / sizeof(boundaries[0]); j++) {
+			DeviceTime time = boundaries[i];
+			uint64_t duration = boundaries[j];
+			DeviceTime later = deviceTimeAdd(time, duration);
+			int64_t expected = duration >= HALF ? (int64_t)duration - (int64_t)WRAP : (int64_t)duration;
+
+			CHECK(later < WRAP, "add %llx + %llx left 40 bits", (unsigned long long)time, (unsigned long long)duration);
+			CHECK(later == ((time + duration) & (WRAP - 1)), "add %llx + %llx", (unsigned long long)time, (unsigned long long)duration);
+			CHECK(deviceTimeDiff(later, time) == duration, "diff after add %llx + %llx", (unsigned long long)time, (unsigned long long)duration);
+			CHECK(deviceTimeSignedDiff(later, time) == expected, "signed diff after add %llx + %llx", (unsigned long long)time, (unsigned long long)duration);
+			CHECK(deviceTimeBefore(time, later) == (duration > 0 && duration <= HALF), "before after add %llx + %llx", (unsigned long long)time, (unsigned long long)duration);
+		}
+	}
+
+	CHECK(deviceTimeDiff(0, WRAP - 1) == 1, "diff across the wrap");
+	CHECK(deviceTimeDiff(WRAP - 1, 0) == WRAP - 1, "diff of the whole range");
+	CHECK(deviceTimeAdd(WRAP - 1, 1) == 0, "add across the wrap");
+	CHECK(deviceTimeAdd(12345, WRAP) == 12345, "add of a whole wrap");
+	CHECK(deviceTimeSignedDiff(0, WRAP - 1) == 1, "signed diff across the wrap");
+	CHECK(deviceTimeSignedDiff(WRAP - 1, 0) == -1, "signed diff backwards across the wrap");
+	CHECK(deviceTimeSignedDiff(HALF, 0) == -(int64_t)HALF, "exactly half the wrap is negative");
+	CHECK(deviceTimeSignedDiff(0, HALF) == -(int64_t)HALF, "exactly half the wrap is negative both ways");
+	CHECK(deviceTimeSignedDiff(HALF - 1, 0) == (int64_t)HALF - 1, "just below half the wrap");
+	CHECK(deviceTimeBefore(WRAP - 1, 0), "before across the wrap");
+	CHECK(!deviceTimeBefore(0, WRAP - 1), "not before across the wrap");
+	CHECK(!deviceTimeBefore(5, 5), "a time is not before itself");
+}
+
+/* Times with bits above 40 come out of the helpers masked. */
+static void testUpperBits() {
+	CHECK(deviceTimeDiff(WRAP + 5, 3) == 2, "diff ignores bits above 40");
+	CHECK(deviceTimeAdd(WRAP + 5, WRAP + 3) == 8, "add ignores bits above 40");
+	CHECK(deviceTimeSignedDiff(3, WRAP + 5) == -2, "signed diff ignores bits above 40");
+}
+
+static void testRandom() {
+	for (int i = 0; i < RANDOM_SAMPLES; i++) {
+		DeviceTime time = randomBelow(WRAP);
+		uint64_t duration = randomBelow(WRAP);
+		DeviceTime later = deviceTimeAdd(time, duration);
+
+		CHECK(deviceTimeDiff(later, time) == duration, "diff after add %llx + %llx", (unsigned long long)time, (unsigned long long)duration);
+		CHECK(deviceTimeAdd(later, WRAP - duration) == time, "add of the complement %llx + %llx", (unsigned long long)time, (unsigned long long)duration);
+		CHECK(deviceTimeSignedDiff(later, time) == -deviceTimeSignedDiff(time, later) || duration == HALF,
+			"signed diff antisymmetric %llx + %llx", (unsigned long long)time, (unsigned long long)duration);
+	}
+}
+
+static void testBytes() {
+	uint8_t bytes[DEVICE_TIME_LENGTH];
+	const uint8_t maximum[DEVICE_TIME_LENGTH] = { 0xFF, 0xFF, 0xFF, 0xFF, 0xFF };
+	const uint8_t ordered[DEVICE_TIME_LENGTH] = { 0x01, 0x02, 0x03, 0x04, 0x05 };
+
+	CHECK(deviceTimeFromBytes(maximum) == WRAP - 1, "all ones");
+	CHECK(deviceTimeFromBytes(ordered) == 0x0504030201ULL, "little endian");
+
+	for (size_t i = 0; i < sizeof(boundaries) / sizeof(boundaries[0]); i++) {
+		deviceTimeToBytes(boundaries[i], bytes);
+		CHECK(deviceTimeFromBytes(bytes) == boundaries[i], "bytes round trip of %llx", (unsigned long long)boundaries[i]);
+	}
+
+	memcpy(rxTimeStamp, ordered, DEVICE_TIME_LENGTH);
+	CHECK(readRxTimeStamp() == 0x0504030201ULL, "RX timestamp in one read");
+}
+
+static void testConversions() {
+	CHECK(deviceTimeToPicoseconds(4992) == 78125, "exact picoseconds");
+	CHECK(deviceTimeToPicoseconds(WRAP - 1) == (uint64_t)((unsigned __int128)(WRAP - 1) * 78125 / 4992), "picoseconds of the whole range");
+	CHECK(microsecondsToDeviceTime(5) == 319488, "exact device time");
+	CHECK(deviceTimeToMicroseconds(319488) == 5, "exact microseconds");
+	CHECK(deviceTimeToMicroseconds(WRAP - 1) == 17207401, "microseconds of the whole range");
+}
+
+/* The chip drops the low 9 bits of the start, the TX timestamp then adds the antenna delay. */
+static void testDelayedTx() {
+	DeviceTime reference = WRAP - 1000;
+	DeviceTime txTimeStamp;
+	uint32_t txTime = delayedTxTime(reference, 1000, 16385, &txTimeStamp);
+	DeviceTime start = deviceTimeAdd(reference, microsecondsToDeviceTime(1000));
+
+	CHECK(start < reference, "the start wraps");
+	CHECK(txTime == (uint32_t)(start >> 8), "register value");
+	CHECK(txTimeStamp == deviceTimeAdd(start & ~0x1FFULL, 16385), "TX timestamp");
+	CHECK(deviceTimeDiff(txTimeStamp, reference) <= microsecondsToDeviceTime(1000) + 16385, "TX timestamp after the reference");
+}
+
+int main() {
+	testBoundaries();
+	testUpperBits();
+	testRandom();
+	testBytes();
+	testConversions();
+	testDelayedTx();
+
+	return testFailures;
+}
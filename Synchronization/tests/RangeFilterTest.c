@@ -0,0 +1,193 @@
+#include <stdlib.h>
+#include <math.h>
+#include <zephyr.h>
+
+#include "Test.h"
+#include "RangeFilter.h"
+
+#define PEER 0x1234
+#define SAMPLES 2000
+
+/* Noise of the noisy runs, uniform in +-NOISE mm. */
+#define NOISE 50
+
+/* Parameters of RangeFilter.c, for the reference. */
+#define MEASUREMENT_VARIANCE (50.0 * 50.0)
+#define ACCELERATION_VARIANCE (2000.0 * 2000.0)
+#define INNOVATION_LIMIT (1 << 20)
+
+/* Error of the fixed point filter against the double one, mm and mm/s, most of it from whole unit covariances at 10 ms. */
+#define DISTANCE_BOUND 2
+#define VELOCITY_BOUND 4
+
+/* The same median and constant velocity Kalman filter in double. */
+struct reference {
+	int count;
+	int32_t window[RANGE_FILTER_MEDIAN_WINDOW];
+	double position;
+	double velocity;
+	double p00, p01, p11;
+};
+
+static void referenceRange(struct reference *filter, int32_t distance, double dt) {
+	int32_t sorted[RANGE_FILTER_MEDIAN_WINDOW];
+	int length = MIN(filter->count + 1, RANGE_FILTER_MEDIAN_WINDOW);
+	double measurement, p00, p01, p11, variance, positionGain, velocityGain, innovation;
+
+	filter->window[filter->count++ % RANGE_FILTER_MEDIAN_WINDOW] = distance;
+	memcpy(sorted, filter->window, sizeof(sorted));
+	for (int i = 1; i < length; i++) {
+		for (int j = i; j > 0 && sorted[j - 1] > sorted[j]; j--) {
+			int32_t swap = sorted[j];
+			sorted[j] = sorted[j - 1];
+			sorted[j - 1] = swap;
+		}
+	}
+	measurement = sorted[length / 2];
+
+	if (filter->count == 1) {
+		filter->position = measurement;
+		filter->velocity = 0;
+		filter->p00 = MEASUREMENT_VARIANCE;
+		filter->p01 = 0;
+		filter->p11 = 1e6;
+		return;
+	}
+
+	filter->position += filter->velocity * dt;
+	p00 = filter->p00 + 2 * filter->p01 * dt + filter->p11 * dt * dt + ACCELERATION_VARIANCE * pow(dt, 4) / 4;
+	p01 = filter->p01 + filter->p11 * dt + ACCELERATION_VARIANCE * pow(dt, 3) / 2;
+	p11 = filter->p11 + ACCELERATION_VARIANCE * dt * dt;
+
+	variance = p00 + MEASUREMENT_VARIANCE;
+	positionGain = p00 / variance;
+	velocityGain = p01 / variance;
+	innovation = fmin(fmax(measurement - filter->position, -INNOVATION_LIMIT), INNOVATION_LIMIT);
+
+	filter->position += positionGain * innovation;
+	filter->velocity += velocityGain * innovation;
+	filter->p00 = p00 * (1 - positionGain);
+	filter->p01 = p01 * (1 - positionGain);
+	filter->p11 = p11 - velocityGain * p01;
+}
+
+/* Uniform in [-noise, noise]. */
+static int32_t randomNoise(int32_t noise) {
+	return (int32_t)randomBelow(2 * noise + 1) - noise;
+}
+
+/*
+ * A static target ranged every dt ms, up to the longest gap the filter
+ * predicts across. Without noise it must stay still, with noise it must
+ * follow the double filter.
+ */
+static void testStatic(uint32_t dt, int32_t distance, int32_t noise) {
+	struct reference reference = { 0 };
+	struct FilteredRange output;
+	uint32_t time = 0xFFFF0000;    /* wraps during the run */
+	double worstDistance = 0;
+	double worstVelocity = 0;
+	int32_t largestVelocity = 0;
+
+	resetRangeFilters();
+	setFilterDecimation(1);
+
+	for (int i = 0; i < SAMPLES; i++, time += dt) {
+		int32_t measured = distance + randomNoise(noise);
+
+		CHECK(filterRange(PEER, measured, time, &output), "no output at dt %u", dt);
+		referenceRange(&reference, measured, dt / 1000.0);
+
+		worstDistance = fmax(worstDistance, fabs(output.distance - reference.position));
+		worstVelocity = fmax(worstVelocity, fabs(output.velocity - reference.velocity));
+		largestVelocity = MAX(largestVelocity, abs(output.velocity));
+	}
+
+	printf(
+		"static at %d mm +-%d, dt %u ms: %.1f mm, %.1f mm/s from the reference, velocity up to %d mm/s\n",
+		distance, noise, dt, worstDistance, worstVelocity, largestVelocity
+	);
+	CHECK(worstDistance <= DISTANCE_BOUND, "distance off by %.1f mm at dt %u", worstDistance, dt);
+	CHECK(worstVelocity <= VELOCITY_BOUND, "velocity off by %.1f mm/s at dt %u", worstVelocity, dt);
+
+	if (noise == 0) {
+		CHECK(largestVelocity == 0, "static target moving at %d mm/s at dt %u", largestVelocity, dt);
+		CHECK(output.distance == distance, "static target at %d mm at dt %u", output.distance, dt);
+	}
+}
+
+/* A peer walking away at 1.5 m/s, ranged every 100 ms. */
+static void testMoving() {
+	struct reference reference = { 0 };
+	struct FilteredRange output;
+	uint32_t time = 0;
+
+	resetRangeFilters();
+
+	for (int i = 0; i < SAMPLES; i++, time += 100) {
+		int32_t measured = 1000 + 150 * i + randomNoise(NOISE);
+
+		filterRange(PEER, measured, time, &output);
+		referenceRange(&reference, measured, 0.1);
+	}
+
+	printf("moving at 1500 mm/s: %d mm/s, reference %.1f mm/s\n", output.velocity, reference.velocity);
+	CHECK(fabs(output.velocity - reference.velocity) <= VELOCITY_BOUND, "moving target at %d mm/s", output.velocity);
+	CHECK(fabs(output.distance - reference.position) <= DISTANCE_BOUND, "moving target at %d mm", output.distance);
+	CHECK(abs(output.velocity - 1500) <= 100, "moving target at %d mm/s", output.velocity);
+}
+
+/*
+ * Ranges jumping across the whole span at the longest gap, the worst case
+ * of the bounds in RangeFilter.c. The innovation clamp makes the filter
+ * chaotic here, so only garbage is checked for, the sanitizer catches the
+ * overflows themselves.
+ */
+static void testExtremes() {
+	struct FilteredRange output;
+	uint32_t time = 0;
+	int32_t largestDistance = 0;
+	int32_t largestVelocity = 0;
+
+	resetRangeFilters();
+
+	for (int i = 0; i < SAMPLES; i++, time += 5000) {
+		filterRange(PEER, (int32_t)randomBelow(1 << 20), time, &output);
+		largestDistance = MAX(largestDistance, abs(output.distance));
+		largestVelocity = MAX(largestVelocity, abs(output.velocity));
+	}
+
+	printf("jumping at dt 5000 ms: distance up to %d mm, velocity up to %d mm/s\n", largestDistance, largestVelocity);
+	CHECK(largestDistance < 4 << 20, "jumping target at %d mm", largestDistance);
+	CHECK(largestVelocity < 1 << 20, "jumping target at %d mm/s", largestVelocity);
+}
+
+/* A gap past the reset restarts the filter at the new distance, with no velocity from the jump. */
+static void testReset() {
+	struct FilteredRange output;
+
+	resetRangeFilters();
+	filterRange(PEER, 1000, 0, &output);
+	filterRange(PEER, 1000, 100, &output);
+	filterRange(PEER, 50000, 100 + 5001, &output);
+
+	CHECK(output.distance == 50000, "no restart, %d mm", output.distance);
+	CHECK(output.velocity == 0, "velocity %d mm/s after restart", output.velocity);
+}
+
+int main() {
+	static const uint32_t gaps[] = { 10, 100, 1000, 4600, 4999, 5000 };
+
+	for (size_t i = 0; i < ARRAY_SIZE(gaps); i++) {
+		testStatic(gaps[i], 10000, 0);
+		testStatic(gaps[i], 300000, 0);
+		testStatic(gaps[i], 10000, NOISE);
+		testStatic(gaps[i], 300000, NOISE);
+	}
+
+	testMoving();
+	testExtremes();
+	testReset();
+
+	return testFailures;
+}
@@ -0,0 +1,35 @@
+#ifndef MJ_TEST
+#define MJ_TEST
+
+#include <stdint.h>
+#include <stdio.h>
+
+/* Counts failed checks, main returns the count so ctest sees the failure. */
+static int testFailures;
+
+#define CHECK(condition, ...) \
+	do { \
+		if (!(condition)) { \
+			testFailures++; \
+			printf("%s:%d: %s failed: ", __FILE__, __LINE__, #condition); \
+			printf(__VA_ARGS__); \
+			printf("\n"); \
+		} \
+	} while (0)
+
+/* xorshift64*, the same sequence every run so failures reproduce. */
+static uint64_t randomState = 0x9E3779B97F4A7C15ULL;
+
+static inline uint64_t randomBits() {
+	randomState ^= randomState >> 12;
+	randomState ^= randomState << 25;
+	randomState ^= randomState >> 27;
+	return randomState * 0x2545F4914F6CDD1DULL;
+}
+
+/* Uniform in [0, limit). */
+static inline uint64_t randomBelow(uint64_t limit) {
+	return randomBits() % limit;
+}
+
+#endif
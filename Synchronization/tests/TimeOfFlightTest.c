@@ -0,0 +1,93 @@
+#include <math.h>
+
+#include "Test.h"
+#include "TimeOfFlight.h"
+
+#define SAMPLES 200000
+
+/* 40-bit durations, the 128-bit path takes everything from 2^31 up. */
+#define DURATION_LIMIT (1ULL << 40)
+#define SHORT_DURATION_LIMIT (1ULL << 31)
+
+/* Up to ~470 m and crystals within +-20 ppm of each other. */
+#define TIME_OF_FLIGHT_LIMIT 100000
+#define DRIFT_LIMIT 20e-6
+
+/*
+ * The integer results are rounded to nearest, the double formula is exact
+ * to far below that. SS-TWR truncates reply * clockOffset / 2^26, up to one
+ * device time unit of the round trip (~2.35 mm of the distance) on top.
+ */
+#define DS_TWR_BOUND 0.501
+#define SS_TWR_BOUND 2.9
+
+static double millimetres(long double units) {
+	return (double)(units * TOF_SPEED_OF_LIGHT / TOF_UNITS_PER_MILLISECOND);
+}
+
+/* The reference keeps the numerator exact in 128 bits, the division in long double. */
+static double dsTwrReference(uint64_t firstLoop, uint64_t firstReply, uint64_t secondLoop, uint64_t secondReply) {
+	__int128 numerator = (__int128)firstLoop * secondLoop - (__int128)firstReply * secondReply;
+
+	return millimetres((long double)numerator / (long double)(firstLoop + firstReply + secondLoop + secondReply));
+}
+
+static void testDsTwr(uint64_t replyLimit) {
+	double worst = 0;
+
+	for (int i = 0; i < SAMPLES; i++) {
+		uint64_t timeOfFlight = randomBelow(TIME_OF_FLIGHT_LIMIT);
+		double drift = ((double)randomBelow(2000001) / 1000000 - 1) * DRIFT_LIMIT;
+		uint64_t firstReply = randomBelow(replyLimit - 4 * TIME_OF_FLIGHT_LIMIT);
+		uint64_t secondReply = randomBelow(replyLimit - 4 * TIME_OF_FLIGHT_LIMIT);
+
+		/* The initiator's loops are seen on its clock, the responder's replies on the drifting one. */
+		uint64_t firstLoop = (uint64_t)llround((2 * timeOfFlight + firstReply) * (1 + drift));
+		uint64_t secondLoop = (uint64_t)llround((2 * timeOfFlight + secondReply / (1 + drift)));
+		int32_t distance = dsTwrDistance(firstLoop, firstReply, secondLoop, secondReply);
+		double error = fabs(distance - dsTwrReference(firstLoop, firstReply, secondLoop, secondReply));
+
+		worst = fmax(worst, error);
+		CHECK(error <= DS_TWR_BOUND, "loops %llu %llu replies %llu %llu: %d mm, off by %.3f mm",
+			(unsigned long long)firstLoop, (unsigned long long)secondLoop,
+			(unsigned long long)firstReply, (unsigned long long)secondReply, distance, error);
+	}
+
+	printf("DS-TWR replies below 2^%d: worst error %.3f mm\n", (int)log2((double)replyLimit), worst);
+}
+
+static void testSsTwr() {
+	double worst = 0;
+
+	for (int i = 0; i < SAMPLES; i++) {
+		uint64_t timeOfFlight = randomBelow(TIME_OF_FLIGHT_LIMIT);
+		uint64_t reply = randomBelow(SHORT_DURATION_LIMIT);
+		int16_t clockOffset = (int16_t)(randomBelow(2 * 1342 + 1) - 1342);
+		long double responderReply = (long double)reply * (1 - clockOffset / (long double)(1 << 26));
+		uint64_t roundTrip = (uint64_t)llroundl(2 * timeOfFlight + responderReply);
+		int32_t distance = ssTwrDistance(roundTrip, reply, clockOffset);
+		double error = fabs(distance - millimetres((roundTrip - responderReply) / 2));
+
+		worst = fmax(worst, error);
+		CHECK(error <= SS_TWR_BOUND, "round trip %llu reply %llu offset %d: %d mm, off by %.3f mm",
+			(unsigned long long)roundTrip, (unsigned long long)reply, clockOffset, distance, error);
+	}
+
+	printf("SS-TWR: worst error %.3f mm\n", worst);
+}
+
+static void testEdges() {
+	CHECK(dsTwrDistance(0, 0, 0, 0) == 0, "empty exchange");
+	CHECK(dsTwrTimeOfFlight(1000, 600, 1000, 600) == 200, "symmetric exchange");
+	CHECK(dsTwrDistance(600, 1000, 600, 1000) < 0, "negative time of flight keeps its sign");
+	CHECK(dsTwrDistance(DURATION_LIMIT - 1, 0, DURATION_LIMIT - 1, 0) == INT32_MAX, "saturates");
+}
+
+int main() {
+	testDsTwr(SHORT_DURATION_LIMIT);
+	testDsTwr(DURATION_LIMIT);
+	testSsTwr();
+	testEdges();
+
+	return testFailures;
+}
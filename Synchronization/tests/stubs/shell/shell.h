@@ -0,0 +1,20 @@
+#ifndef MJ_TEST_SHELL
+#define MJ_TEST_SHELL
+
+/* Shell commands only keep their handlers referenced, the tests call the functions behind them. */
+#include <errno.h>
+#include <stddef.h>
+#include <stdio.h>
+
+struct shell;
+
+#define shell_print(shell, format, ...) printf(format "\n", ##__VA_ARGS__)
+#define shell_error(shell, format, ...) printf(format "\n", ##__VA_ARGS__)
+
+#define SHELL_CMD_ARG(syntax, subcommands, help, handler, mandatory, optional) (const void *)(handler)
+#define SHELL_CMD(syntax, subcommands, help, handler) (const void *)(handler)
+#define SHELL_SUBCMD_SET_END NULL
+#define SHELL_STATIC_SUBCMD_SET_CREATE(name, ...) static const void *const name[] __attribute__((unused)) = { __VA_ARGS__ }
+#define SHELL_CMD_REGISTER(name, subcommands, help, handler) extern const void *const name##Command
+
+#endif
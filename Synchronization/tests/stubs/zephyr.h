@@ -0,0 +1,21 @@
+#ifndef MJ_TEST_ZEPHYR
+#define MJ_TEST_ZEPHYR
+
+/* The parts of the kernel header the kernels under test use. */
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+#define printk printf
+#define snprintk snprintf
+
+#define MIN(a, b) (((a) < (b)) ? (a) : (b))
+#define MAX(a, b) (((a) > (b)) ? (a) : (b))
+#define CLAMP(value, low, high) (((value) <= (low)) ? (low) : (((value) >= (high)) ? (high) : (value)))
+#define ARRAY_SIZE(array) (sizeof(array) / sizeof((array)[0]))
+#define BIT(n) (1UL << (n))
+#define BUILD_ASSERT(condition, ...) _Static_assert(condition, "" __VA_ARGS__)
+
+#endif
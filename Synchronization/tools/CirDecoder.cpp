@@ -0,0 +1,159 @@
+/*
+ * Reassembles the CIR captures of the binary telemetry and upsamples them
+ * with a windowed sinc, one CSV row per interpolated sample.
+ *
+ *   g++ -std=c++17 -O2 -o CirDecoder CirDecoder.cpp
+ *   ./CirDecoder [-u factor] [file] < /dev/ttyACM0 > cir.csv
+ */
+#include <algorithm>
+#include <cmath>
+#include <complex>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <map>
+
+#include "TelemetryFrame.h"
+
+constexpr uint8_t RECORD_CIR = 0x02;
+constexpr size_t CIR_HEADER_LENGTH = 15;
+constexpr size_t SAMPLE_LENGTH = 6;
+
+/* Accumulator sample spacing, half a 499.2 MHz chip. */
+constexpr double TAP_NANOSECONDS = 1e9 / (2 * 499.2e6);
+
+/* Taps on each side of an interpolated point. */
+constexpr int SINC_HALF_WIDTH = 8;
+
+struct Capture {
+	unsigned peer;
+	unsigned sequence;
+	unsigned firstPathIndex;
+	unsigned firstTap;
+	size_t received = 0;
+	std::vector<std::complex<double>> samples;
+};
+
+static int32_t signExtend18(uint64_t value) {
+	return int32_t(uint32_t(value << 14)) >> 14;
+}
+
+static double sinc(double x) {
+	return x == 0 ? 1 : std::sin(M_PI * x) / (M_PI * x);
+}
+
+/* Band limited interpolation, a Lanczos window keeps the ringing of the truncated sinc down. */
+static std::complex<double> interpolate(const std::vector<std::complex<double>> &samples, double position) {
+	std::complex<double> sum = 0;
+	int centre = int(std::floor(position));
+
+	for (int i = centre - SINC_HALF_WIDTH + 1; i <= centre + SINC_HALF_WIDTH; i++) {
+		if (i < 0 || i >= int(samples.size())) {
+			continue;
+		}
+
+		double x = position - i;
+		sum += samples[i] * sinc(x) * sinc(x / SINC_HALF_WIDTH);
+	}
+
+	return sum;
+}
+
+static void writeCapture(unsigned number, const Capture &capture, unsigned factor) {
+	double firstPath = capture.firstPathIndex / 64.0 * TAP_NANOSECONDS;
+
+	for (size_t i = 0; i < capture.samples.size() * factor; i++) {
+		double position = double(i) / factor;
+		std::complex<double> sample = interpolate(capture.samples, position);
+
+		std::cout << number << ",0x" << std::hex << capture.peer << std::dec << "," << capture.sequence << "," << firstPath
+		          << "," << (capture.firstTap + position) * TAP_NANOSECONDS
+		          << "," << sample.real() << "," << sample.imag() << "," << std::abs(sample) << "\n";
+	}
+}
+
+int main(int argc, char *argv[]) {
+	std::ifstream file;
+	std::istream *input = &std::cin;
+	std::map<unsigned, Capture> captures;
+	unsigned factor = 8;
+	size_t corrupted = 0;
+	size_t completed = 0;
+	size_t incomplete = 0;
+
+	for (int i = 1; i < argc; i++) {
+		if (std::strcmp(argv[i], "-u") == 0 && i + 1 < argc) {
+			factor = std::max(1, std::atoi(argv[++i]));
+			continue;
+		}
+
+		file.open(argv[i], std::ios::binary);
+		if (!file) {
+			std::cerr << "Cannot open " << argv[i] << "\n";
+			return 1;
+		}
+		input = &file;
+	}
+
+	std::cout << "capture,peer,sequence,first_path_ns,time_ns,real,imag,magnitude\n";
+
+	while (auto frame = telemetry::readFrame(*input, corrupted)) {
+		const uint8_t *data = frame->data();
+
+		if (frame->size() < CIR_HEADER_LENGTH || data[0] != RECORD_CIR) {
+			continue;
+		}
+
+		unsigned number = telemetry::readLittleEndian(data + 1, 2);
+		size_t totalTaps = telemetry::readLittleEndian(data + 10, 2);
+		size_t offset = telemetry::readLittleEndian(data + 12, 2);
+		size_t taps = data[14];
+
+		if (frame->size() != CIR_HEADER_LENGTH + taps * SAMPLE_LENGTH || offset + taps > totalTaps) {
+			corrupted++;
+			continue;
+		}
+
+		/* Chunks of a capture arrive in order, an older unfinished capture lost a chunk. */
+		for (auto it = captures.begin(); it != captures.end();) {
+			if (it->first != number) {
+				incomplete++;
+				it = captures.erase(it);
+			} else {
+				it++;
+			}
+		}
+
+		Capture &capture = captures[number];
+
+		if (capture.samples.empty()) {
+			capture.peer = telemetry::readLittleEndian(data + 3, 2);
+			capture.sequence = data[5];
+			capture.firstPathIndex = telemetry::readLittleEndian(data + 6, 2);
+			capture.firstTap = telemetry::readLittleEndian(data + 8, 2);
+			capture.samples.resize(totalTaps);
+		}
+
+		for (size_t i = 0; i < taps; i++) {
+			const uint8_t *sample = data + CIR_HEADER_LENGTH + i * SAMPLE_LENGTH;
+
+			capture.samples[offset + i] = {
+				double(signExtend18(telemetry::readLittleEndian(sample, 3))),
+				double(signExtend18(telemetry::readLittleEndian(sample + 3, 3)))
+			};
+		}
+
+		capture.received += taps;
+
+		if (capture.received == capture.samples.size()) {
+			writeCapture(number, capture, factor);
+			captures.erase(number);
+			completed++;
+		}
+	}
+
+	std::cerr << completed << " captures, " << incomplete + captures.size() << " incomplete, " << corrupted << " corrupted frames\n";
+
+	return 0;
+}
@@ -0,0 +1,481 @@
+/*
+ * Positions TDoA tags from the blink telemetry of the anchors. The anchor
+ * clocks are related to the reference anchor through its blinks: every
+ * anchor's timestamps are interpolated between the two reference blinks
+ * around them, then each tag blink is solved for position and emission time
+ * by Gauss-Newton on the hyperbolic equations.
+ *
+ *   g++ -std=c++17 -O2 -o TdoaSolver TdoaSolver.cpp
+ *   ./TdoaSolver [-r reference] [-z height] [-3] anchors.txt anchor1.bin [anchor2.bin ...] > positions.csv
+ *
+ * anchors.txt holds one "address x y z" line per anchor in metres, the first
+ * anchor is the reference unless -r names another. Without -3 the tags are
+ * solved in 2D at the given height.
+ */
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <map>
+#include <sstream>
+#include <vector>
+
+#include "TelemetryFrame.h"
+
+constexpr uint8_t RECORD_BLINK = 0x03;
+constexpr size_t BLINK_RECORD_LENGTH = 11;
+
+constexpr double SPEED_OF_LIGHT = 299702547;
+constexpr double DEVICE_TIME_UNIT = 1.0 / (128 * 499.2e6);
+constexpr int64_t DEVICE_TIME_WRAP = int64_t(1) << 40;
+
+/* Arrivals of one blink at different anchors lie within this, in seconds. */
+constexpr double GROUP_WINDOW = 1e-3;
+
+/* Reference intervals seen by an anchor and sent by the reference agree within crystal tolerance. */
+constexpr double INTERVAL_TOLERANCE = 1e-4;
+
+constexpr int MAX_ITERATIONS = 50;
+
+struct Position {
+	double x;
+	double y;
+	double z;
+};
+
+struct Blink {
+	unsigned tag;
+	unsigned sequence;
+	int64_t sequenceCount;         /* sequence number unwrapped over the stream of this tag */
+	int64_t time;                  /* local device time unwrapped over the stream */
+};
+
+struct SyncPoint {
+	int64_t local;
+	double reference;              /* arrival of the reference blink in reference device time */
+};
+
+struct Arrival {
+	unsigned tag;
+	unsigned sequence;
+	unsigned anchor;
+	double time;                   /* reference device time */
+};
+
+struct Fix {
+	double time;
+	unsigned tag;
+	unsigned sequence;
+	size_t anchors;
+	Position position;
+	double rms;
+};
+
+static double distance(const Position &a, const Position &b) {
+	return std::sqrt((a.x - b.x) * (a.x - b.x) + (a.y - b.y) * (a.y - b.y) + (a.z - b.z) * (a.z - b.z));
+}
+
+static bool readAnchors(const char *path, std::map<unsigned, Position> &anchors, unsigned &firstAnchor) {
+	std::ifstream file(path);
+	std::string line;
+
+	if (!file) {
+		std::cerr << "Cannot open " << path << "\n";
+		return false;
+	}
+
+	while (std::getline(file, line)) {
+		std::istringstream fields(line);
+		std::string address;
+		Position position;
+
+		if (line.empty() || line[0] == '#' || !(fields >> address >> position.x >> position.y >> position.z)) {
+			continue;
+		}
+
+		unsigned value = std::strtoul(address.c_str(), nullptr, 0);
+		if (anchors.empty()) {
+			firstAnchor = value;
+		}
+		anchors[value] = position;
+	}
+
+	return !anchors.empty();
+}
+
+/* Appends the blinks of one telemetry stream to the anchors that saw them, unwrapping time and sequence numbers. */
+static void readBlinks(std::istream &input, std::map<unsigned, std::vector<Blink>> &blinks, size_t &corrupted) {
+	std::map<unsigned, int64_t> lastTime;
+	std::map<std::pair<unsigned, unsigned>, int64_t> lastSequence;
+
+	while (auto frame = telemetry::readFrame(input, corrupted)) {
+		const uint8_t *data = frame->data();
+
+		if (frame->size() != BLINK_RECORD_LENGTH || data[0] != RECORD_BLINK) {
+			continue;
+		}
+
+		unsigned anchor = telemetry::readLittleEndian(data + 1, 2);
+		unsigned tag = telemetry::readLittleEndian(data + 3, 2);
+		unsigned sequence = data[5];
+		int64_t raw = telemetry::readLittleEndian(data + 6, 5);
+
+		auto time = lastTime.find(anchor);
+		int64_t unwrapped = raw;
+		if (time != lastTime.end()) {
+			int64_t step = (raw - time->second) & (DEVICE_TIME_WRAP - 1);
+			unwrapped = time->second + step;
+		}
+		lastTime[anchor] = unwrapped;
+
+		auto key = std::make_pair(anchor, tag);
+		auto previous = lastSequence.find(key);
+		int64_t sequenceCount = sequence;
+		if (previous != lastSequence.end()) {
+			sequenceCount = previous->second + ((sequence - previous->second) & 0xFF);
+		}
+		lastSequence[key] = sequenceCount;
+
+		blinks[anchor].push_back({ tag, sequence, sequenceCount, unwrapped });
+	}
+}
+
+/*
+ * Pairs the reference blinks an anchor received with the ones the reference
+ * sent. Both sides unwrap the 8-bit sequence number from their first blink,
+ * so the streams may be a multiple of 256 apart, the shift whose intervals
+ * agree best wins.
+ */
+static std::vector<SyncPoint> synchronize(
+	const std::vector<Blink> &received, const std::map<int64_t, int64_t> &sent, double propagation, unsigned reference
+) {
+	std::vector<SyncPoint> best;
+
+	for (int64_t shift = -512; shift <= 512; shift += 256) {
+		std::vector<SyncPoint> points;
+		const Blink *previous = nullptr;
+		int64_t previousSent = 0;
+		size_t consistent = 0;
+
+		for (const Blink &blink : received) {
+			if (blink.tag != reference) {
+				continue;
+			}
+
+			auto match = sent.find(blink.sequenceCount + shift);
+			if (match == sent.end()) {
+				continue;
+			}
+
+			if (previous != nullptr) {
+				double localInterval = double(blink.time - previous->time);
+				double sentInterval = double(match->second - previousSent);
+
+				if (std::abs(localInterval - sentInterval) <= INTERVAL_TOLERANCE * std::abs(sentInterval)) {
+					consistent++;
+				}
+			}
+
+			points.push_back({ blink.time, double(match->second) + propagation });
+			previous = &blink;
+			previousSent = match->second;
+		}
+
+		if (consistent + 1 > best.size()) {
+			best = points;
+		}
+	}
+
+	return best;
+}
+
+/* Local time in reference device time, by interpolation between the reference blinks around it. */
+static bool toReference(const std::vector<SyncPoint> &points, int64_t local, double &reference) {
+	auto after = std::lower_bound(points.begin(), points.end(), local, [](const SyncPoint &point, int64_t time) {
+		return point.local < time;
+	});
+
+	if (after == points.begin() || after == points.end()) {
+		return false;
+	}
+
+	auto before = after - 1;
+	reference = before->reference + double(local - before->local) * (after->reference - before->reference) / double(after->local - before->local);
+
+	return true;
+}
+
+/* Solves a x = b in place by Gaussian elimination with partial pivoting. */
+template <size_t N>
+static bool solveLinear(std::array<std::array<double, N>, N> a, std::array<double, N> &b) {
+	for (size_t column = 0; column < N; column++) {
+		size_t pivot = column;
+		for (size_t row = column + 1; row < N; row++) {
+			if (std::abs(a[row][column]) > std::abs(a[pivot][column])) {
+				pivot = row;
+			}
+		}
+
+		if (std::abs(a[pivot][column]) < 1e-12) {
+			return false;
+		}
+
+		std::swap(a[column], a[pivot]);
+		std::swap(b[column], b[pivot]);
+
+		for (size_t row = column + 1; row < N; row++) {
+			double factor = a[row][column] / a[column][column];
+			for (size_t k = column; k < N; k++) {
+				a[row][k] -= factor * a[column][k];
+			}
+			b[row] -= factor * b[column];
+		}
+	}
+
+	for (size_t row = N; row-- > 0;) {
+		for (size_t k = row + 1; k < N; k++) {
+			b[row] -= a[row][k] * b[k];
+		}
+		b[row] /= a[row][row];
+	}
+
+	return true;
+}
+
+/*
+ * Unknowns are the position and the emission time as a distance, the range
+ * to anchor i is c * t_i - emission. Dimensions is 2 (height fixed) or 3.
+ */
+template <size_t Dimensions>
+static bool solve(const std::vector<Position> &anchors, const std::vector<double> &ranges, Position &position, double &rms) {
+	constexpr size_t N = Dimensions + 1;
+	double emission = 0;
+
+	position.x = 0;
+	position.y = 0;
+	for (const Position &anchor : anchors) {
+		position.x += anchor.x / anchors.size();
+		position.y += anchor.y / anchors.size();
+	}
+
+	emission = ranges[0] - distance(position, anchors[0]);
+	for (size_t i = 1; i < anchors.size(); i++) {
+		emission = std::min(emission, ranges[i] - distance(position, anchors[i]));
+	}
+
+	for (int iteration = 0; iteration < MAX_ITERATIONS; iteration++) {
+		std::array<std::array<double, N>, N> normal = {};
+		std::array<double, N> gradient = {};
+		double squares = 0;
+
+		for (size_t i = 0; i < anchors.size(); i++) {
+			double range = std::max(distance(position, anchors[i]), 1e-6);
+			double residual = ranges[i] - emission - range;
+			std::array<double, 3> derivative = {
+				-(position.x - anchors[i].x) / range,
+				-(position.y - anchors[i].y) / range,
+				-(position.z - anchors[i].z) / range
+			};
+			std::array<double, N> row;
+
+			for (size_t k = 0; k < Dimensions; k++) {
+				row[k] = derivative[k];
+			}
+			row[Dimensions] = -1;
+
+			for (size_t j = 0; j < N; j++) {
+				for (size_t k = 0; k < N; k++) {
+					normal[j][k] += row[j] * row[k];
+				}
+				gradient[j] -= row[j] * residual;
+			}
+
+			squares += residual * residual;
+		}
+
+		rms = std::sqrt(squares / anchors.size());
+
+		if (!solveLinear<N>(normal, gradient)) {
+			return false;
+		}
+
+		position.x += gradient[0];
+		position.y += gradient[1];
+		if (Dimensions == 3) {
+			position.z += gradient[2];
+		}
+		emission += gradient[Dimensions];
+
+		double step = 0;
+		for (size_t k = 0; k < N; k++) {
+			step += gradient[k] * gradient[k];
+		}
+
+		if (step < 1e-12) {
+			return true;
+		}
+	}
+
+	return false;
+}
+
+static void solveGroup(
+	const std::vector<Arrival> &group, const std::map<unsigned, Position> &anchorPositions,
+	bool threeDimensions, double height, std::vector<Fix> &fixes
+) {
+	size_t needed = threeDimensions ? 4 : 3;
+	std::vector<Position> anchors;
+	std::vector<double> ranges;
+	Fix fix = { group[0].time * DEVICE_TIME_UNIT, group[0].tag, group[0].sequence, group.size(), { 0, 0, height }, 0 };
+
+	if (group.size() < needed) {
+		return;
+	}
+
+	for (const Arrival &arrival : group) {
+		anchors.push_back(anchorPositions.at(arrival.anchor));
+		ranges.push_back((arrival.time - group[0].time) * DEVICE_TIME_UNIT * SPEED_OF_LIGHT);
+	}
+
+	bool solved = threeDimensions ? solve<3>(anchors, ranges, fix.position, fix.rms) : solve<2>(anchors, ranges, fix.position, fix.rms);
+
+	if (solved) {
+		fixes.push_back(fix);
+	}
+}
+
+int main(int argc, char *argv[]) {
+	std::map<unsigned, Position> anchorPositions;
+	std::map<unsigned, std::vector<Blink>> blinks;
+	std::vector<Arrival> arrivals;
+	std::vector<Fix> fixes;
+	unsigned reference = 0;
+	bool referenceGiven = false;
+	bool threeDimensions = false;
+	double height = 0;
+	size_t corrupted = 0;
+	int argument = 1;
+
+	for (; argument < argc && argv[argument][0] == '-'; argument++) {
+		if (std::strcmp(argv[argument], "-r") == 0 && argument + 1 < argc) {
+			reference = std::strtoul(argv[++argument], nullptr, 0);
+			referenceGiven = true;
+		} else if (std::strcmp(argv[argument], "-z") == 0 && argument + 1 < argc) {
+			height = std::atof(argv[++argument]);
+		} else if (std::strcmp(argv[argument], "-3") == 0) {
+			threeDimensions = true;
+		}
+	}
+
+	if (argument >= argc) {
+		std::cerr << "Usage: " << argv[0] << " [-r reference] [-z height] [-3] anchors.txt [telemetry ...]\n";
+		return 1;
+	}
+
+	unsigned firstAnchor = 0;
+	if (!readAnchors(argv[argument++], anchorPositions, firstAnchor)) {
+		return 1;
+	}
+	if (!referenceGiven) {
+		reference = firstAnchor;
+	}
+	if (anchorPositions.count(reference) == 0) {
+		std::cerr << "Reference 0x" << std::hex << reference << " is not in the anchor list\n";
+		return 1;
+	}
+
+	if (argument == argc) {
+		readBlinks(std::cin, blinks, corrupted);
+	}
+	for (; argument < argc; argument++) {
+		std::ifstream file(argv[argument], std::ios::binary);
+
+		if (!file) {
+			std::cerr << "Cannot open " << argv[argument] << "\n";
+			return 1;
+		}
+		readBlinks(file, blinks, corrupted);
+	}
+
+	/* TX times of the reference blinks, on the reference clock which all others are mapped to. */
+	std::map<int64_t, int64_t> sent;
+	for (const Blink &blink : blinks[reference]) {
+		if (blink.tag == reference) {
+			sent[blink.sequenceCount] = blink.time;
+		}
+	}
+
+	for (const auto &[anchor, anchorBlinks] : blinks) {
+		if (anchorPositions.count(anchor) == 0) {
+			continue;
+		}
+
+		double propagation = distance(anchorPositions[anchor], anchorPositions[reference]) / SPEED_OF_LIGHT / DEVICE_TIME_UNIT;
+		std::vector<SyncPoint> points;
+
+		if (anchor != reference) {
+			points = synchronize(anchorBlinks, sent, propagation, reference);
+			std::cerr << "Anchor 0x" << std::hex << anchor << std::dec << ": " << points.size() << " reference blinks\n";
+		}
+
+		for (const Blink &blink : anchorBlinks) {
+			double time = double(blink.time);
+
+			if (anchorPositions.count(blink.tag) != 0) {
+				continue;
+			}
+			if (anchor != reference && !toReference(points, blink.time, time)) {
+				continue;
+			}
+
+			arrivals.push_back({ blink.tag, blink.sequence, anchor, time });
+		}
+	}
+
+	std::sort(arrivals.begin(), arrivals.end(), [](const Arrival &a, const Arrival &b) {
+		return a.time < b.time;
+	});
+
+	/* Arrivals of one blink are close in reference time and share tag and sequence number. */
+	std::map<std::pair<unsigned, unsigned>, std::vector<Arrival>> open;
+	double window = GROUP_WINDOW / DEVICE_TIME_UNIT;
+
+	for (const Arrival &arrival : arrivals) {
+		auto &group = open[{ arrival.tag, arrival.sequence }];
+
+		if (!group.empty() && arrival.time - group[0].time > window) {
+			solveGroup(group, anchorPositions, threeDimensions, height, fixes);
+			group.clear();
+		}
+
+		bool seen = std::any_of(group.begin(), group.end(), [&](const Arrival &other) {
+			return other.anchor == arrival.anchor;
+		});
+		if (!seen) {
+			group.push_back(arrival);
+		}
+	}
+
+	for (const auto &[key, group] : open) {
+		if (!group.empty()) {
+			solveGroup(group, anchorPositions, threeDimensions, height, fixes);
+		}
+	}
+
+	std::sort(fixes.begin(), fixes.end(), [](const Fix &a, const Fix &b) {
+		return a.time < b.time;
+	});
+
+	std::cout << "time_s,tag,sequence,anchors,x_m,y_m,z_m,rms_m\n";
+	for (const Fix &fix : fixes) {
+		std::cout << fix.time << ",0x" << std::hex << fix.tag << std::dec << "," << fix.sequence << "," << fix.anchors
+		          << "," << fix.position.x << "," << fix.position.y << "," << fix.position.z << "," << fix.rms << "\n";
+	}
+
+	std::cerr << fixes.size() << " fixes from " << arrivals.size() << " arrivals, " << corrupted << " corrupted frames\n";
+
+	return 0;
+}
@@ -0,0 +1,97 @@
+/*
+ * Decodes the binary ranging telemetry into CSV, the raw ranging records or
+ * with --filtered the range filter output.
+ *
+ *   g++ -std=c++17 -O2 -o TelemetryDecoder TelemetryDecoder.cpp
+ *   ./TelemetryDecoder < /dev/ttyACM0 > ranging.csv
+ *   ./TelemetryDecoder --filtered < /dev/ttyACM0 > filtered.csv
+ */
+#include <fstream>
+#include <iostream>
+#include <string>
+
+#include "TelemetryFrame.h"
+
+constexpr uint8_t RECORD_RANGING = 0x01;
+constexpr size_t RANGING_RECORD_LENGTH = 49;
+constexpr uint8_t RECORD_FILTERED = 0x04;
+constexpr size_t FILTERED_RECORD_LENGTH = 17;
+
+static bool printFiltered(const std::vector<uint8_t> &frame) {
+	const uint8_t *data = frame.data();
+
+	if (frame.size() != FILTERED_RECORD_LENGTH || data[0] != RECORD_FILTERED) {
+		return false;
+	}
+
+	std::cout << telemetry::readLittleEndian(data + 1, 4) << ",0x" << std::hex << telemetry::readLittleEndian(data + 5, 2) << std::dec
+	          << "," << int32_t(telemetry::readLittleEndian(data + 7, 4))
+	          << "," << int32_t(telemetry::readLittleEndian(data + 11, 4))
+	          << "," << telemetry::readLittleEndian(data + 15, 2) << "\n";
+	return true;
+}
+
+int main(int argc, char *argv[]) {
+	std::ifstream file;
+	std::istream *input = &std::cin;
+	size_t corrupted = 0;
+	size_t records = 0;
+	bool filtered = false;
+
+	for (int i = 1; i < argc; i++) {
+		if (std::string(argv[i]) == "--filtered") {
+			filtered = true;
+			continue;
+		}
+
+		file.open(argv[i], std::ios::binary);
+		if (!file) {
+			std::cerr << "Cannot open " << argv[i] << "\n";
+			return 1;
+		}
+		input = &file;
+	}
+
+	if (filtered) {
+		std::cout << "uptime_ms,peer,distance_mm,velocity_mm_s,samples\n";
+	} else {
+		std::cout << "uptime_ms,peer,sequence,tx1,rx1,tx2,rx2,tx3,rx3,distance_mm,first_path_power,rx_level,nlos_percent,azimuth_deg\n";
+	}
+
+	while (auto frame = telemetry::readFrame(*input, corrupted)) {
+		const uint8_t *data = frame->data();
+
+		if (filtered) {
+			records += printFiltered(*frame);
+			continue;
+		}
+
+		if (frame->size() != RANGING_RECORD_LENGTH || data[0] != RECORD_RANGING) {
+			continue;
+		}
+
+		std::cout << telemetry::readLittleEndian(data + 1, 4) << ",0x" << std::hex << telemetry::readLittleEndian(data + 5, 2) << std::dec << "," << unsigned(data[7]);
+
+		for (size_t i = 0; i < 6; i++) {
+			std::cout << "," << telemetry::readLittleEndian(data + 8 + 5 * i, 5);
+		}
+
+		std::cout << "," << int32_t(telemetry::readLittleEndian(data + 38, 4))
+		          << "," << int16_t(telemetry::readLittleEndian(data + 42, 2)) / 100.0
+		          << "," << int16_t(telemetry::readLittleEndian(data + 44, 2)) / 100.0
+		          << "," << unsigned(data[46]) << ",";
+
+		/* Empty without PDOA. */
+		int16_t azimuth = int16_t(telemetry::readLittleEndian(data + 47, 2));
+		if (azimuth != INT16_MIN) {
+			std::cout << azimuth / 100.0;
+		}
+		std::cout << "\n";
+
+		records++;
+	}
+
+	std::cerr << records << " records, " << corrupted << " corrupted frames\n";
+
+	return 0;
+}
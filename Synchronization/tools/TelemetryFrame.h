@@ -0,0 +1,93 @@
+#ifndef MJ_TELEMETRY_FRAME
+#define MJ_TELEMETRY_FRAME
+
+#include <cstddef>
+#include <cstdint>
+#include <istream>
+#include <optional>
+#include <vector>
+
+/*
+ * Host side of the telemetry stream from Synchronization/src/Telemetry.c:
+ * zero terminated COBS frames holding a record and its CRC-16/CCITT.
+ */
+namespace telemetry {
+
+inline uint16_t crc16Ccitt(uint16_t seed, const uint8_t *data, size_t length) {
+	for (size_t i = 0; i < length; i++) {
+		uint8_t e = seed ^ data[i];
+		uint8_t f = e ^ (e << 4);
+		seed = (seed >> 8) ^ (uint16_t(f) << 8) ^ (uint16_t(f) << 3) ^ (f >> 4);
+	}
+	return seed;
+}
+
+inline std::optional<std::vector<uint8_t>> decodeCobs(const std::vector<uint8_t> &encoded) {
+	std::vector<uint8_t> decoded;
+	size_t i = 0;
+
+	while (i < encoded.size()) {
+		uint8_t code = encoded[i++];
+
+		if (code == 0 || i + code - 1 > encoded.size()) {
+			return std::nullopt;
+		}
+
+		decoded.insert(decoded.end(), encoded.begin() + i, encoded.begin() + i + code - 1);
+		i += code - 1;
+
+		if (code != 0xFF && i < encoded.size()) {
+			decoded.push_back(0);
+		}
+	}
+
+	return decoded;
+}
+
+/* Reads the next frame whose CRC matches, counting the broken ones. Returns the record without CRC. */
+inline std::optional<std::vector<uint8_t>> readFrame(std::istream &input, size_t &corrupted) {
+	std::vector<uint8_t> encoded;
+	char byte;
+
+	while (input.get(byte)) {
+		if (byte != 0) {
+			encoded.push_back(uint8_t(byte));
+			continue;
+		}
+
+		auto frame = decodeCobs(encoded);
+		encoded.clear();
+
+		if (!frame || frame->size() < 3) {
+			corrupted++;
+			continue;
+		}
+
+		size_t length = frame->size() - 2;
+		uint16_t crc = (*frame)[length] | ((*frame)[length + 1] << 8);
+
+		if (crc16Ccitt(0xFFFF, frame->data(), length) != crc) {
+			corrupted++;
+			continue;
+		}
+
+		frame->resize(length);
+		return frame;
+	}
+
+	return std::nullopt;
+}
+
+inline uint64_t readLittleEndian(const uint8_t *data, size_t length) {
+	uint64_t value = 0;
+
+	for (size_t i = length; i > 0; i--) {
+		value = (value << 8) | data[i - 1];
+	}
+
+	return value;
+}
+
+}
+
+#endif
@@ -3,41 +3,28 @@
 #include <dw3000_spi.h>
 #include <deca_probe_interface.h>
 #include "UWBFrame.h"
+#include "TimeOfFlight.h"
+#include "DeviceTime.h"
+#include "PhyProfile.h"
 
 //#define INITIATOR
 
-#define SPEED_OF_LIGHT 299702547
-
 #define INITIATOR_ADDRESS 0x4556
 #define RESPONDER_ADDRESS 0x4157
 
 #define DUMMY_ANTENNA_DELAY 16385
 
-#define UUS_TO_DWT_TIME 63898
+#define PHY_PROFILE PhyStandard
+
+#define POLL_LENGTH (sizeof(struct UWBFrame) + FCS_LEN)
+#define RESPONSE_LENGTH (sizeof(struct UWBResponseFrame) + FCS_LEN)
+#define FINAL_LENGTH (sizeof(struct UWBDelayDataFrame) + FCS_LEN)
 
-#define RX_DELAY 700
-#define TX_DELAY 3400
 #define RX_TIME_OUT 0
 #define PREAMBLE_TIME_OUT 65000
 
 #define RANGING_INTERVAL 1000
 
-static dwt_config_t config = {
-	5,                /* Channel number. */
-	DWT_PLEN_128,     /* Preamble length. Used in TX only. */
-	DWT_PAC8,         /* Preamble acquisition chunk size. Used in RX only. */
-	9,                /* TX preamble code. Used in TX only. */
-	9,                /* RX preamble code. Used in RX only. */
-	1,                /* 0 to use standard 8 symbol SFD, 1 to use non-standard 8 symbol, 2 for non-standard 16 symbol SFD and 3 for 4z 8 symbol SDF type */
-	DWT_BR_6M8,       /* Data rate. */
-	DWT_PHRMODE_STD,  /* PHY header mode. */
-	DWT_PHRRATE_STD,  /* PHY header rate. */
-	(129 + 8 - 8),    /* SFD timeout (preamble length + 1 + SFD length - PAC size). Used in RX only. */
-	DWT_STS_MODE_OFF, /* STS disabled */
-	DWT_STS_LEN_64,   /* STS length see allowed values in Enum dwt_sts_lengths_e */
-	DWT_PDOA_M0       /* PDOA mode off */
-};
-
 static dwt_txconfig_t txconfig_options = {
 	0x34,
 	0xfdfdfdfd,
@@ -45,6 +32,12 @@ static dwt_txconfig_t txconfig_options = {
 };
 
 void main(void) {
+	/* A copy, dwt_configure takes no const. */
+	dwt_config_t profileConfig = getPhyProfile(PHY_PROFILE)->config;
+	const dwt_config_t *config = &profileConfig;
+	uint32_t responseDelay = minimumReplyDelay(config, POLL_LENGTH, RESPONSE_LENGTH);
+	uint32_t finalDelay = minimumReplyDelay(config, RESPONSE_LENGTH, FINAL_LENGTH);
+
 	dw3000_hw_init();
 	dw3000_spi_speed_fast();
 	dw3000_hw_reset();
@@ -62,7 +55,7 @@ void main(void) {
 		return;
 	}
 
-	if (dwt_configure(&config) != DWT_SUCCESS) {
+	if (dwt_configure(&profileConfig) != DWT_SUCCESS) {
 		printk("Configuration Failed");
 		return;
 	}
@@ -72,7 +65,10 @@ void main(void) {
 	dwt_setrxantennadelay(DUMMY_ANTENNA_DELAY);
 	dwt_settxantennadelay(DUMMY_ANTENNA_DELAY);
 
-	dwt_setrxaftertxdelay(RX_DELAY);
+	dwt_setrxaftertxdelay(MIN(
+		rxAfterTxDelay(config, POLL_LENGTH, responseDelay, RESPONSE_LENGTH),
+		rxAfterTxDelay(config, RESPONSE_LENGTH, finalDelay, FINAL_LENGTH)
+	));
 	dwt_setrxtimeout(RX_TIME_OUT);
 	dwt_setpreambledetecttimeout(PREAMBLE_TIME_OUT);
 
@@ -80,15 +76,14 @@ void main(void) {
 	uint8_t sequenceNumber = 0;
 
 #ifdef INITIATOR
-	uint64_t tx1TimeStamp;
-	uint64_t rxTimeStamp;
-	uint64_t tx2TimeStamp;
+	DeviceTime rxTimeStamp;
+	DeviceTime tx2TimeStamp;
 
 	struct UWBFrame firstTxFrame = {
 		.frameControl = 0x8841,
 		.panId = 0xDECA,
 		.destinationAddress = RESPONDER_ADDRESS,
-		.sourceAddress = INITIATOR_ADRRESS,
+		.sourceAddress = INITIATOR_ADDRESS,
 		.functionCode = 0x21
 	};
 
@@ -97,8 +92,6 @@ void main(void) {
 
 	struct UWBResponseFrame rxFrame;
 
-	uint32_t tx2Time;
-
 	while (true) {
 		firstTxFrame.sequenceNumber = sequenceNumber++;
 
@@ -123,25 +116,14 @@ void main(void) {
 					rxFrame.baseFrame.functionCode == 0x10 &&
 					rxFrame.activityCode == 0x02
 				) {
-					tx1TimeStamp = 0;
-					tx1TimeStamp |= dwt_readtxtimestamphi32();
-					tx1TimeStamp <<= 8;
-					tx1TimeStamp |= dwt_readtxtimestamplo32();
+					dwt_readtxtimestamp(secondTxFrame.tx1TimeStamp);
+					dwt_readrxtimestamp(secondTxFrame.rxTimeStamp);
 
-					rxTimeStamp = 0;
-					rxTimeStamp |= dwt_readrxtimestamphi32();
-					rxTimeStamp <<= 8;
-					rxTimeStamp |= dwt_readrxtimestamplo32();
+					rxTimeStamp = deviceTimeFromBytes(secondTxFrame.rxTimeStamp);
 
-					tx2Time = (rxTimeStamp + (TX_DELAY * UUS_TO_DWT_TIME)) >> 8;
+					dwt_setdelayedtrxtime(delayedTxTime(rxTimeStamp, finalDelay, DUMMY_ANTENNA_DELAY, &tx2TimeStamp));
 
-					dwt_setdelayedtrxtime(tx2Time);
-
-					tx2TimeStamp = (((uint64_t)(tx2Time & 0xFFFFFFFEUL)) << 8) + DUMMY_ANTENNA_DELAY;
-
-					secondTxFrame.tx1TimeStamp = (uint32_t)tx1TimeStamp;
-					secondTxFrame.rxTimeStamp = (uint32_t)rxTimeStamp;
-					secondTxFrame.tx2TimeStamp = (uint32_t)tx2TimeStamp;
+					deviceTimeToBytes(tx2TimeStamp, secondTxFrame.tx2TimeStamp);
 
 					secondTxFrame.baseFrame.sequenceNumber = sequenceNumber++;
 
@@ -163,16 +145,14 @@ void main(void) {
 #else
 	struct UWBFrame firstRxFrame;
 	struct UWBDelayDataFrame secondRxFrame;
-	uint64_t firstRxTimeStamp;
-	uint64_t txTimeStamp;
-	uint64_t secondRxTimeStamp;
-	uint64_t txTime;
-	double firstLoopDuration;
-	double firstProcessingDuration;
-	double secondLoopDuration;
-	double secondProcessingDuration;
-	double timeOfFlight;
-	double distance;
+	DeviceTime firstRxTimeStamp;
+	DeviceTime txTimeStamp;
+	DeviceTime secondRxTimeStamp;
+	uint64_t firstLoopDuration;
+	uint64_t firstProcessingDuration;
+	uint64_t secondLoopDuration;
+	uint64_t secondProcessingDuration;
+	int32_t distance;
 
 	struct UWBResponseFrame txFrame = {
 		.baseFrame = {
@@ -202,14 +182,9 @@ void main(void) {
 					firstRxFrame.sourceAddress == INITIATOR_ADDRESS &&
 					firstRxFrame.functionCode == 0x21
 				) {
-					firstRxTimeStamp = 0;
-					firstRxTimeStamp |= dwt_readrxtimestamphi32();
-					firstRxTimeStamp <<= 8;
-					firstRxTimeStamp |= dwt_readrxtimestamplo32();
-
-					txTime = (firstRxTimeStamp + (TX_DELAY * UUS_TO_DWT_TIME)) >> 8;
+					firstRxTimeStamp = readRxTimeStamp();
 
-					dwt_setdelayedtrxtime(txTime);
+					dwt_setdelayedtrxtime(delayedTxTime(firstRxTimeStamp, responseDelay, DUMMY_ANTENNA_DELAY, NULL));
 
 					txFrame.baseFrame.sequenceNumber = sequenceNumber;
 
@@ -233,28 +208,17 @@ void main(void) {
 									secondRxFrame.baseFrame.sourceAddress == INITIATOR_ADDRESS &&
 									secondRxFrame.baseFrame.functionCode == 0x23
 								) {
-									txTimeStamp = 0;
-									txTimeStamp |= dwt_readtxtimestamphi32();
-									txTimeStamp <<= 8;
-									txTimeStamp |= dwt_readtxtimestamplo32();
-
-									secondRxTimeStamp = 0;
-									secondRxTimeStamp |= dwt_readrxtimestamphi32();
-									secondRxTimeStamp <<= 8;
-									secondRxTimeStamp |= dwt_readrxtimestamplo32();
-
-									firstLoopDuration = (double)(secondRxFrame.rxTimeStamp - secondRxFrame.tx1TimeStamp);
-									firstProcessingDuration = (double)(((uint32_t)txTimeStamp) - ((uint32_t)firstRxTimeStamp));
-									secondLoopDuration = (double)(((uint32_t)secondRxTimeStamp) - ((uint32_t)txTimeStamp));
-									secondProcessingDuration = (double)(secondRxFrame.tx2TimeStamp - secondRxFrame.rxTimeStamp);
+									txTimeStamp = readTxTimeStamp();
+									secondRxTimeStamp = readRxTimeStamp();
 
-									timeOfFlight = (firstLoopDuration * secondLoopDuration - firstProcessingDuration * secondProcessingDuration) /
-									               (firstLoopDuration + secondLoopDuration + firstProcessingDuration + secondProcessingDuration) *
-									               DWT_TIME_UNITS;
+									firstLoopDuration = deviceTimeDiff(deviceTimeFromBytes(secondRxFrame.rxTimeStamp), deviceTimeFromBytes(secondRxFrame.tx1TimeStamp));
+									firstProcessingDuration = deviceTimeDiff(txTimeStamp, firstRxTimeStamp);
+									secondLoopDuration = deviceTimeDiff(secondRxTimeStamp, txTimeStamp);
+									secondProcessingDuration = deviceTimeDiff(deviceTimeFromBytes(secondRxFrame.tx2TimeStamp), deviceTimeFromBytes(secondRxFrame.rxTimeStamp));
 
-									distance = timeOfFlight * SPEED_OF_LIGHT;
+									distance = dsTwrDistance(firstLoopDuration, firstProcessingDuration, secondLoopDuration, secondProcessingDuration);
 
-									printf("Distance = %3.2f m\n", distance);
+									printk("Distance = %d mm\n", distance);
 								}
 							}
 						} else
@@ -0,0 +1,28 @@
+#ifndef MJ_BENCHMARK
+#define MJ_BENCHMARK
+
+#include <stdint.h>
+
+#include "network_time.h"
+
+/*
+ * Synchronization accuracy on real hardware. Every node drives the pin of
+ * the bench-out alias high at the same network times, the master captures
+ * the edges on the pins of the bench-in0 to bench-in3 aliases and compares
+ * them with the times they were scheduled for. Both ends are timed by the
+ * TIMER of timer_io, to 62.5 ns. Wiring the master's own output to an
+ * input measures the fixed delay of the pin path the others include.
+ */
+void initializeBenchmark();
+
+/*
+ * Master side: one phase per beacon interval of the sweep, each with pulses
+ * pulses period ms apart after the clocks settled. Prints the errors every
+ * few pulses and their distribution per phase and input.
+ */
+void startBenchmark(uint32_t period, uint16_t pulses);
+
+/* Every node: drives count pulses period ms apart from network time start. */
+void generatePulses(NetworkTime start, uint32_t period, uint16_t count);
+
+#endif
@@ -133,6 +133,13 @@ struct bt_mesh_chat_cli_handlers {
 	 */
 	void (*const message_reply)(struct bt_mesh_chat_cli *chat,
 				    struct bt_mesh_msg_ctx *ctx);
+
+	/** @brief Called when the first advertisement of a reply on a
+	 * private message starts.
+	 *
+	 * @param[in] cli Chat client instance that sent the reply.
+	 */
+	void (*const reply_sent)(struct bt_mesh_chat_cli *chat);
 };
 
 /* .. include_startingpoint_chat_cli_rst_3 */
@@ -208,6 +215,41 @@ int bt_mesh_chat_cli_private_message_send(struct bt_mesh_chat_cli *chat,
 					  uint16_t addr,
 					  const uint8_t *msg);
 
+/** @brief Publish a binary message, terminated with a null character.
+ *
+ * @param[in] cli           Chat Client model instance to send the message.
+ * @param[in] msg           Message to send.
+ * @param[in] messageLength Length of the message.
+ *
+ * @retval 0 Successfully sent the message.
+ * @retval -EADDRNOTAVAIL Publishing is not configured.
+ * @retval -EAGAIN The device has not been provisioned.
+ */
+int bt_mesh_data_message_send(struct bt_mesh_chat_cli *chat,
+			      const uint8_t *msg,
+			      size_t messageLength);
+
+/** @brief Send a binary message to a specified destination, terminated
+ * with a null character.
+ *
+ * @param[in] cli           Chat Client model instance to send the message.
+ * @param[in] addr          Address of the chat client to send message to.
+ * @param[in] msg           Message to send.
+ * @param[in] messageLength Length of the message.
+ * @param[in] cb            Send callbacks, may be NULL.
+ * @param[in] cb_data       User data of the callbacks.
+ *
+ * @retval 0 Successfully sent the message.
+ * @retval -EINVAL The model is not bound to an application key.
+ * @retval -EAGAIN The device has not been provisioned.
+ */
+int bt_mesh_data_private_message_send(struct bt_mesh_chat_cli *chat,
+				      uint16_t addr,
+				      const uint8_t *msg,
+				      size_t messageLength,
+				      const struct bt_mesh_send_cb *cb,
+				      void *cb_data);
+
 /** @cond INTERNAL_HIDDEN */
 extern const struct bt_mesh_model_op _bt_mesh_chat_cli_op[];
 extern const struct bt_mesh_model_cb _bt_mesh_chat_cli_cb;
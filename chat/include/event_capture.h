@@ -0,0 +1,56 @@
+#ifndef MJ_EVENT_CAPTURE
+#define MJ_EVENT_CAPTURE
+
+#include <stdint.h>
+
+#include "network_time.h"
+
+/*
+ * Rising edges on the pins of the event-in0 to event-in3 aliases, stamped
+ * in network time and uploaded to the master. The edges are captured by
+ * the TIMER of timer_io, so the stamps resolve one 62.5 ns tick, and share
+ * its TIMER_IO_INPUTS with the benchmark inputs. The GPIOTE ISR only
+ * stores the ticks in a single producer ring, the system workqueue
+ * converts the events and sends them in batches back to back, the next as
+ * soon as the mesh finished the last. Events that find the ring full are
+ * folded into a summary per channel instead, events without network time
+ * when converted are counted as lost and reported with the next message.
+ *
+ * A batch record is one 16-bit word, the channel in the top 2 bits and the
+ * time since the previous event of the batch in units of 2^EVENT_TIME_SHIFT
+ * network time units (~64 ns, the power of two above a tick) below, the
+ * first event of a batch is at its start time. Deltas of EVENT_DELTA_ESCAPE
+ * and more are the escape value followed by the delta in two words, low
+ * word first.
+ */
+#define EVENT_CHANNELS 4
+#define EVENT_TIME_SHIFT 12
+#define EVENT_DELTA_BITS 14
+#define EVENT_DELTA_ESCAPE ((1U << EVENT_DELTA_BITS) - 1)
+#define EVENT_BATCH_WORDS 38
+
+/* Events of one channel that overflowed the ring, first and last in network time. */
+struct eventSummary {
+	uint32_t events;
+	NetworkTime first;
+	NetworkTime last;
+} __attribute__((packed));
+
+void initializeEventCapture();
+
+/* The mesh finished sending the last batch or summary, error as from bt_mesh_model_send's end callback. */
+void eventsSent(int error);
+
+/* Master side: takes every event of every node outside summaries, from the mesh RX thread. */
+void setEventHandler(void (*handler)(uint16_t address, uint8_t channel, NetworkTime time));
+
+/* Master side: a batch of address, see above. Messages missing from the sequence are counted. */
+void receiveEvents(uint16_t address, uint16_t sequence, uint16_t lost, NetworkTime start, const uint16_t *words, uint8_t count);
+
+/* Master side: a summary of address, one per channel, sharing the sequence of the batches. */
+void receiveEventSummary(uint16_t address, uint16_t sequence, uint16_t lost, const struct eventSummary *summaries);
+
+/* Master side: events, rate and losses per node and channel. */
+void printEvents();
+
+#endif
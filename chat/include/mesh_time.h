@@ -0,0 +1,35 @@
+#ifndef MJ_MESH_TIME
+#define MJ_MESH_TIME
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "network_time.h"
+
+/*
+ * Coarse network time over the mesh alone, for nodes without UWB. The
+ * follower sends a private message to a synchronized reference and times
+ * the reference's reply on the cycle counter, from the start of its first
+ * advertisement to the reply's RX callback. The reference times the same
+ * message and reply in network time and sends both times in a follow-up,
+ * which gives the offset and the path delay, two-step like PTP. Exchanges
+ * with a delay well above the recent minimum are dropped as queued or
+ * relayed, the rest feed a ClockModel that network time follows. Expect
+ * ms, not ns.
+ *
+ * Follows network time through exchanges with reference, 0 stops.
+ */
+void followMeshTime(uint16_t reference);
+
+/* Hooks of the chat model, called from the mesh threads with k_cycle_get_32 taken first. */
+void meshTimeRequestSent(uint32_t cycles);
+void meshTimeReplySent(uint32_t cycles);
+bool meshTimeReplyReceived(uint16_t address, uint32_t cycles);
+
+/* Reference side: a request with sequence from address arrived at cycles. */
+void meshTimeRequest(uint16_t address, uint8_t sequence, uint32_t cycles);
+
+/* Follower side: the follow-up of the reference with its network times of the request and the reply. */
+void meshTimeFollowUp(uint16_t address, uint8_t sequence, NetworkTime received, NetworkTime replied);
+
+#endif
@@ -22,6 +22,16 @@ const struct bt_mesh_comp *model_handler_init(void);
 
 void sendBroadcast(const uint8_t* message, size_t messageLength);
 void sendUnicast(const uint8_t* message, size_t messageLength, uint16_t address);
+uint16_t getOwnAddress(void);
+
+/* Unicast whose first advertisement start is reported to meshTimeRequestSent. */
+void sendTimedUnicast(const uint8_t* message, size_t messageLength, uint16_t address);
+
+/* Unicast whose end is reported to eventsSent, returns 0 or the error of the send. To itself it is handled at once. */
+int sendEventUnicast(const uint8_t* message, size_t messageLength, uint16_t address);
+
+/* Cycle count the private message being handled was received at, valid inside messageHandler. */
+uint32_t getReceiveCycles(void);
 
 #ifdef __cplusplus
 }
@@ -0,0 +1,77 @@
+#ifndef MJ_NETWORK_TIME
+#define MJ_NETWORK_TIME
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "DeviceTime.h"
+#include "ClockModel.h"
+
+/*
+ * Network time is the master's DW3000 device time in device time units
+ * (~15.65 ps), unwrapped to 64 bits. Nodes follow it through the sync
+ * beacons, the master's own clock defines it. Nodes without UWB count
+ * device time on the cycle counter at its nominal rate instead and follow
+ * over the mesh, see mesh_time.h.
+ *
+ * The conversions are constant time and lock-free, so they may be called
+ * from ISRs. They read a snapshot of the clock relations that the system
+ * workqueue republishes after every beacon and cycle counter calibration,
+ * and return false while the node has no relation to the master yet.
+ */
+typedef int64_t NetworkTime;
+
+/*
+ * Starts the calibration of k_cycle_get_32 and the timer_io ticks against
+ * the DW3000 clock, after initializeUWB. Without UWB the cycle counter is
+ * the local clock itself.
+ */
+void initializeNetworkTime(bool uwbAvailable);
+
+/* The local clock defines network time, for the master. */
+void becomeNetworkMaster();
+
+/*
+ * Follower side: network time comes from the beacons of the master. The
+ * master's network time at about the uptime the hint was taken resolves
+ * the 40-bit wrap of its device time, it has to be right within a few s.
+ * Network time is lost again after a few beacon intervals without one.
+ * Called from the system workqueue, the role changes before it returns.
+ */
+void followNetworkMaster(NetworkTime hint, int64_t uptime);
+
+/* Takes the offset and skew to the master from model, local minus master device time. System workqueue only. */
+void followMasterClock(const struct ClockModel *model);
+
+bool isNetworkTimeValid();
+bool getNetworkTime(NetworkTime *now);
+
+/* Device times are 40-bit, they must lie within a few s of now. */
+bool deviceToNetworkTime(DeviceTime local, NetworkTime *network);
+bool networkToDeviceTime(NetworkTime network, DeviceTime *local);
+
+/* Cycle counts are those of k_cycle_get_32, they must lie within half its wrap of now. */
+bool cyclesToDeviceTime(uint32_t cycles, DeviceTime *local);
+bool cyclesToNetworkTime(uint32_t cycles, NetworkTime *network);
+bool networkToCycles(NetworkTime network, uint32_t *cycles);
+
+/*
+ * Tick counts are those of getTimerTicks, they must lie within half their
+ * wrap of now. They resolve 62.5 ns, 4000 device time units.
+ */
+bool ticksToNetworkTime(uint32_t ticks, NetworkTime *network);
+
+/*
+ * Sends frame over UWB with its TX timestamp at network time time. Frames
+ * far in the future wait on the system workqueue until shortly before, one
+ * frame can be pending. Returns 0 or a negative errno, -ENODEV without UWB.
+ */
+int scheduleTransmission(NetworkTime time, const uint8_t *frame, uint16_t length);
+
+/*
+ * Drives the timed output of timer_io to value at network time time, to a
+ * TIMER tick. Returns 0 or a negative errno, see setOutputAt.
+ */
+int scheduleOutput(NetworkTime time, int value);
+
+#endif
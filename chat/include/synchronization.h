@@ -1,10 +1,62 @@
 #ifndef MJ_SYNCHRONIZATION
 #define MJ_SYNCHRONIZATION
 
+#include <stdbool.h>
 #include <stdint.h>
 
+#include "DeviceTime.h"
+#include "event_capture.h"
+
+/* Brings up the UWB chip, the DS-TWR exchanges measure the clock offsets. Without it network time runs over the mesh. */
+void initializeSynchronization();
 void broadcastMaster();
 void getClockDelta(uint16_t firstNodeAddress, uint16_t secondNodeAddress);
+
+/*
+ * Master side: keeps the clock offset of the pair modelled and repeats
+ * getClockDelta only when the predicted error would exceed maxError ns,
+ * 0 stops tracking the pair.
+ */
+void trackClockDelta(uint16_t firstNodeAddress, uint16_t secondNodeAddress, uint32_t maxError);
+
+/* Master side: every interval ms a UWB beacon synchronizes all nodes in range at once, 0 stops. */
+void startBeacons(uint32_t interval);
+
+/*
+ * Master side: synchronizes every node reachable over the neighbour graph,
+ * each to its parent in the spanning tree rooted at the master. Pairs out
+ * of each other's UWB range run in the same round, links that keep failing
+ * are dropped and the tree is rebuilt around them. The tree with the hops
+ * and accumulated errors is printed at the end.
+ * Links are nodes in UWB range of each other, they are kept until cleared.
+ */
+void addNetworkLink(uint16_t firstNodeAddress, uint16_t secondNodeAddress);
+void clearNetworkLinks();
+void synchronizeNetwork();
+
+/* Adds the mesh neighbours every node reports as links. */
+void collectNeighbours();
+
+/* Called for every mesh message received, direct ones mark the sender as neighbour. */
+void noteMeshNeighbour(uint16_t address, uint8_t receivedTtl);
+
+/*
+ * Offset of node address to the master at its device time time, composed
+ * along the tree, with its standard deviation in device time units.
+ */
+bool getNetworkOffset(uint16_t address, DeviceTime time, DeviceTime *offset, uint32_t *error);
+
+/* Master side: every node, the master included, pulses its benchmark pin at the same network times. */
+void broadcastPulses(int64_t start, uint32_t period, uint16_t count);
+
+/* Messages of the mesh time exchange, see mesh_time.h. The request is timed at its first advertisement. */
+void sendMeshTimeRequest(uint16_t address, uint8_t sequence);
+void sendMeshTimeFollowUp(uint16_t address, uint8_t sequence, int64_t received, int64_t replied);
+
+/* Captured events to the master, see event_capture.h. Return 0 or the error of the send, eventsSent follows a 0. */
+int sendEvents(uint16_t sequence, uint16_t lost, int64_t start, const uint16_t *words, uint8_t count);
+int sendEventSummary(uint16_t sequence, uint16_t lost, const struct eventSummary *summaries);
+
 void messageHandler(const uint8_t* message, uint16_t senderAddress);
 
 #endif
\ No newline at end of file
@@ -0,0 +1,49 @@
+#ifndef MJ_TIMER_IO
+#define MJ_TIMER_IO
+
+#include <stdint.h>
+
+/*
+ * Pin edges timed in hardware by a free running 16 MHz nRF TIMER, 62.5 ns
+ * per tick, instead of the 32768 Hz cycle counter. Inputs trigger a capture
+ * of the TIMER through GPIOTE and PPI, the output is driven by a compare
+ * through PPI and GPIOTE, so interrupt latency moves neither. The HFXO is
+ * kept running, on the RC oscillator the TIMER would be off by up to 1.5 %.
+ *
+ * Pins are nRF pin numbers, port * 32 + pin as NRF_DT_GPIOS_TO_PSEL gives
+ * them. The tick count wraps every 268 s.
+ */
+#define TIMER_IO_TICKS_PER_SECOND 16000000
+#define TIMER_IO_NO_PIN UINT32_MAX
+
+/* Capture registers for inputs, shared by every module that captures edges. */
+#define TIMER_IO_INPUTS 4
+
+/* Called from the GPIOTE ISR with the channel passed to captureEdges and the ticks of the rising edge. */
+typedef void (*TimerIoHandler)(uint8_t channel, uint32_t ticks);
+
+/* Starts the HFXO and the TIMER, before any other call. Returns 0 or a negative errno. */
+int initializeTimerIo();
+
+/* The current tick count, from threads and ISRs. */
+uint32_t getTimerTicks();
+
+/*
+ * Captures the rising edges of pin for handler, without pull. An edge
+ * arriving before the ISR read the one before replaces it. Returns 0, or a
+ * negative errno when all TIMER_IO_INPUTS or the GPIOTE channels are taken.
+ */
+int captureEdges(uint32_t pin, TimerIoHandler handler, uint8_t channel);
+
+/* Makes pin the timed output, driven low until the first edge. Returns 0 or a negative errno. */
+int configureTimedOutput(uint32_t pin);
+
+/*
+ * Drives the timed output to value at ticks, which has to lie at least a
+ * few us and at most half the wrap ahead. Up to two edges wait, in time
+ * order, enough for one pulse. Returns 0, -EBUSY with two edges waiting,
+ * -EINVAL out of order or -ETIME when ticks is too close.
+ */
+int setOutputAt(uint32_t ticks, int value);
+
+#endif
@@ -0,0 +1,261 @@
+#include <zephyr/kernel.h>
+#include <zephyr/logging/log.h>
+#include <soc.h>
+#include "benchmark.h"
+#include "timer_io.h"
+#include "synchronization.h"
+#include "SyncStatistics.h"
+
+LOG_MODULE_DECLARE(chat);
+
+#define DEVICE_TIME_PER_MILLISECOND 63897600LL
+
+/* Beacon intervals in ms the benchmark sweeps, each phase lets the clocks settle for some intervals first. */
+static const uint32_t benchmarkIntervals[] = { 250, 1000, 4000, 16000 };
+#define SETTLE_INTERVALS 4
+#define SETTLE_MINIMUM 5000
+
+/* ms from the broadcast to the first pulse, the pulse width, and how far ahead each pulse is armed. */
+#define PULSE_LEAD 1000
+#define PULSE_WIDTH 1
+#define PULSE_ARM_AHEAD 50
+#define PULSE_PERIOD_MINIMUM 100
+
+/* Errors are printed for every block of this many pulses per input, the phase's distribution at its end. */
+#define BENCHMARK_INPUTS 4
+#define BENCHMARK_BLOCK 10
+#define CAPTURE_QUEUE_LENGTH 16
+
+enum benchmarkStep { BenchmarkSettling, BenchmarkPulsing };
+
+struct capture {
+	uint8_t input;
+	uint32_t ticks;
+};
+
+static const uint32_t pulseOutput = NRF_DT_GPIOS_TO_PSEL_OR(DT_ALIAS(bench_out), gpios, TIMER_IO_NO_PIN);
+static const uint32_t captureInputs[BENCHMARK_INPUTS] = {
+	NRF_DT_GPIOS_TO_PSEL_OR(DT_ALIAS(bench_in0), gpios, TIMER_IO_NO_PIN),
+	NRF_DT_GPIOS_TO_PSEL_OR(DT_ALIAS(bench_in1), gpios, TIMER_IO_NO_PIN),
+	NRF_DT_GPIOS_TO_PSEL_OR(DT_ALIAS(bench_in2), gpios, TIMER_IO_NO_PIN),
+	NRF_DT_GPIOS_TO_PSEL_OR(DT_ALIAS(bench_in3), gpios, TIMER_IO_NO_PIN)
+};
+static bool outputReady;
+static bool inputReady[BENCHMARK_INPUTS];
+
+static void pulseWork(struct k_work *work);
+static void applyPulses(struct k_work *work);
+static void phaseWork(struct k_work *work);
+static void beginBenchmark(struct k_work *work);
+static void captureWork(struct k_work *work);
+
+static K_WORK_DELAYABLE_DEFINE(pulseTrain, pulseWork);
+static K_WORK_DEFINE(pulseRequest, applyPulses);
+static K_WORK_DELAYABLE_DEFINE(benchmarkPhase, phaseWork);
+static K_WORK_DEFINE(benchmarkStart, beginBenchmark);
+static K_WORK_DEFINE(captureProcessing, captureWork);
+
+/* The edges leave the ISR with their captured ticks, they are converted and judged on the system workqueue. */
+K_MSGQ_DEFINE(captures, sizeof(struct capture), CAPTURE_QUEUE_LENGTH, 4);
+
+/* Pulse train of every node, handed over from the mesh thread. */
+static NetworkTime requestedStart;
+static uint32_t requestedPeriod;
+static uint16_t requestedCount;
+
+static NetworkTime pulseStart;
+static int64_t pulsePeriod;              /* network time units */
+static uint16_t pulseCount;
+static uint16_t nextPulse;
+
+/* Master side. */
+static uint32_t benchmarkPeriod;
+static uint16_t benchmarkPulses;
+static uint8_t phase;
+static enum benchmarkStep step;
+static NetworkTime phaseStart;
+static struct SyncStatistics phaseStatistics[BENCHMARK_INPUTS];
+static struct SyncStatistics blockStatistics[BENCHMARK_INPUTS];
+static volatile bool benchmarkRunning;
+
+static void captured(uint8_t input, uint32_t ticks) {
+	struct capture capture = { .ticks = ticks, .input = input };
+
+	k_msgq_put(&captures, &capture, K_NO_WAIT);
+	k_work_submit(&captureProcessing);
+}
+
+void initializeBenchmark() {
+	int result;
+
+	if (pulseOutput != TIMER_IO_NO_PIN) {
+		result = configureTimedOutput(pulseOutput);
+		outputReady = result == 0;
+		if (result != 0) {
+			LOG_WRN("Benchmark output unavailable (err %d)", result);
+		}
+	}
+
+	for (uint8_t i = 0; i < BENCHMARK_INPUTS; i++) {
+		if (captureInputs[i] == TIMER_IO_NO_PIN) {
+			continue;
+		}
+
+		result = captureEdges(captureInputs[i], captured, i);
+		inputReady[i] = result == 0;
+		if (result != 0) {
+			LOG_WRN("Benchmark input %u unavailable (err %d)", i, result);
+		}
+	}
+}
+
+static void applyPulses(struct k_work *work) {
+	pulseStart = requestedStart;
+	pulsePeriod = requestedPeriod * DEVICE_TIME_PER_MILLISECOND;
+	pulseCount = requestedCount;
+	nextPulse = 0;
+
+	k_work_reschedule(&pulseTrain, K_NO_WAIT);
+}
+
+void generatePulses(NetworkTime start, uint32_t period, uint16_t count) {
+	requestedStart = start;
+	requestedPeriod = period;
+	requestedCount = count;
+	k_work_submit(&pulseRequest);
+}
+
+/* Arms one pulse at a time shortly before it, the timed output holds the two edges of one pulse. */
+static void pulseWork(struct k_work *work) {
+	NetworkTime now;
+	NetworkTime time;
+
+	if (nextPulse >= pulseCount || !outputReady) {
+		return;
+	}
+
+	if (!getNetworkTime(&now)) {
+		LOG_WRN("Pulses stopped, network time lost");
+		return;
+	}
+
+	time = pulseStart + nextPulse * pulsePeriod;
+	if (time - now > PULSE_ARM_AHEAD * DEVICE_TIME_PER_MILLISECOND) {
+		k_work_reschedule(&pulseTrain, K_MSEC((time - now) / DEVICE_TIME_PER_MILLISECOND - PULSE_ARM_AHEAD));
+		return;
+	}
+
+	if (scheduleOutput(time, 1) != 0 || scheduleOutput(time + PULSE_WIDTH * DEVICE_TIME_PER_MILLISECOND, 0) != 0) {
+		LOG_WRN("Pulse %u missed", nextPulse);
+	}
+
+	nextPulse++;
+	k_work_reschedule(&pulseTrain, K_NO_WAIT);
+}
+
+static int64_t toPicoseconds(int64_t duration) {
+	return duration < 0 ? -(int64_t)deviceTimeToPicoseconds(-duration) : (int64_t)deviceTimeToPicoseconds(duration);
+}
+
+/* An edge belongs to the pulse it is closest to. */
+static void captureWork(struct k_work *work) {
+	struct capture capture;
+	NetworkTime time;
+	char label[48];
+
+	while (k_msgq_get(&captures, &capture, K_NO_WAIT) == 0) {
+		int64_t period = benchmarkPeriod * DEVICE_TIME_PER_MILLISECOND;
+		int64_t pulse;
+		int64_t error;
+
+		if (!benchmarkRunning || step != BenchmarkPulsing || !ticksToNetworkTime(capture.ticks, &time)) {
+			continue;
+		}
+
+		pulse = (time - phaseStart + period / 2) / period;
+		if (time < phaseStart - period / 2 || pulse >= benchmarkPulses) {
+			continue;
+		}
+
+		error = toPicoseconds(time - (phaseStart + pulse * period));
+		addSyncError(&phaseStatistics[capture.input], error);
+		addSyncError(&blockStatistics[capture.input], error);
+
+		if (blockStatistics[capture.input].count == BENCHMARK_BLOCK) {
+			snprintk(label, sizeof(label), "Interval %u ms, input %u, pulse %lld", benchmarkIntervals[phase], capture.input, pulse);
+			printSyncStatistics(label, &blockStatistics[capture.input]);
+			resetSyncStatistics(&blockStatistics[capture.input]);
+		}
+	}
+}
+
+static void startPhase() {
+	uint32_t interval;
+
+	if (phase == ARRAY_SIZE(benchmarkIntervals)) {
+		printk("Benchmark done\n");
+		benchmarkRunning = false;
+		return;
+	}
+
+	interval = benchmarkIntervals[phase];
+	startBeacons(interval);
+
+	step = BenchmarkSettling;
+	k_work_reschedule(&benchmarkPhase, K_MSEC(MAX(SETTLE_INTERVALS * interval, SETTLE_MINIMUM)));
+}
+
+static void phaseWork(struct k_work *work) {
+	char label[48];
+	NetworkTime now;
+
+	if (step == BenchmarkSettling) {
+		if (!getNetworkTime(&now)) {
+			LOG_ERR("Benchmark needs network time, the master first");
+			benchmarkRunning = false;
+			return;
+		}
+
+		for (uint8_t i = 0; i < BENCHMARK_INPUTS; i++) {
+			resetSyncStatistics(&phaseStatistics[i]);
+			resetSyncStatistics(&blockStatistics[i]);
+		}
+
+		phaseStart = now + PULSE_LEAD * DEVICE_TIME_PER_MILLISECOND;
+		step = BenchmarkPulsing;
+		broadcastPulses(phaseStart, benchmarkPeriod, benchmarkPulses);
+
+		k_work_reschedule(&benchmarkPhase, K_MSEC(2 * PULSE_LEAD + benchmarkPeriod * benchmarkPulses));
+		return;
+	}
+
+	/* The traffic cost of the interval is one beacon per interval, on UWB only. */
+	printk("Interval %u ms, %u beacons per minute:\n", benchmarkIntervals[phase], 60000 / benchmarkIntervals[phase]);
+
+	for (uint8_t i = 0; i < BENCHMARK_INPUTS; i++) {
+		if (inputReady[i]) {
+			snprintk(label, sizeof(label), "  input %u", i);
+			printSyncStatistics(label, &phaseStatistics[i]);
+		}
+	}
+
+	phase++;
+	startPhase();
+}
+
+static void beginBenchmark(struct k_work *work) {
+	phase = 0;
+	startPhase();
+}
+
+void startBenchmark(uint32_t period, uint16_t pulses) {
+	if (benchmarkRunning) {
+		LOG_WRN("Benchmark already running");
+		return;
+	}
+
+	benchmarkRunning = true;
+	benchmarkPeriod = MAX(period, PULSE_PERIOD_MINIMUM);
+	benchmarkPulses = pulses;
+	k_work_submit(&benchmarkStart);
+}
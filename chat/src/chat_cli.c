@@ -32,12 +32,24 @@ static int handle_message(struct bt_mesh_model *model, struct bt_mesh_msg_ctx *c
 	return 0;
 }
 
+static void reply_start(uint16_t duration, int err, void *cb_data) {
+	struct bt_mesh_chat_cli *chat = cb_data;
+
+	if (!err && chat->handlers->reply_sent) {
+		chat->handlers->reply_sent(chat);
+	}
+}
+
+static const struct bt_mesh_send_cb reply_send_cb = {
+	.start = reply_start,
+};
+
 /* .. include_startingpoint_chat_cli_rst_1 */
 static void send_message_reply(struct bt_mesh_chat_cli *chat, struct bt_mesh_msg_ctx *ctx) {
 	BT_MESH_MODEL_BUF_DEFINE(msg, BT_MESH_CHAT_CLI_OP_MESSAGE_REPLY, BT_MESH_CHAT_CLI_MSG_LEN_MESSAGE_REPLY);
 	bt_mesh_model_msg_init(&msg, BT_MESH_CHAT_CLI_OP_MESSAGE_REPLY);
 
-	(void)bt_mesh_model_send(chat->model, ctx, &msg, NULL, NULL);
+	(void)bt_mesh_model_send(chat->model, ctx, &msg, &reply_send_cb, chat);
 }
 
 static int handle_private_message(struct bt_mesh_model *model, struct bt_mesh_msg_ctx *ctx, struct net_buf_simple *buf) {
@@ -273,7 +285,7 @@ int bt_mesh_chat_cli_private_message_send(struct bt_mesh_chat_cli *chat, uint16_
 }
 /* .. include_endpoint_chat_cli_rst_9 */
 
-int bt_mesh_data_private_message_send(struct bt_mesh_chat_cli *chat, uint16_t addr, const uint8_t *msg, size_t messageLength) {
+int bt_mesh_data_private_message_send(struct bt_mesh_chat_cli *chat, uint16_t addr, const uint8_t *msg, size_t messageLength, const struct bt_mesh_send_cb *cb, void *cb_data) {
 	struct bt_mesh_msg_ctx ctx = {
 		.addr = addr,
 		.app_idx = chat->model->keys[0],
@@ -287,5 +299,5 @@ int bt_mesh_data_private_message_send(struct bt_mesh_chat_cli *chat, uint16_t ad
 	net_buf_simple_add_mem(&buf, msg, messageLength);
 	net_buf_simple_add_u8(&buf, '\0');
 
-	return bt_mesh_model_send(chat->model, &ctx, &buf, NULL, NULL);
+	return bt_mesh_model_send(chat->model, &ctx, &buf, cb, cb_data);
 }
\ No newline at end of file
@@ -0,0 +1,396 @@
+#include <zephyr/kernel.h>
+#include <zephyr/logging/log.h>
+#include <zephyr/sys/atomic.h>
+#include <soc.h>
+#include <string.h>
+#include "event_capture.h"
+#include "synchronization.h"
+#include "timer_io.h"
+
+LOG_MODULE_DECLARE(chat);
+
+#define DEVICE_TIME_PER_SECOND 63897600000LL
+#define DEVICE_TIME_PER_MILLISECOND 63897600LL
+
+/*
+ * A batch is a 90-byte message, 9 segments, which the mesh needs about
+ * 0.5 s for with the default network transmit of 3 advertisements 20 ms
+ * apart. With up to 38 events 1 ms apart or less per batch about 75
+ * events/s are sustained one by one. The ring is sized for a 2 s burst at
+ * 4 kHz, 40 KB at 5 bytes an event, and drains in ~110 s. The tick wrap
+ * bounds it, events that waited past EVENT_MAX_AGE can no longer be
+ * converted and are counted as lost. Only edges that find the ring full go
+ * into the summaries, which carry any rate but no single event.
+ */
+#define EVENT_RING_LENGTH 8192
+#define EVENT_MAX_AGE ((uint32_t)TIMER_IO_TICKS_PER_SECOND * 120)
+
+/* ms the first event waits for others to share its batch, and before a send the mesh refused is tried again. */
+#define EVENT_GATHER_INTERVAL 20
+#define EVENT_RETRY_INTERVAL 50
+
+/* ms after which the next message goes out even without eventsSent. */
+#define EVENT_SENT_TIMEOUT 5000
+
+#define EVENT_DELTA_MASK ((1U << EVENT_DELTA_BITS) - 1)
+
+#define EVENT_SOURCES 16
+
+struct eventSource {
+	uint16_t address;
+	uint16_t nextSequence;
+	uint32_t messages;
+	uint32_t missedMessages;
+	uint32_t lost;
+	uint32_t summarized;
+	uint32_t events[EVENT_CHANNELS];
+	NetworkTime first[EVENT_CHANNELS];
+	NetworkTime last[EVENT_CHANNELS];
+};
+
+static const uint32_t eventInputs[EVENT_CHANNELS] = {
+	NRF_DT_GPIOS_TO_PSEL_OR(DT_ALIAS(event_in0), gpios, TIMER_IO_NO_PIN),
+	NRF_DT_GPIOS_TO_PSEL_OR(DT_ALIAS(event_in1), gpios, TIMER_IO_NO_PIN),
+	NRF_DT_GPIOS_TO_PSEL_OR(DT_ALIAS(event_in2), gpios, TIMER_IO_NO_PIN),
+	NRF_DT_GPIOS_TO_PSEL_OR(DT_ALIAS(event_in3), gpios, TIMER_IO_NO_PIN)
+};
+
+static void uploadWork(struct k_work *work);
+static K_WORK_DELAYABLE_DEFINE(upload, uploadWork);
+
+/*
+ * All inputs share the GPIOTE interrupt, so the ISR is the only producer
+ * and the upload work the only consumer. The head is written by the ISR
+ * alone, the tail by the work alone, the atomics order the slot accesses
+ * around them. Both count up and wrap, the slot is the count modulo the
+ * length. The work converts the ticks before they wrap after 268 s.
+ */
+static uint32_t ringTicks[EVENT_RING_LENGTH];
+static uint8_t ringChannels[EVENT_RING_LENGTH];
+static atomic_t ringHead;
+static atomic_t ringTail;
+
+/* Events past a full ring, converted by the ISR. The work takes them under irq_lock. */
+static struct eventSummary overflow[EVENT_CHANNELS];
+
+/* Events without network time, from the ISR and the work, until a message reported them. */
+static atomic_t lostEvents;
+
+/* Sender side, system workqueue only. */
+static uint16_t messageSequence;
+
+/* Master side, mesh RX thread. */
+static struct eventSource eventSources[EVENT_SOURCES];
+static void (*eventHandler)(uint16_t address, uint8_t channel, NetworkTime time);
+
+static void addToSummary(struct eventSummary *summary, uint32_t events, NetworkTime first, NetworkTime last) {
+	if (summary->events == 0 || first < summary->first) {
+		summary->first = first;
+	}
+	if (summary->events == 0 || last > summary->last) {
+		summary->last = last;
+	}
+	summary->events += events;
+}
+
+static void captured(uint8_t channel, uint32_t ticks) {
+	uint32_t head = atomic_get(&ringHead);
+	uint32_t pending = head - (uint32_t)atomic_get(&ringTail);
+	NetworkTime time;
+
+	if (pending >= EVENT_RING_LENGTH) {
+		if (ticksToNetworkTime(ticks, &time)) {
+			addToSummary(&overflow[channel], 1, time, time);
+		} else {
+			atomic_inc(&lostEvents);
+		}
+		return;
+	}
+
+	ringTicks[head % EVENT_RING_LENGTH] = ticks;
+	ringChannels[head % EVENT_RING_LENGTH] = channel;
+	atomic_set(&ringHead, head + 1);
+
+	/* The work reschedules itself while the ring holds events, it only needs waking on the first. */
+	if (pending == 0) {
+		k_work_schedule(&upload, K_MSEC(EVENT_GATHER_INTERVAL));
+	}
+}
+
+void initializeEventCapture() {
+	for (uint8_t i = 0; i < EVENT_CHANNELS; i++) {
+		int result;
+
+		if (eventInputs[i] == TIMER_IO_NO_PIN) {
+			continue;
+		}
+
+		result = captureEdges(eventInputs[i], captured, i);
+		if (result != 0) {
+			LOG_WRN("Event input %u unavailable (err %d)", i, result);
+		}
+	}
+}
+
+/* Takes the overflow summaries, false when there are none. */
+static bool takeOverflow(struct eventSummary *summaries) {
+	unsigned int key = irq_lock();
+	bool taken = false;
+
+	for (uint8_t i = 0; i < EVENT_CHANNELS; i++) {
+		taken |= overflow[i].events > 0;
+	}
+
+	if (taken) {
+		memcpy(summaries, overflow, sizeof(overflow));
+		memset(overflow, 0, sizeof(overflow));
+	}
+
+	irq_unlock(key);
+	return taken;
+}
+
+static void returnOverflow(const struct eventSummary *summaries) {
+	unsigned int key = irq_lock();
+
+	for (uint8_t i = 0; i < EVENT_CHANNELS; i++) {
+		if (summaries[i].events > 0) {
+			addToSummary(&overflow[i], summaries[i].events, summaries[i].first, summaries[i].last);
+		}
+	}
+
+	irq_unlock(key);
+}
+
+/*
+ * Fills a batch from the ring from tail on until it is full or the ring
+ * empty, and returns the tail after it. The deltas are rounded down, the
+ * times they add up to are carried along so the rounding does not
+ * accumulate.
+ */
+static uint32_t fillBatch(uint32_t tail, uint32_t head, uint16_t *words, uint8_t *count, NetworkTime *start, uint32_t *unstamped) {
+	uint32_t now = getTimerTicks();
+	NetworkTime previous = 0;
+
+	for (; tail != head; tail++) {
+		uint32_t ticks = ringTicks[tail % EVENT_RING_LENGTH];
+		uint16_t channel = (uint16_t)ringChannels[tail % EVENT_RING_LENGTH] << EVENT_DELTA_BITS;
+		NetworkTime time;
+		int64_t delta;
+
+		if (now - ticks > EVENT_MAX_AGE || !ticksToNetworkTime(ticks, &time)) {
+			(*unstamped)++;
+			continue;
+		}
+
+		if (*count == 0) {
+			*start = time;
+			previous = time;
+		}
+
+		delta = MAX(time - previous, 0) >> EVENT_TIME_SHIFT;
+		if (delta > UINT32_MAX || *count + (delta < EVENT_DELTA_ESCAPE ? 1 : 3) > EVENT_BATCH_WORDS) {
+			break;
+		}
+
+		if (delta < EVENT_DELTA_ESCAPE) {
+			words[(*count)++] = channel | (uint16_t)delta;
+		} else {
+			words[(*count)++] = channel | EVENT_DELTA_ESCAPE;
+			words[(*count)++] = (uint16_t)delta;
+			words[(*count)++] = (uint16_t)(delta >> 16);
+		}
+
+		previous += delta << EVENT_TIME_SHIFT;
+	}
+
+	return tail;
+}
+
+/*
+ * Sends one message, the summaries first. The ring and the counts only
+ * move on when the mesh took the message, eventsSent starts the next.
+ */
+static void uploadWork(struct k_work *work) {
+	struct eventSummary summaries[EVENT_CHANNELS];
+	uint16_t words[EVENT_BATCH_WORDS];
+	uint32_t tail = atomic_get(&ringTail);
+	uint32_t head = atomic_get(&ringHead);
+	uint32_t lost = atomic_get(&lostEvents);
+	uint32_t unstamped = 0;
+	uint16_t reported;
+	NetworkTime start = 0;
+	uint8_t count = 0;
+	int error;
+
+	if (takeOverflow(summaries)) {
+		reported = MIN(lost, UINT16_MAX);
+		error = sendEventSummary(messageSequence, reported, summaries);
+		if (error != 0) {
+			returnOverflow(summaries);
+		}
+	} else {
+		tail = fillBatch(tail, head, words, &count, &start, &unstamped);
+		if (count == 0 && lost + unstamped == 0) {
+			return;
+		}
+
+		reported = MIN(lost + unstamped, UINT16_MAX);
+		error = sendEvents(messageSequence, reported, start, words, count);
+		if (error == 0) {
+			atomic_set(&ringTail, tail);
+		}
+	}
+
+	if (error != 0) {
+		k_work_schedule(&upload, K_MSEC(EVENT_RETRY_INTERVAL));
+		return;
+	}
+
+	/* The ISR may have lost more meanwhile, only what the message reported is taken off. */
+	messageSequence++;
+	atomic_add(&lostEvents, (atomic_val_t)unstamped - reported);
+
+	if (tail != (uint32_t)atomic_get(&ringHead) || atomic_get(&lostEvents) > 0) {
+		k_work_schedule(&upload, K_MSEC(EVENT_SENT_TIMEOUT));
+	}
+}
+
+void eventsSent(int error) {
+	if (error != 0) {
+		LOG_WRN("Events to the master dropped by the mesh (err %d)", error);
+	}
+
+	k_work_reschedule(&upload, K_NO_WAIT);
+}
+
+void setEventHandler(void (*handler)(uint16_t address, uint8_t channel, NetworkTime time)) {
+	eventHandler = handler;
+}
+
+static struct eventSource *findSource(uint16_t address) {
+	for (uint8_t i = 0; i < EVENT_SOURCES; i++) {
+		if (eventSources[i].address == address) {
+			return &eventSources[i];
+		}
+	}
+
+	for (uint8_t i = 0; i < EVENT_SOURCES; i++) {
+		if (eventSources[i].address == 0) {
+			eventSources[i].address = address;
+			return &eventSources[i];
+		}
+	}
+
+	return NULL;
+}
+
+/* The source of a message, its sequence and losses counted, or NULL when the table is full. */
+static struct eventSource *countMessage(uint16_t address, uint16_t sequence, uint16_t lost) {
+	struct eventSource *source = findSource(address);
+
+	if (source == NULL) {
+		LOG_WRN("Events of 0x%04X dropped, too many sources", address);
+		return NULL;
+	}
+
+	/* Mesh messages are not reordered on one path, a sequence ahead means messages went missing. */
+	if (source->messages > 0 && (int16_t)(sequence - source->nextSequence) > 0) {
+		source->missedMessages += (uint16_t)(sequence - source->nextSequence);
+	}
+	source->nextSequence = sequence + 1;
+	source->messages++;
+	source->lost += lost;
+
+	return source;
+}
+
+/* Summaries arrive ahead of the batches of earlier events, so first and last are kept as extremes. */
+static void addEvents(struct eventSource *source, uint8_t channel, uint32_t events, NetworkTime first, NetworkTime last) {
+	if (source->events[channel] == 0 || first < source->first[channel]) {
+		source->first[channel] = first;
+	}
+	if (source->events[channel] == 0 || last > source->last[channel]) {
+		source->last[channel] = last;
+	}
+	source->events[channel] += events;
+}
+
+void receiveEvents(uint16_t address, uint16_t sequence, uint16_t lost, NetworkTime start, const uint16_t *words, uint8_t count) {
+	struct eventSource *source = countMessage(address, sequence, lost);
+	NetworkTime time = start;
+
+	if (source == NULL) {
+		return;
+	}
+
+	for (uint8_t i = 0; i < count; i++) {
+		uint8_t channel = words[i] >> EVENT_DELTA_BITS;
+		uint32_t delta = words[i] & EVENT_DELTA_MASK;
+
+		if (delta == EVENT_DELTA_ESCAPE) {
+			if (count - i < 3) {
+				break;
+			}
+			delta = words[i + 1] | (uint32_t)words[i + 2] << 16;
+			i += 2;
+		}
+
+		time += (int64_t)delta << EVENT_TIME_SHIFT;
+		addEvents(source, channel, 1, time, time);
+
+		if (eventHandler != NULL) {
+			eventHandler(address, channel, time);
+		}
+	}
+}
+
+void receiveEventSummary(uint16_t address, uint16_t sequence, uint16_t lost, const struct eventSummary *summaries) {
+	struct eventSource *source = countMessage(address, sequence, lost);
+
+	if (source == NULL) {
+		return;
+	}
+
+	for (uint8_t channel = 0; channel < EVENT_CHANNELS; channel++) {
+		if (summaries[channel].events > 0) {
+			addEvents(source, channel, summaries[channel].events, summaries[channel].first, summaries[channel].last);
+			source->summarized += summaries[channel].events;
+		}
+	}
+}
+
+void printEvents() {
+	for (uint8_t i = 0; i < EVENT_SOURCES; i++) {
+		const struct eventSource *source = &eventSources[i];
+
+		if (source->address == 0) {
+			continue;
+		}
+
+		printk(
+			"0x%04X: %u messages, %u missed, %u events lost, %u summarized\n",
+			source->address,
+			source->messages,
+			source->missedMessages,
+			source->lost,
+			source->summarized
+		);
+
+		for (uint8_t channel = 0; channel < EVENT_CHANNELS; channel++) {
+			int64_t span = source->last[channel] - source->first[channel];
+
+			if (source->events[channel] == 0) {
+				continue;
+			}
+
+			printk(
+				"  input %u: %u events, %lld per s, last at %lld ms\n",
+				channel,
+				source->events[channel],
+				span > 0 ? (source->events[channel] - 1) * DEVICE_TIME_PER_SECOND / span : 0,
+				source->last[channel] / DEVICE_TIME_PER_MILLISECOND
+			);
+		}
+	}
+}
@@ -13,6 +13,7 @@
 #include <dk_buttons_and_leds.h>
 #include "model_handler.h"
 #include "chat_cli.h"
+#include "synchronization.h"
 
 #include <zephyr/logging/log.h>
 LOG_MODULE_REGISTER(chat, CONFIG_LOG_DEFAULT_LEVEL);
@@ -51,6 +52,8 @@ void main(void)
 
 	printk("Initializing...\n");
 
+	initializeSynchronization();
+
 	err = bt_enable(bt_ready);
 	if (err) {
 		printk("Bluetooth init failed (err %d)\n", err);
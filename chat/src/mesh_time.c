@@ -0,0 +1,209 @@
+#include <zephyr/kernel.h>
+#include <zephyr/logging/log.h>
+#include <zephyr/sys/atomic.h>
+#include "mesh_time.h"
+#include "synchronization.h"
+
+LOG_MODULE_DECLARE(chat);
+
+#define DEVICE_TIME_PER_MILLISECOND 63897600LL
+
+/* Advertising and scheduling jitter of one exchange, device time units. */
+#define MESH_TIMESTAMP_NOISE (1.0 * DEVICE_TIME_PER_MILLISECOND)
+
+/* The exchanges come as often as the model needs to stay within this error, device time units. */
+#define MESH_TIME_MAX_ERROR (2 * DEVICE_TIME_PER_MILLISECOND)
+#define MESH_TIME_MINIMUM_INTERVAL 1000
+#define MESH_TIME_RETRY 3000
+
+/* Exchanges slower than the fastest of the recent ones by more than the margin waited in some queue. */
+#define MESH_DELAY_WINDOW 8
+#define MESH_DELAY_MARGIN (2 * DEVICE_TIME_PER_MILLISECOND)
+#define MESH_FOLLOW_UP_QUEUE_LENGTH 4
+
+enum exchangeFlag { RequestSent, ReplyReceived };
+
+struct followUp {
+	uint16_t address;
+	uint8_t sequence;
+	NetworkTime received;
+	NetworkTime replied;
+};
+
+static void referenceWork(struct k_work *work);
+static void exchangeWork(struct k_work *work);
+static void followUpWork(struct k_work *work);
+static void answerWork(struct k_work *work);
+
+static K_WORK_DEFINE(referenceChange, referenceWork);
+static K_WORK_DELAYABLE_DEFINE(exchange, exchangeWork);
+static K_WORK_DEFINE(followUpProcessing, followUpWork);
+static K_WORK_DEFINE(answer, answerWork);
+
+K_MSGQ_DEFINE(followUps, sizeof(struct followUp), MESH_FOLLOW_UP_QUEUE_LENGTH, 4);
+
+/* Follower side, the reference is handed over from the mesh thread. */
+static uint16_t requestedReference;
+static uint16_t reference;
+static uint8_t sequence;
+static struct ClockModel model;
+static int64_t recentDelays[MESH_DELAY_WINDOW];
+static uint8_t delayCount;
+
+/* Stamped by the mesh threads, the flags say which of the current exchange are set. */
+static atomic_t exchangeFlags;
+static uint32_t requestCycles;
+static uint32_t replyCycles;
+
+/*
+ * Reference side, one request is answered at a time. A reply to another
+ * private message going out first lends the follow-up its time, the
+ * follower's delay filter drops such exchanges.
+ */
+static atomic_t replyAwaited;
+static uint16_t requester;
+static uint8_t requestSequence;
+static uint32_t requestReceived;
+static uint32_t replySent;
+
+static void referenceWork(struct k_work *work) {
+	reference = requestedReference;
+	resetClockModel(&model);
+	model.measurementNoise = MESH_TIMESTAMP_NOISE;
+	delayCount = 0;
+
+	if (reference != 0) {
+		k_work_reschedule(&exchange, K_NO_WAIT);
+	} else {
+		k_work_cancel_delayable(&exchange);
+	}
+}
+
+void followMeshTime(uint16_t address) {
+	requestedReference = address;
+	k_work_submit(&referenceChange);
+}
+
+/* Rescheduled when the follow-up arrives, otherwise the exchange is retried. */
+static void exchangeWork(struct k_work *work) {
+	if (reference == 0) {
+		return;
+	}
+
+	atomic_clear(&exchangeFlags);
+	sequence++;
+	sendMeshTimeRequest(reference, sequence);
+
+	k_work_reschedule(&exchange, K_MSEC(MESH_TIME_RETRY));
+}
+
+void meshTimeRequestSent(uint32_t cycles) {
+	requestCycles = cycles;
+	atomic_set_bit(&exchangeFlags, RequestSent);
+}
+
+bool meshTimeReplyReceived(uint16_t address, uint32_t cycles) {
+	if (address != reference || !atomic_test_bit(&exchangeFlags, RequestSent) || atomic_test_bit(&exchangeFlags, ReplyReceived)) {
+		return false;
+	}
+
+	replyCycles = cycles;
+	atomic_set_bit(&exchangeFlags, ReplyReceived);
+	return true;
+}
+
+void meshTimeFollowUp(uint16_t address, uint8_t followUpSequence, NetworkTime received, NetworkTime replied) {
+	struct followUp followUp = { .address = address, .sequence = followUpSequence, .received = received, .replied = replied };
+
+	k_msgq_put(&followUps, &followUp, K_NO_WAIT);
+	k_work_submit(&followUpProcessing);
+}
+
+static bool delayPlausible(int64_t delay) {
+	int64_t minimum = delay;
+
+	recentDelays[delayCount++ % MESH_DELAY_WINDOW] = delay;
+
+	for (uint8_t i = 0; i < MIN(delayCount, MESH_DELAY_WINDOW); i++) {
+		minimum = MIN(minimum, recentDelays[i]);
+	}
+
+	return delay <= minimum + MESH_DELAY_MARGIN;
+}
+
+/*
+ * Offset at the middle of the exchange, local device time minus network
+ * time, on the assumption that the request and the reply took equally long.
+ */
+static void followUpWork(struct k_work *work) {
+	struct followUp followUp;
+
+	while (k_msgq_get(&followUps, &followUp, K_NO_WAIT) == 0) {
+		DeviceTime sent;
+		DeviceTime returned;
+		DeviceTime middle;
+		NetworkTime referenceMiddle;
+		int64_t roundTrip;
+		int64_t turnaround;
+		int64_t delay;
+
+		if (followUp.address != reference || followUp.sequence != sequence
+			|| !atomic_test_bit(&exchangeFlags, RequestSent) || !atomic_test_bit(&exchangeFlags, ReplyReceived)) {
+			continue;
+		}
+		atomic_clear(&exchangeFlags);
+
+		if (!cyclesToDeviceTime(requestCycles, &sent) || !cyclesToDeviceTime(replyCycles, &returned)) {
+			continue;
+		}
+
+		roundTrip = deviceTimeDiff(returned, sent);
+		turnaround = followUp.replied - followUp.received;
+		delay = (roundTrip - turnaround) / 2;
+		k_work_reschedule(&exchange, K_MSEC(MESH_TIME_MINIMUM_INTERVAL));
+
+		if (turnaround < 0 || delay < 0 || !delayPlausible(delay)) {
+			LOG_DBG("Mesh time exchange %u dropped, delay %lld us", sequence, (long long)(delay * 1000 / DEVICE_TIME_PER_MILLISECOND));
+			continue;
+		}
+
+		middle = deviceTimeAdd(sent, roundTrip / 2);
+		referenceMiddle = followUp.received + turnaround / 2;
+
+		/* The first exchange tells which wrap of the master's clock network time is in. */
+		if (model.updates == 0 && !isNetworkTimeValid()) {
+			followNetworkMaster(referenceMiddle, k_uptime_get());
+		}
+
+		updateClockModel(&model, middle, k_uptime_get(), (middle - (DeviceTime)referenceMiddle) & DEVICE_TIME_MASK);
+		followMasterClock(&model);
+
+		k_work_reschedule(&exchange, K_MSEC(MAX(resyncInterval(&model, MESH_TIME_MAX_ERROR), MESH_TIME_MINIMUM_INTERVAL)));
+	}
+}
+
+void meshTimeRequest(uint16_t address, uint8_t requestedSequence, uint32_t cycles) {
+	requester = address;
+	requestSequence = requestedSequence;
+	requestReceived = cycles;
+	atomic_set(&replyAwaited, 1);
+}
+
+void meshTimeReplySent(uint32_t cycles) {
+	if (atomic_cas(&replyAwaited, 1, 0)) {
+		replySent = cycles;
+		k_work_submit(&answer);
+	}
+}
+
+/* A reference without network time stays silent, the follower retries. */
+static void answerWork(struct k_work *work) {
+	NetworkTime received;
+	NetworkTime replied;
+
+	if (!cyclesToNetworkTime(requestReceived, &received) || !cyclesToNetworkTime(replySent, &replied)) {
+		return;
+	}
+
+	sendMeshTimeFollowUp(requester, requestSequence, received, replied);
+}
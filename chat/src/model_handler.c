@@ -8,6 +8,9 @@
 #include "model_handler.h"
 #include <zephyr/logging/log.h>
 #include "synchronization.h"
+#include "benchmark.h"
+#include "mesh_time.h"
+#include "event_capture.h"
 
 LOG_MODULE_DECLARE(chat);
 
@@ -144,6 +147,8 @@ static void handle_chat_start(struct bt_mesh_chat_cli *chat) {
 
 static void handle_chat_presence(struct bt_mesh_chat_cli *chat, struct bt_mesh_msg_ctx *ctx, enum bt_mesh_chat_cli_presence presence)
 {
+	noteMeshNeighbour(ctx->addr, ctx->recv_ttl);
+
 	if (address_is_local(chat->model, ctx->addr)) {
 		if (address_is_unicast(ctx->recv_dst)) {
 			shell_print(chat_shell, "<you> are %s", presence_string[presence]);
@@ -158,19 +163,31 @@ static void handle_chat_presence(struct bt_mesh_chat_cli *chat, struct bt_mesh_m
 }
 
 static void handle_chat_message(struct bt_mesh_chat_cli *chat, struct bt_mesh_msg_ctx *ctx, const uint8_t *msg) {
+	noteMeshNeighbour(ctx->addr, ctx->recv_ttl);
 	if (!address_is_local(chat->model, ctx->addr)) {
 		messageHandler(msg, ctx->addr);
 	}
 }
 
+/* Cycle count at the RX callback of the private message being handled, for the mesh time exchange. */
+static uint32_t receiveCycles;
+
 static void handle_chat_private_message(struct bt_mesh_chat_cli *chat, struct bt_mesh_msg_ctx *ctx, const uint8_t *msg) {
+	receiveCycles = k_cycle_get_32();
+	noteMeshNeighbour(ctx->addr, ctx->recv_ttl);
 	if (!address_is_local(chat->model, ctx->addr)) {
 		messageHandler(msg, ctx->addr);
 	}
 }
 
 static void handle_chat_message_reply(struct bt_mesh_chat_cli *chat, struct bt_mesh_msg_ctx *ctx) {
-	shell_print(chat_shell, "<0x%04X> received the message", ctx->addr);
+	if (!meshTimeReplyReceived(ctx->addr, k_cycle_get_32())) {
+		shell_print(chat_shell, "<0x%04X> received the message", ctx->addr);
+	}
+}
+
+static void handle_chat_reply_sent(struct bt_mesh_chat_cli *chat) {
+	meshTimeReplySent(k_cycle_get_32());
 }
 
 static const struct bt_mesh_chat_cli_handlers chat_handlers = {
@@ -179,6 +196,7 @@ static const struct bt_mesh_chat_cli_handlers chat_handlers = {
 	.message = handle_chat_message,
 	.private_message = handle_chat_private_message,
 	.message_reply = handle_chat_message_reply,
+	.reply_sent = handle_chat_reply_sent,
 };
 
 /* .. include_startingpoint_model_handler_rst_1 */
@@ -225,6 +243,26 @@ static int cmd_message(const struct shell *shell, size_t argc, char *argv[]) {
 		broadcastMaster();
 	} else if (strcmp(argv[1], "SYNC") == 0) {
 		getClockDelta(strtol(argv[2], NULL, 0), strtol(argv[3], NULL, 0));
+	} else if (strcmp(argv[1], "TRACK") == 0) {
+		trackClockDelta(strtol(argv[2], NULL, 0), strtol(argv[3], NULL, 0), strtol(argv[4], NULL, 0));
+	} else if (strcmp(argv[1], "BEACON") == 0) {
+		startBeacons(strtol(argv[2], NULL, 0));
+	} else if (strcmp(argv[1], "LINK") == 0) {
+		if (argc < 4) {
+			clearNetworkLinks();
+		} else {
+			addNetworkLink(strtol(argv[2], NULL, 0), strtol(argv[3], NULL, 0));
+		}
+	} else if (strcmp(argv[1], "NETWORK") == 0) {
+		synchronizeNetwork();
+	} else if (strcmp(argv[1], "NEIGHBOURS") == 0) {
+		collectNeighbours();
+	} else if (strcmp(argv[1], "BENCH") == 0) {
+		startBenchmark(strtol(argv[2], NULL, 0), strtol(argv[3], NULL, 0));
+	} else if (strcmp(argv[1], "MESHTIME") == 0) {
+		followMeshTime(strtol(argv[2], NULL, 0));
+	} else if (strcmp(argv[1], "EVENTS") == 0) {
+		printEvents();
 	}
 
 	return 0;
@@ -329,7 +367,7 @@ SHELL_STATIC_SUBCMD_SET_CREATE(
 	SHELL_CMD_ARG(status, NULL, "Print client status", cmd_status, 1, 0),
 	SHELL_CMD(presence, &presence_cmds, "Presence commands", cmd_presence),
 	SHELL_CMD_ARG(private, NULL, "Send a private text message to a client <node> <message>", cmd_private_message, 3, 0),
-	SHELL_CMD_ARG(msg, NULL, "Send a text message to the chat <message>", cmd_message, 2, 2),
+	SHELL_CMD_ARG(msg, NULL, "Send a text message to the chat <message>", cmd_message, 2, 3),
 	SHELL_SUBCMD_SET_END
 );
 
@@ -369,11 +407,54 @@ void sendBroadcast(const uint8_t* message, size_t messageLength) {
 
 void sendUnicast(const uint8_t* message, size_t messageLength, uint16_t address) {
 	if (bt_mesh_model_elem(chat.model)->addr != address) {
-		int error = bt_mesh_data_private_message_send(&chat, address, message, messageLength);
+		int error = bt_mesh_data_private_message_send(&chat, address, message, messageLength, NULL, NULL);
 		if (error) {
 			LOG_WRN("Failed to publish message: %d", error);
 		}
 	} else {
 		messageHandler(message, bt_mesh_model_elem(chat.model)->addr);
 	}
-}
\ No newline at end of file
+}
+
+static void timed_start(uint16_t duration, int err, void *cb_data) {
+	if (!err) {
+		meshTimeRequestSent(k_cycle_get_32());
+	}
+}
+
+static const struct bt_mesh_send_cb timed_send_cb = {
+	.start = timed_start,
+};
+
+void sendTimedUnicast(const uint8_t* message, size_t messageLength, uint16_t address) {
+	int error = bt_mesh_data_private_message_send(&chat, address, message, messageLength, &timed_send_cb, NULL);
+	if (error) {
+		LOG_WRN("Failed to send timed message: %d", error);
+	}
+}
+
+static void events_end(int err, void *cb_data) {
+	eventsSent(err);
+}
+
+static const struct bt_mesh_send_cb events_send_cb = {
+	.end = events_end,
+};
+
+int sendEventUnicast(const uint8_t* message, size_t messageLength, uint16_t address) {
+	if (bt_mesh_model_elem(chat.model)->addr == address) {
+		messageHandler(message, address);
+		eventsSent(0);
+		return 0;
+	}
+
+	return bt_mesh_data_private_message_send(&chat, address, message, messageLength, &events_send_cb, NULL);
+}
+
+uint32_t getReceiveCycles(void) {
+	return receiveCycles;
+}
+
+uint16_t getOwnAddress(void) {
+	return bt_mesh_model_elem(chat.model)->addr;
+}
@@ -0,0 +1,530 @@
+#include <zephyr/kernel.h>
+#include <zephyr/logging/log.h>
+#include <zephyr/sys/atomic.h>
+#include <math.h>
+#include <string.h>
+#include "network_time.h"
+#include "timer_io.h"
+#include "DSTWR.h"
+#include "SyncBeacon.h"
+#include <deca_device_api.h>
+
+LOG_MODULE_DECLARE(chat);
+
+#define DEVICE_TIME_PER_SECOND 63897600000LL
+#define DEVICE_TIME_PER_MILLISECOND 63897600LL
+#define DEVICE_TIME_WRAP (1LL << 40)
+
+/* ms between readings of the DW3000 clock against the cycle counter, the rate spans the whole ring. */
+#define CALIBRATION_INTERVAL 1000
+#define CALIBRATION_SAMPLES 16
+
+/* Scheduled frames leave the workqueue this long before their TX time, the chip waits out the rest. */
+#define TRANSMISSION_LEAD_US 10000
+#define TRANSMISSION_MINIMUM_US 200
+
+/*
+ * Readings whose tick bracket is this much wider than the narrowest seen
+ * were preempted around the SPI read, they would move the tick mapping by
+ * up to the delay and are dropped from it. Every drop widens the limit by a
+ * tick, so a lucky narrow bracket cannot stall the mapping.
+ */
+#define TICK_BRACKET_SLACK 32
+
+/*
+ * A follower gives up network time when this many of its beacon or mesh
+ * exchange intervals passed without one, the last interval measured and
+ * at least the minimum in ms. Its last network time stays as the hint.
+ */
+#define MISSED_FOLLOW_LIMIT 4
+#define FOLLOW_TIMEOUT_MINIMUM 10000
+
+/*
+ * Relation of the cycle counter, the local device time and network time,
+ * all anchored at bases so the conversions are a multiply and shift. Local
+ * device time is unwrapped to 64 bits here, the rates are Q32.
+ */
+struct timeMapping {
+	uint32_t sequence;
+	bool calibrated;
+	bool synchronized;
+	uint32_t cycleBase;
+	int64_t cycleLocal;         /* local device time at cycleBase */
+	uint64_t devicePerCycle;
+	bool ticksCalibrated;
+	uint32_t tickBase;
+	int64_t tickLocal;          /* local device time at tickBase */
+	uint64_t devicePerTick;
+	int64_t localBase;
+	NetworkTime networkBase;    /* network time at localBase */
+	int64_t skew;               /* network minus local rate, relative */
+};
+
+/*
+ * The system workqueue writes the inactive mapping and flips activeMapping,
+ * so readers interrupting it see a complete one. The sequence catches the
+ * rare reader preempted across two publishes.
+ */
+static struct timeMapping mappings[2];
+static atomic_t activeMapping;
+
+/* Writer state, system workqueue only. */
+static struct timeMapping current;
+static uint32_t calibrationCycles[CALIBRATION_SAMPLES];
+static int64_t calibrationLocal[CALIBRATION_SAMPLES];
+static uint32_t calibrationCount;
+static uint32_t tickSamples[CALIBRATION_SAMPLES];
+static int64_t tickSampleLocal[CALIBRATION_SAMPLES];
+static uint32_t tickSampleCount;
+static uint32_t narrowestBracket = UINT32_MAX;
+static bool timerIo;
+static bool uwb;
+static bool master;
+static bool hintValid;
+static NetworkTime hint;
+static int64_t hintUptime;
+static int64_t lastFollowLocal;
+static int64_t followInterval;
+
+static void calibrationWork(struct k_work *work);
+static K_WORK_DELAYABLE_DEFINE(calibration, calibrationWork);
+
+/* Role changes from the mesh thread are applied on the workqueue, with the next publish. */
+static struct k_work roleChange;
+static bool requestedMaster;
+static NetworkTime requestedHint;
+static int64_t requestedHintUptime;
+
+static struct k_work_delayable transmissionWork;
+static atomic_t transmissionPending;
+static NetworkTime transmissionTime;
+static uint8_t transmissionFrame[DSTWR_MAX_FRAME_LENGTH];
+static uint16_t transmissionLength;
+
+static void readMapping(struct timeMapping *mapping) {
+	uint32_t sequence;
+
+	do {
+		const struct timeMapping *active = &mappings[atomic_get(&activeMapping)];
+
+		sequence = active->sequence;
+		compiler_barrier();
+		*mapping = *active;
+		compiler_barrier();
+	} while ((sequence & 1) != 0 || sequence != mapping->sequence);
+}
+
+static void publishMapping() {
+	int next = !atomic_get(&activeMapping);
+	uint32_t sequence = mappings[next].sequence + 1;
+
+	mappings[next].sequence = sequence;
+	compiler_barrier();
+	mappings[next] = current;
+	mappings[next].sequence = sequence + 1;
+	compiler_barrier();
+	atomic_set(&activeMapping, next);
+}
+
+static int64_t mulQ32(int64_t value, uint64_t factor) {
+	uint64_t magnitude = value < 0 ? -value : value;
+	uint64_t result = magnitude * (factor >> 32) + ((magnitude * (factor & UINT32_MAX)) >> 32);
+
+	return value < 0 ? -(int64_t)result : (int64_t)result;
+}
+
+static int64_t localFromCycles(const struct timeMapping *mapping, uint32_t cycles) {
+	return mapping->cycleLocal + mulQ32((int32_t)(cycles - mapping->cycleBase), mapping->devicePerCycle);
+}
+
+static uint32_t cyclesFromLocal(const struct timeMapping *mapping, int64_t local) {
+	return mapping->cycleBase + (uint32_t)((local - mapping->cycleLocal) * 65536 / (int64_t)(mapping->devicePerCycle >> 16));
+}
+
+static int64_t localFromTicks(const struct timeMapping *mapping, uint32_t ticks) {
+	return mapping->tickLocal + mulQ32((int32_t)(ticks - mapping->tickBase), mapping->devicePerTick);
+}
+
+static uint32_t ticksFromLocal(const struct timeMapping *mapping, int64_t local) {
+	return mapping->tickBase + (uint32_t)((local - mapping->tickLocal) * 65536 / (int64_t)(mapping->devicePerTick >> 16));
+}
+
+/* Signed value times the Q32 relative skew, split so it cannot overflow for skews below 1. */
+static int64_t mulSkew(int64_t value, int64_t skew) {
+	uint64_t magnitude = value < 0 ? -value : value;
+	uint64_t factor = skew < 0 ? -skew : skew;
+	uint64_t result = (magnitude >> 32) * factor + (((magnitude & UINT32_MAX) * factor) >> 32);
+
+	return (value < 0) != (skew < 0) ? -(int64_t)result : (int64_t)result;
+}
+
+/* The bases move with every calibration, so elapsed stays around a second for times near now. */
+static NetworkTime networkFromLocal(const struct timeMapping *mapping, int64_t local) {
+	int64_t elapsed = local - mapping->localBase;
+
+	return mapping->networkBase + elapsed + mulSkew(elapsed, mapping->skew);
+}
+
+static int64_t localFromNetwork(const struct timeMapping *mapping, NetworkTime network) {
+	int64_t elapsed = network - mapping->networkBase;
+
+	return mapping->localBase + elapsed - mulSkew(elapsed, mapping->skew);
+}
+
+/* The unwrapped time with the low 40 bits of time closest to near. */
+static int64_t unwrapNear(DeviceTime time, int64_t near) {
+	int64_t difference = (int64_t)((time - (uint64_t)near) & DEVICE_TIME_MASK);
+
+	if (difference >= DEVICE_TIME_WRAP / 2) {
+		difference -= DEVICE_TIME_WRAP;
+	}
+
+	return near + difference;
+}
+
+void followMasterClock(const struct ClockModel *model) {
+	int64_t local;
+	DeviceTime masterTime;
+
+	if (master || !current.calibrated) {
+		return;
+	}
+
+	local = unwrapNear(model->baseTime & DEVICE_TIME_MASK, localFromCycles(&current, k_cycle_get_32()));
+	masterTime = (local - (model->baseOffset + llround(model->offset))) & DEVICE_TIME_MASK;
+
+	if (current.synchronized) {
+		current.networkBase = unwrapNear(masterTime, networkFromLocal(&current, local));
+	} else if (hintValid) {
+		current.networkBase = unwrapNear(masterTime, hint + (k_uptime_get() - hintUptime) * DEVICE_TIME_PER_MILLISECOND);
+	} else {
+		return;
+	}
+
+	if (current.synchronized) {
+		followInterval = local - lastFollowLocal;
+	}
+	lastFollowLocal = local;
+
+	/* The model's skew is the offset drift, local minus master, per local second. */
+	current.localBase = local;
+	current.skew = -llround(ldexp(model->skew / DEVICE_TIME_PER_SECOND, 32));
+	current.synchronized = true;
+
+	publishMapping();
+}
+
+/*
+ * The TIMER ticks get their own ring, of the readings with a narrow
+ * bracket. The rate spans the ring like that of the cycles, the local time
+ * at the base is the mean over the ring so a single reading's jitter is
+ * averaged too. What remains is the constant delay from the middle of the
+ * bracket to the DW3000 latching its clock, the same on identical nodes.
+ */
+static void calibrateTicks(uint32_t before, uint32_t after, int64_t local) {
+	uint32_t bracket = after - before;
+	uint32_t ticks = before + bracket / 2;
+	uint8_t slot = tickSampleCount % CALIBRATION_SAMPLES;
+	uint8_t samples;
+	int64_t deviation = 0;
+
+	narrowestBracket = MIN(narrowestBracket, bracket);
+	if (bracket > narrowestBracket + TICK_BRACKET_SLACK) {
+		narrowestBracket++;
+		return;
+	}
+
+	if (tickSampleCount == 0) {
+		current.devicePerTick = ((uint64_t)DEVICE_TIME_PER_SECOND << 16) / TIMER_IO_TICKS_PER_SECOND << 16;
+	} else {
+		uint8_t oldest = tickSampleCount < CALIBRATION_SAMPLES ? 0 : slot;
+
+		current.devicePerTick = (uint64_t)ldexp((double)(local - tickSampleLocal[oldest]) / (uint32_t)(ticks - tickSamples[oldest]), 32);
+	}
+
+	tickSamples[slot] = ticks;
+	tickSampleLocal[slot] = local;
+	tickSampleCount++;
+
+	samples = MIN(tickSampleCount, CALIBRATION_SAMPLES);
+	for (uint8_t i = 0; i < samples; i++) {
+		deviation += tickSampleLocal[i] + mulQ32((int32_t)(ticks - tickSamples[i]), current.devicePerTick) - local;
+	}
+
+	current.tickBase = ticks;
+	current.tickLocal = local + deviation / samples;
+	current.ticksCalibrated = true;
+}
+
+/*
+ * Rebases the follower's mapping at local, or drops network time when the
+ * beacons stopped. Nothing but calibration moves the bases between them.
+ */
+static void followTimeout(int64_t local) {
+	int64_t timeout = MAX(MISSED_FOLLOW_LIMIT * followInterval, FOLLOW_TIMEOUT_MINIMUM * DEVICE_TIME_PER_MILLISECOND);
+	NetworkTime network = networkFromLocal(&current, local);
+
+	if (local - lastFollowLocal > timeout) {
+		LOG_WRN("No beacon for %lld ms, network time lost", (long long)((local - lastFollowLocal) / DEVICE_TIME_PER_MILLISECOND));
+		hint = network;
+		hintUptime = k_uptime_get();
+		hintValid = true;
+		followInterval = 0;
+		current.synchronized = false;
+		return;
+	}
+
+	current.networkBase = network;
+	current.localBase = local;
+}
+
+static void calibrationWork(struct k_work *work) {
+	uint32_t before = k_cycle_get_32();
+	uint32_t ticksBefore = timerIo ? getTimerTicks() : 0;
+	DeviceTime device = uwb ? (DeviceTime)dwt_readsystimestamphi32() << 8 : 0;
+	uint32_t ticksAfter = timerIo ? getTimerTicks() : 0;
+	uint32_t after = k_cycle_get_32();
+	uint32_t cycles = before + (after - before) / 2;
+	int64_t local;
+	uint8_t slot = calibrationCount % CALIBRATION_SAMPLES;
+
+	if (current.calibrated && !uwb) {
+		local = localFromCycles(&current, cycles);
+	} else if (current.calibrated) {
+		local = unwrapNear(device, localFromCycles(&current, cycles));
+	} else {
+		local = device;
+		current.devicePerCycle = ((uint64_t)DEVICE_TIME_PER_SECOND << 16) / sys_clock_hw_cycles_per_sec() << 16;
+	}
+
+	/* Once the ring is full the rate spans CALIBRATION_SAMPLES s, which averages out the read jitter. */
+	if (uwb && calibrationCount > 0) {
+		uint8_t oldest = calibrationCount < CALIBRATION_SAMPLES ? 0 : slot;
+
+		current.devicePerCycle = (uint64_t)ldexp((double)(local - calibrationLocal[oldest]) / (uint32_t)(cycles - calibrationCycles[oldest]), 32);
+	}
+
+	calibrationCycles[slot] = cycles;
+	calibrationLocal[slot] = local;
+	calibrationCount++;
+
+	current.cycleBase = cycles;
+	current.cycleLocal = local;
+	current.calibrated = true;
+
+	if (timerIo) {
+		calibrateTicks(ticksBefore, ticksAfter, local);
+	}
+
+	if (master) {
+		current.localBase = local;
+		current.networkBase = local;
+		current.skew = 0;
+		current.synchronized = true;
+	} else if (current.synchronized) {
+		followTimeout(local);
+	}
+
+	publishMapping();
+
+	k_work_schedule(&calibration, K_MSEC(CALIBRATION_INTERVAL));
+}
+
+static void applyRole(struct k_work *work) {
+	master = requestedMaster;
+	hint = requestedHint;
+	hintUptime = requestedHintUptime;
+	hintValid = !master;
+	followInterval = 0;
+
+	/* A master change starts over, the new master's network time has nothing to do with the old one. */
+	current.synchronized = false;
+	current.skew = 0;
+
+	k_work_reschedule(&calibration, K_NO_WAIT);
+}
+
+static void transmit(struct k_work *work) {
+	struct timeMapping mapping;
+
+	readMapping(&mapping);
+
+	if (!mapping.synchronized) {
+		LOG_WRN("Scheduled frame dropped, network time lost");
+	} else if (!sendFrameAt(transmissionFrame, transmissionLength, localFromNetwork(&mapping, transmissionTime) & DEVICE_TIME_MASK)) {
+		LOG_WRN("Scheduled frame dropped, radio busy");
+	}
+
+	atomic_set(&transmissionPending, 0);
+}
+
+void initializeNetworkTime(bool uwbAvailable) {
+	uwb = uwbAvailable;
+	k_work_init(&roleChange, applyRole);
+	k_work_init_delayable(&transmissionWork, transmit);
+
+	timerIo = initializeTimerIo() == 0;
+	if (!timerIo) {
+		LOG_ERR("TIMER initialization failed, no timed pins");
+	}
+
+	if (uwb) {
+		setMasterClockHandler(followMasterClock);
+	}
+	k_work_schedule(&calibration, K_NO_WAIT);
+}
+
+/* On the workqueue already the role applies at once, so a followMasterClock right after sees it. */
+static void changeRole() {
+	if (k_current_get() == k_work_queue_thread_get(&k_sys_work_q)) {
+		applyRole(&roleChange);
+	} else {
+		k_work_submit(&roleChange);
+	}
+}
+
+void becomeNetworkMaster() {
+	requestedMaster = true;
+	changeRole();
+}
+
+void followNetworkMaster(NetworkTime networkTime, int64_t uptime) {
+	requestedMaster = false;
+	requestedHint = networkTime;
+	requestedHintUptime = uptime;
+	changeRole();
+}
+
+bool isNetworkTimeValid() {
+	struct timeMapping mapping;
+
+	readMapping(&mapping);
+	return mapping.synchronized;
+}
+
+bool getNetworkTime(NetworkTime *now) {
+	return cyclesToNetworkTime(k_cycle_get_32(), now);
+}
+
+bool deviceToNetworkTime(DeviceTime local, NetworkTime *network) {
+	struct timeMapping mapping;
+
+	readMapping(&mapping);
+	if (!mapping.synchronized) {
+		return false;
+	}
+
+	*network = networkFromLocal(&mapping, unwrapNear(local, localFromCycles(&mapping, k_cycle_get_32())));
+	return true;
+}
+
+bool networkToDeviceTime(NetworkTime network, DeviceTime *local) {
+	struct timeMapping mapping;
+
+	readMapping(&mapping);
+	if (!mapping.synchronized) {
+		return false;
+	}
+
+	*local = localFromNetwork(&mapping, network) & DEVICE_TIME_MASK;
+	return true;
+}
+
+bool cyclesToDeviceTime(uint32_t cycles, DeviceTime *local) {
+	struct timeMapping mapping;
+
+	readMapping(&mapping);
+	if (!mapping.calibrated) {
+		return false;
+	}
+
+	*local = localFromCycles(&mapping, cycles) & DEVICE_TIME_MASK;
+	return true;
+}
+
+bool cyclesToNetworkTime(uint32_t cycles, NetworkTime *network) {
+	struct timeMapping mapping;
+
+	readMapping(&mapping);
+	if (!mapping.synchronized) {
+		return false;
+	}
+
+	*network = networkFromLocal(&mapping, localFromCycles(&mapping, cycles));
+	return true;
+}
+
+bool ticksToNetworkTime(uint32_t ticks, NetworkTime *network) {
+	struct timeMapping mapping;
+
+	readMapping(&mapping);
+	if (!mapping.synchronized || !mapping.ticksCalibrated) {
+		return false;
+	}
+
+	*network = networkFromLocal(&mapping, localFromTicks(&mapping, ticks));
+	return true;
+}
+
+bool networkToCycles(NetworkTime network, uint32_t *cycles) {
+	struct timeMapping mapping;
+
+	readMapping(&mapping);
+	if (!mapping.synchronized) {
+		return false;
+	}
+
+	*cycles = cyclesFromLocal(&mapping, localFromNetwork(&mapping, network));
+	return true;
+}
+
+int scheduleTransmission(NetworkTime time, const uint8_t *frame, uint16_t length) {
+	struct timeMapping mapping;
+	int64_t ahead;
+	int64_t delay;
+
+	if (!uwb) {
+		return -ENODEV;
+	}
+
+	if (length > DSTWR_MAX_FRAME_LENGTH) {
+		return -EINVAL;
+	}
+
+	readMapping(&mapping);
+	if (!mapping.synchronized) {
+		return -EAGAIN;
+	}
+
+	ahead = localFromNetwork(&mapping, time) - localFromCycles(&mapping, k_cycle_get_32());
+	if (ahead < 0 || (delay = deviceTimeToMicroseconds(ahead)) < TRANSMISSION_MINIMUM_US) {
+		return -ETIME;
+	}
+
+	/* The chip takes delayed starts up to half its wrap ahead. */
+	if (ahead >= DEVICE_TIME_WRAP / 2) {
+		return -EINVAL;
+	}
+
+	if (!atomic_cas(&transmissionPending, 0, 1)) {
+		return -EBUSY;
+	}
+
+	memcpy(transmissionFrame, frame, length);
+	transmissionLength = length;
+	transmissionTime = time;
+
+	k_work_schedule(&transmissionWork, K_USEC(MAX(delay - TRANSMISSION_LEAD_US, 0)));
+	return 0;
+}
+
+int scheduleOutput(NetworkTime time, int value) {
+	struct timeMapping mapping;
+
+	readMapping(&mapping);
+	if (!mapping.synchronized || !mapping.ticksCalibrated) {
+		return -EAGAIN;
+	}
+
+	return setOutputAt(ticksFromLocal(&mapping, localFromNetwork(&mapping, time)), value);
+}
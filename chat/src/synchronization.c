@@ -1,8 +1,85 @@
+#include <zephyr/kernel.h>
+#include <zephyr/logging/log.h>
+#include <math.h>
+#include <string.h>
 #include "synchronization.h"
 #include "model_handler.h"
+#include "network_time.h"
+#include "benchmark.h"
+#include "mesh_time.h"
+#include "event_capture.h"
+#include "ClockModel.h"
+#include "ClockOffset.h"
+#include "DSTWR.h"
+#include "SyncBeacon.h"
 #include <dk_buttons_and_leds.h>
 
-enum messageType { SetMaster, SetupSynchronization, StartSynchronization, SynchronizationResult };
+LOG_MODULE_DECLARE(chat);
+
+/* ms a node keeps its side of the exchange before it gives up, the initiator retries failed exchanges until then. */
+#define SYNCHRONIZATION_TIME_OUT 2000
+
+/*
+ * Scheduled exchanges start this many ms after the master sends the
+ * schedule, enough for mesh delivery, in slots of this many ms. The
+ * responder listens for the window in us around the start.
+ */
+#define SCHEDULE_LEAD 500
+#define SCHEDULE_SLOT 10
+#define SCHEDULE_WINDOW 200
+#define DEVICE_TIME_PER_MILLISECOND 63897600LL
+
+/* Nodes whose time of flight to the master is known, and how many of them fit one mesh message. */
+#define PROPAGATION_TABLE_SIZE 32
+#define PROPAGATION_CHUNK 12
+
+/*
+ * Pairs the master keeps synchronized. A result counts as lost after the
+ * time out, mesh round trips included, and is retried after the retry.
+ */
+#define TRACKED_PAIRS 8
+#define TRACKING_TIME_OUT 5000
+#define TRACKING_RETRY 1000
+#define TRACKING_QUEUE_LENGTH 8
+
+/* Exchanges requested of this node per side, a round of the whole network asks for one each at most. */
+#define PAIRING_QUEUE_LENGTH 4
+
+/*
+ * Whole network synchronization by the master. A round waits for its
+ * results this long, failed pairs get this many more attempts, and this
+ * many pairs fit one mesh message.
+ */
+#define NETWORK_NODES CONFIG_BT_MESH_CHAT_SAMPLE_NETWORK_NODES
+#define NETWORK_NODE_WORDS ((NETWORK_NODES + 31) / 32)
+#define NETWORK_ROUNDS 64
+#define NETWORK_ROUND_TIME_OUT 4000
+#define NETWORK_RETRIES 2
+#define NETWORK_QUEUE_LENGTH 16
+#define ROUND_CHUNK 19
+
+/* Mesh neighbours a node remembers and reports, forgotten when not heard for the time out. */
+#define NEIGHBOUR_TABLE_SIZE 40
+#define NEIGHBOUR_TIME_OUT 600000
+
+enum messageType {
+	SetMaster,
+	SetupSynchronization,
+	StartSynchronization,
+	SynchronizationResult,
+	SynchronizationFailed,
+	FollowBeacons,
+	StopBeacons,
+	SynchronizationRound,
+	CollectNeighbours,
+	NeighbourReport,
+	ScheduleSynchronization,
+	BenchmarkPulses,
+	MeshTimeRequest,
+	MeshTimeFollowUp,
+	EventBatch,
+	EventSummary
+};
 
 volatile uint16_t masterAddress;
 
@@ -11,39 +88,1269 @@ struct addressMessage {
 	uint16_t address;
 } __attribute__((packed));
 
+/*
+ * Sent to both nodes of a pair, each arms its side for the poll at network
+ * time startTime plus slot slots, with the PHY profile profile.
+ */
+struct scheduleMessage {
+	const uint8_t type;
+	uint16_t responderAddress;
+	uint16_t initiatorAddress;
+	uint8_t profile;
+	uint8_t slot;
+	int64_t startTime;
+} __attribute__((packed));
+
+/* Every node pulses count times period ms apart from network time start, see benchmark.h. */
+struct pulseMessage {
+	const uint8_t type;
+	uint16_t count;
+	uint32_t period;
+	int64_t start;
+} __attribute__((packed));
+
+/* Mesh time exchange, the follow-up carries the reference's network times of the request and its reply. */
+struct meshTimeMessage {
+	const uint8_t type;
+	uint8_t sequence;
+	int64_t received;
+	int64_t replied;
+} __attribute__((packed));
+
+/* Captured events for the master, count words as in event_capture.h. */
+struct eventMessage {
+	const uint8_t type;
+	uint8_t count;
+	uint16_t sequence;
+	uint16_t lost;
+	int64_t start;
+	uint16_t words[EVENT_BATCH_WORDS];
+} __attribute__((packed));
+
+BUILD_ASSERT(sizeof(struct eventMessage) <= CONFIG_BT_MESH_CHAT_CLI_MESSAGE_LENGTH, "A batch of events must fit into one message.");
+
+struct eventSummaryMessage {
+	const uint8_t type;
+	uint16_t sequence;
+	uint16_t lost;
+	struct eventSummary summaries[EVENT_CHANNELS];
+} __attribute__((packed));
+
+BUILD_ASSERT(sizeof(struct eventSummaryMessage) <= CONFIG_BT_MESH_CHAT_CLI_MESSAGE_LENGTH, "A summary of events must fit into one message.");
+
+/* Sent by the responder, clockDelta is its device time minus the initiator's at its device time timeStamp, see ClockOffset.h. */
 struct resultMessage {
 	const uint8_t type;
+	uint16_t initiatorAddress;
+	uint64_t timeStamp;
 	uint64_t clockDelta;
+	int32_t timeOfFlight;
+	int32_t skew;
+} __attribute__((packed));
+
+struct propagationEntry {
+	uint16_t address;
+	int32_t timeOfFlight;
+} __attribute__((packed));
+
+/*
+ * One chunk of the master's propagation table, remaining counts the chunks
+ * still to come. networkTime is the master's network time when it was sent,
+ * followers place the 40-bit beacon timestamps on it.
+ */
+struct beaconMessage {
+	const uint8_t type;
+	uint8_t remaining;
+	uint8_t count;
+	int64_t networkTime;
+	struct propagationEntry entries[PROPAGATION_CHUNK];
+} __attribute__((packed));
+
+struct pairEntry {
+	uint16_t responder;
+	uint16_t initiator;
+} __attribute__((packed));
+
+/*
+ * One chunk of a round, every node named starts its exchange with the one
+ * next to it at network time startTime. Without network time on the master
+ * startTime is 0 and the responders start the exchanges over mesh.
+ */
+struct roundMessage {
+	const uint8_t type;
+	uint8_t count;
+	uint8_t profile;
+	int64_t startTime;
+	struct pairEntry entries[ROUND_CHUNK];
 } __attribute__((packed));
 
+enum trackingEventType { TrackingAdd, TrackingResult, TrackingFailed };
+
+struct trackingEvent {
+	enum trackingEventType type;
+	uint16_t responder;
+	uint16_t initiator;
+	uint32_t maxError;             /* device time units, TrackingAdd only */
+	DeviceTime time;
+	DeviceTime offset;
+	int64_t uptime;
+};
+
+/* One side of an exchange requested over mesh, start is its network time and 0 for one started over mesh. */
+struct pairingRequest {
+	uint16_t peer;
+	uint8_t profile;
+	NetworkTime start;
+};
+
+/* Offset of the responder to the initiator, resynchronized whenever its predicted error reaches maxError. */
+struct trackedPair {
+	bool used;
+	uint16_t responder;
+	uint16_t initiator;
+	uint32_t maxError;             /* device time units */
+	int64_t due;                   /* uptime ms of the next synchronization */
+	uint32_t synchronizations;
+	uint32_t failures;
+	struct ClockModel model;
+};
+
+enum networkPairState { PairWaiting, PairInRound, PairDone, PairFailed };
+
+/*
+ * A node of the synchronization tree, it responds to its parent one UWB hop
+ * closer to the master. The model is its clock minus the parent's.
+ */
+struct networkNode {
+	uint16_t address;
+	int16_t parent;                /* node index, -1 for the master and nodes out of reach */
+	uint8_t hops;
+	uint8_t round;
+	uint8_t attempts;
+	enum networkPairState state;
+	struct ClockModel model;
+};
+
+struct meshNeighbour {
+	uint16_t address;
+	int64_t heard;                 /* uptime ms */
+};
+
+/* Sent to the master on CollectNeighbours, the nodes this one hears directly over mesh. */
+struct neighbourMessage {
+	const uint8_t type;
+	uint8_t count;
+	uint16_t addresses[NEIGHBOUR_TABLE_SIZE];
+} __attribute__((packed));
+
+/*
+ * Mesh messages arrive in the Bluetooth RX thread, the DS-TWR engine lives
+ * on the system workqueue, so the UWB side of every step runs from work.
+ * The UWB address of a node is its mesh unicast address.
+ */
+static void setupWork(struct k_work *work);
+static void startWork(struct k_work *work);
+static void endResponder(struct k_work *work);
+static void endInitiator(struct k_work *work);
+static void trackPairs(struct k_work *work);
+static void synchronizeRounds(struct k_work *work);
+
+static K_WORK_DEFINE(setupUWB, setupWork);
+static K_WORK_DEFINE(startUWB, startWork);
+static K_WORK_DELAYABLE_DEFINE(responderEnd, endResponder);
+static K_WORK_DELAYABLE_DEFINE(initiatorEnd, endInitiator);
+static K_WORK_DELAYABLE_DEFINE(trackingWork, trackPairs);
+static K_WORK_DELAYABLE_DEFINE(networkWork, synchronizeRounds);
+
+/* Tracking state belongs to the system workqueue, mesh and shell hand their events over. */
+K_MSGQ_DEFINE(trackingEvents, sizeof(struct trackingEvent), TRACKING_QUEUE_LENGTH, 4);
+K_MSGQ_DEFINE(networkEvents, sizeof(struct trackingEvent), NETWORK_QUEUE_LENGTH, 4);
+
+/* Requests from the mesh handler, each one replaces the session of its side in the order they came. */
+K_MSGQ_DEFINE(responderRequests, sizeof(struct pairingRequest), PAIRING_QUEUE_LENGTH, 8);
+K_MSGQ_DEFINE(initiatorRequests, sizeof(struct pairingRequest), PAIRING_QUEUE_LENGTH, 8);
+
+/* Master side, the first free slot. */
+static NetworkTime nextSlot;
+
+static struct DSTWRSession *responderSession;
+static struct DSTWRSession *initiatorSession;
+static bool resultSent;
+
+/* Master side, filled from the DS-TWR results the master took part in. */
+static struct propagationEntry propagationTable[PROPAGATION_TABLE_SIZE];
+static uint8_t propagationCount;
+
+static struct trackedPair trackedPairs[TRACKED_PAIRS];
+static struct trackedPair *pairInFlight;
+static int64_t inFlightDeadline;
+
+/*
+ * Neighbour graph from the shell and the neighbour reports, nodes in UWB
+ * range of each other. It is only changed while no network synchronization
+ * runs, the run reads it on the system workqueue. The tree persists across
+ * runs, so the edge models improve with every run.
+ */
+static struct networkNode networkNodes[NETWORK_NODES];
+static uint16_t networkNodeCount;
+static uint32_t adjacency[NETWORK_NODES][NETWORK_NODE_WORDS];
+static uint32_t brokenLinks[NETWORK_NODES][NETWORK_NODE_WORDS];
+static volatile bool networkRunning;
+
+/* Tree nodes without the master, breadth first. */
+BUILD_ASSERT(NETWORK_NODES <= 256, "Tree order holds 8-bit node indices.");
+static uint8_t treeOrder[NETWORK_NODES];
+static uint16_t treeSize;
+static uint8_t roundCount;
+static uint8_t currentRound;
+static uint16_t roundPending;
+static int64_t roundDeadline;
+static int64_t networkStart;
+static uint32_t roundsRun;
+static uint32_t rebalances;
+
+/* Every node, heard from the mesh RX thread. */
+static struct meshNeighbour meshNeighbours[NEIGHBOUR_TABLE_SIZE];
+
+/* Without UWB the node follows the beacons through mesh time exchanges with the master. */
+static bool uwbAvailable;
+
+/* Follower side, set when an earlier chunk of the master's table named this node. */
+static bool propagationKnown;
+
+void initializeSynchronization() {
+	uwbAvailable = initializeUWB();
+	if (!uwbAvailable) {
+		LOG_ERR("UWB initialization failed, network time over the mesh only");
+	}
+
+	initializeNetworkTime(uwbAvailable);
+	initializeBenchmark();
+	initializeEventCapture();
+}
+
 void broadcastMaster() {
 	uint8_t message = SetMaster;
 	sendBroadcast(&message, sizeof(message));
 }
 
-void getClockDelta(uint16_t firstNodeAddress, uint16_t secondNodeAddress) {
-	struct addressMessage message = { .type = SetupSynchronization, .address = secondNodeAddress };
-	sendUnicast(&message, sizeof(message), firstNodeAddress);
+static void synchronizationResult(struct DSTWRSession *session, struct DSTWRResult result) {
+	struct ClockOffset clockOffset;
+
+	if (session != responderSession || resultSent) {
+		return;
+	}
+
+	computeClockOffset(&result, &clockOffset);
+
+	struct resultMessage message = {
+		.type = SynchronizationResult,
+		.initiatorAddress = session->peerAddress,
+		.timeStamp = clockOffset.time,
+		.clockDelta = clockOffset.offset,
+		.timeOfFlight = clockOffset.timeOfFlight,
+		.skew = clockOffset.skew
+	};
+	sendUnicast((const uint8_t*)&message, sizeof(message), masterAddress);
+
+	resultSent = true;
+	k_work_reschedule(&responderEnd, K_NO_WAIT);
 }
 
-void setupSynchronization(uint16_t initiatorAddress) {
-	// TODO setup UWB listening
+static void endResponder(struct k_work *work) {
+	if (responderSession == NULL) {
+		return;
+	}
+
+	if (!resultSent) {
+		struct addressMessage message = { .type = SynchronizationFailed, .address = responderSession->peerAddress };
+		sendUnicast((const uint8_t*)&message, sizeof(message), masterAddress);
+	}
+
+	destroySession(responderSession);
+	responderSession = NULL;
+}
+
+static void endInitiator(struct k_work *work) {
+	if (initiatorSession != NULL) {
+		destroySession(initiatorSession);
+		initiatorSession = NULL;
+	}
+}
+
+static void initiatorDone(struct DSTWRSession *session) {
+	k_work_reschedule(&initiatorEnd, K_NO_WAIT);
+}
+
+/*
+ * Arms session for network time start, lead returns the ms until then.
+ * Fails without network time or with the start out of reach, the session
+ * then starts unscheduled.
+ */
+static bool scheduleSession(struct DSTWRSession *session, NetworkTime start, uint8_t profile, uint32_t *lead) {
+	NetworkTime now;
+	DeviceTime localStart;
+
+	if (session == NULL || start == 0 || !getNetworkTime(&now) || start <= now || !networkToDeviceTime(start, &localStart)) {
+		return false;
+	}
+
+	setSessionProfile(session, getPhyProfile(profile < PHY_PROFILE_COUNT ? profile : PhyStandard));
+	*lead = (start - now) / DEVICE_TIME_PER_MILLISECOND;
+
+	return startSessionAt(session, localStart, SCHEDULE_WINDOW);
+}
+
+/*
+ * Unscheduled, the responder listens before it lets the initiator start,
+ * so the first poll is not lost. Scheduled, both sides arm the radio for
+ * the start time and the initiator knows it already.
+ */
+static void setupResponder(const struct pairingRequest *request) {
+	uint32_t lead = 0;
+	bool scheduled;
+
+	endResponder(NULL);
+
+	setLocalAddress(getOwnAddress());
+	responderSession = createSession(request->peer, DSTWRResponder, 0, synchronizationResult);
+	resultSent = false;
+
+	scheduled = scheduleSession(responderSession, request->start, request->profile, &lead);
+
+	if (!scheduled && !startSession(responderSession)) {
+		struct addressMessage message = { .type = SynchronizationFailed, .address = request->peer };
+		sendUnicast((const uint8_t*)&message, sizeof(message), masterAddress);
+		return;
+	}
+
+	k_work_reschedule(&responderEnd, K_MSEC(lead + SYNCHRONIZATION_TIME_OUT));
+
+	if (request->start == 0) {
+		uint8_t message = StartSynchronization;
+		sendUnicast(&message, sizeof(message), request->peer);
+	}
+}
+
+/* A request replaced by a later one before it finished is reported failed by endResponder. */
+static void setupWork(struct k_work *work) {
+	struct pairingRequest request;
+
+	while (k_msgq_get(&responderRequests, &request, K_NO_WAIT) == 0) {
+		setupResponder(&request);
+	}
+}
+
+static void startInitiator(const struct pairingRequest *request) {
+	uint32_t lead = 0;
+
+	endInitiator(NULL);
+
+	setLocalAddress(getOwnAddress());
+	initiatorSession = createSession(request->peer, DSTWRInitiator, 0, NULL);
+	if (initiatorSession == NULL) {
+		return;
+	}
+
+	setInitiatorDone(initiatorSession, initiatorDone);
+	if (!scheduleSession(initiatorSession, request->start, request->profile, &lead)) {
+		startSession(initiatorSession);
+	}
 
-	uint8_t message = StartSynchronization;
-	sendUnicast(&message, sizeof(message), initiatorAddress);
+	k_work_reschedule(&initiatorEnd, K_MSEC(lead + SYNCHRONIZATION_TIME_OUT));
+}
+
+static void startWork(struct k_work *work) {
+	struct pairingRequest request;
+
+	while (k_msgq_get(&initiatorRequests, &request, K_NO_WAIT) == 0) {
+		startInitiator(&request);
+	}
+}
+
+/* A responder request that does not fit the queue is reported failed at once, the master retries it. */
+static void requestResponder(uint16_t initiator, NetworkTime start, uint8_t profile) {
+	struct pairingRequest request = { .peer = initiator, .profile = profile, .start = start };
+
+	if (k_msgq_put(&responderRequests, &request, K_NO_WAIT) != 0) {
+		struct addressMessage message = { .type = SynchronizationFailed, .address = initiator };
+
+		LOG_WRN("Responder request of 0x%04X dropped", initiator);
+		sendUnicast((const uint8_t*)&message, sizeof(message), masterAddress);
+		return;
+	}
+
+	k_work_submit(&setupUWB);
+}
+
+static void requestInitiator(uint16_t responder, NetworkTime start, uint8_t profile) {
+	struct pairingRequest request = { .peer = responder, .profile = profile, .start = start };
+
+	if (k_msgq_put(&initiatorRequests, &request, K_NO_WAIT) != 0) {
+		LOG_WRN("Initiator request of 0x%04X dropped", responder);
+		return;
+	}
+
+	k_work_submit(&startUWB);
+}
+
+void setupSynchronization(uint16_t initiatorAddress) {
+	requestResponder(initiatorAddress, 0, PhyStandard);
 }
 
 void startSynchronization(uint16_t responderAddress) {
-	// TODO setup UWB initiator
+	requestInitiator(responderAddress, 0, PhyStandard);
+}
+
+/* Takes the side of this node in the scheduled exchange of the pair, if it is in it. */
+static void joinSchedule(uint16_t responder, uint16_t initiator, NetworkTime start, uint8_t profile) {
+	if (responder == getOwnAddress()) {
+		requestResponder(initiator, start, profile);
+	} else if (initiator == getOwnAddress()) {
+		requestInitiator(responder, start, profile);
+	}
+}
+
+static uint8_t listenProfileId() {
+	for (uint8_t id = 0; id < PHY_PROFILE_COUNT; id++) {
+		if (getPhyProfile(id) == getListenProfile()) {
+			return id;
+		}
+	}
+
+	return PhyStandard;
+}
+
+/*
+ * Master side: the first slot at least SCHEDULE_LEAD ms ahead that no
+ * earlier schedule took, as the start of the slot grid and the slot in it.
+ */
+static NetworkTime allocateSlot(NetworkTime now, uint8_t *slot) {
+	NetworkTime length = SCHEDULE_SLOT * DEVICE_TIME_PER_MILLISECOND;
+	NetworkTime start = (now + SCHEDULE_LEAD * DEVICE_TIME_PER_MILLISECOND + length - 1) / length * length;
+
+	*slot = 0;
+	if (nextSlot > start) {
+		*slot = MIN((nextSlot - start) / length, UINT8_MAX);
+		start = nextSlot - *slot * length;
+	}
+
+	nextSlot = start + (*slot + 1) * length;
+
+	return start;
+}
+
+/* Scheduled when the master has network time, otherwise the responder starts the exchange over mesh. */
+void getClockDelta(uint16_t firstNodeAddress, uint16_t secondNodeAddress) {
+	NetworkTime now;
+
+	if (!getNetworkTime(&now)) {
+		struct addressMessage message = { .type = SetupSynchronization, .address = secondNodeAddress };
+		sendUnicast((const uint8_t*)&message, sizeof(message), firstNodeAddress);
+		return;
+	}
+
+	struct scheduleMessage message = {
+		.type = ScheduleSynchronization,
+		.responderAddress = firstNodeAddress,
+		.initiatorAddress = secondNodeAddress,
+		.profile = listenProfileId()
+	};
+
+	message.startTime = allocateSlot(now, &message.slot);
+
+	sendUnicast((const uint8_t*)&message, sizeof(message), firstNodeAddress);
+	sendUnicast((const uint8_t*)&message, sizeof(message), secondNodeAddress);
+}
+
+static void storePropagation(uint16_t address, int32_t timeOfFlight) {
+	for (uint8_t i = 0; i < propagationCount; i++) {
+		if (propagationTable[i].address == address) {
+			propagationTable[i].timeOfFlight = timeOfFlight;
+			return;
+		}
+	}
+
+	if (propagationCount < PROPAGATION_TABLE_SIZE) {
+		propagationTable[propagationCount++] = (struct propagationEntry){ .address = address, .timeOfFlight = timeOfFlight };
+	}
+}
+
+static void postTrackingEvent(const struct trackingEvent *event) {
+	if (k_msgq_put(&trackingEvents, event, K_NO_WAIT) != 0) {
+		LOG_WRN("Tracking event dropped");
+	}
+
+	k_work_reschedule(&trackingWork, K_NO_WAIT);
+}
+
+void trackClockDelta(uint16_t firstNodeAddress, uint16_t secondNodeAddress, uint32_t maxError) {
+	struct trackingEvent event = {
+		.type = TrackingAdd,
+		.responder = firstNodeAddress,
+		.initiator = secondNodeAddress,
+		.maxError = microsecondsToDeviceTime(maxError) / 1000
+	};
+
+	postTrackingEvent(&event);
+}
+
+static struct trackedPair *findPair(uint16_t responder, uint16_t initiator) {
+	for (int i = 0; i < TRACKED_PAIRS; i++) {
+		if (trackedPairs[i].used && trackedPairs[i].responder == responder && trackedPairs[i].initiator == initiator) {
+			return &trackedPairs[i];
+		}
+	}
+
+	return NULL;
+}
+
+static void handleTrackingEvent(const struct trackingEvent *event, int64_t now) {
+	struct trackedPair *pair = findPair(event->responder, event->initiator);
+
+	if (event->type == TrackingAdd) {
+		for (int i = 0; i < TRACKED_PAIRS && pair == NULL; i++) {
+			if (!trackedPairs[i].used) {
+				pair = &trackedPairs[i];
+				*pair = (struct trackedPair){ .used = true, .responder = event->responder, .initiator = event->initiator };
+				resetClockModel(&pair->model);
+			}
+		}
+
+		if (pair == NULL) {
+			LOG_ERR("No free tracking slot");
+			return;
+		}
+
+		/* maxError 0 stops tracking the pair. */
+		pair->used = event->maxError != 0;
+		pair->maxError = event->maxError;
+		pair->due = now;
+		return;
+	}
+
+	if (pair == NULL) {
+		return;
+	}
+
+	if (pair == pairInFlight) {
+		pairInFlight = NULL;
+	}
+
+	if (event->type == TrackingFailed) {
+		pair->failures++;
+		pair->due = now + TRACKING_RETRY;
+		return;
+	}
+
+	updateClockModel(&pair->model, event->time, event->uptime, event->offset);
+	pair->synchronizations++;
+	pair->due = event->uptime + resyncInterval(&pair->model, pair->maxError);
+
+	printk(
+		"Tracking 0x%04X to 0x%04X: skew %d ppb, next synchronization in %lld ms\n",
+		pair->initiator,
+		pair->responder,
+		getModelSkew(&pair->model),
+		pair->due - now
+	);
+}
+
+/* Runs one synchronization at a time, always of the pair due first. */
+static void trackPairs(struct k_work *work) {
+	struct trackingEvent event;
+	struct trackedPair *next = NULL;
+	int64_t now = k_uptime_get();
+
+	while (k_msgq_get(&trackingEvents, &event, K_NO_WAIT) == 0) {
+		handleTrackingEvent(&event, now);
+	}
+
+	if (pairInFlight != NULL) {
+		if (now < inFlightDeadline) {
+			k_work_reschedule(&trackingWork, K_MSEC(inFlightDeadline - now));
+			return;
+		}
+
+		pairInFlight->failures++;
+		pairInFlight = NULL;
+	}
+
+	for (int i = 0; i < TRACKED_PAIRS; i++) {
+		if (trackedPairs[i].used && (next == NULL || trackedPairs[i].due < next->due)) {
+			next = &trackedPairs[i];
+		}
+	}
+
+	if (next == NULL) {
+		return;
+	}
+
+	if (next->due > now) {
+		k_work_reschedule(&trackingWork, K_MSEC(next->due - now));
+		return;
+	}
+
+	pairInFlight = next;
+	inFlightDeadline = now + TRACKING_TIME_OUT;
+	getClockDelta(next->responder, next->initiator);
+
+	k_work_reschedule(&trackingWork, K_MSEC(TRACKING_TIME_OUT));
+}
+
+static int findNode(uint16_t address) {
+	for (uint16_t i = 0; i < networkNodeCount; i++) {
+		if (networkNodes[i].address == address) {
+			return i;
+		}
+	}
+
+	return -1;
+}
+
+static int addNode(uint16_t address) {
+	int node = findNode(address);
+
+	if (node < 0 && networkNodeCount < NETWORK_NODES) {
+		node = networkNodeCount++;
+		networkNodes[node] = (struct networkNode){ .address = address, .parent = -1 };
+		resetClockModel(&networkNodes[node].model);
+	}
+
+	return node;
+}
+
+/* In range, for interference, and usable, for the tree, which drops links that failed every attempt. */
+static bool adjacent(uint8_t first, uint8_t second) {
+	return first == second || (adjacency[first][second / 32] & BIT(second % 32)) != 0;
+}
+
+static bool linked(uint8_t first, uint8_t second) {
+	return first != second && adjacent(first, second) && (brokenLinks[first][second / 32] & BIT(second % 32)) == 0;
+}
+
+void addNetworkLink(uint16_t firstNodeAddress, uint16_t secondNodeAddress) {
+	int first;
+	int second;
+
+	if (networkRunning) {
+		LOG_WRN("Network synchronization running, link ignored");
+		return;
+	}
+
+	first = addNode(firstNodeAddress);
+	second = addNode(secondNodeAddress);
+	if (first < 0 || second < 0) {
+		LOG_ERR("Neighbour graph full");
+		return;
+	}
+
+	adjacency[first][second / 32] |= BIT(second % 32);
+	adjacency[second][first / 32] |= BIT(first % 32);
+	brokenLinks[first][second / 32] &= ~BIT(second % 32);
+	brokenLinks[second][first / 32] &= ~BIT(first % 32);
+}
+
+void clearNetworkLinks() {
+	if (networkRunning) {
+		LOG_WRN("Network synchronization running, links kept");
+		return;
+	}
 
-	struct resultMessage message = { .type = SynchronizationResult, .clockDelta = 420 };
-	sendUnicast(&message, sizeof(message), masterAddress);
+	networkNodeCount = 0;
+	treeSize = 0;
+	memset(adjacency, 0, sizeof(adjacency));
+	memset(brokenLinks, 0, sizeof(brokenLinks));
+}
+
+/*
+ * Breadth first from the master, so every node hangs off a parent one hop
+ * closer to it. Nodes that keep their parent keep their clock model, a new
+ * parent starts the model over.
+ */
+static bool buildSpanningTree() {
+	static uint8_t queue[NETWORK_NODES];
+	static bool visited[NETWORK_NODES];
+	uint16_t head = 0;
+	uint16_t tail = 0;
+	int root = findNode(getOwnAddress());
+
+	treeSize = 0;
+	memset(visited, 0, sizeof(visited));
+
+	if (root < 0) {
+		LOG_ERR("Master 0x%04X has no links", getOwnAddress());
+		return false;
+	}
+
+	queue[tail++] = root;
+	visited[root] = true;
+	networkNodes[root].parent = -1;
+	networkNodes[root].hops = 0;
+
+	while (head < tail) {
+		uint8_t parent = queue[head++];
+
+		for (uint16_t child = 0; child < networkNodeCount; child++) {
+			struct networkNode *node = &networkNodes[child];
+
+			if (visited[child] || !linked(parent, child)) {
+				continue;
+			}
+
+			if (node->parent != parent) {
+				node->parent = parent;
+				node->state = PairWaiting;
+				resetClockModel(&node->model);
+			}
+
+			node->hops = networkNodes[parent].hops + 1;
+			visited[child] = true;
+			queue[tail++] = child;
+			treeOrder[treeSize++] = child;
+		}
+	}
+
+	for (uint16_t i = 0; i < networkNodeCount; i++) {
+		if (!visited[i]) {
+			networkNodes[i].parent = -1;
+		}
+	}
+
+	if (tail < networkNodeCount) {
+		LOG_WRN("%u nodes unreachable from the master", networkNodeCount - tail);
+	}
+
+	return true;
+}
+
+/*
+ * Two exchanges interfere when they share a node or a node of one hears a
+ * node of the other. Greedy colouring in tree order, the colours are the
+ * rounds, so interference free pairs run concurrently.
+ */
+static bool interfere(const struct networkNode *first, const struct networkNode *second) {
+	return adjacent(first - networkNodes, second - networkNodes) || adjacent(first - networkNodes, second->parent)
+		|| adjacent(first->parent, second - networkNodes) || adjacent(first->parent, second->parent);
+}
+
+static bool colourPairs() {
+	roundCount = 0;
+
+	for (uint16_t i = 0; i < treeSize; i++) {
+		struct networkNode *node = &networkNodes[treeOrder[i]];
+		uint64_t taken = 0;
+		uint8_t round = 0;
+
+		for (uint16_t j = 0; j < i; j++) {
+			if (interfere(node, &networkNodes[treeOrder[j]])) {
+				taken |= 1ULL << networkNodes[treeOrder[j]].round;
+			}
+		}
+
+		while (round < NETWORK_ROUNDS && (taken & (1ULL << round)) != 0) {
+			round++;
+		}
+
+		if (round == NETWORK_ROUNDS) {
+			LOG_ERR("Neighbour graph needs more than %d rounds", NETWORK_ROUNDS);
+			return false;
+		}
+
+		node->round = round;
+		roundCount = MAX(roundCount, round + 1);
+	}
+
+	return true;
+}
+
+static bool needsAttempt(const struct networkNode *node) {
+	return node->state != PairDone && node->attempts <= NETWORK_RETRIES;
+}
+
+static void sendRound(const struct pairEntry *entries, uint8_t count, NetworkTime startTime) {
+	struct roundMessage message = { .type = SynchronizationRound, .count = count, .profile = listenProfileId(), .startTime = startTime };
+
+	memcpy(message.entries, entries, count * sizeof(struct pairEntry));
+	sendBroadcast((const uint8_t*)&message, offsetof(struct roundMessage, entries) + count * sizeof(struct pairEntry));
+}
+
+static bool startRound(uint8_t round, int64_t now) {
+	struct pairEntry entries[ROUND_CHUNK];
+	uint8_t count = 0;
+	NetworkTime startTime = 0;
+	uint8_t slot;
+
+	/* All pairs of a round share the slot, they do not hear each other. */
+	if (getNetworkTime(&startTime)) {
+		startTime = allocateSlot(startTime, &slot);
+		startTime += slot * SCHEDULE_SLOT * DEVICE_TIME_PER_MILLISECOND;
+	}
+
+	roundPending = 0;
+
+	for (uint16_t i = 0; i < treeSize; i++) {
+		struct networkNode *node = &networkNodes[treeOrder[i]];
+
+		if (node->round != round || !needsAttempt(node)) {
+			continue;
+		}
+
+		node->state = PairInRound;
+		node->attempts++;
+		roundPending++;
+
+		entries[count++] = (struct pairEntry){ .responder = node->address, .initiator = networkNodes[node->parent].address };
+		if (count == ROUND_CHUNK) {
+			sendRound(entries, count, startTime);
+			count = 0;
+		}
+	}
+
+	if (count > 0) {
+		sendRound(entries, count, startTime);
+	}
+
+	roundDeadline = now + NETWORK_ROUND_TIME_OUT;
+	roundsRun += roundPending > 0;
+
+	return roundPending > 0;
+}
+
+static void handleNetworkEvent(const struct trackingEvent *event) {
+	int responder = findNode(event->responder);
+	struct networkNode *node;
+
+	if (responder < 0) {
+		return;
+	}
+
+	node = &networkNodes[responder];
+	if (node->state != PairInRound || node->parent != findNode(event->initiator)) {
+		return;
+	}
+
+	if (event->type == TrackingResult && updateClockModel(&node->model, event->time, event->uptime, event->offset)) {
+		node->state = PairDone;
+	} else {
+		node->state = PairFailed;
+	}
+
+	roundPending--;
+}
+
+/*
+ * Offset of a node to the master at its device time time, summed along the
+ * tree path from the edge models. Every hop moves time to the parent's
+ * clock first, the errors of the hops add up as independent.
+ */
+static bool composeOffset(uint8_t index, DeviceTime time, int64_t uptime, DeviceTime *offset, uint32_t *error) {
+	DeviceTime total = 0;
+	uint64_t variance = 0;
+
+	while (networkNodes[index].parent >= 0) {
+		const struct networkNode *node = &networkNodes[index];
+		DeviceTime hop;
+		uint32_t hopError;
+
+		if (!node->model.initialized) {
+			return false;
+		}
+
+		hop = predictOffset(&node->model, time, uptime);
+		hopError = predictedError(&node->model, uptime);
+
+		total = deviceTimeAdd(total, hop);
+		time = deviceTimeDiff(time, hop);
+		variance += (uint64_t)hopError * hopError;
+		index = node->parent;
+	}
+
+	if (networkNodes[index].address != getOwnAddress()) {
+		return false;
+	}
+
+	*offset = total;
+	*error = sqrt(variance);
+	return true;
+}
+
+bool getNetworkOffset(uint16_t address, DeviceTime time, DeviceTime *offset, uint32_t *error) {
+	int node = findNode(address);
+
+	return node >= 0 && composeOffset(node, time, k_uptime_get(), offset, error);
+}
+
+static void printTree() {
+	int64_t now = k_uptime_get();
+
+	for (uint16_t i = 0; i < treeSize; i++) {
+		const struct networkNode *node = &networkNodes[treeOrder[i]];
+		DeviceTime offset;
+		uint32_t error;
+
+		if (!composeOffset(treeOrder[i], node->model.baseTime & DEVICE_TIME_MASK, now, &offset, &error)) {
+			printk("0x%04X: %u hops via 0x%04X, not synchronized\n", node->address, node->hops, networkNodes[node->parent].address);
+			continue;
+		}
+
+		printk(
+			"0x%04X: %u hops via 0x%04X, offset %llu, error %llu ps\n",
+			node->address,
+			node->hops,
+			networkNodes[node->parent].address,
+			offset,
+			deviceTimeToPicoseconds(error)
+		);
+	}
+}
+
+static void reportNetwork(int64_t now) {
+	uint16_t done = 0;
+	uint32_t attempts = 0;
+	uint8_t depth = 0;
+
+	for (uint16_t i = 0; i < treeSize; i++) {
+		done += networkNodes[treeOrder[i]].state == PairDone;
+		attempts += networkNodes[treeOrder[i]].attempts;
+		depth = MAX(depth, networkNodes[treeOrder[i]].hops);
+	}
+
+	printk(
+		"Network synchronized: %u of %u nodes, %u hops deep, in %u rounds, %u attempts, %u rebalances, %lld ms\n",
+		done,
+		treeSize,
+		depth,
+		roundsRun,
+		attempts,
+		rebalances,
+		now - networkStart
+	);
+
+	networkRunning = false;
+}
+
+/*
+ * Nodes that failed every attempt lose the link to their parent, the tree
+ * is rebuilt around it and the new edges are synchronized. Every rebalance
+ * drops a link, so it ends.
+ */
+static bool rebalance() {
+	bool broken = false;
+
+	for (uint16_t i = 0; i < treeSize; i++) {
+		struct networkNode *node = &networkNodes[treeOrder[i]];
+		uint8_t index = treeOrder[i];
+
+		if (node->state == PairDone) {
+			continue;
+		}
+
+		LOG_WRN("Link 0x%04X to 0x%04X failed", node->address, networkNodes[node->parent].address);
+		brokenLinks[index][node->parent / 32] |= BIT(node->parent % 32);
+		brokenLinks[node->parent][index / 32] |= BIT(index % 32);
+		broken = true;
+	}
+
+	if (!broken || !buildSpanningTree() || !colourPairs()) {
+		return false;
+	}
+
+	for (uint16_t i = 0; i < treeSize; i++) {
+		networkNodes[treeOrder[i]].attempts = 0;
+	}
+
+	rebalances++;
+	currentRound = roundCount - 1;
+	return true;
+}
+
+/*
+ * Runs the colours in order, each as soon as the previous one has all its
+ * results or timed out, then passes over them again for the failed pairs.
+ */
+static void synchronizeRounds(struct k_work *work) {
+	struct trackingEvent event;
+	int64_t now = k_uptime_get();
+	bool retry = false;
+
+	while (k_msgq_get(&networkEvents, &event, K_NO_WAIT) == 0) {
+		if (networkRunning) {
+			handleNetworkEvent(&event);
+		}
+	}
+
+	if (!networkRunning) {
+		return;
+	}
+
+	if (roundPending > 0) {
+		if (now < roundDeadline) {
+			k_work_reschedule(&networkWork, K_MSEC(roundDeadline - now));
+			return;
+		}
+
+		for (uint16_t i = 0; i < treeSize; i++) {
+			if (networkNodes[treeOrder[i]].state == PairInRound) {
+				networkNodes[treeOrder[i]].state = PairFailed;
+			}
+		}
+		roundPending = 0;
+	}
+
+	for (uint16_t i = 0; i < treeSize && !retry; i++) {
+		retry = needsAttempt(&networkNodes[treeOrder[i]]);
+	}
+
+	if (!retry && !rebalance()) {
+		reportNetwork(now);
+		printTree();
+		return;
+	}
+
+	do {
+		currentRound = (currentRound + 1) % roundCount;
+	} while (!startRound(currentRound, now));
+
+	k_work_reschedule(&networkWork, K_MSEC(NETWORK_ROUND_TIME_OUT));
+}
+
+/* Earlier runs leave their models, a new run refines them, pairs start over. */
+static void startNetwork(struct k_work *work) {
+	if (!buildSpanningTree() || treeSize == 0 || !colourPairs()) {
+		networkRunning = false;
+		return;
+	}
+
+	printk("Synchronizing %u nodes in %u colours\n", treeSize, roundCount);
+
+	for (uint16_t i = 0; i < treeSize; i++) {
+		networkNodes[treeOrder[i]].state = PairWaiting;
+		networkNodes[treeOrder[i]].attempts = 0;
+	}
+
+	k_msgq_purge(&networkEvents);
+	networkStart = k_uptime_get();
+	roundsRun = 0;
+	rebalances = 0;
+	roundPending = 0;
+	currentRound = roundCount - 1;
+
+	k_work_reschedule(&networkWork, K_NO_WAIT);
+}
+
+static K_WORK_DEFINE(networkStartWork, startNetwork);
+
+void synchronizeNetwork() {
+	if (networkRunning) {
+		LOG_WRN("Network synchronization already running");
+		return;
+	}
+
+	networkRunning = true;
+	k_work_submit(&networkStartWork);
+}
+
+static void postNetworkEvent(const struct trackingEvent *event) {
+	if (!networkRunning) {
+		return;
+	}
+
+	if (k_msgq_put(&networkEvents, event, K_NO_WAIT) != 0) {
+		LOG_WRN("Network event dropped");
+	}
+
+	k_work_reschedule(&networkWork, K_NO_WAIT);
+}
+
+static void startRoundPairs(const struct roundMessage *message) {
+	for (uint8_t i = 0; i < message->count && i < ROUND_CHUNK; i++) {
+		const struct pairEntry *pair = &message->entries[i];
+
+		if (message->startTime != 0) {
+			joinSchedule(pair->responder, pair->initiator, message->startTime, message->profile);
+		} else if (pair->responder == getOwnAddress()) {
+			setupSynchronization(pair->initiator);
+		}
+	}
+}
+
+/*
+ * Mesh neighbours: a message that arrives with the TTL it was sent with
+ * was not relayed, its sender is in radio range. The nodes share the
+ * default TTL, BLE range is taken as UWB range.
+ */
+void noteMeshNeighbour(uint16_t address, uint8_t receivedTtl) {
+	int64_t now = k_uptime_get();
+	uint8_t oldest = 0;
+
+	if (receivedTtl != bt_mesh_default_ttl_get() || address == getOwnAddress()) {
+		return;
+	}
+
+	for (uint8_t i = 0; i < NEIGHBOUR_TABLE_SIZE; i++) {
+		if (meshNeighbours[i].address == address || meshNeighbours[i].address == 0) {
+			meshNeighbours[i] = (struct meshNeighbour){ .address = address, .heard = now };
+			return;
+		}
+
+		if (meshNeighbours[i].heard < meshNeighbours[oldest].heard) {
+			oldest = i;
+		}
+	}
+
+	meshNeighbours[oldest] = (struct meshNeighbour){ .address = address, .heard = now };
+}
+
+void collectNeighbours() {
+	uint8_t message = CollectNeighbours;
+	sendBroadcast(&message, sizeof(message));
+}
+
+static void reportNeighbours() {
+	struct neighbourMessage message = { .type = NeighbourReport };
+	int64_t now = k_uptime_get();
+
+	for (uint8_t i = 0; i < NEIGHBOUR_TABLE_SIZE; i++) {
+		if (meshNeighbours[i].address != 0 && now - meshNeighbours[i].heard < NEIGHBOUR_TIME_OUT) {
+			message.addresses[message.count++] = meshNeighbours[i].address;
+		}
+	}
+
+	sendUnicast((const uint8_t*)&message, offsetof(struct neighbourMessage, addresses) + message.count * sizeof(uint16_t), masterAddress);
+}
+
+static void addNeighbours(const struct neighbourMessage *message, uint16_t senderAddress) {
+	for (uint8_t i = 0; i < message->count && i < NEIGHBOUR_TABLE_SIZE; i++) {
+		addNetworkLink(senderAddress, message->addresses[i]);
+	}
+}
+
+static void printResult(const struct resultMessage *message, uint16_t responderAddress) {
+	if (message->initiatorAddress == getOwnAddress()) {
+		storePropagation(responderAddress, message->timeOfFlight);
+	} else if (responderAddress == getOwnAddress()) {
+		storePropagation(message->initiatorAddress, message->timeOfFlight);
+	}
+
+	printk(
+		"Result: 0x%04X to 0x%04X clock delta %llu, time of flight %d, skew %d ppb\n",
+		message->initiatorAddress,
+		responderAddress,
+		message->clockDelta,
+		message->timeOfFlight,
+		message->skew
+	);
+}
+
+/*
+ * Hands the propagation table to the nodes and starts the beacons. Nodes
+ * missing from the table follow with a zero time of flight, their offset
+ * is then off by the propagation.
+ */
+void startBeacons(uint32_t interval) {
+	uint8_t chunks = (propagationCount + PROPAGATION_CHUNK - 1) / PROPAGATION_CHUNK;
+	NetworkTime networkTime;
+
+	if (interval == 0) {
+		uint8_t message = StopBeacons;
+		sendBroadcast(&message, sizeof(message));
+		startSyncBeacons(0);
+		return;
+	}
+
+	if (!getNetworkTime(&networkTime)) {
+		LOG_WRN("No network time yet, beacons not started");
+		return;
+	}
+
+	for (uint8_t chunk = 0; chunk < MAX(chunks, 1); chunk++) {
+		struct beaconMessage message = {
+			.type = FollowBeacons,
+			.remaining = MAX(chunks, 1) - chunk - 1,
+			.count = MIN(propagationCount - chunk * PROPAGATION_CHUNK, PROPAGATION_CHUNK),
+			.networkTime = networkTime
+		};
+
+		memcpy(message.entries, &propagationTable[chunk * PROPAGATION_CHUNK], message.count * sizeof(struct propagationEntry));
+		sendBroadcast((const uint8_t*)&message, offsetof(struct beaconMessage, entries) + message.count * sizeof(struct propagationEntry));
+	}
+
+	startSyncBeacons(interval);
+}
+
+static void followBeacons(const struct beaconMessage *message, uint16_t master) {
+	bool found = false;
+
+	if (master == getOwnAddress()) {
+		return;
+	}
+
+	if (!uwbAvailable) {
+		if (message->remaining == 0) {
+			followNetworkMaster(message->networkTime, k_uptime_get());
+			followMeshTime(master);
+		}
+		return;
+	}
+
+	for (uint8_t i = 0; i < message->count && i < PROPAGATION_CHUNK; i++) {
+		if (message->entries[i].address == getOwnAddress()) {
+			followNetworkMaster(message->networkTime, k_uptime_get());
+			followSyncBeacons(master, message->entries[i].timeOfFlight);
+			found = true;
+			break;
+		}
+	}
+
+	if (message->remaining != 0) {
+		propagationKnown |= found;
+		return;
+	}
+
+	if (!found && !propagationKnown) {
+		followNetworkMaster(message->networkTime, k_uptime_get());
+		followSyncBeacons(master, 0);
+	}
+	propagationKnown = false;
+}
+
+void broadcastPulses(int64_t start, uint32_t period, uint16_t count) {
+	struct pulseMessage message = { .type = BenchmarkPulses, .count = count, .period = period, .start = start };
+	sendBroadcast((const uint8_t*)&message, sizeof(message));
+}
+
+void sendMeshTimeRequest(uint16_t address, uint8_t sequence) {
+	struct meshTimeMessage message = { .type = MeshTimeRequest, .sequence = sequence };
+	sendTimedUnicast((const uint8_t*)&message, offsetof(struct meshTimeMessage, received), address);
+}
+
+void sendMeshTimeFollowUp(uint16_t address, uint8_t sequence, int64_t received, int64_t replied) {
+	struct meshTimeMessage message = { .type = MeshTimeFollowUp, .sequence = sequence, .received = received, .replied = replied };
+	sendUnicast((const uint8_t*)&message, sizeof(message), address);
+}
+
+int sendEvents(uint16_t sequence, uint16_t lost, int64_t start, const uint16_t *words, uint8_t count) {
+	struct eventMessage message = { .type = EventBatch, .count = count, .sequence = sequence, .lost = lost, .start = start };
+
+	memcpy(message.words, words, count * sizeof(uint16_t));
+	return sendEventUnicast((const uint8_t*)&message, offsetof(struct eventMessage, words) + count * sizeof(uint16_t), masterAddress);
+}
+
+int sendEventSummary(uint16_t sequence, uint16_t lost, const struct eventSummary *summaries) {
+	struct eventSummaryMessage message = { .type = EventSummary, .sequence = sequence, .lost = lost };
+
+	memcpy(message.summaries, summaries, sizeof(message.summaries));
+	return sendEventUnicast((const uint8_t*)&message, sizeof(message), masterAddress);
 }
 
 void messageHandler(const uint8_t* message, uint16_t senderAddress) {
 	switch (*message) {
 	case SetMaster:
 		masterAddress = senderAddress;
+		if (senderAddress == getOwnAddress()) {
+			becomeNetworkMaster();
+		}
 		dk_set_led(0, 1); //DEBUG
 		break;
 	case SetupSynchronization:
@@ -52,8 +1359,101 @@ void messageHandler(const uint8_t* message, uint16_t senderAddress) {
 	case StartSynchronization:
 		startSynchronization(senderAddress);
 		break;
-	case SynchronizationResult:
-		printk("Result: %llu\n", ((struct resultMessage*)message)->clockDelta);
+	case SynchronizationResult: {
+		struct trackingEvent result = {
+			.type = TrackingResult,
+			.responder = senderAddress,
+			.initiator = ((struct resultMessage*)message)->initiatorAddress,
+			.time = ((struct resultMessage*)message)->timeStamp,
+			.offset = ((struct resultMessage*)message)->clockDelta,
+			.uptime = k_uptime_get()
+		};
+
+		printResult((const struct resultMessage*)message, senderAddress);
+		postTrackingEvent(&result);
+		postNetworkEvent(&result);
 		break;
 	}
-}
\ No newline at end of file
+	case SynchronizationFailed: {
+		struct trackingEvent failure = {
+			.type = TrackingFailed,
+			.responder = senderAddress,
+			.initiator = ((struct addressMessage*)message)->address
+		};
+
+		printk("Synchronization of 0x%04X with 0x%04X failed\n", ((struct addressMessage*)message)->address, senderAddress);
+		postTrackingEvent(&failure);
+		postNetworkEvent(&failure);
+		break;
+	}
+	case FollowBeacons:
+		followBeacons((const struct beaconMessage*)message, senderAddress);
+		break;
+	case StopBeacons:
+		if (senderAddress == getOwnAddress()) {
+			break;
+		}
+
+		if (uwbAvailable) {
+			stopFollowing();
+		} else {
+			followMeshTime(0);
+		}
+		break;
+	case SynchronizationRound:
+		startRoundPairs((const struct roundMessage*)message);
+		break;
+	case ScheduleSynchronization: {
+		const struct scheduleMessage *schedule = (const struct scheduleMessage*)message;
+
+		joinSchedule(
+			schedule->responderAddress,
+			schedule->initiatorAddress,
+			schedule->startTime + schedule->slot * SCHEDULE_SLOT * DEVICE_TIME_PER_MILLISECOND,
+			schedule->profile
+		);
+		break;
+	}
+	case EventBatch: {
+		const struct eventMessage *events = (const struct eventMessage*)message;
+		uint16_t words[EVENT_BATCH_WORDS];
+		uint8_t count = MIN(events->count, EVENT_BATCH_WORDS);
+
+		/* The words are unaligned in the message. */
+		memcpy(words, events->words, count * sizeof(uint16_t));
+		receiveEvents(senderAddress, events->sequence, events->lost, events->start, words, count);
+		break;
+	}
+	case EventSummary: {
+		const struct eventSummaryMessage *summary = (const struct eventSummaryMessage*)message;
+		struct eventSummary summaries[EVENT_CHANNELS];
+
+		memcpy(summaries, summary->summaries, sizeof(summaries));
+		receiveEventSummary(senderAddress, summary->sequence, summary->lost, summaries);
+		break;
+	}
+	case MeshTimeRequest:
+		meshTimeRequest(senderAddress, ((const struct meshTimeMessage*)message)->sequence, getReceiveCycles());
+		break;
+	case MeshTimeFollowUp: {
+		const struct meshTimeMessage *followUp = (const struct meshTimeMessage*)message;
+
+		meshTimeFollowUp(senderAddress, followUp->sequence, followUp->received, followUp->replied);
+		break;
+	}
+	case BenchmarkPulses: {
+		const struct pulseMessage *pulses = (const struct pulseMessage*)message;
+
+		generatePulses(pulses->start, pulses->period, pulses->count);
+		break;
+	}
+	case CollectNeighbours:
+		reportNeighbours();
+		break;
+	case NeighbourReport:
+		if (getOwnAddress() == masterAddress) {
+			addNeighbours((const struct neighbourMessage*)message, senderAddress);
+		}
+		break;
+	}
+}
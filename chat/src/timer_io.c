@@ -0,0 +1,203 @@
+#include <zephyr/kernel.h>
+#include <zephyr/logging/log.h>
+#include <zephyr/drivers/clock_control/nrf_clock_control.h>
+#include <nrfx_timer.h>
+#include <nrfx_gpiote.h>
+#include <nrfx_ppi.h>
+#include "timer_io.h"
+
+LOG_MODULE_DECLARE(chat);
+
+#define TIMER_NODE DT_NODELABEL(timer4)
+
+/* CC0 to CC3 take the input captures, CC4 the reads of the count, CC5 the output compare. */
+#define NOW_CHANNEL NRF_TIMER_CC_CHANNEL4
+#define OUTPUT_CHANNEL NRF_TIMER_CC_CHANNEL5
+
+/* Ticks an edge has to lie ahead, more than arming the compare and PPI takes. */
+#define OUTPUT_LEAD 32
+
+struct timedInput {
+	uint32_t pin;
+	TimerIoHandler handler;
+	uint8_t channel;
+};
+
+struct outputEdge {
+	uint32_t ticks;
+	int value;
+};
+
+static const nrfx_timer_t timer = NRFX_TIMER_INSTANCE(4);
+static struct onoff_client hfxo;
+
+static struct timedInput inputs[TIMER_IO_INPUTS];
+static uint8_t inputCount;
+
+/* The queue is shared with the TIMER ISR, threads change it under irq_lock. */
+static uint32_t outputPin = TIMER_IO_NO_PIN;
+static nrf_ppi_channel_t outputPpi;
+static struct outputEdge edges[2];
+static uint8_t edgeCount;
+
+static void disarmOutput() {
+	nrfx_ppi_channel_disable(outputPpi);
+	nrfx_timer_compare_int_disable(&timer, OUTPUT_CHANNEL);
+	nrf_timer_event_clear(timer.p_reg, nrf_timer_compare_event_get(OUTPUT_CHANNEL));
+}
+
+/* Points the compare at the edge, false when the count passed it before the compare was armed. */
+static bool armOutput(const struct outputEdge *edge) {
+	uint32_t task = edge->value ? nrfx_gpiote_set_task_addr_get(outputPin) : nrfx_gpiote_clr_task_addr_get(outputPin);
+
+	nrfx_ppi_channel_assign(outputPpi, nrfx_timer_compare_event_address_get(&timer, OUTPUT_CHANNEL), task);
+	nrfx_timer_compare(&timer, OUTPUT_CHANNEL, edge->ticks, true);
+	nrfx_ppi_channel_enable(outputPpi);
+
+	if ((int32_t)(edge->ticks - getTimerTicks()) > 0) {
+		return true;
+	}
+
+	disarmOutput();
+	return false;
+}
+
+static void timerEvent(nrf_timer_event_t event, void *context) {
+	if (event != nrf_timer_compare_event_get(OUTPUT_CHANNEL) || edgeCount == 0) {
+		return;
+	}
+
+	edges[0] = edges[1];
+	edgeCount--;
+
+	if (edgeCount == 0) {
+		disarmOutput();
+	} else if (!armOutput(&edges[0])) {
+		edgeCount = 0;
+		LOG_WRN("Output edge at %u missed", edges[0].ticks);
+	}
+}
+
+static void edgeCaptured(nrfx_gpiote_pin_t pin, nrf_gpiote_polarity_t action) {
+	for (uint8_t i = 0; i < inputCount; i++) {
+		if (inputs[i].pin == pin) {
+			inputs[i].handler(inputs[i].channel, nrfx_timer_capture_get(&timer, (nrf_timer_cc_channel_t)i));
+			return;
+		}
+	}
+}
+
+int initializeTimerIo() {
+	nrfx_timer_config_t config = {
+		.frequency = NRF_TIMER_FREQ_16MHz,
+		.mode = NRF_TIMER_MODE_TIMER,
+		.bit_width = NRF_TIMER_BIT_WIDTH_32,
+		.interrupt_priority = DT_IRQ(TIMER_NODE, priority),
+		.p_context = NULL
+	};
+
+	sys_notify_init_spinwait(&hfxo.notify);
+	if (onoff_request(z_nrf_clock_control_get_onoff(CLOCK_CONTROL_NRF_SUBSYS_HF), &hfxo) < 0) {
+		return -EIO;
+	}
+
+	/* The GPIO driver owns GPIOTE and its interrupt, the pins here only take channels. */
+	if (!nrfx_gpiote_is_init()) {
+		return -ENODEV;
+	}
+
+	IRQ_CONNECT(DT_IRQN(TIMER_NODE), DT_IRQ(TIMER_NODE, priority), nrfx_timer_4_irq_handler, NULL, 0);
+	if (nrfx_timer_init(&timer, &config, timerEvent) != NRFX_SUCCESS) {
+		return -EIO;
+	}
+
+	nrfx_timer_enable(&timer);
+	return 0;
+}
+
+uint32_t getTimerTicks() {
+	unsigned int key = irq_lock();
+	uint32_t ticks = nrfx_timer_capture(&timer, NOW_CHANNEL);
+
+	irq_unlock(key);
+	return ticks;
+}
+
+int captureEdges(uint32_t pin, TimerIoHandler handler, uint8_t channel) {
+	nrfx_gpiote_in_config_t config = NRFX_GPIOTE_RAW_CONFIG_IN_SENSE_LOTOHI(true);
+	nrf_ppi_channel_t ppi;
+	uint8_t input = inputCount;
+
+	if (input == TIMER_IO_INPUTS) {
+		return -ENOSPC;
+	}
+
+	if (nrfx_ppi_channel_alloc(&ppi) != NRFX_SUCCESS) {
+		return -ENOSPC;
+	}
+
+	/* Registered before the event is enabled, the ISR only looks at the inputs below inputCount. */
+	inputs[input] = (struct timedInput){ .pin = pin, .handler = handler, .channel = channel };
+	inputCount++;
+
+	if (nrfx_gpiote_in_init(pin, &config, edgeCaptured) != NRFX_SUCCESS) {
+		inputCount--;
+		nrfx_ppi_channel_free(ppi);
+		return -ENOSPC;
+	}
+
+	nrfx_ppi_channel_assign(ppi, nrfx_gpiote_in_event_addr_get(pin), nrfx_timer_capture_task_address_get(&timer, (nrf_timer_cc_channel_t)input));
+	nrfx_ppi_channel_enable(ppi);
+	nrfx_gpiote_in_event_enable(pin, true);
+	return 0;
+}
+
+int configureTimedOutput(uint32_t pin) {
+	nrfx_gpiote_out_config_t config = NRFX_GPIOTE_CONFIG_OUT_TASK_TOGGLE(false);
+
+	if (outputPin != TIMER_IO_NO_PIN) {
+		return -EALREADY;
+	}
+
+	if (nrfx_ppi_channel_alloc(&outputPpi) != NRFX_SUCCESS) {
+		return -ENOSPC;
+	}
+
+	if (nrfx_gpiote_out_init(pin, &config) != NRFX_SUCCESS) {
+		nrfx_ppi_channel_free(outputPpi);
+		return -ENOSPC;
+	}
+
+	nrfx_gpiote_out_task_enable(pin);
+	outputPin = pin;
+	return 0;
+}
+
+int setOutputAt(uint32_t ticks, int value) {
+	unsigned int key;
+	int result = 0;
+
+	if (outputPin == TIMER_IO_NO_PIN) {
+		return -ENODEV;
+	}
+
+	key = irq_lock();
+
+	if (edgeCount == ARRAY_SIZE(edges)) {
+		result = -EBUSY;
+	} else if ((int32_t)(ticks - getTimerTicks()) < OUTPUT_LEAD) {
+		result = -ETIME;
+	} else if (edgeCount > 0 && (int32_t)(ticks - edges[0].ticks) <= 0) {
+		result = -EINVAL;
+	} else {
+		edges[edgeCount++] = (struct outputEdge){ .ticks = ticks, .value = value };
+
+		if (edgeCount == 1 && !armOutput(&edges[0])) {
+			edgeCount = 0;
+			result = -ETIME;
+		}
+	}
+
+	irq_unlock(key);
+	return result;
+}